@@ -97,14 +97,7 @@ void ImguiRenderer::draw(VkCommandBuffer& frame_cb, uint64_t frame_counter) {
 		if (atlas_batch_id > vgd->completed_image_batches()) return;
 		
 	
-		uint32_t tex_index = std::numeric_limits<uint32_t>::max();
-		for (auto it = vgd->bindless_images.begin(); it != vgd->bindless_images.end(); ++it) {
-			VulkanBindlessImage image = *it;
-			if (atlas_batch_id == image.batch_id) {
-				tex_index = it.slot_index();
-				break;
-			}
-		}
+		uint32_t tex_index = vgd->bindless_images.find<BINDLESS_BATCH_ID>(atlas_batch_id);
 		PRORENDER_ASSERT(tex_index != std::numeric_limits<uint32_t>::max(), true);
 
 		atlas_idx = tex_index;
@@ -223,7 +216,7 @@ void ImguiRenderer::draw(VkCommandBuffer& frame_cb, uint64_t frame_counter) {
 			vkCmdPushConstants(
 				frame_cb,
 				vgd->get_pipeline_layout(),
-				VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+				PUSH_CONSTANT_STAGES,
 				0,
 				sizeof(ImguiPushConstants),
 				&pcs
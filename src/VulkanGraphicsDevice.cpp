@@ -1,16 +1,25 @@
 #include "VulkanGraphicsDevice.h"
 #include <algorithm>
 #include <filesystem>
+#include <limits>
+#include <string.h>
+#include "mapped_file.h"
+#include "mip_generation.h"
 #include "stb_image.h"
 #include "timer.h"
 #include "utils.h"
 
+static constexpr VkDeviceSize STAGING_RING_SIZE = 64 * 1024 * 1024;
+static constexpr VkDeviceSize STAGING_RING_ALIGNMENT = 16;
+static constexpr size_t MAX_STAGING_SUBMISSIONS = 64;		//Half of the transfer command buffers
+
 VulkanGraphicsDevice::VulkanGraphicsDevice() {
 	Timer timer = Timer("VGD initialization");
 
 	alloc_callbacks = nullptr;			//TODO: Custom allocator(s)
 	vma_alloc_callbacks = nullptr;
 
+	//These only reserve address space, pages get committed as slots are used
 	_buffers.alloc(1024 * 1024);
 	bindless_images.alloc(1024 * 1024);
 	_pending_images.alloc(1024 * 1024);
@@ -19,6 +28,7 @@ VulkanGraphicsDevice::VulkanGraphicsDevice() {
 	_semaphores.alloc(1024);
 	_render_passes.alloc(32);
 	_graphics_pipelines.alloc(32);
+	_compute_pipelines.alloc(32);
 
 	//Initialize volk
 	VKASSERT_OR_CRASH(volkInitialize());
@@ -178,6 +188,31 @@ VulkanGraphicsDevice::VulkanGraphicsDevice() {
 					exit(-1);
 				}
 
+				if (!descriptor_indexing_features.descriptorBindingStorageBufferUpdateAfterBind) {
+					printf("No support for updating storage buffer descriptors after binding on this device.\n");
+					exit(-1);
+				}
+
+				//Texture uploads stay RGBA8 without it
+				_block_compression_supported = device_features.features.textureCompressionBC;
+
+				//GPU culling writes its own draw count
+				{
+					uint32_t extension_count = 0;
+					VKASSERT_OR_CRASH(vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &extension_count, nullptr));
+					std::vector<VkExtensionProperties> extensions(extension_count);
+					VKASSERT_OR_CRASH(vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &extension_count, extensions.data()));
+
+					bool has_draw_indirect_count = false;
+					for (VkExtensionProperties& extension : extensions) {
+						if (strcmp(extension.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0) has_draw_indirect_count = true;
+					}
+					if (!has_draw_indirect_count) {
+						printf("No support for indirect draw counts on this device.\n");
+						exit(-1);
+					}
+				}
+
 				break;
 			};
 		}
@@ -223,7 +258,8 @@ VulkanGraphicsDevice::VulkanGraphicsDevice() {
 
 		std::vector<const char*> extension_names = {
 			VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-			VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME
+			VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME,
+			VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME
 		};
 
 		VkDeviceCreateInfo device_info = {};
@@ -334,6 +370,34 @@ VulkanGraphicsDevice::VulkanGraphicsDevice() {
 
 	image_upload_semaphore = create_timeline_semaphore(0);
 
+	//Create the timestamp queries that time mip blits
+	if (physical_limits.timestampComputeAndGraphics) {
+		VkQueryPoolCreateInfo info = {};
+		info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		info.queryCount = 2 * FRAMES_IN_FLIGHT;
+
+		if (vkCreateQueryPool(device, &info, alloc_callbacks, &_mip_timestamp_pool) != VK_SUCCESS) {
+			printf("Creating timestamp query pool failed.\n");
+			exit(-1);
+		}
+	}
+
+	//Create the staging ring for image uploads
+	{
+		VmaAllocationCreateInfo alloc_info = {};
+		alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+		alloc_info.usage = VMA_MEMORY_USAGE_AUTO;
+		alloc_info.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		alloc_info.priority = 1.0;
+		_staging_ring = create_buffer(STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, alloc_info);
+
+		//Cached so the image upload thread never has to look into _buffers
+		VulkanBuffer* b = _buffers.get(_staging_ring);
+		_staging_ring_buffer = b->buffer;
+		_staging_ring_mapped = static_cast<uint8_t*>(b->alloc_info.pMappedData);
+	}
+
 	//Create pipeline cache
 	{
 		VkPipelineCacheCreateInfo info = {};
@@ -416,6 +480,13 @@ VulkanGraphicsDevice::VulkanGraphicsDevice() {
                 .immutable_samplers = _immutable_samplers.data()
             });
 
+            //Storage buffers
+            descriptor_sets.push_back({
+                .descriptor_type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptor_count = MAX_STORAGE_BUFFERS,
+                .stage_flags = VK_SHADER_STAGE_COMPUTE_BIT
+            });
+
 			{
 				std::vector<VkDescriptorSetLayoutBinding> bindings;
 				bindings.reserve(descriptor_sets.size());
@@ -468,6 +539,10 @@ VulkanGraphicsDevice::VulkanGraphicsDevice() {
                     {
                         .type = VK_DESCRIPTOR_TYPE_SAMPLER,
                         .descriptorCount = 16
+                    },
+                    {
+                        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                        .descriptorCount = MAX_STORAGE_BUFFERS
                     }
                 };
 
@@ -475,7 +550,7 @@ VulkanGraphicsDevice::VulkanGraphicsDevice() {
                     .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
                     .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
                     .maxSets = 1,
-                    .poolSizeCount = 2,
+                    .poolSizeCount = 3,
                     .pPoolSizes = sizes
                 };
 
@@ -504,7 +579,7 @@ VulkanGraphicsDevice::VulkanGraphicsDevice() {
 		{
 			std::vector<VkPushConstantRange> ranges = {
 				{
-					.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+					.stageFlags = PUSH_CONSTANT_STAGES,
 					.offset = 0,
 					.size = 128
 				}
@@ -555,17 +630,35 @@ VulkanGraphicsDevice::~VulkanGraphicsDevice() {
 		fclose(f);
 	}
 
-	//Wait for the image upload thread
+	//Wake the image upload thread and wait for it
+	_image_work_mutex.lock();
 	_image_upload_running = false;
+	_image_work_mutex.unlock();
+	_image_work_available.notify_one();
 	_image_upload_thread.join();
 
+	//The upload thread can submit after the app's last vkDeviceWaitIdle(), so its transfers may still be reading
+	//the staging ring and running command buffers from transfer_command_pool. Both have to outlive them
+	while (_staging_submissions.size() > 0) {
+		reclaim_staging_space(true);
+	}
+
 	//TODO: It doesn't make sense why I had to do this
 	for (uint32_t i = 0; i < FRAMES_IN_FLIGHT + 1; i++)
 		service_deletion_queues();
 
-	for (VulkanBindlessImage& im : bindless_images) {
-		vkDestroyImageView(device, im.vk_image.image_view, alloc_callbacks);
-		vmaDestroyImage(allocator, im.vk_image.image, im.vk_image.image_allocation);
+	{
+		VulkanBuffer* b = _buffers.get(_staging_ring);
+		vmaDestroyBuffer(allocator, b->buffer, b->allocation);
+		_buffers.remove(EXTRACT_IDX(_staging_ring.value()));
+	}
+
+	if (_mip_timestamp_pool) vkDestroyQueryPool(device, _mip_timestamp_pool, alloc_callbacks);
+
+	for (auto it = bindless_images.begin(); it != bindless_images.end(); ++it) {
+		VulkanImage& im = it.get<BINDLESS_VK_IMAGE>();
+		vkDestroyImageView(device, im.image_view, alloc_callbacks);
+		vmaDestroyImage(allocator, im.image, im.image_allocation);
 	}
 
 	for (VulkanPendingImage& im : _pending_images) {
@@ -581,6 +674,10 @@ VulkanGraphicsDevice::~VulkanGraphicsDevice() {
 		vkDestroyPipeline(device, p.pipeline, alloc_callbacks);
 	}
 
+	for (VulkanComputePipeline& p : _compute_pipelines) {
+		vkDestroyPipeline(device, p.pipeline, alloc_callbacks);
+	}
+
 	for (VkSemaphore& s : _semaphores) {
 		vkDestroySemaphore(device, s, alloc_callbacks);
 	}
@@ -628,6 +725,16 @@ VkCommandBuffer VulkanGraphicsDevice::get_graphics_command_buffer() {
 		0,
 		nullptr
 	);
+	vkCmdBindDescriptorSets(
+		cb,
+		VK_PIPELINE_BIND_POINT_COMPUTE,
+		_pipeline_layout,
+		0,
+		1,
+		&_image_descriptor_set,
+		0,
+		nullptr
+	);
 
 	return cb;
 }
@@ -648,7 +755,7 @@ void VulkanGraphicsDevice::graphics_queue_submit(VkCommandBuffer cb, SyncData& s
 	vkGetDeviceQueue(device, graphics_queue_family_idx, 0, &q);
 	{
 		sync_data.wait_semaphores.push_back(*_semaphores.get(image_upload_semaphore));
-		sync_data.wait_values.push_back(_image_batches_completed);
+		sync_data.wait_values.push_back(_image_upload_value_seen);
 
 		uint32_t wait_count = static_cast<uint32_t>(sync_data.wait_semaphores.size());
 		uint32_t signal_count = static_cast<uint32_t>(sync_data.signal_semaphores.size());
@@ -695,12 +802,14 @@ void VulkanGraphicsDevice::graphics_queue_submit(VkCommandBuffer cb, SyncData& s
 }
 
 VkCommandBuffer VulkanGraphicsDevice::borrow_transfer_command_buffer() {
+	std::lock_guard<std::mutex> lock(_transfer_command_buffer_mutex);
 	VkCommandBuffer cb = _transfer_command_buffers.top();
 	_transfer_command_buffers.pop();
 	return cb;
 }
 
 void VulkanGraphicsDevice::return_transfer_command_buffer(VkCommandBuffer cb) {
+	std::lock_guard<std::mutex> lock(_transfer_command_buffer_mutex);
 	_transfer_command_buffers.push(cb);
 }
 
@@ -910,16 +1019,56 @@ void VulkanGraphicsDevice::create_graphics_pipelines(
 		exit(-1);
 	}
 
-	for (uint32_t i = 0; i < pipeline_configs.size(); i++) {
-		out_pipelines_handles[i] = _graphics_pipelines.insert({
-			.pipeline = pipelines[i]
-		});
+	std::vector<VulkanGraphicsPipeline> pipeline_entries;
+	pipeline_entries.reserve(pipelines.size());
+	for (VkPipeline pipeline : pipelines) {
+		pipeline_entries.push_back({ .pipeline = pipeline });
+	}
+	_graphics_pipelines.insert_range(std::span<const VulkanGraphicsPipeline>(pipeline_entries), out_pipelines_handles);
 
+	for (uint32_t i = 0; i < pipeline_configs.size(); i++) {
 		vkDestroyShaderModule(device, shader_stage_infos[2 * i].module, alloc_callbacks);
 		vkDestroyShaderModule(device, shader_stage_infos[2 * i + 1].module, alloc_callbacks);
 	}
 }
 
+void VulkanGraphicsDevice::create_compute_pipelines(
+	const std::vector<const char*>& spv_paths,
+	Key<VulkanComputePipeline>* out_pipeline_handles
+) {
+	std::vector<VkComputePipelineCreateInfo> pipeline_infos;
+	pipeline_infos.reserve(spv_paths.size());
+	for (const char* path : spv_paths) {
+		VkComputePipelineCreateInfo info = {};
+		info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		info.stage.module = this->load_shader_module(path);
+		info.stage.pName = "main";
+		info.layout = _pipeline_layout;
+		pipeline_infos.push_back(info);
+	}
+
+	std::vector<VkPipeline> pipelines;
+	pipelines.resize(spv_paths.size());
+
+	if (vkCreateComputePipelines(device, pipeline_cache, (uint32_t)pipeline_infos.size(), pipeline_infos.data(), alloc_callbacks, pipelines.data()) != VK_SUCCESS) {
+		printf("Creating compute pipeline failed.\n");
+		exit(-1);
+	}
+
+	std::vector<VulkanComputePipeline> pipeline_entries;
+	pipeline_entries.reserve(pipelines.size());
+	for (VkPipeline pipeline : pipelines) {
+		pipeline_entries.push_back({ .pipeline = pipeline });
+	}
+	_compute_pipelines.insert_range(std::span<const VulkanComputePipeline>(pipeline_entries), out_pipeline_handles);
+
+	for (VkComputePipelineCreateInfo& info : pipeline_infos) {
+		vkDestroyShaderModule(device, info.stage.module, alloc_callbacks);
+	}
+}
+
 Key<VulkanBuffer> VulkanGraphicsDevice::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage_flags, VmaAllocationCreateInfo& allocation_info) {
 	VkBufferCreateInfo buffer_info = {};
 	buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1024,57 +1173,259 @@ VkResult VulkanGraphicsDevice::create_images(std::span<VkImageCreateInfo> create
 
 		VKASSERT_OR_CRASH(vkCreateImageView(device, &view_info, alloc_callbacks, &out_image.vk_image.image_view));
 
-		out_images[i] = bindless_images.insert(out_image);
+		out_images[i] = bindless_images.insert(out_image.batch_id, out_image.original_idx, out_image.vk_image);
 	}
 
 	return VK_SUCCESS;
 }
 
-void VulkanGraphicsDevice::submit_image_upload_batch(uint64_t id, const std::vector<RawImage>& raw_images, const std::vector<VkFormat>& image_formats) {
+//Decodes image image_idx of batch as RGBA8
+//Returns a buffer to free with stbi_image_free(), or the caller's own pixels for a raw image
+static uint8_t* decode_image(const ImageBatchParameters& batch, uint32_t image_idx, uint32_t* width, uint32_t* height) {
+	if (batch.raw_images.size() > 0) {
+		const RawImage& raw_image = batch.raw_images[image_idx];
+		*width = raw_image.width;
+		*height = raw_image.height;
+		return raw_image.data;
+	}
+
+	int x, y;
+	uint8_t* pixels;
+	if (batch.compressed_images.size() > 0) {
+		const CompressedImage& image = batch.compressed_images[image_idx];
+		pixels = stbi_load_from_memory(image.bytes.data(), static_cast<int>(image.bytes.size()), &x, &y, nullptr, STBI_rgb_alpha);
+		printf("Decompressed image from memory with dimensions (%i, %i)\n", x, y);
+	} else {
+		pixels = stbi_load(batch.filenames[image_idx], &x, &y, nullptr, STBI_rgb_alpha);
+	}
+	if (!pixels) {
+		printf("Loading image failed.\n");
+		exit(-1);
+	}
+	*width = static_cast<uint32_t>(x);
+	*height = static_cast<uint32_t>(y);
+	return pixels;
+}
+
+static void free_decoded_image(const ImageBatchParameters& batch, uint8_t* pixels) {
+	if (batch.raw_images.size() == 0) stbi_image_free(pixels);
+}
+
+//Reads just the dimensions and the number of channels stored in the file from the image's header
+static void image_dimensions(const ImageBatchParameters& batch, uint32_t image_idx, uint32_t* width, uint32_t* height, uint32_t* channels_in_file) {
+	if (batch.raw_images.size() > 0) {
+		*width = batch.raw_images[image_idx].width;
+		*height = batch.raw_images[image_idx].height;
+		*channels_in_file = 4;
+		return;
+	}
+
+	int x, y, channels;
+	int ok;
+	if (batch.compressed_images.size() > 0) {
+		const CompressedImage& image = batch.compressed_images[image_idx];
+		ok = stbi_info_from_memory(image.bytes.data(), static_cast<int>(image.bytes.size()), &x, &y, &channels);
+	} else {
+		ok = stbi_info(batch.filenames[image_idx], &x, &y, &channels);
+	}
+	if (!ok) {
+		printf("Loading image failed.\n");
+		exit(-1);
+	}
+	*width = static_cast<uint32_t>(x);
+	*height = static_cast<uint32_t>(y);
+	*channels_in_file = static_cast<uint32_t>(channels);
+}
+
+//Picks a block-compressed format from the channels the image actually has
+//BC4 and BC5 have no sRGB variants, so grey sRGB images go to the color formats instead
+static ImageEncoding choose_image_encoding(VkFormat requested_format, uint32_t channels_in_file, TextureCompression compression) {
+	ImageEncoding encoding = {};
+	encoding.format = requested_format;
+	encoding.generate_mips = true;
+	encoding.components = COMPONENT_MAPPING_DEFAULT;
+
+	bool srgb;
+	if (requested_format == VK_FORMAT_R8G8B8A8_SRGB) srgb = true;
+	else if (requested_format == VK_FORMAT_R8G8B8A8_UNORM) srgb = false;
+	else return encoding;
+	if (compression == TEXTURE_COMPRESSION_NONE) return encoding;
+
+	encoding.block_compressed = true;
+	encoding.generate_mips = false;
+	encoding.srgb = srgb;
+	bool has_alpha = channels_in_file == 2 || channels_in_file == 4;
+	if (!srgb && channels_in_file == 1) {
+		encoding.format = VK_FORMAT_BC4_UNORM_BLOCK;
+		encoding.block_format = BLOCK_FORMAT_BC4;
+		encoding.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_ONE };
+	} else if (!srgb && channels_in_file == 2) {
+		encoding.format = VK_FORMAT_BC5_UNORM_BLOCK;
+		encoding.block_format = BLOCK_FORMAT_BC5;
+		encoding.alpha_to_green = true;
+		encoding.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G };
+	} else if (!has_alpha) {
+		encoding.format = srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		encoding.block_format = BLOCK_FORMAT_BC1;
+	} else if (compression == TEXTURE_COMPRESSION_FAST) {
+		encoding.format = srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+		encoding.block_format = BLOCK_FORMAT_BC3;
+	} else {
+		encoding.format = srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+		encoding.block_format = BLOCK_FORMAT_BC7;
+	}
+	return encoding;
+}
+
+//Returns the bytes of image image_idx if it's a KTX2 or DDS container, mapping the file into file if it comes from one
+//Returns nullptr for anything stb_image should decode
+static const uint8_t* container_bytes(const ImageBatchParameters& batch, uint32_t image_idx, MappedFile& file, size_t* size) {
+	if (batch.raw_images.size() > 0) return nullptr;
+
+	if (batch.compressed_images.size() > 0) {
+		const CompressedImage& image = batch.compressed_images[image_idx];
+		if (!is_texture_container(image.bytes.data(), image.bytes.size())) return nullptr;
+		*size = image.bytes.size();
+		return image.bytes.data();
+	}
+
+	if (!file.open(batch.filenames[image_idx])) {
+		printf("Loading image failed.\n");
+		exit(-1);
+	}
+	if (!is_texture_container(file.data, file.size)) {
+		file.close();
+		return nullptr;
+	}
+	*size = file.size;
+	return file.data;
+}
+
+//Containers already hold the format the GPU samples, so only legacy DDS files get their color space from the requested format
+//Basis Universal containers are transcoded to the format their parser picked, which only ever has the levels they store
+static ImageEncoding container_encoding(const TextureContainer& container, VkFormat requested_format) {
+	ImageEncoding encoding = {};
+	encoding.format = container.format;
+	if (!container.color_space_known && requested_format == VK_FORMAT_R8G8B8A8_SRGB) encoding.format = srgb_format(container.format);
+	encoding.components = COMPONENT_MAPPING_DEFAULT;
+
+	if (container.basis) {
+		encoding.block_compressed = true;
+		encoding.transcode = true;
+		switch (container.format) {
+		case VK_FORMAT_BC4_UNORM_BLOCK:
+			encoding.block_format = BLOCK_FORMAT_BC4;
+			encoding.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_ONE };
+			break;
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+			encoding.block_format = BLOCK_FORMAT_BC5;
+			if (container.basis_channels == BASIS_CHANNELS_GREY_ALPHA) {
+				encoding.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G };
+			}
+			break;
+		default:
+			encoding.block_format = BLOCK_FORMAT_BC7;
+			break;
+		}
+		return encoding;
+	}
+
+	//Mips can only be blitted from uncompressed levels. The caller still has to check the format can be blitted with linear filtering
+	encoding.generate_mips = container.generate_mips && texel_block(container.format).width == 1;
+	return encoding;
+}
+
+void VulkanGraphicsDevice::submit_image_upload_batch(const ImageBatchParameters& batch) {
 	VulkanImageUploadBatch current_batch = {};
-	current_batch.id = id;
+	current_batch.id = batch.id;
+
+	uint32_t image_count = (uint32_t)batch.image_formats.size();
+	int channels = 4;
+
+	//Only the headers are read here. Pixels are decoded once they have somewhere to go in the staging ring
+	//KTX2 and DDS containers need no decoding, and their levels are copied straight from the container's bytes
+	std::vector<uint32_t> widths(image_count);
+	std::vector<uint32_t> heights(image_count);
+	std::vector<uint32_t> channels_in_file(image_count);
+	std::vector<MappedFile> container_files(image_count);
+	std::vector<const uint8_t*> container_data(image_count);
+	std::vector<TextureContainer> containers(image_count);
+	_image_decode_pool.parallel_for(image_count, [&](uint32_t i) {
+		size_t size;
+		container_data[i] = container_bytes(batch, i, container_files[i], &size);
+		if (container_data[i] == nullptr) {
+			image_dimensions(batch, i, &widths[i], &heights[i], &channels_in_file[i]);
+			return;
+		}
+
+		if (!parse_texture_container(container_data[i], size, &containers[i])) {
+			printf("Loading image failed.\n");
+			exit(-1);
+		}
+		widths[i] = containers[i].width;
+		heights[i] = containers[i].height;
+	});
 
-	uint32_t image_count = (uint32_t)raw_images.size();
+	std::vector<ImageEncoding> encodings(image_count);
 	std::vector<uint32_t> mip_counts;
 	mip_counts.reserve(image_count);
-	VkDeviceSize total_staging_size = 0;
-	int channels = 4;
 	for (uint32_t i = 0; i < image_count; i++) {
 		//Compute number of mips this image will have
 		uint32_t mip_count = 1;
-		int max_dimension = std::max(raw_images[i].width, raw_images[i].height);
+		uint32_t max_dimension = std::max(widths[i], heights[i]);
 		while (max_dimension >>= 1) {
 			mip_count += 1;
 		}
-		mip_counts.push_back(mip_count);
-
-		total_staging_size += raw_images[i].width * raw_images[i].height * channels;
-	}
 
-	//Create staging buffer
-	{
-		VmaAllocationCreateInfo alloc_info = {};
-		alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-		alloc_info.usage = VMA_MEMORY_USAGE_AUTO;
-		alloc_info.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-		alloc_info.priority = 1.0;
-		current_batch.staging_buffer_id = create_buffer(total_staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, alloc_info);
+		//A container with its own levels gets exactly those
+		//So does one asking for mips in a format the device can't blit, since they can't be made on the CPU either
+		if (container_data[i] != nullptr) {
+			encodings[i] = container_encoding(containers[i], batch.image_formats[i]);
+			if (encodings[i].generate_mips && !format_supports_mip_blits(encodings[i].format)) encodings[i].generate_mips = false;
+			if (!encodings[i].generate_mips) mip_count = containers[i].level_count;
+		}
+		mip_counts.push_back(mip_count);
 	}
-	VulkanBuffer* staging_buffer = _buffers.get(current_batch.staging_buffer_id);
 
-	//Copy image data to staging buffer
-	{
-		uint8_t* mapped_head = static_cast<uint8_t*>(staging_buffer->alloc_info.pMappedData);
-
-		for (uint32_t i = 0; i < image_count; i++) {
-			void* image_bytes = raw_images[i].data;
-			int x = raw_images[i].width;
-			int y = raw_images[i].height;
-			size_t num_bytes = static_cast<size_t>(x * y * channels);
+	//Decoded images are block-compressed with their mips on the decode threads when the device supports it
+	//Anything whose compressed mip chain wouldn't fit in the staging ring stays RGBA8
+	TextureCompression compression = _block_compression_supported && batch.raw_images.size() == 0 ? texture_compression : TEXTURE_COMPRESSION_NONE;
+	std::vector<VkDeviceSize> upload_sizes(image_count);
+	for (uint32_t i = 0; i < image_count; i++) {
+		if (container_data[i] != nullptr) {
+			if (texel_block(containers[i].format).width > 1 && !_block_compression_supported) {
+				printf("Can't load block-compressed texture without device support for BC formats.\n");
+				exit(-1);
+			}
 
-			memcpy(mapped_head, image_bytes, num_bytes);
+			//Transcoded levels are written straight into the ring like any other decoded image, so they have to fit in it
+			if (encodings[i].transcode) {
+				upload_sizes[i] = block_compressed_mip_chain_size(encodings[i].block_format, widths[i], heights[i], mip_counts[i]);
+				if (upload_sizes[i] > STAGING_RING_SIZE) {
+					printf("Basis Universal texture is too big to transcode through the staging ring.\n");
+					exit(-1);
+				}
+			}
+			continue;
+		}
 
-			mapped_head += num_bytes;
+		encodings[i] = choose_image_encoding(batch.image_formats[i], channels_in_file[i], compression);
+		if (encodings[i].block_compressed) {
+			upload_sizes[i] = block_compressed_mip_chain_size(encodings[i].block_format, widths[i], heights[i], mip_counts[i]);
+			if (upload_sizes[i] > STAGING_RING_SIZE) encodings[i] = choose_image_encoding(batch.image_formats[i], channels_in_file[i], TEXTURE_COMPRESSION_NONE);
+		}
+		if (!encodings[i].block_compressed) {
+			upload_sizes[i] = static_cast<VkDeviceSize>(widths[i]) * heights[i] * channels;
+
+			//The whole mip chain gets staged together when the mips are made on the CPU
+			VkFormat format = encodings[i].format;
+			bool rgba8 = format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+			VkDeviceSize chain_size = rgba8_mip_chain_size(widths[i], heights[i], mip_counts[i]);
+			if (rgba8 && mip_counts[i] > 1 && chain_size <= STAGING_RING_SIZE && (cpu_mip_generation || !format_supports_mip_blits(format))) {
+				encodings[i].generate_mips = false;
+				encodings[i].srgb = format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_SRGB;
+				upload_sizes[i] = chain_size;
+			}
 		}
 	}
 	
@@ -1091,17 +1442,18 @@ void VulkanGraphicsDevice::submit_image_upload_batch(uint64_t id, const std::vec
 			VkImageCreateInfo info = {};
 			info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 			info.imageType = VK_IMAGE_TYPE_2D;
-			info.format = image_formats[i];
+			info.format = encodings[i].format;
 			info.extent = {
-				.width = static_cast<uint32_t>(raw_images[i].width),
-				.height = static_cast<uint32_t>(raw_images[i].height),
+				.width = widths[i],
+				.height = heights[i],
 				.depth = 1
 			};
 			info.mipLevels = mip_counts[i];
 			info.arrayLayers = 1;
 			info.samples = VK_SAMPLE_COUNT_1_BIT;
 			info.tiling = VK_IMAGE_TILING_OPTIMAL;
-			info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+			if (encodings[i].generate_mips) info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 			info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 			info.queueFamilyIndexCount = 1;
 			info.pQueueFamilyIndices = &transfer_queue_family_idx;
@@ -1131,8 +1483,8 @@ void VulkanGraphicsDevice::submit_image_upload_batch(uint64_t id, const std::vec
 			info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 			info.image = images[i];
 			info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-			info.format = image_formats[i];
-			info.components = COMPONENT_MAPPING_DEFAULT;
+			info.format = encodings[i].format;
+			info.components = encodings[i].components;
 			info.subresourceRange = subresource_range;
 
 			if (vkCreateImageView(device, &info, alloc_callbacks, &image_views[i]) != VK_SUCCESS) {
@@ -1142,76 +1494,282 @@ void VulkanGraphicsDevice::submit_image_upload_batch(uint64_t id, const std::vec
 		}
 	}
 
-	//Record CopyBufferToImage commands along with relevant barriers
-	{
-		current_batch.command_buffer = borrow_transfer_command_buffer();
+	for (uint32_t i = 0; i < image_count; i++) {
+		if (container_data[i] != nullptr && !encodings[i].transcode) {
+			upload_container_levels(images[i], container_data[i], containers[i], mip_counts[i], encodings[i].generate_mips);
+			continue;
+		}
 
-		//Begin command buffer
-		{
-			VkCommandBufferBeginInfo info = {};
-			info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VkDeviceSize row_size = static_cast<VkDeviceSize>(widths[i]) * channels;
 
-			vkBeginCommandBuffer(current_batch.command_buffer, &info);
+		//Most images get one region of the ring and are decoded into it later, alongside other staged images
+		if (upload_sizes[i] <= STAGING_RING_SIZE) {
+			VkDeviceSize reserved_size;
+			VulkanStagedImage staged = {
+				.batch = &batch,
+				.image_idx = i,
+				.image = images[i],
+				.encoding = encodings[i],
+				.mip_count = mip_counts[i],
+				.width = widths[i],
+				.height = heights[i],
+				.ring_offset = reserve_staging_space(upload_sizes[i], upload_sizes[i], upload_sizes[i], &reserved_size)
+			};
+			_staged_images.push_back(staged);
+			continue;
 		}
 
-		//Record barrier to transition into optimal transfer dst layout
-		for (uint32_t i = 0; i < image_count; i++) {
-			VkImageMemoryBarrier2KHR barrier = {};
-			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
-			barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR;
-			barrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR;
-			barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-
-			barrier.image = images[i];
-			barrier.subresourceRange = {
-				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-				.baseMipLevel = 0,
-				.levelCount = mip_counts[i],
-				.baseArrayLayer = 0,
-				.layerCount = 1
-			};
+		//An image bigger than the whole ring is decoded up front and streamed through it by rows across several submissions
+		uint32_t x, y;
+		uint8_t* pixels = decode_image(batch, i, &x, &y);
+		if (x != widths[i] || y != heights[i]) {
+			printf("Loading image failed.\n");
+			exit(-1);
+		}
 
-			VkDependencyInfoKHR info = {};
-			info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
-			info.imageMemoryBarrierCount = 1;
-			info.pImageMemoryBarriers = &barrier;
+		uint32_t rows_copied = 0;
+		while (rows_copied < y) {
+			VkDeviceSize chunk_size;
+			VkDeviceSize ring_offset = reserve_staging_space(row_size, row_size * (y - rows_copied), row_size, &chunk_size);
+			uint32_t chunk_rows = static_cast<uint32_t>(chunk_size / row_size);
+			memcpy(_staging_ring_mapped + ring_offset, pixels + rows_copied * row_size, chunk_size);
 
-			vkCmdPipelineBarrier2KHR(current_batch.command_buffer, &info);
+			VkCommandBuffer cb = open_transfer_submission();
+			if (rows_copied == 0) begin_image_upload(cb, images[i], mip_counts[i]);
+			copy_staged_rows(cb, images[i], ring_offset, 0, x, rows_copied, chunk_rows);
+
+			rows_copied += chunk_rows;
 		}
+		end_image_upload(open_transfer_submission(), images[i], mip_counts[i], true);
 
-		//Record buffer copy to image
-		VkDeviceSize copy_offset = 0;
-		for (uint32_t i = 0; i < image_count; i++) {
-			uint32_t x = static_cast<uint32_t>(raw_images[i].width);
-			uint32_t y = static_cast<uint32_t>(raw_images[i].height);
-			VkBufferImageCopy region = {
-				.bufferOffset = copy_offset,
-				.bufferRowLength = 0,
-				.bufferImageHeight = 0,
-				.imageSubresource = {
-					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-					.mipLevel = 0,
-					.baseArrayLayer = 0,
-					.layerCount = 1
-				},
-				.imageOffset = 0,
-				.imageExtent = {
-					.width = x,
-					.height = y,
-					.depth = 1
-				}
-			};
+		free_decoded_image(batch, pixels);
+	}
 
-			copy_offset += x * y * channels;
+	//The batch is done once the submission being recorded now completes
+	//Staged images can't be flushed into a different submission without recording them first, so this holds for them too
+	//Opening it here makes sure a batch with no images still gets a submission to signal its value
+	open_transfer_submission();
+	current_batch.timeline_value = _image_upload_timeline + 1;
 
-			vkCmdCopyBufferToImage(current_batch.command_buffer, staging_buffer->buffer, images[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	//Insert into pending images table
+	//These must be visible before the batch is, since the render thread matches them up by batch id
+	for (uint32_t i = 0; i < image_count; i++) {
+		VulkanPendingImage pending_image = {};
+		pending_image.vk_image.image = images[i];
+		pending_image.vk_image.image_view = image_views[i];
+		pending_image.vk_image.image_allocation = image_allocations[i];
+		pending_image.batch_id = current_batch.id;
+		pending_image.vk_image.mip_levels = mip_counts[i];
+		pending_image.vk_image.width = widths[i];
+		pending_image.vk_image.height = heights[i];
+		pending_image.vk_image.depth = 1;
+		pending_image.original_idx = i;
+		pending_image.generate_mips = encodings[i].generate_mips;
+
+		_pending_images.insert(pending_image);
+	}
+	_image_upload_batches.insert(current_batch);
+	
+	printf("[image thread] Recorded batch #%i\n", (int)batch.id);
+}
+
+//Decodes every staged image into its ring region on the decode pool, then records their uploads
+void VulkanGraphicsDevice::record_staged_images() {
+	if (_staged_images.size() == 0) return;
+
+	_image_decode_pool.parallel_for((uint32_t)_staged_images.size(), [&](uint32_t staged_idx) {
+		const VulkanStagedImage& staged = _staged_images[staged_idx];
+
+		//Basis Universal containers go from the file's bytes to BCn blocks without ever being RGBA8
+		//Their files were unmapped once the headers were read, so they're mapped again here the way decode_image() reloads images
+		if (staged.encoding.transcode) {
+			MappedFile file;
+			size_t size;
+			TextureContainer container;
+			const uint8_t* bytes = container_bytes(*staged.batch, staged.image_idx, file, &size);
+			if (bytes == nullptr || !parse_texture_container(bytes, size, &container) || !transcode_basis_levels(bytes, size, container, _staging_ring_mapped + staged.ring_offset)) {
+				printf("Loading image failed.\n");
+				exit(-1);
+			}
+			return;
+		}
+
+		uint32_t x, y;
+		uint8_t* pixels = decode_image(*staged.batch, staged.image_idx, &x, &y);
+		if (x != staged.width || y != staged.height) {
+			printf("Loading image failed.\n");
+			exit(-1);
 		}
 
-		//Queue ownership transfer
-		for (uint32_t i = 0; i < image_count; i++) {
-			std::vector<VkImageMemoryBarrier2KHR> barriers;
+		//stb_image always decodes into memory of its own, so what goes into the ring is written while the pixels are still hot in this thread's cache
+		uint8_t* dst = _staging_ring_mapped + staged.ring_offset;
+		const ImageEncoding& encoding = staged.encoding;
+		if (encoding.block_compressed) {
+			if (encoding.alpha_to_green) {
+				for (size_t t = 0; t < static_cast<size_t>(x) * y; t++) pixels[4 * t + 1] = pixels[4 * t + 3];
+			}
+			compress_mip_chain(encoding.block_format, pixels, x, y, staged.mip_count, encoding.srgb, dst);
+		} else if (!encoding.generate_mips) {
+			Timer mip_timer;
+			generate_mip_chain_rgba8(pixels, x, y, staged.mip_count, encoding.srgb, dst);
+			_cpu_mip_generation_ns.fetch_add(static_cast<uint64_t>(mip_timer.check() * 1000000.0), std::memory_order_relaxed);
+			_cpu_mip_generation_texels.fetch_add(static_cast<uint64_t>(x) * y, std::memory_order_relaxed);
+		} else {
+			memcpy(dst, pixels, static_cast<size_t>(x) * y * 4);
+		}
+		free_decoded_image(*staged.batch, pixels);
+	});
+
+	VkCommandBuffer cb = open_transfer_submission();
+	for (VulkanStagedImage& staged : _staged_images) {
+		begin_image_upload(cb, staged.image, staged.mip_count);
+		if (!staged.encoding.generate_mips) {
+			//Every mip was made on the CPU and sits in the ring one after another
+			VkDeviceSize mip_offset = staged.ring_offset;
+			for (uint32_t k = 0; k < staged.mip_count; k++) {
+				uint32_t mip_width = std::max(staged.width >> k, 1u);
+				uint32_t mip_height = std::max(staged.height >> k, 1u);
+				copy_staged_rows(cb, staged.image, mip_offset, k, mip_width, 0, mip_height);
+				if (staged.encoding.block_compressed) mip_offset += block_compressed_size(staged.encoding.block_format, mip_width, mip_height);
+				else mip_offset += 4 * static_cast<VkDeviceSize>(mip_width) * mip_height;
+			}
+		} else {
+			copy_staged_rows(cb, staged.image, staged.ring_offset, 0, staged.width, 0, staged.height);
+		}
+		end_image_upload(cb, staged.image, staged.mip_count, staged.encoding.generate_mips);
+	}
+	_staged_images.clear();
+}
+
+//Record barrier to transition into optimal transfer dst layout
+void VulkanGraphicsDevice::begin_image_upload(VkCommandBuffer cb, VkImage image, uint32_t mip_count) {
+	VkImageMemoryBarrier2KHR barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+	barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR;
+	barrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+
+	barrier.image = image;
+	barrier.subresourceRange = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = mip_count,
+		.baseArrayLayer = 0,
+		.layerCount = 1
+	};
+
+	VkDependencyInfoKHR info = {};
+	info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	info.imageMemoryBarrierCount = 1;
+	info.pImageMemoryBarriers = &barrier;
+
+	vkCmdPipelineBarrier2KHR(cb, &info);
+}
+
+//Record buffer copy of row_count rows of a mip starting at first_row
+void VulkanGraphicsDevice::copy_staged_rows(VkCommandBuffer cb, VkImage image, VkDeviceSize ring_offset, uint32_t mip_level, uint32_t width, uint32_t first_row, uint32_t row_count) {
+	VkBufferImageCopy region = {
+		.bufferOffset = ring_offset,
+		.bufferRowLength = 0,
+		.bufferImageHeight = 0,
+		.imageSubresource = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.mipLevel = mip_level,
+			.baseArrayLayer = 0,
+			.layerCount = 1
+		},
+		.imageOffset = {
+			.x = 0,
+			.y = static_cast<int32_t>(first_row),
+			.z = 0
+		},
+		.imageExtent = {
+			.width = width,
+			.height = row_count,
+			.depth = 1
+		}
+	};
+	vkCmdCopyBufferToImage(cb, _staging_ring_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+}
+
+//Copies a container's stored levels through the ring as they are, with one copy per level
+//A level too big for the ring goes through in several copies of whole block rows
+void VulkanGraphicsDevice::upload_container_levels(VkImage image, const uint8_t* bytes, const TextureContainer& container, uint32_t mip_count, bool generate_mips) {
+	TexelBlock block = texel_block(container.format);
+	for (uint32_t k = 0; k < container.level_count; k++) {
+		const TextureLevel& level = container.levels[k];
+		uint32_t level_width = std::max(container.width >> k, 1u);
+		uint32_t level_height = std::max(container.height >> k, 1u);
+		VkDeviceSize block_row_size = level.size / ((level_height + block.height - 1) / block.height);
+
+		VkDeviceSize bytes_copied = 0;
+		while (bytes_copied < level.size) {
+			VkDeviceSize chunk_size;
+			VkDeviceSize ring_offset = reserve_staging_space(block_row_size, level.size - bytes_copied, block_row_size, &chunk_size);
+			memcpy(_staging_ring_mapped + ring_offset, bytes + level.offset + bytes_copied, chunk_size);
+
+			uint32_t first_row = static_cast<uint32_t>(bytes_copied / block_row_size) * block.height;
+			uint32_t row_count = std::min(static_cast<uint32_t>(chunk_size / block_row_size) * block.height, level_height - first_row);
+			VkCommandBuffer cb = open_transfer_submission();
+			if (k == 0 && bytes_copied == 0) begin_image_upload(cb, image, mip_count);
+			copy_staged_rows(cb, image, ring_offset, k, level_width, first_row, row_count);
+
+			bytes_copied += chunk_size;
+		}
+	}
+	end_image_upload(open_transfer_submission(), image, mip_count, generate_mips);
+}
+
+//Queue ownership transfer
+void VulkanGraphicsDevice::end_image_upload(VkCommandBuffer cb, VkImage image, uint32_t mip_count, bool generate_mips) {
+	std::vector<VkImageMemoryBarrier2KHR> barriers;
+
+	//Every level was uploaded, so the whole image goes straight to being sampled
+	if (!generate_mips) {
+		barriers.push_back({
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
+			.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
+			.srcAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
+			.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
+			.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
+
+			.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			.srcQueueFamilyIndex = transfer_queue_family_idx,
+			.dstQueueFamilyIndex = graphics_queue_family_idx,
+			.image = image,
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = mip_count,
+				.baseArrayLayer = 0,
+				.layerCount = 1
+			}
+		});
+	} else {
+		barriers.push_back({
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
+			.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
+			.srcAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
+			.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
+			.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
+
+			.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			.srcQueueFamilyIndex = transfer_queue_family_idx,
+			.dstQueueFamilyIndex = graphics_queue_family_idx,
+			.image = image,
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1
+			}
+		});
+
+		if (mip_count > 1) {
 			barriers.push_back({
 				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
 				.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
@@ -1219,77 +1777,125 @@ void VulkanGraphicsDevice::submit_image_upload_batch(uint64_t id, const std::vec
 				.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
 				.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
 
-				.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+				.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 				.srcQueueFamilyIndex = transfer_queue_family_idx,
 				.dstQueueFamilyIndex = graphics_queue_family_idx,
-				.image = images[i],
+				.image = image,
 				.subresourceRange = {
 					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-					.baseMipLevel = 0,
-					.levelCount = 1,
+					.baseMipLevel = 1,
+					.levelCount = mip_count - 1,
 					.baseArrayLayer = 0,
 					.layerCount = 1
 				}
 			});
+		}
+	}
 
-			if (mip_counts[i] > 1) {
-				barriers.push_back({
-					.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
-					.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
-					.srcAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
-					.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
-					.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
-
-					.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-					.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-					.srcQueueFamilyIndex = transfer_queue_family_idx,
-					.dstQueueFamilyIndex = graphics_queue_family_idx,
-					.image = images[i],
-					.subresourceRange = {
-						.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-						.baseMipLevel = 1,
-						.levelCount = mip_counts[i] - 1,
-						.baseArrayLayer = 0,
-						.layerCount = 1
-					}
-				});
-			}
+	VkDependencyInfoKHR info = {};
+	info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	info.imageMemoryBarrierCount = (uint32_t)barriers.size();
+	info.pImageMemoryBarriers = barriers.data();
 
-			VkDependencyInfoKHR info = {};
-			info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
-			info.imageMemoryBarrierCount = (uint32_t)barriers.size();
-			info.pImageMemoryBarriers = barriers.data();
+	vkCmdPipelineBarrier2KHR(cb, &info);
+}
+
+//Returns the ring offset of a contiguous region between min_size and max_size bytes, sized in multiples of granularity
+//Blocks on the GPU when the ring is too full to fit min_size
+VkDeviceSize VulkanGraphicsDevice::reserve_staging_space(VkDeviceSize min_size, VkDeviceSize max_size, VkDeviceSize granularity, VkDeviceSize* out_size) {
+	if (min_size > STAGING_RING_SIZE) {
+		printf("Upload of %i bytes can't fit in the staging ring.\n", (int)min_size);
+		exit(-1);
+	}
 
-			vkCmdPipelineBarrier2KHR(current_batch.command_buffer, &info);
+	while (true) {
+		reclaim_staging_space(false);
+
+		//Start from the beginning when the ring is empty, so the whole of it is contiguous
+		if (_staging_ring_head == _staging_ring_tail) {
+			_staging_ring_head = (_staging_ring_head + STAGING_RING_SIZE - 1) / STAGING_RING_SIZE * STAGING_RING_SIZE;
+			_staging_ring_tail = _staging_ring_head;
+		}
+
+		uint64_t head = (_staging_ring_head + STAGING_RING_ALIGNMENT - 1) / STAGING_RING_ALIGNMENT * STAGING_RING_ALIGNMENT;
+		uint64_t used = head - _staging_ring_tail;
+		if (used <= STAGING_RING_SIZE) {
+			VkDeviceSize free_size = STAGING_RING_SIZE - used;
+			VkDeviceSize offset = head % STAGING_RING_SIZE;
+			VkDeviceSize to_end = STAGING_RING_SIZE - offset;
+
+			//Skip the rest of the ring if min_size only fits after wrapping around
+			if (to_end < min_size && free_size >= to_end + min_size) {
+				head += to_end;
+				free_size -= to_end;
+				offset = 0;
+				to_end = STAGING_RING_SIZE;
+			}
+
+			VkDeviceSize available = std::min(free_size, to_end) / granularity * granularity;
+			if (available >= min_size) {
+				*out_size = std::min(available, max_size);
+				_staging_ring_head = head + *out_size;
+				return offset;
+			}
 		}
 
-		vkEndCommandBuffer(current_batch.command_buffer);
+		//Out of space. Submit everything reserved so far so the GPU has work, then wait for the oldest submission
+		flush_transfer_submission();
+		reclaim_staging_space(true);
 	}
+}
 
-	_pending_image_mutex.lock();
-	_image_upload_mutex.lock();
-	//Insert into pending images table
-	for (uint32_t i = 0; i < image_count; i++) {
-		VulkanPendingImage pending_image = {};
-		pending_image.vk_image.image = images[i];
-		pending_image.vk_image.image_view = image_views[i];
-		pending_image.vk_image.image_allocation = image_allocations[i];
-		pending_image.batch_id = current_batch.id;
-		pending_image.vk_image.mip_levels = mip_counts[i];
-		pending_image.vk_image.width = raw_images[i].width;
-		pending_image.vk_image.height = raw_images[i].height;
-		pending_image.vk_image.depth = 1;
-		pending_image.original_idx = i;
+void VulkanGraphicsDevice::reclaim_staging_space(bool wait_for_oldest) {
+	if (wait_for_oldest && _staging_submissions.size() > 0) {
+		VkSemaphoreWaitInfo info = {};
+		info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		info.semaphoreCount = 1;
+		info.pSemaphores = get_semaphore(image_upload_semaphore);
+		info.pValues = &_staging_submissions.front().timeline_value;
+		VKASSERT_OR_CRASH(vkWaitSemaphores(device, &info, std::numeric_limits<uint64_t>::max()));
+	}
 
-		_pending_images.insert(pending_image);
+	uint64_t gpu_value = check_timeline_semaphore(image_upload_semaphore);
+	while (_staging_submissions.size() > 0 && _staging_submissions.front().timeline_value <= gpu_value) {
+		VulkanStagingSubmission& submission = _staging_submissions.front();
+		return_transfer_command_buffer(submission.command_buffer);
+		_staging_ring_tail = submission.ring_end;
+		_staging_submissions.pop_front();
 	}
+}
+
+//Returns the transfer command buffer currently being recorded, beginning a new one if needed
+VkCommandBuffer VulkanGraphicsDevice::open_transfer_submission() {
+	if (_open_transfer_cb == VK_NULL_HANDLE) {
+		//Keep the number of submissions in flight within the transfer command buffer pool
+		while (_staging_submissions.size() >= MAX_STAGING_SUBMISSIONS) {
+			reclaim_staging_space(true);
+		}
+
+		_open_transfer_cb = borrow_transfer_command_buffer();
+
+		VkCommandBufferBeginInfo info = {};
+		info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(_open_transfer_cb, &info);
+	}
+	return _open_transfer_cb;
+}
+
+//Submits the open transfer command buffer, which signals the next image_upload_semaphore value
+//Staged images are decoded and recorded first, since their ring space can't be submitted empty
+void VulkanGraphicsDevice::flush_transfer_submission() {
+	record_staged_images();
+	if (_open_transfer_cb == VK_NULL_HANDLE) return;
+
+	vkEndCommandBuffer(_open_transfer_cb);
 
-	//Submit upload command buffer
 	VkQueue q;
 	vkGetDeviceQueue(device, transfer_queue_family_idx, 0, &q);
 	{
-		uint64_t signal_value = id;
+		uint64_t signal_value = _image_upload_timeline + 1;
 		VkTimelineSemaphoreSubmitInfo ts_info = {};
 		ts_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
 		ts_info.signalSemaphoreValueCount = 1;
@@ -1302,184 +1908,176 @@ void VulkanGraphicsDevice::submit_image_upload_batch(uint64_t id, const std::vec
 		info.signalSemaphoreCount = 1;
 		info.pSignalSemaphores = get_semaphore(image_upload_semaphore);
 		info.commandBufferCount = 1;
-		info.pCommandBuffers = &current_batch.command_buffer;
+		info.pCommandBuffers = &_open_transfer_cb;
 		info.pWaitDstStageMask = flags;
 
 		VKASSERT_OR_CRASH(vkQueueSubmit(q, 1, &info, VK_NULL_HANDLE));
-
-		_image_upload_batches.insert(current_batch);
 	}
-	_pending_image_mutex.unlock();
-	_image_upload_mutex.unlock();
-	
-	printf("[image thread] Submitted batch #%i\n", (int)id);
+
+	_image_upload_timeline += 1;
+	_staging_submissions.push_back({
+		.command_buffer = _open_transfer_cb,
+		.timeline_value = _image_upload_timeline,
+		.ring_end = _staging_ring_head
+	});
+	_open_transfer_cb = VK_NULL_HANDLE;
 }
 
 uint64_t VulkanGraphicsDevice::load_raw_images(
 	const std::vector<RawImage> raw_images,
 	const std::vector<VkFormat> image_formats
 ) {
-	_image_batches_requested += 1;
+	uint64_t id = _image_batches_requested.fetch_add(1) + 1;
 	_raw_image_mutex.lock();
 	_raw_image_batch_queue.push({
-		.id = _image_batches_requested,
+		.id = id,
 		.raw_images = raw_images,
 		.image_formats = image_formats
 	});
 	_raw_image_mutex.unlock();
+	notify_image_upload_thread();
 
-	return _image_batches_requested;
+	return id;
 }
 
 uint64_t VulkanGraphicsDevice::load_compressed_images(
 	const std::vector<CompressedImage> images,
 	const std::vector<VkFormat> formats
 ) {
-	_image_batches_requested += 1;
+	uint64_t id = _image_batches_requested.fetch_add(1) + 1;
 	_compressed_image_mutex.lock();
 	_compressed_image_batch_queue.push({
-		.id = _image_batches_requested,
+		.id = id,
 		.images = images,
 		.image_formats = formats
 	});
 	_compressed_image_mutex.unlock();
+	notify_image_upload_thread();
 	
-	return _image_batches_requested;
+	return id;
 }
 
 uint64_t VulkanGraphicsDevice::load_image_files(
 	const std::vector<const char*> filenames,
 	const std::vector<VkFormat> image_formats
 ) {
-	_image_batches_requested += 1;
+	uint64_t id = _image_batches_requested.fetch_add(1) + 1;
 	_file_batch_mutex.lock();
 	_image_file_batch_queue.push({
-		.id = _image_batches_requested,
+		.id = id,
 		.filenames = filenames,
 		.image_formats = image_formats
 	});
 	_file_batch_mutex.unlock();
+	notify_image_upload_thread();
 
-	return _image_batches_requested;
+	return id;
+}
+
+void VulkanGraphicsDevice::notify_image_upload_thread() {
+	_image_work_mutex.lock();
+	_image_work_queued = true;
+	_image_work_mutex.unlock();
+	_image_work_available.notify_one();
 }
 
 //Main function for image loading thread
 void VulkanGraphicsDevice::load_images_impl() {
-	while (_image_upload_running) {
-		std::vector<RawImageBatchParameters> final_parameters;
-
-		//Loading images from memory
-		while (_raw_image_batch_queue.size() > 0) {
-			RawImageBatchParameters params = _raw_image_batch_queue.front();
+	//Batches waiting on a batch with a lower id
+	std::vector<ImageBatchParameters> ready_batches;
+	uint64_t next_batch_id = 1;
 
-			final_parameters.push_back(params);
+	while (true) {
+		//Sleep until there is something new to do
+		{
+			std::unique_lock<std::mutex> lock(_image_work_mutex);
+			_image_work_available.wait(lock, [this]() { return _image_work_queued || !_image_upload_running; });
+			if (!_image_upload_running) return;
+			_image_work_queued = false;
+		}
 
-			//Remove processed parameters
-			_raw_image_mutex.lock();
+		//Take everything that has been queued so far
+		//Nothing is decoded here. Pixels are decoded once they have space in the staging ring
+		_raw_image_mutex.lock();
+		while (_raw_image_batch_queue.size() > 0) {
+			RawImageBatchParameters& params = _raw_image_batch_queue.front();
+			ready_batches.push_back({
+				.id = params.id,
+				.raw_images = std::move(params.raw_images),
+				.image_formats = std::move(params.image_formats)
+			});
 			_raw_image_batch_queue.pop();
-			_raw_image_mutex.unlock();
 		}
+		_raw_image_mutex.unlock();
 
-		//Loading compressed images from memory
+		_compressed_image_mutex.lock();
 		while (_compressed_image_batch_queue.size() > 0) {
 			CompressedImageBatchParameters& params = _compressed_image_batch_queue.front();
-			uint32_t image_count = (uint32_t)params.images.size();
-
-			std::vector<RawImage> raw_images;
-			raw_images.resize(image_count);
-			for (uint32_t i = 0; i < image_count; i++) {
-				int width, height;
-				raw_images[i].data = stbi_load_from_memory(params.images[i].bytes.data(), static_cast<int>(params.images[i].bytes.size()), &width, &height, nullptr, STBI_rgb_alpha);
-				raw_images[i].width = width;
-				raw_images[i].height = height;
-				printf("Decompressed image from memory with dimensions (%i, %i)\n", width, height);
-			}
-
-			RawImageBatchParameters p = {
+			ready_batches.push_back({
 				.id = params.id,
-				.raw_images = raw_images,
-				.image_formats = params.image_formats
-			};
-			final_parameters.push_back(p);
-
-			//Free loaded image memory
-			// for (RawImage& image : raw_images) {
-			// 	stbi_image_free(image.data);
-			// }
-
-			_compressed_image_mutex.lock();
+				.compressed_images = std::move(params.images),
+				.image_formats = std::move(params.image_formats)
+			});
 			_compressed_image_batch_queue.pop();
-			_compressed_image_mutex.unlock();
 		}
+		_compressed_image_mutex.unlock();
 
-		//Loading images from files
+		_file_batch_mutex.lock();
 		while (_image_file_batch_queue.size() > 0) {
 			FileImageBatchParameters& params = _image_file_batch_queue.front();
-			uint32_t image_count = (uint32_t)params.filenames.size();
-
-			//Load image data from disk
-			std::vector<RawImage> raw_images;
-			raw_images.resize(image_count);
-			for (uint32_t i = 0; i < image_count; i++) {
-				int width, height;
-				raw_images[i].data = stbi_load(params.filenames[i], &width, &height, nullptr, STBI_rgb_alpha);
-				raw_images[i].width = static_cast<uint32_t>(width);
-				raw_images[i].height = static_cast<uint32_t>(height);
-				
-				if (!raw_images[i].data) {
-					printf("Loading image failed.\n");
-					exit(-1);
-				}
-			}
-
-			RawImageBatchParameters p = {
+			ready_batches.push_back({
 				.id = params.id,
-				.raw_images = raw_images,
-				.image_formats = params.image_formats
-			};
-			final_parameters.push_back(p);
-
-			//Free loaded image memory
-			// for (RawImage& image : raw_images) {
-			// 	stbi_image_free(image.data);
-			// }
-
-			//Remove processed parameters
-			_file_batch_mutex.lock();
+				.filenames = std::move(params.filenames),
+				.image_formats = std::move(params.image_formats)
+			});
 			_image_file_batch_queue.pop();
-			_file_batch_mutex.unlock();
 		}
+		_file_batch_mutex.unlock();
 
-		//Call submit after batches have been collated
-		std::sort(final_parameters.begin(), final_parameters.end(), [](RawImageBatchParameters& p1, RawImageBatchParameters& p2) {
+		//Batches complete in the order they are submitted, so they must be submitted in id order
+		//A batch whose predecessor hasn't been queued yet waits here for a later iteration
+		std::sort(ready_batches.begin(), ready_batches.end(), [](ImageBatchParameters& p1, ImageBatchParameters& p2) {
 			return p1.id < p2.id;
 		});
-		for (RawImageBatchParameters& p : final_parameters) {
-			this->submit_image_upload_batch(p.id, p.raw_images, p.image_formats);
+		uint32_t submitted_count = 0;
+		while (submitted_count < ready_batches.size() && ready_batches[submitted_count].id == next_batch_id) {
+			this->submit_image_upload_batch(ready_batches[submitted_count]);
+			next_batch_id += 1;
+			submitted_count += 1;
 		}
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		//Everything recorded this iteration goes to the GPU in one submission, unless the staging ring filled up along the way
+		//Staged images point into ready_batches, so this has to happen before the submitted batches are dropped
+		flush_transfer_submission();
+		ready_batches.erase(ready_batches.begin(), ready_batches.begin() + submitted_count);
 	}
 }
 
 void VulkanGraphicsDevice::tick_image_uploads(VkCommandBuffer render_cb) {
-	if (!_pending_image_mutex.try_lock())
-		return;
-
-	if (!_image_upload_mutex.try_lock()) {
-		_pending_image_mutex.unlock();
-		return;
-	}
-
-	uint64_t gpu_batches_processed = check_timeline_semaphore(image_upload_semaphore);
+	uint64_t gpu_upload_value = check_timeline_semaphore(image_upload_semaphore);
+	_image_upload_value_seen = gpu_upload_value;
 	// {
 	// 	static int last_seen = 0;
-	// 	if (gpu_batches_processed > last_seen) {
-	// 		last_seen = (int)gpu_batches_processed;
-	// 		printf("Saw batch %i with upload batch count of %i...\n", (int)gpu_batches_processed, (int)_image_upload_batches.count());
+	// 	if (gpu_upload_value > last_seen) {
+	// 		last_seen = (int)gpu_upload_value;
+	// 		printf("Saw batch %i with upload batch count of %i...\n", (int)gpu_upload_value, (int)_image_upload_batches.count());
 	// 	}
 	// }
 
+	//Collect the mip blit time from the last frame that used this pair of timestamps
+	//It was FRAMES_IN_FLIGHT frames ago, so the results are normally there without waiting
+	//If they aren't, the pair stays taken until they are, and this frame's blits go untimed
+	uint32_t timestamp_slot = static_cast<uint32_t>(_mip_timestamp_frame++ % FRAMES_IN_FLIGHT);
+	if (_mip_timestamps_written[timestamp_slot]) {
+		uint64_t timestamps[2];
+		VkResult res = vkGetQueryPoolResults(device, _mip_timestamp_pool, 2 * timestamp_slot, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if (res == VK_SUCCESS) {
+			_gpu_mip_generation_ns += static_cast<uint64_t>((timestamps[1] - timestamps[0]) * (double)physical_limits.timestampPeriod);
+			_gpu_mip_generation_texels += _mip_timestamp_texels[timestamp_slot];
+			_mip_timestamps_written[timestamp_slot] = false;
+		}
+	}
+
 	//Descriptor update state
 	std::vector<VkDescriptorImageInfo> desc_infos;
 	std::vector<VkWriteDescriptorSet> desc_writes;
@@ -1488,13 +2086,10 @@ void VulkanGraphicsDevice::tick_image_uploads(VkCommandBuffer render_cb) {
 
 	std::vector<uint32_t> pending_images_to_delete;
 	std::vector<uint32_t> batches_to_delete;
+	std::vector<VulkanImage> mip_blit_images;
 	for (auto batch_it = _image_upload_batches.begin(); batch_it != _image_upload_batches.end(); ++batch_it) {
 		VulkanImageUploadBatch& batch = *batch_it;
-		if (batch.id > gpu_batches_processed) continue;		
-
-		//Make the transfer command buffer available again and destroy the staging buffer
-		return_transfer_command_buffer(batch.command_buffer);
-		vmaDestroyBuffer(allocator, _buffers.get(batch.staging_buffer_id)->buffer, _buffers.get(batch.staging_buffer_id)->allocation);
+		if (batch.timeline_value > gpu_upload_value) continue;
 
 		for (auto pending_image_it = _pending_images.begin(); pending_image_it != _pending_images.end(); ++pending_image_it) {
 			VulkanPendingImage& pending_image = *pending_image_it;
@@ -1504,28 +2099,7 @@ void VulkanGraphicsDevice::tick_image_uploads(VkCommandBuffer render_cb) {
 				//Record Graphics queue acquire ownership of the image
 				{
 					std::vector<VkImageMemoryBarrier2KHR> barriers;
-					barriers.push_back({
-						.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
-						.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
-						.srcAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
-						.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
-						.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
-
-						.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-						.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-						.srcQueueFamilyIndex = transfer_queue_family_idx,
-						.dstQueueFamilyIndex = graphics_queue_family_idx,
-						.image = pending_image.vk_image.image,
-						.subresourceRange = {
-							.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-							.baseMipLevel = 0,
-							.levelCount = 1,
-							.baseArrayLayer = 0,
-							.layerCount = 1
-						}
-					});
-
-					if (pending_image.vk_image.mip_levels > 1) {
+					if (!pending_image.generate_mips) {
 						barriers.push_back({
 							.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
 							.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
@@ -1533,158 +2107,76 @@ void VulkanGraphicsDevice::tick_image_uploads(VkCommandBuffer render_cb) {
 							.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
 							.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
 
-							.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-							.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+							.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+							.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
 							.srcQueueFamilyIndex = transfer_queue_family_idx,
 							.dstQueueFamilyIndex = graphics_queue_family_idx,
 							.image = pending_image.vk_image.image,
 							.subresourceRange = {
 								.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-								.baseMipLevel = 1,
-								.levelCount = pending_image.vk_image.mip_levels - 1,
+								.baseMipLevel = 0,
+								.levelCount = pending_image.vk_image.mip_levels,
 								.baseArrayLayer = 0,
 								.layerCount = 1
 							}
 						});
-					}
-
-					VkDependencyInfoKHR info = {};
-					info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
-					info.imageMemoryBarrierCount = (uint32_t)barriers.size();
-					info.pImageMemoryBarriers = barriers.data();
-
-					vkCmdPipelineBarrier2KHR(render_cb, &info);
-				}
+					} else {
+						barriers.push_back({
+							.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
+							.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
+							.srcAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
+							.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
+							.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
 
-				//Record mipmapping commands
-				if (pending_image.vk_image.mip_levels > 1) {
-					for (uint32_t k = 0; k < pending_image.vk_image.mip_levels - 1; k++) {
-						VkImageBlit region = {
-							.srcSubresource = {
-								.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-								.mipLevel = k,
-								.baseArrayLayer = 0,
-								.layerCount = 1,
-							},
-							.srcOffsets = {
-								{
-									.x = 0,
-									.y = 0,
-									.z = 0,
-								},
-								{
-									.x = static_cast<int32_t>(pending_image.vk_image.width >> k),
-									.y = static_cast<int32_t>(pending_image.vk_image.height >> k),
-									.z = 1,
-								}
-							},
-							.dstSubresource = {
+							.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+							.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+							.srcQueueFamilyIndex = transfer_queue_family_idx,
+							.dstQueueFamilyIndex = graphics_queue_family_idx,
+							.image = pending_image.vk_image.image,
+							.subresourceRange = {
 								.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-								.mipLevel = k + 1,
+								.baseMipLevel = 0,
+								.levelCount = 1,
 								.baseArrayLayer = 0,
 								.layerCount = 1
-							},
-							.dstOffsets = {
-								{
-									.x = 0,
-									.y = 0,
-									.z = 0,
-								},
-								{
-									.x = static_cast<int32_t>(pending_image.vk_image.width >> (k + 1)),
-									.y = static_cast<int32_t>(pending_image.vk_image.height >> (k + 1)),
-									.z = 1,
-								}
-							},
-						};
-
-						vkCmdBlitImage(
-							render_cb,
-							pending_image.vk_image.image,
-							VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-							pending_image.vk_image.image,
-							VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-							1,
-							&region,
-							VK_FILTER_LINEAR
-						);
-
-						{
-							VkImageMemoryBarrier2KHR barriers[] = {
-								{
-									.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
-									.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
-									.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
-									.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR,
-									.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR,
-									.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-									.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-									.image = pending_image.vk_image.image,
-									.subresourceRange = {
-										.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-										.baseMipLevel = k,
-										.levelCount = 1,
-										.baseArrayLayer = 0,
-										.layerCount = 1,
-									}
-								},
-								{
-									.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
-									.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
-									.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
-									.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
-									.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR,
-									.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-									.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-									.image = pending_image.vk_image.image,
-									.subresourceRange = {
-										.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-										.baseMipLevel = k + 1,
-										.levelCount = 1,
-										.baseArrayLayer = 0,
-										.layerCount = 1,
-									}
-								}
-							};
-							VkDependencyInfoKHR info = {
-								.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR,
-								.imageMemoryBarrierCount = 2,
-								.pImageMemoryBarriers = barriers
-							};
-							vkCmdPipelineBarrier2KHR(render_cb, &info);
-						}
-					}
+							}
+						});
 
-					//Final barrier
-					{
-						VkImageMemoryBarrier2KHR barriers[] = {
-							{
+						if (pending_image.vk_image.mip_levels > 1) {
+							barriers.push_back({
 								.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
-								.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
-								.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
-								.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR,
-								.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR,
-								.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-								.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+								.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
+								.srcAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
+								.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
+								.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
+
+								.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+								.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+								.srcQueueFamilyIndex = transfer_queue_family_idx,
+								.dstQueueFamilyIndex = graphics_queue_family_idx,
 								.image = pending_image.vk_image.image,
 								.subresourceRange = {
 									.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-									.baseMipLevel = pending_image.vk_image.mip_levels - 1,
-									.levelCount = 1,
+									.baseMipLevel = 1,
+									.levelCount = pending_image.vk_image.mip_levels - 1,
 									.baseArrayLayer = 0,
-									.layerCount = 1,
+									.layerCount = 1
 								}
-							}
-						};
-						VkDependencyInfoKHR info = {
-							.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR,
-							.imageMemoryBarrierCount = 1,
-							.pImageMemoryBarriers = barriers
-						};
-						vkCmdPipelineBarrier2KHR(render_cb, &info);
+							});
+						}
 					}
+
+					VkDependencyInfoKHR info = {};
+					info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+					info.imageMemoryBarrierCount = (uint32_t)barriers.size();
+					info.pImageMemoryBarriers = barriers.data();
+
+					vkCmdPipelineBarrier2KHR(render_cb, &info);
 				}
 
+				//Block-compressed images and ones with CPU mips arrive with their mips already uploaded
+				if (pending_image.generate_mips && pending_image.vk_image.mip_levels > 1) mip_blit_images.push_back(pending_image.vk_image);
+
 				//Descriptor update data
 				{
 					VulkanBindlessImage ava = {};
@@ -1692,7 +2184,7 @@ void VulkanGraphicsDevice::tick_image_uploads(VkCommandBuffer render_cb) {
 					ava.original_idx = pending_image.original_idx;
 					ava.vk_image = pending_image.vk_image;
 					
-					Key<VulkanBindlessImage> handle = bindless_images.insert(ava);
+					Key<VulkanBindlessImage> handle = bindless_images.insert(ava.batch_id, ava.original_idx, ava.vk_image);
 					pending_images_to_delete.push_back(pending_image_it.slot_index());
 					//printf("Pushed bindless image from batch %i into array\n", (int)batch.id);
 
@@ -1721,6 +2213,151 @@ void VulkanGraphicsDevice::tick_image_uploads(VkCommandBuffer render_cb) {
 		batches_to_delete.push_back(batch_it.slot_index());
 	}
 	
+	//Record mipmapping commands
+	//They all come after the ownership acquires, so the timestamps on either side only see blits and the barriers between levels
+	bool time_blits = _mip_timestamp_pool && !_mip_timestamps_written[timestamp_slot] && mip_blit_images.size() > 0;
+	if (time_blits) {
+		vkCmdResetQueryPool(render_cb, _mip_timestamp_pool, 2 * timestamp_slot, 2);
+		vkCmdWriteTimestamp2KHR(render_cb, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR, _mip_timestamp_pool, 2 * timestamp_slot);
+		_mip_timestamps_written[timestamp_slot] = true;
+		_mip_timestamp_texels[timestamp_slot] = 0;
+	} else if (_mip_timestamp_pool) {
+		_gpu_mip_untimed_images += static_cast<uint32_t>(mip_blit_images.size());
+	}
+	for (size_t i = 0; i < mip_blit_images.size(); i++) {
+		const VulkanImage& vk_image = mip_blit_images[i];
+		if (time_blits) _mip_timestamp_texels[timestamp_slot] += static_cast<uint64_t>(vk_image.width) * vk_image.height;
+
+		for (uint32_t k = 0; k < vk_image.mip_levels - 1; k++) {
+			VkImageBlit region = {
+				.srcSubresource = {
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.mipLevel = k,
+					.baseArrayLayer = 0,
+					.layerCount = 1,
+				},
+				.srcOffsets = {
+					{
+						.x = 0,
+						.y = 0,
+						.z = 0,
+					},
+					{
+						.x = static_cast<int32_t>(vk_image.width >> k),
+						.y = static_cast<int32_t>(vk_image.height >> k),
+						.z = 1,
+					}
+				},
+				.dstSubresource = {
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.mipLevel = k + 1,
+					.baseArrayLayer = 0,
+					.layerCount = 1
+				},
+				.dstOffsets = {
+					{
+						.x = 0,
+						.y = 0,
+						.z = 0,
+					},
+					{
+						.x = static_cast<int32_t>(vk_image.width >> (k + 1)),
+						.y = static_cast<int32_t>(vk_image.height >> (k + 1)),
+						.z = 1,
+					}
+				},
+			};
+
+			vkCmdBlitImage(
+				render_cb,
+				vk_image.image,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				vk_image.image,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				1,
+				&region,
+				VK_FILTER_LINEAR
+			);
+			if (time_blits && i + 1 == mip_blit_images.size() && k + 2 == vk_image.mip_levels) {
+				vkCmdWriteTimestamp2KHR(render_cb, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR, _mip_timestamp_pool, 2 * timestamp_slot + 1);
+			}
+
+			{
+				VkImageMemoryBarrier2KHR barriers[] = {
+					{
+						.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
+						.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
+						.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
+						.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR,
+						.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR,
+						.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+						.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+						.image = vk_image.image,
+						.subresourceRange = {
+							.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+							.baseMipLevel = k,
+							.levelCount = 1,
+							.baseArrayLayer = 0,
+							.layerCount = 1,
+						}
+					},
+					{
+						.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
+						.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
+						.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
+						.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
+						.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR,
+						.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+						.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+						.image = vk_image.image,
+						.subresourceRange = {
+							.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+							.baseMipLevel = k + 1,
+							.levelCount = 1,
+							.baseArrayLayer = 0,
+							.layerCount = 1,
+						}
+					}
+				};
+				VkDependencyInfoKHR info = {
+					.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR,
+					.imageMemoryBarrierCount = 2,
+					.pImageMemoryBarriers = barriers
+				};
+				vkCmdPipelineBarrier2KHR(render_cb, &info);
+			}
+		}
+
+		//Final barrier
+		{
+			VkImageMemoryBarrier2KHR barriers[] = {
+				{
+					.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
+					.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
+					.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
+					.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR,
+					.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT_KHR,
+					.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+					.image = vk_image.image,
+					.subresourceRange = {
+						.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+						.baseMipLevel = vk_image.mip_levels - 1,
+						.levelCount = 1,
+						.baseArrayLayer = 0,
+						.layerCount = 1,
+					}
+				}
+			};
+			VkDependencyInfoKHR info = {
+				.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR,
+				.imageMemoryBarrierCount = 1,
+				.pImageMemoryBarriers = barriers
+			};
+			vkCmdPipelineBarrier2KHR(render_cb, &info);
+		}
+	}
+
 	for (uint32_t& idx : batches_to_delete) {
 		_image_upload_batches.remove(idx);
 	}
@@ -1729,28 +2366,52 @@ void VulkanGraphicsDevice::tick_image_uploads(VkCommandBuffer render_cb) {
 	for (uint32_t& idx : pending_images_to_delete) {
 		_pending_images.remove(idx);
 	}
-
-	//Release relevant locks
-	_pending_image_mutex.unlock();
-	_image_upload_mutex.unlock();
 	
 	if (batches_to_delete.size() > 0)
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(desc_writes.size()), desc_writes.data(), 0, nullptr);
 }
 
+double VulkanGraphicsDevice::cpu_mip_generation_ms() {
+	return _cpu_mip_generation_ns.load(std::memory_order_relaxed) / 1000000.0;
+}
+
+double VulkanGraphicsDevice::gpu_mip_generation_ms() {
+	return _gpu_mip_generation_ns / 1000000.0;
+}
+
+uint64_t VulkanGraphicsDevice::cpu_mip_generation_texels() {
+	return _cpu_mip_generation_texels.load(std::memory_order_relaxed);
+}
+
+uint64_t VulkanGraphicsDevice::gpu_mip_generation_texels() {
+	return _gpu_mip_generation_texels;
+}
+
+uint32_t VulkanGraphicsDevice::gpu_mip_untimed_images() {
+	return _gpu_mip_untimed_images;
+}
+
+//Mips are blitted from one level to the next with linear filtering
+bool VulkanGraphicsDevice::format_supports_mip_blits(VkFormat format) {
+	VkFormatProperties props;
+	vkGetPhysicalDeviceFormatProperties(physical_device, format, &props);
+	VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return (props.optimalTilingFeatures & needed) == needed;
+}
+
 uint64_t VulkanGraphicsDevice::completed_image_batches() {
 	return _image_batches_completed;
 }
 
 void VulkanGraphicsDevice::destroy_image(Key<VulkanBindlessImage> key) {
-	VulkanBindlessImage* im = bindless_images.get(key);
+	VulkanImage* im = bindless_images.get<BINDLESS_VK_IMAGE>(key);
 	if (im) {
 		ImageDeletion d = {
 			.idx = EXTRACT_IDX(key.value()),
 			.frames_til = FRAMES_IN_FLIGHT,
-			.image = im->vk_image.image,
-			.image_view = im->vk_image.image_view,
-			.image_allocation = im->vk_image.image_allocation
+			.image = im->image,
+			.image_view = im->image_view,
+			.image_allocation = im->image_allocation
 		};
 		_image_deletion_queue.emplace_front(d);
 	}
@@ -1849,6 +2510,10 @@ VulkanGraphicsPipeline* VulkanGraphicsDevice::get_graphics_pipeline(Key<VulkanGr
 	return _graphics_pipelines.get(handle);
 }
 
+VulkanComputePipeline* VulkanGraphicsDevice::get_compute_pipeline(Key<VulkanComputePipeline> handle) {
+	return _compute_pipelines.get(handle);
+}
+
 Key<VkFramebuffer> VulkanGraphicsDevice::create_framebuffer(VkFramebufferCreateInfo& info) {
 	VkFramebuffer fb;
 	if (vkCreateFramebuffer(device, &info, alloc_callbacks, &fb) != VK_SUCCESS) {
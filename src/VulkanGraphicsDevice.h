@@ -1,22 +1,37 @@
 #pragma once
 
+#include <condition_variable>
 #include <deque>
+#include <memory>
 #include <queue>
 #include <mutex>
 #include <span>
+#include <stack>
 #include "volk.h"
 #include "vma.h"
 #include "slotmap.h"
+#include "concurrent_slotmap.h"
+#include "paged_slotmap.h"
+#include "soa_slotmap.h"
 #include "VulkanGraphicsPipeline.h"
+#include "thread_pool.h"
+#include "block_compression.h"
+#include "texture_container.h"
 
 #define FRAMES_IN_FLIGHT 2		//Number of simultaneous frames the GPU could be working on
 #define PIPELINE_CACHE_FILENAME ".shadercache"
 
 enum DescriptorBindings : uint8_t {
 	SAMPLED_IMAGES,
-	SAMPLERS
+	SAMPLERS,
+	STORAGE_BUFFERS
 };
 
+#define MAX_STORAGE_BUFFERS 64
+
+//Every pipeline shares one layout, so push constants are always visible to all of these stages
+constexpr VkShaderStageFlags PUSH_CONSTANT_STAGES = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
 enum ImmutableSamplers : uint8_t {
 	STANDARD,
 	NEAREST,
@@ -82,27 +97,63 @@ struct RawImage {
 	uint8_t* data;
 };
 
-//A JPEG or PNG image
+//A JPEG, PNG, KTX2 or DDS image, viewed in place
+//owner keeps the bytes alive until the upload thread has decoded them, so they can point into a mapped file
 struct CompressedImage {
-	std::vector<uint8_t> bytes;
+	std::span<const uint8_t> bytes;
+	std::shared_ptr<const void> owner;
 };
 
 struct VulkanPendingImage {
 	uint64_t batch_id;
 	uint32_t original_idx;
 	VulkanImage vk_image;
+	bool generate_mips;		//Only mip 0 was uploaded and the rest get blitted from it on the graphics queue
+};
+
+//Which block-compressed formats decoded images are uploaded as. Raw images are never compressed
+enum TextureCompression : uint8_t {
+	TEXTURE_COMPRESSION_NONE,		//RGBA8 with mips generated on the GPU
+	TEXTURE_COMPRESSION_FAST,		//BC1 for color and BC3 when there's alpha
+	TEXTURE_COMPRESSION_QUALITY		//BC1 for color and BC7 when there's alpha
 };
 
+//How one uploaded image is stored on the GPU
+struct ImageEncoding {
+	VkFormat format;
+	bool block_compressed;
+	BlockFormat block_format;
+	bool srgb;					//Mips are filtered in linear space
+	bool alpha_to_green;		//Grey and alpha images move alpha into G before compressing to BC5
+	bool generate_mips;			//Only mip 0 is uploaded and the rest get blitted from it on the graphics queue
+	bool transcode;				//Every level is transcoded from a Basis Universal container on the decode threads
+	VkComponentMapping components;
+};
+
+//Logical layout of a bindless image. bindless_images stores these fields as separate columns
 struct VulkanBindlessImage {
 	uint64_t batch_id;
 	uint32_t original_idx;
 	VulkanImage vk_image;
 };
 
+//Column indices into VulkanGraphicsDevice::bindless_images
+enum BindlessImageColumn : size_t {
+	BINDLESS_BATCH_ID,
+	BINDLESS_ORIGINAL_IDX,
+	BINDLESS_VK_IMAGE
+};
+
 struct VulkanImageUploadBatch {
 	uint64_t id;
-	Key<VulkanBuffer> staging_buffer_id;
+	uint64_t timeline_value;		//Value of image_upload_semaphore once every image in the batch has been copied
+};
+
+//One submission of transfer commands whose staging ring space is in use until the GPU finishes it
+struct VulkanStagingSubmission {
 	VkCommandBuffer command_buffer;
+	uint64_t timeline_value;		//Value of image_upload_semaphore this submission signals
+	uint64_t ring_end;				//Staging ring head when it was submitted
 };
 
 struct RawImageBatchParameters {
@@ -123,6 +174,27 @@ struct FileImageBatchParameters {
 	std::vector<VkFormat> image_formats;
 };
 
+//A batch from any of the ::load_* queues as the image upload thread handles it. Only one of the image vectors is filled
+struct ImageBatchParameters {
+	uint64_t id;
+	std::vector<RawImage> raw_images;
+	std::vector<CompressedImage> compressed_images;
+	std::vector<const char*> filenames;
+	std::vector<VkFormat> image_formats;
+};
+
+//Image whose pixels will be decoded straight into a region of the staging ring
+struct VulkanStagedImage {
+	const ImageBatchParameters* batch;
+	uint32_t image_idx;				//Into batch
+	VkImage image;
+	ImageEncoding encoding;
+	uint32_t mip_count;
+	uint32_t width;
+	uint32_t height;
+	VkDeviceSize ring_offset;
+};
+
 struct SemaphoreWait {
 	uint64_t wait_value;
 	Key<VkSemaphore> wait_semaphore;
@@ -162,7 +234,8 @@ struct VulkanGraphicsDevice {
 	VkCommandPool transfer_command_pool;
 	Key<VkSemaphore> image_upload_semaphore;			//Timeline semaphore whose value increments by one for each image upload batch
 	
-	slotmap<VulkanBindlessImage> bindless_images;
+	//A bindless image's slot index is also its index into the sampled image descriptor array
+	soa_slotmap<Key<VulkanBindlessImage>, uint64_t, uint32_t, VulkanImage> bindless_images;
 
 	VmaAllocator allocator;		//Thank you, AMD
 	const VmaDeviceMemoryCallbacks* vma_alloc_callbacks;
@@ -178,6 +251,13 @@ struct VulkanGraphicsDevice {
 	);
 	VulkanGraphicsPipeline* get_graphics_pipeline(Key<VulkanGraphicsPipeline> key);
 
+	//One pipeline per compute shader in spv_paths
+	void create_compute_pipelines(
+		const std::vector<const char*>& spv_paths,
+		Key<VulkanComputePipeline>* out_pipeline_handles
+	);
+	VulkanComputePipeline* get_compute_pipeline(Key<VulkanComputePipeline> key);
+
 	Key<VulkanBuffer> create_buffer(VkDeviceSize size, VkBufferUsageFlags usage_flags, VmaAllocationCreateInfo& allocation_info);
 	VulkanBuffer* get_buffer(Key<VulkanBuffer> key);
 	VkDeviceAddress buffer_device_address(Key<VulkanBuffer> key);
@@ -206,6 +286,23 @@ struct VulkanGraphicsDevice {
 		const std::vector<VkFormat> image_formats
 	);
 	void tick_image_uploads(VkCommandBuffer render_cb);
+
+	//Read by the image upload thread when it records a batch, so set it before queueing the images it should apply to
+	TextureCompression texture_compression = TEXTURE_COMPRESSION_QUALITY;
+
+	//Build the mips of uncompressed RGBA8 images on the decode workers instead of blitting them on the graphics queue
+	//Formats the device can't blit always get CPU mips. Read at the same time as texture_compression
+	bool cpu_mip_generation = false;
+
+	//Time spent generating mips so far and the level 0 texels it was spent on, so the two sides compare as rates
+	//CPU time is summed over the decode workers. GPU time comes from timestamps around the blits ::tick_image_uploads() records,
+	//and trails by the frames in flight. Blits recorded while their frame's timestamps were still unread aren't in either GPU total
+	double cpu_mip_generation_ms();
+	double gpu_mip_generation_ms();
+	uint64_t cpu_mip_generation_texels();
+	uint64_t gpu_mip_generation_texels();
+	uint32_t gpu_mip_untimed_images();
+
 	uint64_t completed_image_batches();
 	void destroy_image(Key<VulkanBindlessImage> key);
 	VkPipelineLayout get_pipeline_layout();
@@ -231,16 +328,60 @@ struct VulkanGraphicsDevice {
 	VkDescriptorSet _image_descriptor_set;
 private:
 	void load_images_impl();
-	void submit_image_upload_batch(uint64_t id, const std::vector<RawImage>& raw_images, const std::vector<VkFormat>& image_formats);
-
-	slotmap<VulkanBuffer> _buffers;
+	void notify_image_upload_thread();
+	void submit_image_upload_batch(const ImageBatchParameters& batch);
+	void record_staged_images();
+	void begin_image_upload(VkCommandBuffer cb, VkImage image, uint32_t mip_count);
+	void copy_staged_rows(VkCommandBuffer cb, VkImage image, VkDeviceSize ring_offset, uint32_t mip_level, uint32_t width, uint32_t first_row, uint32_t row_count);
+	void end_image_upload(VkCommandBuffer cb, VkImage image, uint32_t mip_count, bool generate_mips);
+	void upload_container_levels(VkImage image, const uint8_t* bytes, const TextureContainer& container, uint32_t mip_count, bool generate_mips);
+	bool format_supports_mip_blits(VkFormat format);
+
+	//Staging ring used by the image upload thread
+	//Uploads are decoded or copied into a persistent host-visible buffer, and space is handed back
+	//as image_upload_semaphore passes the value of the submission that used it
+	//Images are only decoded once they have space in the ring, so it also bounds how much decoded data is resident
+	VkDeviceSize reserve_staging_space(VkDeviceSize min_size, VkDeviceSize max_size, VkDeviceSize granularity, VkDeviceSize* out_size);
+	void reclaim_staging_space(bool wait_for_oldest);
+	VkCommandBuffer open_transfer_submission();
+	void flush_transfer_submission();
+
+	paged_slotmap<VulkanBuffer> _buffers;
 	std::deque<BufferDeletion> _buffer_deletion_queue;
 
 	//State related to image uploading system
-	bool _image_upload_running = true;
 	std::thread _image_upload_thread;
-	uint64_t _image_batches_requested = 0;		//Incremented when any of the ::load_* methods are called
+	//The upload thread sleeps on _image_work_available until a ::load_* method queues a batch or the device shuts down
+	std::mutex _image_work_mutex;
+	std::condition_variable _image_work_available;
+	bool _image_work_queued = false;		//Guarded by _image_work_mutex
+	bool _image_upload_running = true;		//Guarded by _image_work_mutex
+	ThreadPool _image_decode_pool;		//The image upload thread decodes compressed and file images on this, one image per index
+	std::atomic<uint64_t> _image_batches_requested = 0;		//Incremented when any of the ::load_* methods are called
 	uint64_t _image_batches_completed = 0;		//Incremented every iteration of the outer loop in ::tick_image_uploads()
+	uint64_t _image_upload_value_seen = 0;		//Latest image_upload_semaphore value ::tick_image_uploads() has seen
+
+	//Mip generation timing
+	std::atomic<uint64_t> _cpu_mip_generation_ns = 0;		//Added to by the decode workers
+	std::atomic<uint64_t> _cpu_mip_generation_texels = 0;
+	VkQueryPool _mip_timestamp_pool = VK_NULL_HANDLE;		//A begin and end timestamp per frame in flight. Null if the graphics queue can't write timestamps
+	bool _mip_timestamps_written[FRAMES_IN_FLIGHT] = {};		//Stays set until the results have been read back
+	uint64_t _mip_timestamp_texels[FRAMES_IN_FLIGHT] = {};		//Level 0 texels of the images blitted between each pair
+	uint64_t _mip_timestamp_frame = 0;		//Calls to ::tick_image_uploads() so far
+	uint64_t _gpu_mip_generation_ns = 0;
+	uint64_t _gpu_mip_generation_texels = 0;
+	uint32_t _gpu_mip_untimed_images = 0;
+
+	Key<VulkanBuffer> _staging_ring;
+	VkBuffer _staging_ring_buffer;
+	uint8_t* _staging_ring_mapped;
+	uint64_t _staging_ring_head = 0;		//Bytes ever reserved, including space skipped when wrapping around
+	uint64_t _staging_ring_tail = 0;		//Everything before this is free again
+	VkCommandBuffer _open_transfer_cb = VK_NULL_HANDLE;		//Being recorded, not submitted yet
+	std::deque<VulkanStagingSubmission> _staging_submissions;		//Submitted and not yet seen complete, oldest first
+	bool _block_compression_supported = false;
+	std::vector<VulkanStagedImage> _staged_images;		//Have ring space reserved but haven't been decoded or recorded yet
+	uint64_t _image_upload_timeline = 0;		//Last value submitted for image_upload_semaphore
 
 	std::queue<RawImageBatchParameters, std::deque<RawImageBatchParameters>> _raw_image_batch_queue;
 	std::mutex _raw_image_mutex;
@@ -252,11 +393,9 @@ private:
 	std::mutex _file_batch_mutex;
 
 
-	slotmap<VulkanPendingImage> _pending_images;
-	std::mutex _pending_image_mutex;
-
-	slotmap<VulkanImageUploadBatch> _image_upload_batches;
-	std::mutex _image_upload_mutex;
+	//Written by the image upload thread and consumed by the render thread
+	concurrent_slotmap<VulkanPendingImage> _pending_images;
+	concurrent_slotmap<VulkanImageUploadBatch> _image_upload_batches;
 
 	std::deque<ImageDeletion> _image_deletion_queue;
 
@@ -269,7 +408,9 @@ private:
 	slotmap<VkRenderPass> _render_passes;
 	slotmap<VkSemaphore> _semaphores;
 	slotmap<VulkanGraphicsPipeline> _graphics_pipelines;
+	slotmap<VulkanComputePipeline> _compute_pipelines;
 	std::stack<VkCommandBuffer, std::vector<VkCommandBuffer>> _graphics_command_buffers;
 	std::deque<CommandBufferReturn> _command_buffer_returns;
 	std::stack<VkCommandBuffer, std::vector<VkCommandBuffer>> _transfer_command_buffers;
+	std::mutex _transfer_command_buffer_mutex;
 };
@@ -5,6 +5,10 @@ struct VulkanGraphicsPipeline {
 	VkPipeline pipeline;
 };
 
+struct VulkanComputePipeline {
+	VkPipeline pipeline;
+};
+
 //Might not even be necessary?
 //Shouldn't need this bc we are opinionated about vertex pulling
 struct VulkanVertexInputState {
@@ -1,11 +1,22 @@
 #include "VulkanRenderer.h"
 #include "imgui.h"
 #include "utils.h"
+#include <algorithm>
 #include <limits>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+static constexpr float CAMERA_FOVY = (float)(M_PI / 2.0);
+
+//Storage buffer descriptor the meshlet cull pass appends its draws through
+static constexpr uint32_t MESHLET_DRAWS_STORAGE_BUFFER_IDX = 0;
+
+//Each frame's region of the meshlet draw buffer: one draw count per index width padded to 16 bytes,
+//then MAX_MESHLET_DRAWS commands for each of the two index widths
+static constexpr VkDeviceSize MESHLET_DRAW_COUNTS_SIZE = 16;
+static constexpr VkDeviceSize MESHLET_DRAW_REGION_SIZE = MESHLET_DRAW_COUNTS_SIZE + 2 * MAX_MESHLET_DRAWS * sizeof(VkDrawIndexedIndirectCommand);
+
 hlslpp::float4x4 Camera::make_view_matrix() {
     using namespace hlslpp;
 
@@ -55,6 +66,7 @@ VulkanRenderer::VulkanRenderer(VulkanGraphicsDevice* vgd, Key<VkRenderPass> wind
     _color_buffers.alloc(MAX_VERTEX_ATTRIBS);
     _uv_buffers.alloc(MAX_VERTEX_ATTRIBS);
     _index16_buffers.alloc(MAX_VERTEX_ATTRIBS);
+    _index32_buffers.alloc(MAX_VERTEX_ATTRIBS);
     _materials.alloc(MAX_MATERIALS);
     _gpu_materials.alloc(MAX_MATERIALS);
     _gpu_meshes.alloc(MAX_MESHES);
@@ -79,6 +91,7 @@ VulkanRenderer::VulkanRenderer(VulkanGraphicsDevice* vgd, Key<VkRenderPass> wind
         frame_uniforms.uvs_addr = vgd->buffer_device_address(vertex_uv_buffer);
         
         index_buffer = vgd->create_buffer(buffer_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, alloc_info);
+        index32_buffer = vgd->create_buffer(buffer_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, alloc_info);
 
         //Create buffer for per-frame uniform data
         frame_uniforms_buffer = vgd->create_buffer(FRAMES_IN_FLIGHT * sizeof(FrameUniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, alloc_info);
@@ -102,6 +115,30 @@ VulkanRenderer::VulkanRenderer(VulkanGraphicsDevice* vgd, Key<VkRenderPass> wind
         //Create mesh data buffer
         _mesh_buffer = vgd->create_buffer(MAX_MESHES * sizeof(GPUMesh), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, alloc_info);
         frame_uniforms.meshes_addr = vgd->buffer_device_address(_mesh_buffer);
+
+        //Create meshlet culling buffers
+        _meshlet_buffer = vgd->create_buffer(MAX_MESHLETS * sizeof(MeshMeshlet), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, alloc_info);
+        _meshlet_job_buffer = vgd->create_buffer(FRAMES_IN_FLIGHT * MAX_MESHLET_CULL_JOBS * sizeof(GPUMeshletCullJob), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, alloc_info);
+        _meshlet_draw_buffer = vgd->create_buffer(FRAMES_IN_FLIGHT * MESHLET_DRAW_REGION_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, alloc_info);
+    }
+
+    //Point the cull pass's storage buffer descriptor at the meshlet draw buffer
+    {
+        VkDescriptorBufferInfo buffer_info = {
+            .buffer = vgd->get_buffer(_meshlet_draw_buffer)->buffer,
+            .offset = 0,
+            .range = VK_WHOLE_SIZE
+        };
+        VkWriteDescriptorSet write = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = vgd->_image_descriptor_set,
+            .dstBinding = DescriptorBindings::STORAGE_BUFFERS,
+            .dstArrayElement = MESHLET_DRAWS_STORAGE_BUFFER_IDX,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &buffer_info
+        };
+        vkUpdateDescriptorSets(vgd->device, 1, &write, 0, nullptr);
     }
 
     //Create rendertarget buffers (color, depth)
@@ -180,13 +217,13 @@ VulkanRenderer::VulkanRenderer(VulkanGraphicsDevice* vgd, Key<VkRenderPass> wind
 
         for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
             VkDescriptorImageInfo info = {
-                .imageView = vgd->bindless_images.get(color_buffers[0])->vk_image.image_view,
+                .imageView = vgd->bindless_images.get<BINDLESS_VK_IMAGE>(color_buffers[0])->image_view,
                 .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
             };
             desc_infos.push_back(info);
         }
         VkDescriptorImageInfo info = {
-            .imageView = vgd->bindless_images.get(depth_buffer)->vk_image.image_view,
+            .imageView = vgd->bindless_images.get<BINDLESS_VK_IMAGE>(depth_buffer)->image_view,
             .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
         };
         desc_infos.push_back(info);
@@ -291,8 +328,8 @@ VulkanRenderer::VulkanRenderer(VulkanGraphicsDevice* vgd, Key<VkRenderPass> wind
     {
         for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
             VkImageView views[] = {
-                vgd->bindless_images.get(color_buffers[i])->vk_image.image_view,
-                vgd->bindless_images.get(depth_buffer)->vk_image.image_view
+                vgd->bindless_images.get<BINDLESS_VK_IMAGE>(color_buffers[i])->image_view,
+                vgd->bindless_images.get<BINDLESS_VK_IMAGE>(depth_buffer)->image_view
             };  
 
             VkFramebufferCreateInfo info = {};
@@ -348,6 +385,12 @@ VulkanRenderer::VulkanRenderer(VulkanGraphicsDevice* vgd, Key<VkRenderPass> wind
         postfx_pipeline = pipelines[1];
 	}
 
+    //Create compute pipelines
+    {
+        std::vector<const char*> spv_paths = { "shaders/meshlet_cull.comp.spv" };
+        vgd->create_compute_pipelines(spv_paths, &meshlet_cull_pipeline);
+    }
+
 	//Create graphics pipeline timeline semaphore
 	frames_completed_semaphore = vgd->create_timeline_semaphore(0);
 
@@ -355,19 +398,26 @@ VulkanRenderer::VulkanRenderer(VulkanGraphicsDevice* vgd, Key<VkRenderPass> wind
     this->vgd = vgd;
 }
 
-Key<BufferView> VulkanRenderer::push_vertex_positions(std::span<float> data) {
-    VulkanBuffer* buffer = vgd->get_buffer(vertex_position_buffer);
-    float* ptr = (float*)buffer->alloc_info.pMappedData;
-    ptr += vertex_position_offset;
-    memcpy(ptr, data.data(), data.size_bytes());
+//Copies a stream into a mapped vertex buffer at the next 16 byte boundary after offset
+//Offsets and the returned view are in 32-bit words
+static BufferView write_vertex_stream(VulkanBuffer* buffer, uint32_t& offset, const void* data, size_t size_bytes) {
+    offset = (offset + 3) & ~3u;
+    uint32_t* ptr = (uint32_t*)buffer->alloc_info.pMappedData;
+    ptr += offset;
+    memcpy(ptr, data, size_bytes);
 
     BufferView b = {
-        .start = vertex_position_offset,
-        .length = (uint32_t)data.size()
+        .start = offset,
+        .length = (uint32_t)((size_bytes + sizeof(uint32_t) - 1) / sizeof(uint32_t))
     };
 
-    vertex_position_offset += (uint32_t)data.size();
-    
+    offset += b.length;
+    return b;
+}
+
+Key<BufferView> VulkanRenderer::push_vertex_positions(std::span<const float> data) {
+    VulkanBuffer* buffer = vgd->get_buffer(vertex_position_buffer);
+    BufferView b = write_vertex_stream(buffer, vertex_position_offset, data.data(), data.size_bytes());
     return _position_buffers.insert(b);
 }
 
@@ -375,24 +425,13 @@ BufferView* VulkanRenderer::get_vertex_positions(Key<BufferView> key) {
     return _position_buffers.get(key);
 }
 
-Key<MeshAttribute> VulkanRenderer::push_vertex_colors(Key<BufferView> position_key, std::span<float> data) {
+Key<MeshAttribute> VulkanRenderer::push_vertex_colors(Key<BufferView> position_key, std::span<const float> data) {
     PRORENDER_ASSERT(_position_buffers.get(position_key) != nullptr, true);
     
     VulkanBuffer* buffer = vgd->get_buffer(vertex_color_buffer);
-    float* ptr = (float*)buffer->alloc_info.pMappedData;
-    ptr += vertex_color_offset;
-    memcpy(ptr, data.data(), data.size_bytes());
-
-    BufferView b = {
-        .start = vertex_color_offset,
-        .length = (uint32_t)data.size()
-    };
-
-    vertex_color_offset += (uint32_t)data.size();
-
     MeshAttribute a = {
         .position_key = position_key,
-        .view = b
+        .view = write_vertex_stream(buffer, vertex_color_offset, data.data(), data.size_bytes())
     };
     return _color_buffers.insert(a);
 }
@@ -410,25 +449,54 @@ BufferView* VulkanRenderer::get_vertex_colors(Key<BufferView> key) {
     return result;
 }
 
-Key<MeshAttribute> VulkanRenderer::push_vertex_uvs(Key<BufferView> position_key, std::span<float> data) {
+Key<MeshAttribute> VulkanRenderer::push_vertex_uvs(Key<BufferView> position_key, std::span<const float> data) {
     PRORENDER_ASSERT(_position_buffers.get(position_key) != nullptr, true);
     
     VulkanBuffer* buffer = vgd->get_buffer(vertex_uv_buffer);
-    float* ptr = (float*)buffer->alloc_info.pMappedData;
-    ptr += vertex_uv_offset;
-    memcpy(ptr, data.data(), data.size_bytes());
+    MeshAttribute a = {
+        .position_key = position_key,
+        .view = write_vertex_stream(buffer, vertex_uv_offset, data.data(), data.size_bytes())
+    };
+    return _uv_buffers.insert(a);
+}
 
-    BufferView b = {
-        .start = vertex_uv_offset,
-        .length = (uint32_t)data.size()
+Key<BufferView> VulkanRenderer::push_quantized_vertex_positions(std::span<const uint16_t> data, const VertexQuantization& quantization) {
+    VulkanBuffer* buffer = vgd->get_buffer(vertex_position_buffer);
+    BufferView b = write_vertex_stream(buffer, vertex_position_offset, data.data(), data.size_bytes());
+    Key<BufferView> position_key = _position_buffers.insert(b);
+
+    MeshQuantization& q = _mesh_quantizations[position_key.value()];
+    memcpy(q.params.position_scale, quantization.position_scale, sizeof(q.params.position_scale));
+    memcpy(q.params.position_offset, quantization.position_offset, sizeof(q.params.position_offset));
+    q.flags |= MESH_QUANTIZED_POSITIONS;
+    return position_key;
+}
+
+Key<MeshAttribute> VulkanRenderer::push_quantized_vertex_colors(Key<BufferView> position_key, std::span<const uint32_t> data) {
+    PRORENDER_ASSERT(_position_buffers.get(position_key) != nullptr, true);
+
+    VulkanBuffer* buffer = vgd->get_buffer(vertex_color_buffer);
+    MeshAttribute a = {
+        .position_key = position_key,
+        .view = write_vertex_stream(buffer, vertex_color_offset, data.data(), data.size_bytes())
     };
+    _mesh_quantizations[position_key.value()].flags |= MESH_QUANTIZED_COLORS;
+    return _color_buffers.insert(a);
+}
 
-    vertex_uv_offset += (uint32_t)data.size();
+Key<MeshAttribute> VulkanRenderer::push_quantized_vertex_uvs(Key<BufferView> position_key, std::span<const uint16_t> data, const VertexQuantization& quantization) {
+    PRORENDER_ASSERT(_position_buffers.get(position_key) != nullptr, true);
 
+    VulkanBuffer* buffer = vgd->get_buffer(vertex_uv_buffer);
     MeshAttribute a = {
         .position_key = position_key,
-        .view = b
+        .view = write_vertex_stream(buffer, vertex_uv_offset, data.data(), data.size_bytes())
     };
+
+    MeshQuantization& q = _mesh_quantizations[position_key.value()];
+    memcpy(q.params.uv_scale, quantization.uv_scale, sizeof(q.params.uv_scale));
+    memcpy(q.params.uv_offset, quantization.uv_offset, sizeof(q.params.uv_offset));
+    q.flags |= MESH_QUANTIZED_UVS;
     return _uv_buffers.insert(a);
 }
 
@@ -447,7 +515,7 @@ BufferView* VulkanRenderer::get_vertex_uvs(Key<BufferView> position_key) {
     return result;
 }
 
-Key<MeshAttribute> VulkanRenderer::push_indices16(Key<BufferView> position_key, std::span<uint16_t> data) {
+Key<MeshAttribute> VulkanRenderer::push_indices16(Key<BufferView> position_key, std::span<const uint16_t> data) {
     PRORENDER_ASSERT(_position_buffers.get(position_key) != nullptr, true);
 
     VulkanBuffer* buffer = vgd->get_buffer(index_buffer);
@@ -483,6 +551,98 @@ BufferView* VulkanRenderer::get_indices16(Key<BufferView> position_key) {
 
 }
 
+Key<MeshAttribute> VulkanRenderer::push_indices32(Key<BufferView> position_key, std::span<const uint32_t> data) {
+    PRORENDER_ASSERT(_position_buffers.get(position_key) != nullptr, true);
+
+    VulkanBuffer* buffer = vgd->get_buffer(index32_buffer);
+    uint32_t* ptr = (uint32_t*)buffer->alloc_info.pMappedData;
+    ptr += index32_buffer_offset;
+    memcpy(ptr, data.data(), data.size_bytes());
+
+    BufferView b = {
+        .start = index32_buffer_offset,
+        .length = (uint32_t) data.size()
+    };
+
+    index32_buffer_offset += (uint32_t)data.size();
+
+    MeshAttribute a = {
+        .position_key = position_key,
+        .view = b
+    };
+    return _index32_buffers.insert(a);
+}
+
+BufferView* VulkanRenderer::get_indices32(Key<BufferView> position_key) {
+
+    BufferView* result = nullptr;
+    for (MeshAttribute& att : _index32_buffers) {
+        if (att.position_key.value() == position_key.value()) {
+            result = &att.view;
+            break;
+        }
+    }
+
+    return result;
+
+}
+
+void VulkanRenderer::push_mesh_lods(Key<BufferView> position_key, std::span<const MeshLod> lods) {
+    PRORENDER_ASSERT(_position_buffers.get(position_key) != nullptr, true);
+    _mesh_lods[position_key.value()].assign(lods.begin(), lods.end());
+}
+
+void VulkanRenderer::push_mesh_meshlets(Key<BufferView> position_key, std::span<const MeshMeshlet> meshlets) {
+    PRORENDER_ASSERT(_position_buffers.get(position_key) != nullptr, true);
+    if (_meshlet_offset + meshlets.size() > MAX_MESHLETS) {
+        printf("Meshlet buffer is full, drawing mesh without meshlet culling\n");
+        return;
+    }
+
+    VulkanBuffer* buffer = vgd->get_buffer(_meshlet_buffer);
+    MeshMeshlet* ptr = static_cast<MeshMeshlet*>(buffer->alloc_info.pMappedData);
+    memcpy(ptr + _meshlet_offset, meshlets.data(), meshlets.size_bytes());
+
+    _mesh_meshlets[position_key.value()] = {
+        .start = _meshlet_offset,
+        .length = (uint32_t)meshlets.size()
+    };
+    _meshlet_offset += (uint32_t)meshlets.size();
+}
+
+//Queues a cull job for each of the instance_count instances after the ones recorded so far
+//Returns false without queueing anything when this frame's jobs are full, or when every meshlet
+//surviving culling could overflow the index width's MAX_MESHLET_DRAWS, since the cull shader drops draws past that
+bool VulkanRenderer::push_meshlet_cull_jobs(const BufferView& meshlets, uint32_t first_index, IndexWidth index_width, uint32_t instance_count) {
+    if (_meshlet_cull_jobs.size() + instance_count > MAX_MESHLET_CULL_JOBS) return false;
+    uint64_t draws = (uint64_t)meshlets.length * instance_count;
+    if (_meshlet_draws_queued[index_width] + draws > MAX_MESHLET_DRAWS) return false;
+    _meshlet_draws_queued[index_width] += draws;
+
+    uint32_t first_instance = _instances_so_far + MAX_INSTANCES * (uint32_t)(_current_frame % FRAMES_IN_FLIGHT);
+    for (uint32_t i = 0; i < instance_count; i++) {
+        GPUMeshletCullJob job = {
+            .instance_idx = first_instance + i,
+            .meshlet_start = meshlets.start,
+            .meshlet_count = meshlets.length,
+            .first_index = first_index,
+            .index_width = index_width
+        };
+        _meshlet_cull_jobs.push_back(job);
+    }
+    return true;
+}
+
+//Coarsest level whose error projects to at most max_pixels
+static uint32_t select_lod(std::span<const MeshLod> lods, float pixels_per_unit, float max_pixels) {
+    uint32_t level = 0;
+    for (uint32_t i = 1; i < lods.size(); i++) {
+        if (lods[i].error * pixels_per_unit > max_pixels) break;
+        level = i;
+    }
+    return level;
+}
+
 Key<Material> VulkanRenderer::push_material(uint32_t sampler_idx, const hlslpp::float4& base_color) {
     return this->push_material(0, sampler_idx, base_color);
 }
@@ -496,6 +656,10 @@ Key<Material> VulkanRenderer::push_material(uint64_t batch_id, uint32_t sampler_
     return _materials.insert(mat);
 }
 
+std::span<Key<Material>> VulkanRenderer::push_materials(std::span<const Material> materials, Key<Material>* out_keys) {
+    return _materials.insert_range(materials, out_keys);
+}
+
 uint64_t VulkanRenderer::get_current_frame() {
     return _current_frame;
 }
@@ -529,16 +693,7 @@ void VulkanRenderer::ps1_draw(Key<BufferView> mesh_key, Key<Material> material_k
         mat.base_color = material->base_color;
 
         if (material->batch_id > 0) {
-            for (auto it = vgd->bindless_images.begin(); it != vgd->bindless_images.end(); ++it) {
-                VulkanBindlessImage& image = *it;
-                //printf("Image batch id: %d\nMaterial batch id:%d\n", (int)image.batch_id, (int)material->batch_id);
-                if (image.batch_id == material->batch_id) {
-                    mat.texture_indices[0] = it.slot_index();
-                    //printf("Match!\n");
-                    break;
-                }
-                //printf("\n");
-            }
+            mat.texture_indices[0] = vgd->bindless_images.find<BINDLESS_BATCH_ID>(material->batch_id);
             assert(mat.texture_indices[0] != std::numeric_limits<uint32_t>::max());
         } else {
             //Material doesn't have textures, so use defaults
@@ -550,7 +705,12 @@ void VulkanRenderer::ps1_draw(Key<BufferView> mesh_key, Key<Material> material_k
     }
 
     //Get geometry data
+    IndexWidth index_width = INDEX_WIDTH_16;
     BufferView* index_data = get_indices16(mesh_key);
+    if (index_data == nullptr) {
+        index_width = INDEX_WIDTH_32;
+        index_data = get_indices32(mesh_key);
+    }
     Key<GPUMesh> gpu_mesh_key;
     if (_mesh_map.contains(mesh_key.value())) {
         gpu_mesh_key = _mesh_map[mesh_key.value()];
@@ -571,34 +731,134 @@ void VulkanRenderer::ps1_draw(Key<BufferView> mesh_key, Key<Material> material_k
         GPUMesh g_mesh = {
             .position_start = position_data->start,
             .uv_start = uv_start,
-            .color_start = color_start
+            .color_start = color_start,
+            .flags = 0,
+            .position_scale = hlslpp::float4(1.0f, 1.0f, 1.0f, 0.0f),
+            .position_offset = hlslpp::float4(0.0f, 0.0f, 0.0f, 0.0f),
+            .uv_scale_offset = hlslpp::float4(1.0f, 1.0f, 0.0f, 0.0f)
         };
+        auto quantization = _mesh_quantizations.find(mesh_key.value());
+        if (quantization != _mesh_quantizations.end()) {
+            VertexQuantization& q = quantization->second.params;
+            g_mesh.flags = quantization->second.flags;
+            g_mesh.position_scale = hlslpp::float4(q.position_scale[0], q.position_scale[1], q.position_scale[2], 0.0f);
+            g_mesh.position_offset = hlslpp::float4(q.position_offset[0], q.position_offset[1], q.position_offset[2], 0.0f);
+            g_mesh.uv_scale_offset = hlslpp::float4(q.uv_scale[0], q.uv_scale[1], q.uv_offset[0], q.uv_offset[1]);
+        }
         gpu_mesh_key = _gpu_meshes.insert(g_mesh);
         _mesh_map.insert(std::pair(mesh_key.value(), gpu_mesh_key.value()));
     }
 
-    //Record GPUInstanceData structure(s)
-    uint32_t instance_count = (uint32_t)instance_datas.size();
-    for (InstanceData& in_data : instance_datas) {
-        GPUInstanceData g_data = {
-            .world_matrix = in_data.world_from_model,
-            .mesh_idx = EXTRACT_IDX(gpu_mesh_key.value()),
-            .material_idx = EXTRACT_IDX(gpu_mat_key.value()),
+    //Meshlets only cover the full detail level
+    BufferView* meshlets = nullptr;
+    auto meshlets_it = _mesh_meshlets.find(mesh_key.value());
+    if (meshlet_culling && meshlets_it != _mesh_meshlets.end() && cameras.count() > 0) meshlets = &meshlets_it->second;
+
+    //Meshes without levels of detail get one draw over their whole index range
+    uint32_t in_flight_frame_slot = _current_frame % FRAMES_IN_FLIGHT;
+    auto lods_it = _mesh_lods.find(mesh_key.value());
+    if (lods_it == _mesh_lods.end() || lods_it->second.size() <= 1 || cameras.count() == 0) {
+        //Record GPUInstanceData structure(s)
+        uint32_t instance_count = (uint32_t)instance_datas.size();
+        for (InstanceData& in_data : instance_datas) {
+            GPUInstanceData g_data = {
+                .world_matrix = in_data.world_from_model,
+                .mesh_idx = EXTRACT_IDX(gpu_mesh_key.value()),
+                .material_idx = EXTRACT_IDX(gpu_mat_key.value()),
+            };
+            _gpu_instance_datas.push_back(g_data);
+        }
+
+        if (meshlets != nullptr && push_meshlet_cull_jobs(*meshlets, index_data->start, index_width, instance_count)) {
+            _instances_so_far += instance_count;
+            return;
+        }
+
+        //Finally, record the actual indirect draw command
+        VkDrawIndexedIndirectCommand command = {
+            .indexCount = index_data->length,
+            .instanceCount = instance_count,
+            .firstIndex = index_data->start,
+            .vertexOffset = 0,
+            .firstInstance = _instances_so_far + MAX_INSTANCES * in_flight_frame_slot
         };
-        _gpu_instance_datas.push_back(g_data);
+        _instances_so_far += instance_count;
+        _draw_calls[index_width].push_back(command);
+        return;
     }
 
-    //Finally, record the actual indirect draw command
-    uint32_t in_flight_frame_slot = _current_frame % FRAMES_IN_FLIGHT;
-    VkDrawIndexedIndirectCommand command = {
-        .indexCount = index_data->length,
-        .instanceCount = instance_count,
-        .firstIndex = index_data->start,
-        .vertexOffset = 0,
-        .firstInstance = _instances_so_far + MAX_INSTANCES * in_flight_frame_slot
-    };
-    _instances_so_far += instance_count;
-    _draw_calls.push_back(command);
+    //Pick a level per instance from how many pixels its error covers, as seen from the main camera
+    //Hysteresis: the level only moves when the previous one falls outside the range the widened thresholds allow
+    //Several calls can draw the same mesh and material in a frame, so each keeps its own levels by call order
+    std::vector<MeshLod>& lods = lods_it->second;
+    LodDrawKey draw_key = { mesh_key.value(), material_key.value(), 0 };
+    draw_key.call_idx = _lod_draw_calls[draw_key]++;
+    LodDrawState& lod_state = _draw_lods[draw_key];
+    lod_state.last_frame = _current_frame;
+    std::vector<uint8_t>& levels = lod_state.levels;
+    levels.resize(instance_datas.size(), 0);
+    {
+        using namespace hlslpp;
+
+        Camera& camera = *cameras.begin();
+        float pixels_per_radian = (float)main_framebuffers[0].height / (2.0f * tanf(CAMERA_FOVY / 2.0f));
+        float fine_threshold = lod_pixel_error * (1.0f - lod_hysteresis);
+        float coarse_threshold = lod_pixel_error * (1.0f + lod_hysteresis);
+        for (size_t i = 0; i < instance_datas.size(); i++) {
+            float4x4& world = instance_datas[i].world_from_model;
+            float4 origin = mul(world, float4(0.0f, 0.0f, 0.0f, 1.0f));
+            float4 axes[3] = {
+                mul(world, float4(1.0f, 0.0f, 0.0f, 0.0f)),
+                mul(world, float4(0.0f, 1.0f, 0.0f, 0.0f)),
+                mul(world, float4(0.0f, 0.0f, 1.0f, 0.0f))
+            };
+            float max_scale = 0.0f;
+            for (float4& axis : axes) {
+                float a0 = axis[0], a1 = axis[1], a2 = axis[2];
+                max_scale = std::max(max_scale, sqrtf(a0 * a0 + a1 * a1 + a2 * a2));
+            }
+            float dx = (float)origin[0] - (float)camera.position[0];
+            float dy = (float)origin[1] - (float)camera.position[1];
+            float dz = (float)origin[2] - (float)camera.position[2];
+            float distance = std::max(sqrtf(dx * dx + dy * dy + dz * dz), 0.1f);
+
+            float pixels_per_unit = max_scale * pixels_per_radian / distance;
+            uint32_t finest = select_lod(lods, pixels_per_unit, fine_threshold);
+            uint32_t coarsest = select_lod(lods, pixels_per_unit, coarse_threshold);
+            levels[i] = (uint8_t)std::clamp((uint32_t)levels[i], finest, coarsest);
+        }
+    }
+
+    //Instances are grouped by level so each level is one draw
+    for (uint32_t level = 0; level < lods.size(); level++) {
+        uint32_t instance_count = 0;
+        for (size_t i = 0; i < instance_datas.size(); i++) {
+            if (levels[i] != level) continue;
+            GPUInstanceData g_data = {
+                .world_matrix = instance_datas[i].world_from_model,
+                .mesh_idx = EXTRACT_IDX(gpu_mesh_key.value()),
+                .material_idx = EXTRACT_IDX(gpu_mat_key.value()),
+            };
+            _gpu_instance_datas.push_back(g_data);
+            instance_count++;
+        }
+        if (instance_count == 0) continue;
+
+        if (level == 0 && meshlets != nullptr && push_meshlet_cull_jobs(*meshlets, index_data->start, index_width, instance_count)) {
+            _instances_so_far += instance_count;
+            continue;
+        }
+
+        VkDrawIndexedIndirectCommand command = {
+            .indexCount = lods[level].index_count,
+            .instanceCount = instance_count,
+            .firstIndex = index_data->start + lods[level].index_offset,
+            .vertexOffset = 0,
+            .firstInstance = _instances_so_far + MAX_INSTANCES * in_flight_frame_slot
+        };
+        _instances_so_far += instance_count;
+        _draw_calls[index_width].push_back(command);
+    }
 }
 
 //Synchronizes CPU and GPU buffers, then
@@ -642,7 +902,22 @@ void VulkanRenderer::render(VkCommandBuffer frame_cb, SyncData& sync_data) {
         VulkanBuffer* indirect_draw_buffer = vgd->get_buffer(_indirect_draw_buffer);
         VkDrawIndexedIndirectCommand* ptr = static_cast<VkDrawIndexedIndirectCommand*>(indirect_draw_buffer->alloc_info.pMappedData);
         ptr += (_current_frame % FRAMES_IN_FLIGHT) * MAX_INDIRECT_DRAWS;
-        memcpy(ptr, _draw_calls.data(), _draw_calls.size() * sizeof(VkDrawIndexedIndirectCommand));
+        for (uint32_t i = 0; i < INDEX_WIDTH_COUNT; i++) {
+            memcpy(ptr, _draw_calls[i].data(), _draw_calls[i].size() * sizeof(VkDrawIndexedIndirectCommand));
+            ptr += _draw_calls[i].size();
+        }
+    }
+
+    //Upload meshlet cull jobs and reset the counts the cull pass appends to
+    VkDeviceSize meshlet_draws_offset = (_current_frame % FRAMES_IN_FLIGHT) * MESHLET_DRAW_REGION_SIZE;
+    if (!_meshlet_cull_jobs.empty()) {
+        VulkanBuffer* job_buffer = vgd->get_buffer(_meshlet_job_buffer);
+        GPUMeshletCullJob* ptr = static_cast<GPUMeshletCullJob*>(job_buffer->alloc_info.pMappedData);
+        ptr += (_current_frame % FRAMES_IN_FLIGHT) * MAX_MESHLET_CULL_JOBS;
+        memcpy(ptr, _meshlet_cull_jobs.data(), _meshlet_cull_jobs.size() * sizeof(GPUMeshletCullJob));
+
+        VulkanBuffer* draw_buffer = vgd->get_buffer(_meshlet_draw_buffer);
+        memset((uint8_t*)draw_buffer->alloc_info.pMappedData + meshlet_draws_offset, 0, MESHLET_DRAW_COUNTS_SIZE);
     }
 
     VulkanFrameBuffer& main_framebuffer = main_framebuffers[_current_frame % FRAMES_IN_FLIGHT];
@@ -672,7 +947,7 @@ void VulkanRenderer::render(VkCommandBuffer frame_cb, SyncData& sync_data) {
             );
 
             float aspect = (float)main_framebuffer.width / (float)main_framebuffer.height;
-            float desired_fov = (float)(M_PI / 2.0);
+            float desired_fov = CAMERA_FOVY;
             float nearplane = 0.1f;
             float farplane = 1000000.0f;
             float tan_fovy = tanf(desired_fov / 2.0f);
@@ -694,6 +969,37 @@ void VulkanRenderer::render(VkCommandBuffer frame_cb, SyncData& sync_data) {
         memcpy(cam_buffer->alloc_info.pMappedData, g_cameras.data(), g_cameras.size() * sizeof(GPUCamera));
     }
 
+    //Cull meshlets, writing the draws of the visible ones for the main pass
+    if (!_meshlet_cull_jobs.empty()) {
+        vkCmdBindPipeline(frame_cb, VK_PIPELINE_BIND_POINT_COMPUTE, vgd->get_compute_pipeline(meshlet_cull_pipeline)->pipeline);
+
+        MeshletCullPushConstants pcs = {
+            .uniforms_addr = _frame_uniforms_addr,
+            .camera_idx = 0,
+            .job_count = (uint32_t)_meshlet_cull_jobs.size(),
+            .jobs_addr = vgd->buffer_device_address(_meshlet_job_buffer) + (_current_frame % FRAMES_IN_FLIGHT) * MAX_MESHLET_CULL_JOBS * sizeof(GPUMeshletCullJob),
+            .meshlets_addr = vgd->buffer_device_address(_meshlet_buffer),
+            .draws_buffer_idx = MESHLET_DRAWS_STORAGE_BUFFER_IDX,
+            .draws_offset = (uint32_t)meshlet_draws_offset,
+            .max_draws = MAX_MESHLET_DRAWS
+        };
+        vkCmdPushConstants(frame_cb, vgd->get_pipeline_layout(), PUSH_CONSTANT_STAGES, 0, sizeof(MeshletCullPushConstants), &pcs);
+        vkCmdDispatch(frame_cb, (uint32_t)_meshlet_cull_jobs.size(), 1, 1);
+
+        VkMemoryBarrier2KHR barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR,
+            .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR,
+            .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR,
+            .dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR,
+            .dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT_KHR
+        };
+        VkDependencyInfoKHR info = {};
+        info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+        info.memoryBarrierCount = 1;
+        info.pMemoryBarriers = &barrier;
+        vkCmdPipelineBarrier2KHR(frame_cb, &info);
+    }
+
     {	
         vgd->begin_render_pass(frame_cb, main_framebuffer);
 
@@ -722,9 +1028,6 @@ void VulkanRenderer::render(VkCommandBuffer frame_cb, SyncData& sync_data) {
 			vkCmdSetScissor(frame_cb, 0, 1, &scissor);
 		}
 
-		//Bind global index buffer
-		vkCmdBindIndexBuffer(frame_cb, vgd->get_buffer(index_buffer)->buffer, 0, VK_INDEX_TYPE_UINT16);
-		
 		//Bind pipeline for this pass
 		vkCmdBindPipeline(frame_cb, VK_PIPELINE_BIND_POINT_GRAPHICS, vgd->get_graphics_pipeline(ps1_pipeline)->pipeline);
 
@@ -733,10 +1036,30 @@ void VulkanRenderer::render(VkCommandBuffer frame_cb, SyncData& sync_data) {
             .uniforms_addr = _frame_uniforms_addr,
             .camera_idx = 0
         };
-        vkCmdPushConstants(frame_cb, vgd->get_pipeline_layout(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(RenderPushConstants), &pcs);
+        vkCmdPushConstants(frame_cb, vgd->get_pipeline_layout(), PUSH_CONSTANT_STAGES, 0, sizeof(RenderPushConstants), &pcs);
 
+        //One indirect draw per index width, each with its global index buffer bound
+        //The commands of each width were uploaded back to back
         VkDeviceSize indirect_offset = (_current_frame % FRAMES_IN_FLIGHT) * MAX_INDIRECT_DRAWS * sizeof(VkDrawIndexedIndirectCommand);
-        vkCmdDrawIndexedIndirect(frame_cb, vgd->get_buffer(_indirect_draw_buffer)->buffer, indirect_offset, static_cast<uint32_t>(_draw_calls.size()), sizeof(VkDrawIndexedIndirectCommand));
+        Key<VulkanBuffer> index_buffers[INDEX_WIDTH_COUNT] = { index_buffer, index32_buffer };
+        VkIndexType index_types[INDEX_WIDTH_COUNT] = { VK_INDEX_TYPE_UINT16, VK_INDEX_TYPE_UINT32 };
+        for (uint32_t i = 0; i < INDEX_WIDTH_COUNT; i++) {
+            if (_draw_calls[i].empty()) continue;
+            vkCmdBindIndexBuffer(frame_cb, vgd->get_buffer(index_buffers[i])->buffer, 0, index_types[i]);
+            vkCmdDrawIndexedIndirect(frame_cb, vgd->get_buffer(_indirect_draw_buffer)->buffer, indirect_offset, static_cast<uint32_t>(_draw_calls[i].size()), sizeof(VkDrawIndexedIndirectCommand));
+            indirect_offset += _draw_calls[i].size() * sizeof(VkDrawIndexedIndirectCommand);
+        }
+
+        //Then whichever meshlets survived culling, as many as the cull pass counted
+        if (!_meshlet_cull_jobs.empty()) {
+            VkBuffer draw_buffer = vgd->get_buffer(_meshlet_draw_buffer)->buffer;
+            for (uint32_t i = 0; i < INDEX_WIDTH_COUNT; i++) {
+                VkDeviceSize count_offset = meshlet_draws_offset + i * sizeof(uint32_t);
+                VkDeviceSize commands_offset = meshlet_draws_offset + MESHLET_DRAW_COUNTS_SIZE + i * MAX_MESHLET_DRAWS * sizeof(VkDrawIndexedIndirectCommand);
+                vkCmdBindIndexBuffer(frame_cb, vgd->get_buffer(index_buffers[i])->buffer, 0, index_types[i]);
+                vkCmdDrawIndexedIndirectCountKHR(frame_cb, draw_buffer, commands_offset, draw_buffer, count_offset, MAX_MESHLET_DRAWS, sizeof(VkDrawIndexedIndirectCommand));
+            }
+        }
 
         vgd->end_render_pass(frame_cb);
 
@@ -781,9 +1104,13 @@ void VulkanRenderer::render(VkCommandBuffer frame_cb, SyncData& sync_data) {
 	}
 
     //Get renderer state ready for next frame
-    _draw_calls.clear();
+    for (uint32_t i = 0; i < INDEX_WIDTH_COUNT; i++) _draw_calls[i].clear();
+    _meshlet_cull_jobs.clear();
+    for (uint32_t i = 0; i < INDEX_WIDTH_COUNT; i++) _meshlet_draws_queued[i] = 0;
     _gpu_instance_datas.clear();
     _instances_so_far = 0;
+    std::erase_if(_draw_lods, [this](const auto& entry) { return entry.second.last_frame != _current_frame; });
+    _lod_draw_calls.clear();
     _current_frame += 1;
 }
 
@@ -811,7 +1138,7 @@ void VulkanRenderer::postprocessing(VkCommandBuffer frame_cb, VulkanFrameBuffer&
     vkCmdSetScissor(frame_cb, 0, 1, &scissor);
 
     uint32_t color_buffer_idx = EXTRACT_IDX(color_buffers[_current_frame % FRAMES_IN_FLIGHT].value());
-    vkCmdPushConstants(frame_cb, vgd->get_pipeline_layout(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, 4, &color_buffer_idx);
+    vkCmdPushConstants(frame_cb, vgd->get_pipeline_layout(), PUSH_CONSTANT_STAGES, 0, 4, &color_buffer_idx);
     vkCmdBindPipeline(frame_cb, VK_PIPELINE_BIND_POINT_GRAPHICS, vgd->get_graphics_pipeline(postfx_pipeline)->pipeline);
     vkCmdDraw(frame_cb, 3, 1, 0, 0);
 }
@@ -834,6 +1161,9 @@ void VulkanRenderer::cpu_sync() {
 VulkanRenderer::~VulkanRenderer() {
     vgd->destroy_buffer(_instance_buffer);
     vgd->destroy_buffer(_mesh_buffer);
+    vgd->destroy_buffer(_meshlet_buffer);
+    vgd->destroy_buffer(_meshlet_job_buffer);
+    vgd->destroy_buffer(_meshlet_draw_buffer);
     vgd->destroy_buffer(_indirect_draw_buffer);
     vgd->destroy_buffer(_material_buffer);
     vgd->destroy_buffer(camera_buffer);
@@ -842,4 +1172,5 @@ VulkanRenderer::~VulkanRenderer() {
     vgd->destroy_buffer(vertex_position_buffer);
     vgd->destroy_buffer(vertex_uv_buffer);
     vgd->destroy_buffer(index_buffer);
+    vgd->destroy_buffer(index32_buffer);
 }
\ No newline at end of file
@@ -4,7 +4,10 @@
 #include <hlsl++.h>
 #include <imgui.h>
 #include "slotmap.h"
+#include "dense_slotmap.h"
 #include "VulkanGraphicsDevice.h"
+#include "mesh_optimizer.h"
+#include "vertex_quantization.h"
 
 #define MAX_CAMERAS 64
 #define MAX_MATERIALS 1024
@@ -12,6 +15,9 @@
 #define MAX_MESHES 128*1024
 #define MAX_INDIRECT_DRAWS 100000
 #define MAX_INSTANCES 1024*1024
+#define MAX_MESHLETS 256*1024
+#define MAX_MESHLET_CULL_JOBS 65535		//One compute group each, and 65535 is the smallest maxComputeWorkGroupCount allowed
+#define MAX_MESHLET_DRAWS 128*1024		//Per index width
 
 #define VERTEX_POSITION_BLOCK_SIZE 4
 
@@ -44,10 +50,22 @@ struct GPUCamera {
 	hlslpp::float4x4 projection_matrix;
 };
 
+//Which of a mesh's streams are stored in the quantized encodings from vertex_quantization.h
+enum GPUMeshFlags : uint32_t {
+	MESH_QUANTIZED_POSITIONS = 1 << 0,
+	MESH_QUANTIZED_UVS = 1 << 1,
+	MESH_QUANTIZED_COLORS = 1 << 2
+};
+
+//Stream starts are in 32-bit words from the start of each vertex buffer
 struct GPUMesh {
 	uint32_t position_start;
 	uint32_t uv_start;
 	uint32_t color_start;
+	uint32_t flags;
+	hlslpp::float4 position_scale;		//xyz, position = position_offset + position_scale * quantized
+	hlslpp::float4 position_offset;		//xyz
+	hlslpp::float4 uv_scale_offset;		//Scale in xy, offset in zw
 };
 
 #define MAX_MATERIAL_TEXTURES 8
@@ -65,6 +83,27 @@ struct GPUInstanceData {
 	uint32_t _pad0 = 0, _pad1 = 0;
 };
 
+//One instance of a mesh to cull meshlet by meshlet. Mirrored in shaders/meshlet_cull.hlsl
+struct GPUMeshletCullJob {
+	uint32_t instance_idx;		//Into the instance buffer, frame offset included
+	uint32_t meshlet_start;
+	uint32_t meshlet_count;
+	uint32_t first_index;		//Of the mesh in its index buffer
+	uint32_t index_width;
+	uint32_t _pad0 = 0, _pad1 = 0, _pad2 = 0;
+};
+
+struct MeshletCullPushConstants {
+	uint64_t uniforms_addr;
+	uint32_t camera_idx;
+	uint32_t job_count;
+	uint64_t jobs_addr;
+	uint64_t meshlets_addr;
+	uint32_t draws_buffer_idx;
+	uint32_t draws_offset;		//Bytes from the start of the draw buffer to this frame's counts
+	uint32_t max_draws;
+};
+
 struct BufferView {
 	uint32_t start;
 	uint32_t length;
@@ -75,6 +114,12 @@ struct MeshAttribute {
 	BufferView view;
 };
 
+//Dequantization state of a mesh with any quantized streams
+struct MeshQuantization {
+	VertexQuantization params;
+	uint32_t flags;
+};
+
 struct Material {
 	hlslpp::float4 base_color;
 	uint64_t batch_id;		//The batch where this material's textures come from. Zero if no images
@@ -85,6 +130,30 @@ struct InstanceData {
 	hlslpp::float4x4 world_from_model;
 };
 
+//Identifies a ps1_draw() call from one frame to the next: the call_idx-th call this frame drawing mesh with material
+struct LodDrawKey {
+	uint64_t mesh;
+	uint64_t material;
+	uint32_t call_idx;
+
+	bool operator==(const LodDrawKey& other) const = default;
+};
+
+struct LodDrawKeyHash {
+	size_t operator()(const LodDrawKey& key) const {
+		uint64_t h = key.mesh * 0x9E3779B97F4A7C15ull;
+		h = (h ^ (h >> 31) ^ key.material) * 0xBF58476D1CE4E5B9ull;
+		h = (h ^ (h >> 29) ^ key.call_idx) * 0x94D049BB133111EBull;
+		return (size_t)(h ^ (h >> 32));
+	}
+};
+
+//Level each instance of a draw was picked at, by position in its instance span
+struct LodDrawState {
+	std::vector<uint8_t> levels;
+	uint64_t last_frame;		//Entries not drawn in the frame that just ended are dropped
+};
+
 struct VulkanRenderer {
 	Key<VkSemaphore> frames_completed_semaphore;
 
@@ -94,7 +163,7 @@ struct VulkanRenderer {
 
 	//Buffer of camera data
 	Key<VulkanBuffer> camera_buffer;
-	slotmap<Camera> cameras;
+	dense_slotmap<Camera> cameras;
 
 	//Vertex buffers
 	uint32_t vertex_position_offset = 0;
@@ -104,25 +173,50 @@ struct VulkanRenderer {
 	uint32_t vertex_uv_offset = 0;
 	Key<VulkanBuffer> vertex_uv_buffer;
 
-	//Buffer for storing all loaded mesh indices
+	//Buffers for storing all loaded mesh indices, one per index width
 	uint32_t index_buffer_offset = 0;
 	Key<VulkanBuffer> index_buffer;
+	uint32_t index32_buffer_offset = 0;
+	Key<VulkanBuffer> index32_buffer;
 
-	Key<BufferView> push_vertex_positions(std::span<float> data);
+	Key<BufferView> push_vertex_positions(std::span<const float> data);
 	BufferView* get_vertex_positions(Key<BufferView> key);
-	Key<MeshAttribute> push_vertex_colors(Key<BufferView> position_key, std::span<float> data);
+	Key<MeshAttribute> push_vertex_colors(Key<BufferView> position_key, std::span<const float> data);
 	BufferView* get_vertex_colors(Key<BufferView> key);
-	Key<MeshAttribute> push_vertex_uvs(Key<BufferView> position_key, std::span<float> data);
+	Key<MeshAttribute> push_vertex_uvs(Key<BufferView> position_key, std::span<const float> data);
 	BufferView* get_vertex_uvs(Key<BufferView> key);
-	Key<MeshAttribute> push_indices16(Key<BufferView> position_key, std::span<uint16_t> data);
+	Key<MeshAttribute> push_indices16(Key<BufferView> position_key, std::span<const uint16_t> data);
+
+	//Quantized streams share the vertex buffers with float ones. See vertex_quantization.h for the encodings
+	Key<BufferView> push_quantized_vertex_positions(std::span<const uint16_t> data, const VertexQuantization& quantization);
+	Key<MeshAttribute> push_quantized_vertex_colors(Key<BufferView> position_key, std::span<const uint32_t> data);
+	Key<MeshAttribute> push_quantized_vertex_uvs(Key<BufferView> position_key, std::span<const uint16_t> data, const VertexQuantization& quantization);
+
+	//Levels of detail as ranges of the mesh's index stream, finest first
+	void push_mesh_lods(Key<BufferView> position_key, std::span<const MeshLod> lods);
+
+	//Meshlets of the mesh's full detail level. Instances drawn at that level are culled meshlet by meshlet on the GPU
+	void push_mesh_meshlets(Key<BufferView> position_key, std::span<const MeshMeshlet> meshlets);
+
 	BufferView* get_indices16(Key<BufferView> position_key);
+	Key<MeshAttribute> push_indices32(Key<BufferView> position_key, std::span<const uint32_t> data);
+	BufferView* get_indices32(Key<BufferView> position_key);
 
 	Key<Material> push_material(uint32_t sampler_idx, const hlslpp::float4& base_color);
 	Key<Material> push_material(uint64_t batch_id, uint32_t sampler_idx, const hlslpp::float4& base_color);
+	std::span<Key<Material>> push_materials(std::span<const Material> materials, Key<Material>* out_keys);
 	
 	uint32_t standard_sampler_idx;
 	uint32_t point_sampler_idx;
 
+	//LOD selection picks the coarsest level whose error projects to at most lod_pixel_error pixels
+	//An instance only changes level once the error crosses that threshold by the lod_hysteresis fraction
+	float lod_pixel_error = 1.0f;
+	float lod_hysteresis = 0.25f;
+
+	//Cull meshlets against the main camera's frustum and by their normal cones before drawing them
+	bool meshlet_culling = true;
+
 	uint64_t get_current_frame();
 
 	//Called to ensure CPU doesn't get too far ahead of the current frames in flight
@@ -142,21 +236,46 @@ struct VulkanRenderer {
 private:
 	Key<VulkanGraphicsPipeline> ps1_pipeline;
 	Key<VulkanGraphicsPipeline> postfx_pipeline;
+	Key<VulkanComputePipeline> meshlet_cull_pipeline;
 
 	//Views into global vertex buffer categorized by attribute
 	slotmap<BufferView> _position_buffers;
-	slotmap<MeshAttribute> _uv_buffers;
-	slotmap<MeshAttribute> _color_buffers;
-	slotmap<MeshAttribute> _index16_buffers;
+	dense_slotmap<MeshAttribute> _uv_buffers;
+	dense_slotmap<MeshAttribute> _color_buffers;
+	dense_slotmap<MeshAttribute> _index16_buffers;
+	dense_slotmap<MeshAttribute> _index32_buffers;
+	std::unordered_map<uint64_t, MeshQuantization> _mesh_quantizations;	//Keyed by position key
+	std::unordered_map<uint64_t, std::vector<MeshLod>> _mesh_lods;		//Keyed by position key
+
+	//Levels each LOD'd draw picked last frame, and how many calls each mesh and material pair has had this frame
+	std::unordered_map<LodDrawKey, LodDrawState, LodDrawKeyHash> _draw_lods;
+	std::unordered_map<LodDrawKey, uint32_t, LodDrawKeyHash> _lod_draw_calls;		//call_idx is always zero here
 
 	slotmap<Material> _materials;
 	std::vector<VkSampler> _samplers;
 
 	//Draw stream state
 	Key<VulkanBuffer> _indirect_draw_buffer;
-	std::vector<VkDrawIndexedIndirectCommand> _draw_calls;	//Reset every frame
+	//Draws are batched by index width since the index type is bound per vkCmdDrawIndexedIndirect
+	enum IndexWidth : uint32_t {
+		INDEX_WIDTH_16,
+		INDEX_WIDTH_32,
+		INDEX_WIDTH_COUNT
+	};
+	std::vector<VkDrawIndexedIndirectCommand> _draw_calls[INDEX_WIDTH_COUNT];	//Reset every frame
 	uint32_t _instances_so_far = 0;
 
+	//Meshlet culling state
+	//The compute pass appends the draws of visible meshlets to _meshlet_draw_buffer, counting them per index width
+	Key<VulkanBuffer> _meshlet_buffer;
+	uint32_t _meshlet_offset = 0;
+	std::unordered_map<uint64_t, BufferView> _mesh_meshlets;		//Keyed by position key, in meshlets
+	Key<VulkanBuffer> _meshlet_job_buffer;
+	std::vector<GPUMeshletCullJob> _meshlet_cull_jobs;				//Reset every frame
+	uint64_t _meshlet_draws_queued[INDEX_WIDTH_COUNT] = {};		//Worst case draws the queued jobs can append, reset every frame
+	Key<VulkanBuffer> _meshlet_draw_buffer;
+	bool push_meshlet_cull_jobs(const BufferView& meshlets, uint32_t first_index, IndexWidth index_width, uint32_t instance_count);
+
 	Key<VulkanBuffer> _instance_buffer;
 	std::vector<GPUInstanceData> _gpu_instance_datas;
 
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+//Minimal shared harness for the benchmark executables
+//Each benchmark collects BenchResults into a BenchReport which gets printed as a table
+//and written out as JSON so numbers can be diffed between runs.
+
+//Results get folded into this so the optimizer can't drop the measured work
+inline volatile uint64_t bench_sink = 0;
+
+struct BenchTimer {
+    std::chrono::steady_clock::time_point start_time;
+
+    void start() {
+        start_time = std::chrono::steady_clock::now();
+    }
+
+    double elapsed_ns() {
+        auto end_time = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end_time - start_time).count();
+    }
+};
+
+//Calls case_fn runs times and returns the median of the nanosecond timings it reports
+template<typename F>
+double bench_median_ns(uint32_t runs, F&& case_fn) {
+    std::vector<double> timings;
+    timings.reserve(runs);
+    for (uint32_t i = 0; i < runs; i++) {
+        timings.push_back(case_fn());
+    }
+    std::sort(timings.begin(), timings.end());
+    return timings[timings.size() / 2];
+}
+
+struct BenchResult {
+    std::string subject;        //Thing being measured, e.g. a container or kernel name
+    std::string test;           //What was done to it
+    std::string params;         //Free-form parameter description, e.g. fill ratio
+    uint64_t ops;
+    double total_ns;
+};
+
+struct BenchReport {
+    std::string name;
+    std::vector<BenchResult> results;
+
+    void add(const std::string& subject, const std::string& test, const std::string& params, uint64_t ops, double total_ns) {
+        results.push_back({ subject, test, params, ops, total_ns });
+    }
+
+    void print() {
+        printf("%-22s %-24s %-16s %12s %12s %12s\n", "subject", "test", "params", "ops", "ns/op", "Mops/s");
+        for (BenchResult& r : results) {
+            printf(
+                "%-22s %-24s %-16s %12llu %12.2f %12.1f\n",
+                r.subject.c_str(),
+                r.test.c_str(),
+                r.params.c_str(),
+                (unsigned long long)r.ops,
+                r.total_ns / (double)r.ops,
+                (double)r.ops * 1e3 / r.total_ns
+            );
+        }
+    }
+
+    bool write_json(const char* path) {
+        FILE* f = fopen(path, "wb");
+        if (f == nullptr) {
+            printf("Couldn't open %s for writing.\n", path);
+            return false;
+        }
+
+        fprintf(f, "{\n  \"benchmark\": \"%s\",\n  \"results\": [\n", name.c_str());
+        for (size_t i = 0; i < results.size(); i++) {
+            BenchResult& r = results[i];
+            fprintf(
+                f,
+                "    { \"subject\": \"%s\", \"test\": \"%s\", \"params\": \"%s\", \"ops\": %llu, \"total_ns\": %.0f, \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f }%s\n",
+                r.subject.c_str(),
+                r.test.c_str(),
+                r.params.c_str(),
+                (unsigned long long)r.ops,
+                r.total_ns,
+                r.total_ns / (double)r.ops,
+                (double)r.ops * 1e9 / r.total_ns,
+                i + 1 < results.size() ? "," : ""
+            );
+        }
+        fprintf(f, "  ]\n}\n");
+        fclose(f);
+        return true;
+    }
+};
@@ -0,0 +1,198 @@
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include "../concurrent_slotmap.h"
+
+//Stress test for concurrent_slotmap
+//Writer threads insert and remove their own elements as fast as they can while reader threads
+//read every key they can find with get(), try_read() and iteration. Readers check that each copy
+//is a whole element and that it's the element the key was handed out for.
+//Usage: ConcurrentSlotmapStress [threads] [operations per writer]
+
+static constexpr uint32_t CAPACITY = 1 << 16;
+static constexpr uint32_t LIVE_PER_WRITER = 512;
+static constexpr uint32_t PUBLISHED_KEYS = 4096;
+static constexpr uint32_t RNG_SEED = 0x50524F52;
+
+//Every word is derived from id, so a copy mixing two elements can't pass check_payload()
+struct Payload {
+    uint64_t id;
+    uint64_t check[7];
+};
+
+static Payload make_payload(uint64_t id) {
+    Payload p;
+    p.id = id;
+    for (uint64_t i = 0; i < 7; i++) p.check[i] = (id + i) * 0x9E3779B97F4A7C15;
+    return p;
+}
+
+static bool check_payload(const Payload& p) {
+    for (uint64_t i = 0; i < 7; i++) {
+        if (p.check[i] != (p.id + i) * 0x9E3779B97F4A7C15) return false;
+    }
+    return true;
+}
+
+struct StressState {
+    concurrent_slotmap<Payload> map;
+
+    //Generation and low id bits of the element each slot holds, written by its writer after insert
+    std::unique_ptr<std::atomic<uint64_t>[]> expected;
+
+    //Keys writers have handed out, some of which have been removed since
+    std::unique_ptr<std::atomic<uint64_t>[]> published;
+
+    std::atomic<bool> writers_done;
+    std::atomic<uint64_t> failures;
+    std::atomic<uint64_t> reads;
+    std::atomic<uint64_t> stale_reads;
+};
+
+static void fail(StressState& state, const char* what, uint64_t key) {
+    if (state.failures.fetch_add(1, std::memory_order_relaxed) < 16) {
+        printf("FAIL: %s (slot %u, generation 0x%08X)\n", what, (uint32_t)EXTRACT_IDX(key), (uint32_t)(key >> 32));
+    }
+}
+
+//Returns false if key was removed, which readers expect to happen
+static bool read_key(StressState& state, uint64_t key) {
+    Payload p;
+    if (!state.map.try_read(Key<Payload>(key), p)) return false;
+    if (!check_payload(p)) {
+        fail(state, "try_read returned a torn element", key);
+        return true;
+    }
+
+    //expected is written after the key's insert and before the key can be found anywhere,
+    //so it either describes this key or a later element in the same slot
+    uint64_t expected = state.expected[EXTRACT_IDX(key)].load(std::memory_order_acquire);
+    if ((expected >> 32) == (key >> 32) && (uint32_t)expected != (uint32_t)p.id) {
+        fail(state, "try_read returned another generation's element", key);
+    }
+    return true;
+}
+
+static void writer(StressState& state, uint32_t thread_idx, uint32_t operations) {
+    std::mt19937 rng(RNG_SEED + thread_idx);
+    std::vector<std::pair<uint64_t, uint64_t>> live;    //Key, id
+    live.reserve(LIVE_PER_WRITER);
+    uint64_t next_id = (uint64_t)thread_idx << 40;
+
+    for (uint32_t op = 0; op < operations; op++) {
+        if (live.size() < LIVE_PER_WRITER && (live.empty() || rng() % 2 == 0)) {
+            uint64_t id = next_id++;
+            uint64_t key = state.map.insert(make_payload(id)).value();
+            uint32_t idx = EXTRACT_IDX(key);
+            state.expected[idx].store((key & 0xFFFFFFFF00000000) | (uint32_t)id, std::memory_order_release);
+            state.published[rng() % PUBLISHED_KEYS].store(key, std::memory_order_release);
+            live.push_back({ key, id });
+        } else {
+            size_t victim = rng() % live.size();
+            auto [key, id] = live[victim];
+            live[victim] = live.back();
+            live.pop_back();
+
+            //Only this thread removes its elements, so they can be read in place until then
+            Payload* p = state.map.get(Key<Payload>(key));
+            if (p == nullptr) fail(state, "get lost a live element", key);
+            else if (p->id != id || !check_payload(*p)) fail(state, "get returned the wrong element", key);
+
+            state.map.remove(EXTRACT_IDX(key));
+            Payload stale;
+            if (state.map.get(Key<Payload>(key)) != nullptr) fail(state, "get found a removed element", key);
+            if (state.map.try_read(Key<Payload>(key), stale)) fail(state, "try_read found a removed element", key);
+        }
+    }
+
+    for (auto [key, id] : live) {
+        Payload* p = state.map.get(Key<Payload>(key));
+        if (p == nullptr || p->id != id) fail(state, "get lost a live element", key);
+    }
+}
+
+static void reader(StressState& state, uint32_t thread_idx) {
+    std::mt19937 rng(RNG_SEED ^ (thread_idx * 0x1234567));
+    uint64_t reads = 0;
+    uint64_t stale = 0;
+    uint32_t round = 0;
+    while (!state.writers_done.load(std::memory_order_acquire)) {
+        if (round++ % 64 == 0) {
+            //Every live slot the iterator passes must give a key that reads back, unless it was removed in between
+            for (auto it = state.map.begin(); it != state.map.end(); ++it) {
+                uint64_t key = ((uint64_t)it.generation_bits() << 32) | it.slot_index();
+                if (!(key >> 32 & LIVE_BIT)) continue;
+                if (read_key(state, key)) reads += 1;
+                else stale += 1;
+            }
+        } else {
+            uint64_t key = state.published[rng() % PUBLISHED_KEYS].load(std::memory_order_acquire);
+            if (key == 0) continue;
+
+            //Generations only move forward, so once get() has rejected a key try_read() must too
+            bool was_live = state.map.get(Key<Payload>(key)) != nullptr;
+            if (read_key(state, key)) {
+                if (!was_live) fail(state, "try_read found a key get() had rejected", key);
+                reads += 1;
+            } else {
+                stale += 1;
+            }
+        }
+    }
+    state.reads.fetch_add(reads, std::memory_order_relaxed);
+    state.stale_reads.fetch_add(stale, std::memory_order_relaxed);
+}
+
+int main(int argc, char** argv) {
+    uint32_t threads = argc > 1 ? (uint32_t)atoi(argv[1]) : std::max(4u, std::thread::hardware_concurrency());
+    uint32_t operations = argc > 2 ? (uint32_t)atoi(argv[2]) : 1000000;
+    uint32_t writer_count = std::max(1u, threads / 2);
+    uint32_t reader_count = std::max(1u, threads - writer_count);
+    if (writer_count * LIVE_PER_WRITER > CAPACITY) {
+        printf("Too many writer threads for a capacity of %u.\n", CAPACITY);
+        return -1;
+    }
+
+    StressState state;
+    state.map.alloc(CAPACITY);
+    state.expected = std::make_unique<std::atomic<uint64_t>[]>(CAPACITY);
+    state.published = std::make_unique<std::atomic<uint64_t>[]>(PUBLISHED_KEYS);
+    for (uint32_t i = 0; i < CAPACITY; i++) state.expected[i].store(0, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < PUBLISHED_KEYS; i++) state.published[i].store(0, std::memory_order_relaxed);
+    state.writers_done.store(false, std::memory_order_relaxed);
+    state.failures.store(0, std::memory_order_relaxed);
+    state.reads.store(0, std::memory_order_relaxed);
+    state.stale_reads.store(0, std::memory_order_relaxed);
+
+    printf("%u writers x %u operations, %u readers\n", writer_count, operations, reader_count);
+    std::vector<std::thread> readers;
+    for (uint32_t i = 0; i < reader_count; i++) readers.emplace_back(reader, std::ref(state), i);
+    std::vector<std::thread> writers;
+    for (uint32_t i = 0; i < writer_count; i++) writers.emplace_back(writer, std::ref(state), i, operations);
+    for (std::thread& t : writers) t.join();
+    state.writers_done.store(true, std::memory_order_release);
+    for (std::thread& t : readers) t.join();
+
+    //Everything has settled, so iteration and count() have to agree exactly
+    uint32_t iterated = 0;
+    for (auto it = state.map.begin(); it != state.map.end(); ++it) {
+        uint64_t key = ((uint64_t)it.generation_bits() << 32) | it.slot_index();
+        if (!check_payload(*it)) fail(state, "iteration found a torn element", key);
+        if (state.map.get(Key<Payload>(key)) != &*it) fail(state, "iterated key doesn't get() its element", key);
+        iterated += 1;
+    }
+    if (iterated != state.map.count()) {
+        printf("FAIL: iterated %u elements but count() is %u\n", iterated, state.map.count());
+        state.failures.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t failures = state.failures.load(std::memory_order_relaxed);
+    printf("%llu reads, %llu of removed keys, %u elements left, %llu failures\n",
+        (unsigned long long)state.reads.load(std::memory_order_relaxed),
+        (unsigned long long)state.stale_reads.load(std::memory_order_relaxed),
+        iterated, (unsigned long long)failures);
+    return failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,407 @@
+#include <random>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "../mip_generation.h"
+#include "../vertex_conversion.h"
+
+#define VOLK_IMPLEMENTATION
+#include "volk.h"
+
+//CPU mip generation on each instruction set the CPU supports, next to the GPU blits it replaces
+//ops are texels of the source level, so Mops/s reads as millions of source texels per second on both sides
+//The GPU rows record the same blits and barriers VulkanGraphicsDevice::tick_image_uploads() does for an image of each size,
+//with timestamps on either side of the blits and nothing else. They're skipped when there's no Vulkan device that can blit RGBA8.
+//CPU mip chains include writing every level out, like the decode workers do into the staging ring.
+//Usage: MipGenerationBench [output.json]
+
+static constexpr uint32_t IMAGE_SIZES[] = { 512, 2048 };
+static constexpr uint32_t RUNS = 7;
+static constexpr uint32_t RNG_SEED = 0x50524F52;
+
+static uint32_t mip_count(uint32_t width, uint32_t height) {
+    uint32_t count = 1;
+    for (uint32_t dimension = std::max(width, height); dimension >>= 1;) count += 1;
+    return count;
+}
+
+//Owns a device with one graphics queue and times blit chains on it
+struct BlitBench {
+    VkInstance instance = VK_NULL_HANDLE;
+    VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    VkCommandPool command_pool = VK_NULL_HANDLE;
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    VkQueryPool query_pool = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memory_properties = {};
+    double timestamp_period = 0.0;
+    uint64_t timestamp_mask = 0;
+
+    ~BlitBench() {
+        if (device) {
+            vkDeviceWaitIdle(device);
+            if (query_pool) vkDestroyQueryPool(device, query_pool, nullptr);
+            if (fence) vkDestroyFence(device, fence, nullptr);
+            if (command_pool) vkDestroyCommandPool(device, command_pool, nullptr);
+            vkDestroyDevice(device, nullptr);
+        }
+        if (instance) vkDestroyInstance(instance, nullptr);
+    }
+
+    static bool can_blit(VkPhysicalDevice pd, VkFormat format) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(pd, format, &props);
+        VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        return (props.optimalTilingFeatures & needed) == needed;
+    }
+
+    //Returns false if there's no device to run on, which isn't an error for the benchmark
+    bool init() {
+        if (volkInitialize() != VK_SUCCESS) {
+            printf("No Vulkan loader, skipping the GPU blits.\n");
+            return false;
+        }
+
+        VkApplicationInfo app_info = {};
+        app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        app_info.pApplicationName = "MipGenerationBench";
+        app_info.apiVersion = VK_MAKE_API_VERSION(0, 1, 2, 0);
+
+        VkInstanceCreateInfo inst_info = {};
+        inst_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        inst_info.pApplicationInfo = &app_info;
+        if (vkCreateInstance(&inst_info, nullptr, &instance) != VK_SUCCESS) {
+            printf("Creating a Vulkan instance failed, skipping the GPU blits.\n");
+            return false;
+        }
+        volkLoadInstanceOnly(instance);
+
+        //Takes the first discrete GPU whose graphics queue can blit both formats and write timestamps, or else the first other device that can
+        uint32_t device_count = 0;
+        vkEnumeratePhysicalDevices(instance, &device_count, nullptr);
+        std::vector<VkPhysicalDevice> devices(device_count);
+        vkEnumeratePhysicalDevices(instance, &device_count, devices.data());
+
+        uint32_t queue_family = 0;
+        bool discrete = false;
+        for (VkPhysicalDevice pd : devices) {
+            if (!can_blit(pd, VK_FORMAT_R8G8B8A8_UNORM) || !can_blit(pd, VK_FORMAT_R8G8B8A8_SRGB)) continue;
+
+            uint32_t family_count = 0;
+            vkGetPhysicalDeviceQueueFamilyProperties(pd, &family_count, nullptr);
+            std::vector<VkQueueFamilyProperties> families(family_count);
+            vkGetPhysicalDeviceQueueFamilyProperties(pd, &family_count, families.data());
+            for (uint32_t i = 0; i < family_count; i++) {
+                if (!(families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) || families[i].timestampValidBits == 0) continue;
+
+                VkPhysicalDeviceProperties props;
+                vkGetPhysicalDeviceProperties(pd, &props);
+                bool pd_discrete = props.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+                if (physical_device == VK_NULL_HANDLE || (pd_discrete && !discrete)) {
+                    physical_device = pd;
+                    queue_family = i;
+                    discrete = pd_discrete;
+                    timestamp_period = props.limits.timestampPeriod;
+                    timestamp_mask = families[i].timestampValidBits >= 64 ? ~0ull : (1ull << families[i].timestampValidBits) - 1;
+                }
+                break;
+            }
+        }
+        if (physical_device == VK_NULL_HANDLE) {
+            printf("No Vulkan device can blit and time RGBA8 mips, skipping the GPU blits.\n");
+            return false;
+        }
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(physical_device, &props);
+        printf("Timing GPU blits on %s\n", props.deviceName);
+        vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+
+        float priority = 1.0f;
+        VkDeviceQueueCreateInfo queue_info = {};
+        queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queue_info.queueFamilyIndex = queue_family;
+        queue_info.queueCount = 1;
+        queue_info.pQueuePriorities = &priority;
+
+        VkDeviceCreateInfo device_info = {};
+        device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        device_info.queueCreateInfoCount = 1;
+        device_info.pQueueCreateInfos = &queue_info;
+        if (vkCreateDevice(physical_device, &device_info, nullptr, &device) != VK_SUCCESS) {
+            printf("Creating a Vulkan device failed, skipping the GPU blits.\n");
+            return false;
+        }
+        volkLoadDevice(device);
+        vkGetDeviceQueue(device, queue_family, 0, &queue);
+
+        VkCommandPoolCreateInfo pool_info = {};
+        pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        pool_info.queueFamilyIndex = queue_family;
+        if (vkCreateCommandPool(device, &pool_info, nullptr, &command_pool) != VK_SUCCESS) {
+            printf("Creating a command pool failed.\n");
+            exit(-1);
+        }
+
+        VkCommandBufferAllocateInfo cb_info = {};
+        cb_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cb_info.commandPool = command_pool;
+        cb_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cb_info.commandBufferCount = 1;
+        if (vkAllocateCommandBuffers(device, &cb_info, &command_buffer) != VK_SUCCESS) {
+            printf("Allocating a command buffer failed.\n");
+            exit(-1);
+        }
+
+        VkFenceCreateInfo fence_info = {};
+        fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        if (vkCreateFence(device, &fence_info, nullptr, &fence) != VK_SUCCESS) {
+            printf("Creating a fence failed.\n");
+            exit(-1);
+        }
+
+        VkQueryPoolCreateInfo query_info = {};
+        query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        query_info.queryCount = 2;
+        if (vkCreateQueryPool(device, &query_info, nullptr, &query_pool) != VK_SUCCESS) {
+            printf("Creating a timestamp query pool failed.\n");
+            exit(-1);
+        }
+        return true;
+    }
+
+    uint32_t memory_type(uint32_t type_bits, VkMemoryPropertyFlags flags) {
+        for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+            if ((type_bits & (1u << i)) && (memory_properties.memoryTypes[i].propertyFlags & flags) == flags) return i;
+        }
+        printf("No memory type with flags 0x%X.\n", flags);
+        exit(-1);
+    }
+
+    VkDeviceMemory allocate(VkMemoryRequirements reqs, VkMemoryPropertyFlags flags) {
+        VkMemoryAllocateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        info.allocationSize = reqs.size;
+        info.memoryTypeIndex = memory_type(reqs.memoryTypeBits, flags);
+
+        VkDeviceMemory memory;
+        if (vkAllocateMemory(device, &info, nullptr, &memory) != VK_SUCCESS) {
+            printf("Allocating %llu bytes of device memory failed.\n", (unsigned long long)reqs.size);
+            exit(-1);
+        }
+        return memory;
+    }
+
+    void begin() {
+        VkCommandBufferBeginInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(command_buffer, &info);
+    }
+
+    void submit_and_wait() {
+        vkEndCommandBuffer(command_buffer);
+        VkSubmitInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        info.commandBufferCount = 1;
+        info.pCommandBuffers = &command_buffer;
+        if (vkQueueSubmit(queue, 1, &info, fence) != VK_SUCCESS || vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+            printf("Submitting GPU blits failed.\n");
+            exit(-1);
+        }
+        vkResetFences(device, 1, &fence);
+    }
+
+    static void barrier(VkCommandBuffer cb, VkImage image, uint32_t base_mip, uint32_t mip_count, VkImageLayout old_layout, VkImageLayout new_layout, VkPipelineStageFlags dst_stage) {
+        VkImageMemoryBarrier b = {};
+        b.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        b.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        b.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        b.oldLayout = old_layout;
+        b.newLayout = new_layout;
+        b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        b.image = image;
+        b.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, base_mip, mip_count, 0, 1 };
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &b);
+    }
+
+    //Median GPU time of blitting level 0 of a size x size image down through blit_count levels
+    double time_blits(VkFormat format, const std::vector<uint8_t>& rgba, uint32_t size, uint32_t blit_count) {
+        uint32_t mips = mip_count(size, size);
+
+        VkImageCreateInfo image_info = {};
+        image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_info.imageType = VK_IMAGE_TYPE_2D;
+        image_info.format = format;
+        image_info.extent = { size, size, 1 };
+        image_info.mipLevels = mips;
+        image_info.arrayLayers = 1;
+        image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_info.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VkImage image;
+        VkMemoryRequirements image_reqs;
+        if (vkCreateImage(device, &image_info, nullptr, &image) != VK_SUCCESS) {
+            printf("Creating a %ux%u image failed.\n", size, size);
+            exit(-1);
+        }
+        vkGetImageMemoryRequirements(device, image, &image_reqs);
+        VkDeviceMemory image_memory = allocate(image_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        vkBindImageMemory(device, image, image_memory, 0);
+
+        VkBufferCreateInfo buffer_info = {};
+        buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        buffer_info.size = 4 * (VkDeviceSize)size * size;
+        buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+        VkBuffer staging;
+        VkMemoryRequirements staging_reqs;
+        if (vkCreateBuffer(device, &buffer_info, nullptr, &staging) != VK_SUCCESS) {
+            printf("Creating a staging buffer failed.\n");
+            exit(-1);
+        }
+        vkGetBufferMemoryRequirements(device, staging, &staging_reqs);
+        VkDeviceMemory staging_memory = allocate(staging_reqs, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        vkBindBufferMemory(device, staging, staging_memory, 0);
+
+        void* mapped;
+        vkMapMemory(device, staging_memory, 0, buffer_info.size, 0, &mapped);
+        memcpy(mapped, rgba.data(), buffer_info.size);
+        vkUnmapMemory(device, staging_memory);
+
+        //Level 0 ends up shader readable, like an uploaded image would be after its first run through here
+        begin();
+        barrier(command_buffer, image, 0, 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        VkBufferImageCopy copy = {};
+        copy.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        copy.imageExtent = { size, size, 1 };
+        vkCmdCopyBufferToImage(command_buffer, staging, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+        barrier(command_buffer, image, 0, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+        submit_and_wait();
+
+        auto run = [&]() {
+            begin();
+            vkCmdResetQueryPool(command_buffer, query_pool, 0, 2);
+
+            //Stands in for the ownership acquire, which stays outside the timestamps just like in the app
+            barrier(command_buffer, image, 0, 1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            barrier(command_buffer, image, 1, mips - 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 0);
+            for (uint32_t k = 0; k < blit_count; k++) {
+                VkImageBlit region = {};
+                region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, k, 0, 1 };
+                region.srcOffsets[1] = { std::max((int32_t)(size >> k), 1), std::max((int32_t)(size >> k), 1), 1 };
+                region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, k + 1, 0, 1 };
+                region.dstOffsets[1] = { std::max((int32_t)(size >> (k + 1)), 1), std::max((int32_t)(size >> (k + 1)), 1), 1 };
+                vkCmdBlitImage(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
+                if (k + 1 == blit_count) vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 1);
+
+                barrier(command_buffer, image, k, 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+                barrier(command_buffer, image, k + 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            }
+            barrier(command_buffer, image, blit_count, 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+            submit_and_wait();
+
+            uint64_t timestamps[2];
+            if (vkGetQueryPoolResults(device, query_pool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS) {
+                printf("Reading blit timestamps failed.\n");
+                exit(-1);
+            }
+            return (double)((timestamps[1] - timestamps[0]) & timestamp_mask) * timestamp_period;
+        };
+
+        //The first run pays for the driver setting things up
+        run();
+        double ns = bench_median_ns(RUNS, run);
+
+        vkDestroyBuffer(device, staging, nullptr);
+        vkFreeMemory(device, staging_memory, nullptr);
+        vkDestroyImage(device, image, nullptr);
+        vkFreeMemory(device, image_memory, nullptr);
+        return ns;
+    }
+};
+
+template<typename F>
+static void bench_case(BenchReport& report, const std::string& subject, const std::string& test, const std::string& params, uint64_t texels, F&& run) {
+    BenchTimer timer;
+    double ns = bench_median_ns(RUNS, [&]() {
+        timer.start();
+        run();
+        return timer.elapsed_ns();
+    });
+    report.add(subject, test, params, texels, ns);
+}
+
+//Every instruction set's row and the GPU row for one test end up next to each other
+static void run_size(BenchReport& report, const std::vector<ConversionIsa>& isas, BlitBench* gpu, const std::vector<uint8_t>& image, uint32_t size) {
+    std::string params = std::to_string(size) + "x" + std::to_string(size);
+    uint64_t texels = (uint64_t)size * size;
+    uint32_t mips = mip_count(size, size);
+    std::vector<uint8_t> half(texels);
+    std::vector<uint8_t> chain(rgba8_mip_chain_size(size, size, mips));
+
+    for (bool srgb : { false, true }) {
+        std::string test = srgb ? "downsample srgb" : "downsample unorm";
+        for (ConversionIsa isa : isas) {
+            set_conversion_isa(isa);
+            bench_case(report, conversion_isa_name(isa), test, params, texels, [&]() {
+                downsample_rgba8(image.data(), size, size, srgb, half.data());
+                bench_sink = bench_sink + half[half.size() - 1];
+            });
+        }
+        if (gpu) report.add("gpu", test, params, texels, gpu->time_blits(srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM, image, size, 1));
+    }
+
+    //What the upload thread does per image
+    for (bool srgb : { false, true }) {
+        std::string test = srgb ? "mip chain srgb" : "mip chain unorm";
+        for (ConversionIsa isa : isas) {
+            set_conversion_isa(isa);
+            bench_case(report, conversion_isa_name(isa), test, params, texels, [&]() {
+                generate_mip_chain_rgba8(image.data(), size, size, mips, srgb, chain.data());
+                bench_sink = bench_sink + chain[chain.size() - 1];
+            });
+        }
+        if (gpu) report.add("gpu", test, params, texels, gpu->time_blits(srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM, image, size, mips - 1));
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* out_path = argc > 1 ? argv[1] : "mip_generation_bench.json";
+
+    std::vector<ConversionIsa> isas;
+    ConversionIsa supported = supported_conversion_isa();
+    for (uint32_t isa = 0; isa <= (uint32_t)supported; isa++) {
+        //Same kernels as sse2
+        if (isa == CONVERSION_ISA_SSSE3) continue;
+        isas.push_back((ConversionIsa)isa);
+    }
+
+    BlitBench gpu;
+    bool have_gpu = gpu.init();
+
+    BenchReport report;
+    report.name = "mip_generation";
+    std::mt19937 rng(RNG_SEED);
+    for (uint32_t size : IMAGE_SIZES) {
+        std::vector<uint8_t> image(4 * (size_t)size * size);
+        for (uint8_t& b : image) b = (uint8_t)rng();
+        run_size(report, isas, have_gpu ? &gpu : nullptr, image, size);
+    }
+    set_conversion_isa(supported);
+
+    report.print();
+    if (!report.write_json(out_path)) return -1;
+    printf("Wrote %s\n", out_path);
+    return 0;
+}
@@ -0,0 +1,339 @@
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include "bench.h"
+#include "../slotmap.h"
+#include "../dense_slotmap.h"
+#include "../paged_slotmap.h"
+#include "../concurrent_slotmap.h"
+
+//Throughput of the slotmap family against std::unordered_map and a bare vector
+//Usage: SlotmapBench [output.json]
+
+static constexpr uint32_t CAPACITY = 1 << 17;
+static constexpr uint32_t LIVE_COUNT = 1 << 16;
+static constexpr uint32_t RUNS = 5;
+static constexpr uint32_t RNG_SEED = 0x50524F52;
+
+//Roughly the size of the device's per-image bookkeeping
+struct Payload {
+    uint64_t id;
+    float data[14];
+};
+
+template<typename Map>
+struct SlotmapAdapter {
+    using Handle = Key<Payload>;
+    std::unique_ptr<Map> map;
+
+    SlotmapAdapter() : map(std::make_unique<Map>()) { map->alloc(CAPACITY); }
+    Handle insert(const Payload& p) { return map->insert(p); }
+    Payload* get(Handle h) { return map->get(h); }
+    void remove(Handle h) { map->remove(EXTRACT_IDX(h.value())); }
+
+    template<typename F>
+    void for_each(F&& f) {
+        for (Payload& p : *map) f(p);
+    }
+};
+
+struct UnorderedMapAdapter {
+    using Handle = uint64_t;
+    std::unordered_map<uint64_t, Payload> map;
+    uint64_t next_id = 0;
+
+    UnorderedMapAdapter() { map.reserve(CAPACITY); }
+    Handle insert(const Payload& p) {
+        Handle h = next_id++;
+        map.emplace(h, p);
+        return h;
+    }
+    Payload* get(Handle h) {
+        auto it = map.find(h);
+        return it == map.end() ? nullptr : &it->second;
+    }
+    void remove(Handle h) { map.erase(h); }
+
+    template<typename F>
+    void for_each(F&& f) {
+        for (auto& [k, p] : map) f(p);
+    }
+};
+
+//Lower bound: index-addressed array with a free list and no stale handle detection
+struct VectorAdapter {
+    using Handle = uint32_t;
+    std::vector<Payload> data;
+    std::vector<uint8_t> live;
+    std::vector<uint32_t> free_indices;
+    uint32_t end_idx = 0;
+
+    VectorAdapter() {
+        data.resize(CAPACITY);
+        live.resize(CAPACITY);
+        free_indices.reserve(CAPACITY);
+    }
+    Handle insert(const Payload& p) {
+        uint32_t idx;
+        if (free_indices.size() > 0) {
+            idx = free_indices.back();
+            free_indices.pop_back();
+        } else {
+            idx = end_idx++;
+        }
+        data[idx] = p;
+        live[idx] = 1;
+        return idx;
+    }
+    Payload* get(Handle h) { return &data[h]; }
+    void remove(Handle h) {
+        live[h] = 0;
+        free_indices.push_back(h);
+    }
+
+    template<typename F>
+    void for_each(F&& f) {
+        for (uint32_t i = 0; i < end_idx; i++) {
+            if (live[i]) f(data[i]);
+        }
+    }
+};
+
+static Payload make_payload(uint64_t id) {
+    Payload p = {};
+    p.id = id;
+    p.data[0] = (float)id;
+    return p;
+}
+
+//Inserts LIVE_COUNT elements then removes random ones until only fill * LIVE_COUNT remain
+template<typename A>
+static std::vector<typename A::Handle> fill_with_holes(A& a, float fill, std::mt19937& rng) {
+    std::vector<typename A::Handle> handles;
+    handles.reserve(LIVE_COUNT);
+    for (uint32_t i = 0; i < LIVE_COUNT; i++) {
+        handles.push_back(a.insert(make_payload(i)));
+    }
+    std::shuffle(handles.begin(), handles.end(), rng);
+    uint32_t keep = (uint32_t)(fill * LIVE_COUNT);
+    for (uint32_t i = keep; i < LIVE_COUNT; i++) {
+        a.remove(handles[i]);
+    }
+    handles.resize(keep);
+    return handles;
+}
+
+template<typename A>
+static void run_suite(BenchReport& report, const char* name) {
+    std::mt19937 rng(RNG_SEED);
+    BenchTimer timer;
+
+    //Bulk insert into an empty container
+    double ns = bench_median_ns(RUNS, [&]() {
+        A a;
+        timer.start();
+        for (uint32_t i = 0; i < LIVE_COUNT; i++) {
+            a.insert(make_payload(i));
+        }
+        return timer.elapsed_ns();
+    });
+    report.add(name, "insert", "", LIVE_COUNT, ns);
+
+    //Lookups and iteration with the table partially vacated
+    const float fills[] = { 0.25f, 0.5f, 0.9f };
+    for (float fill : fills) {
+        char params[32];
+        snprintf(params, sizeof(params), "fill=%.2f", fill);
+
+        A a;
+        std::vector<typename A::Handle> handles = fill_with_holes(a, fill, rng);
+        std::shuffle(handles.begin(), handles.end(), rng);
+
+        const uint32_t passes = 4;
+        ns = bench_median_ns(RUNS, [&]() {
+            uint64_t sum = 0;
+            timer.start();
+            for (uint32_t pass = 0; pass < passes; pass++) {
+                for (typename A::Handle h : handles) {
+                    sum += a.get(h)->id;
+                }
+            }
+            double t = timer.elapsed_ns();
+            bench_sink = bench_sink + sum;
+            return t;
+        });
+        report.add(name, "get_random", params, (uint64_t)handles.size() * passes, ns);
+
+        ns = bench_median_ns(RUNS, [&]() {
+            uint64_t sum = 0;
+            timer.start();
+            a.for_each([&](Payload& p) { sum += p.id; });
+            double t = timer.elapsed_ns();
+            bench_sink = bench_sink + sum;
+            return t;
+        });
+        report.add(name, "iterate", params, (uint64_t)handles.size(), ns);
+    }
+
+    //Removing everything in random order
+    ns = bench_median_ns(RUNS, [&]() {
+        A a;
+        std::vector<typename A::Handle> handles;
+        handles.reserve(LIVE_COUNT);
+        for (uint32_t i = 0; i < LIVE_COUNT; i++) {
+            handles.push_back(a.insert(make_payload(i)));
+        }
+        std::shuffle(handles.begin(), handles.end(), rng);
+        timer.start();
+        for (typename A::Handle h : handles) {
+            a.remove(h);
+        }
+        return timer.elapsed_ns();
+    });
+    report.add(name, "remove_random", "", LIVE_COUNT, ns);
+
+    //Texture streaming: a steady population where random residents are evicted and replaced,
+    //with a couple of lookups per upload
+    {
+        const uint32_t churn_ops = LIVE_COUNT * 2;
+        ns = bench_median_ns(RUNS, [&]() {
+            A a;
+            std::vector<typename A::Handle> handles = fill_with_holes(a, 0.75f, rng);
+            std::uniform_int_distribution<uint32_t> pick(0, (uint32_t)handles.size() - 1);
+            std::vector<uint32_t> victims(churn_ops);
+            for (uint32_t& v : victims) v = pick(rng);
+
+            uint64_t sum = 0;
+            timer.start();
+            for (uint32_t i = 0; i < churn_ops; i++) {
+                uint32_t v = victims[i];
+                a.remove(handles[v]);
+                handles[v] = a.insert(make_payload(i));
+                sum += a.get(handles[v])->id;
+                sum += a.get(handles[victims[(i + 1) % churn_ops]])->id;
+            }
+            double t = timer.elapsed_ns();
+            bench_sink = bench_sink + sum;
+            return t;
+        });
+        report.add(name, "churn_streaming", "fill=0.75", churn_ops, ns);
+    }
+
+    //Per-frame transients: a batch is created, touched, walked and freed every frame
+    {
+        const uint32_t frames = 256;
+        const uint32_t per_frame = 1024;
+        ns = bench_median_ns(RUNS, [&]() {
+            A a;
+            std::vector<typename A::Handle> handles;
+            handles.reserve(per_frame);
+            uint64_t sum = 0;
+            timer.start();
+            for (uint32_t f = 0; f < frames; f++) {
+                for (uint32_t i = 0; i < per_frame; i++) {
+                    handles.push_back(a.insert(make_payload(i)));
+                }
+                for (typename A::Handle h : handles) {
+                    sum += a.get(h)->id;
+                }
+                a.for_each([&](Payload& p) { sum += p.id; });
+                for (typename A::Handle h : handles) {
+                    a.remove(h);
+                }
+                handles.clear();
+            }
+            double t = timer.elapsed_ns();
+            bench_sink = bench_sink + sum;
+            return t;
+        });
+        report.add(name, "churn_transient", "batch=1024", (uint64_t)frames * per_frame, ns);
+    }
+}
+
+//Several threads inserting, reading back and removing their own elements at once
+template<typename Insert, typename Get, typename Remove>
+static double threaded_churn(uint32_t thread_count, uint32_t ops_per_thread, Insert&& insert, Get&& get, Remove&& remove) {
+    std::vector<std::thread> threads;
+    BenchTimer timer;
+    timer.start();
+    for (uint32_t t = 0; t < thread_count; t++) {
+        threads.emplace_back([&, t]() {
+            std::vector<Key<Payload>> mine;
+            mine.reserve(256);
+            uint64_t sum = 0;
+            for (uint32_t i = 0; i < ops_per_thread; i++) {
+                if (mine.size() < 256) {
+                    mine.push_back(insert(make_payload(t)));
+                } else {
+                    Key<Payload> k = mine[i % 256];
+                    sum += get(k);
+                    remove(k);
+                    mine[i % 256] = mine.back();
+                    mine.pop_back();
+                }
+            }
+            for (Key<Payload> k : mine) remove(k);
+            bench_sink = bench_sink + sum;
+        });
+    }
+    for (std::thread& th : threads) th.join();
+    return timer.elapsed_ns();
+}
+
+static void run_threaded_suite(BenchReport& report) {
+    uint32_t thread_count = std::max(2u, std::min(8u, std::thread::hardware_concurrency()));
+    const uint32_t ops_per_thread = 1 << 18;
+    char params[32];
+    snprintf(params, sizeof(params), "threads=%u", thread_count);
+
+    double ns = bench_median_ns(RUNS, [&]() {
+        slotmap<Payload> map;
+        map.alloc(CAPACITY);
+        std::mutex m;
+        return threaded_churn(
+            thread_count,
+            ops_per_thread,
+            [&](const Payload& p) { std::lock_guard<std::mutex> lock(m); return map.insert(p); },
+            [&](Key<Payload> k) { std::lock_guard<std::mutex> lock(m); return map.get(k)->id; },
+            [&](Key<Payload> k) { std::lock_guard<std::mutex> lock(m); map.remove(EXTRACT_IDX(k.value())); }
+        );
+    });
+    report.add("slotmap+mutex", "churn_threaded", params, (uint64_t)thread_count * ops_per_thread, ns);
+
+    ns = bench_median_ns(RUNS, [&]() {
+        concurrent_slotmap<Payload> map;
+        map.alloc(CAPACITY);
+        return threaded_churn(
+            thread_count,
+            ops_per_thread,
+            [&](const Payload& p) { return map.insert(p); },
+            [&](Key<Payload> k) {
+                Payload p;
+                return map.try_read(k, p) ? p.id : 0;
+            },
+            [&](Key<Payload> k) { map.remove(EXTRACT_IDX(k.value())); }
+        );
+    });
+    report.add("concurrent_slotmap", "churn_threaded", params, (uint64_t)thread_count * ops_per_thread, ns);
+}
+
+int main(int argc, char** argv) {
+    const char* out_path = argc > 1 ? argv[1] : "slotmap_bench.json";
+
+    BenchReport report;
+    report.name = "slotmap";
+    run_suite<VectorAdapter>(report, "vector");
+    run_suite<SlotmapAdapter<slotmap<Payload>>>(report, "slotmap");
+    run_suite<SlotmapAdapter<dense_slotmap<Payload>>>(report, "dense_slotmap");
+    run_suite<SlotmapAdapter<paged_slotmap<Payload>>>(report, "paged_slotmap");
+    run_suite<SlotmapAdapter<concurrent_slotmap<Payload>>>(report, "concurrent_slotmap");
+    run_suite<UnorderedMapAdapter>(report, "std::unordered_map");
+    run_threaded_suite(report);
+
+    report.print();
+    if (!report.write_json(out_path)) return -1;
+    printf("Wrote %s\n", out_path);
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <random>
+#include <string.h>
+#include "bench.h"
+#include "../vertex_conversion.h"
+
+//Throughput of the glTF accessor conversion kernels on each instruction set the CPU supports
+//ops are vertices, so Mops/s reads as millions of vertices per second
+//Usage: VertexConversionBench [output.json]
+
+static constexpr uint32_t VERTEX_COUNT = 1 << 20;
+static constexpr uint32_t RUNS = 7;
+static constexpr uint32_t RNG_SEED = 0x50524F52;
+
+//Interleaved vertex as an exporter might write it: position, normal, uv, color
+static constexpr size_t INTERLEAVED_STRIDE = 36;
+
+static std::vector<uint8_t> make_source(size_t stride, std::mt19937& rng) {
+    std::vector<uint8_t> bytes(VERTEX_COUNT * stride);
+    std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+    for (size_t i = 0; i + sizeof(float) <= bytes.size(); i += sizeof(float)) {
+        float f = dist(rng);
+        memcpy(&bytes[i], &f, sizeof(f));
+    }
+    return bytes;
+}
+
+template<typename F>
+static void bench_case(BenchReport& report, const std::string& subject, const std::string& test, const std::string& params, F&& run) {
+    BenchTimer timer;
+    double ns = bench_median_ns(RUNS, [&]() {
+        timer.start();
+        run();
+        return timer.elapsed_ns();
+    });
+    report.add(subject, test, params, VERTEX_COUNT, ns);
+}
+
+//What the loader did before the kernels: element by element with emplace_back
+static void run_baseline(BenchReport& report, const std::vector<uint8_t>& packed) {
+    bench_case(report, "emplace_back", "float3 -> float4", "stride 12", [&]() {
+        std::vector<float> out;
+        out.reserve(4 * VERTEX_COUNT);
+        for (uint32_t i = 0; i < VERTEX_COUNT; i++) {
+            float p[3];
+            memcpy(p, &packed[12 * i], sizeof(p));
+            out.emplace_back(p[0]);
+            out.emplace_back(p[1]);
+            out.emplace_back(p[2]);
+            out.emplace_back(1.0f);
+        }
+        bench_sink = bench_sink + (uint64_t)out[4 * (VERTEX_COUNT - 1)];
+    });
+}
+
+static void run_suite(BenchReport& report, ConversionIsa isa, const std::vector<uint8_t>& packed, const std::vector<uint8_t>& interleaved) {
+    set_conversion_isa(isa);
+    std::string name = conversion_isa_name(isa);
+    std::vector<float> out(4 * VERTEX_COUNT);
+    std::vector<uint8_t> gathered(16 * VERTEX_COUNT);
+
+    bench_case(report, name, "float3 -> float4", "stride 12", [&]() {
+        convert_float3_to_float4(packed.data(), 12, VERTEX_COUNT, 1.0f, out.data());
+        bench_sink = bench_sink + (uint64_t)out[4 * (VERTEX_COUNT - 1)];
+    });
+    bench_case(report, name, "float3 -> float4", "stride 36", [&]() {
+        convert_float3_to_float4(interleaved.data(), INTERLEAVED_STRIDE, VERTEX_COUNT, 1.0f, out.data());
+        bench_sink = bench_sink + (uint64_t)out[4 * (VERTEX_COUNT - 1)];
+    });
+    bench_case(report, name, "unorm8x4 -> float4", "stride 4", [&]() {
+        convert_normalized_to_float(packed.data(), 4, VERTEX_COUNT, NORMALIZED_UNORM8, 4, 4, 1.0f, out.data());
+        bench_sink = bench_sink + (uint64_t)out[4 * (VERTEX_COUNT - 1)];
+    });
+    bench_case(report, name, "unorm8x3 -> float4", "stride 36", [&]() {
+        convert_normalized_to_float(interleaved.data() + 32, INTERLEAVED_STRIDE, VERTEX_COUNT, NORMALIZED_UNORM8, 3, 4, 1.0f, out.data());
+        bench_sink = bench_sink + (uint64_t)out[4 * (VERTEX_COUNT - 1)];
+    });
+    bench_case(report, name, "unorm16x2 -> float2", "stride 4", [&]() {
+        convert_normalized_to_float(packed.data(), 4, VERTEX_COUNT, NORMALIZED_UNORM16, 2, 2, 0.0f, out.data());
+        bench_sink = bench_sink + (uint64_t)out[2 * (VERTEX_COUNT - 1)];
+    });
+    bench_case(report, name, "snorm16x4 -> float4", "stride 8", [&]() {
+        convert_normalized_to_float(packed.data(), 8, VERTEX_COUNT, NORMALIZED_SNORM16, 4, 4, 0.0f, out.data());
+        bench_sink = bench_sink + (uint64_t)out[4 * (VERTEX_COUNT - 1)];
+    });
+    bench_case(report, name, "gather 8 bytes", "stride 36", [&]() {
+        gather_strided(interleaved.data() + 24, INTERLEAVED_STRIDE, VERTEX_COUNT, 8, gathered.data());
+        bench_sink = bench_sink + gathered[8 * (VERTEX_COUNT - 1)];
+    });
+    bench_case(report, name, "gather 4 bytes", "stride 36", [&]() {
+        gather_strided(interleaved.data() + 32, INTERLEAVED_STRIDE, VERTEX_COUNT, 4, gathered.data());
+        bench_sink = bench_sink + gathered[4 * (VERTEX_COUNT - 1)];
+    });
+    bench_case(report, name, "gather 16 bytes", "stride 36", [&]() {
+        gather_strided(interleaved.data(), INTERLEAVED_STRIDE, VERTEX_COUNT, 16, gathered.data());
+        bench_sink = bench_sink + gathered[16 * (VERTEX_COUNT - 1)];
+    });
+}
+
+int main(int argc, char** argv) {
+    const char* out_path = argc > 1 ? argv[1] : "vertex_conversion_bench.json";
+
+    std::mt19937 rng(RNG_SEED);
+    std::vector<uint8_t> packed = make_source(16, rng);
+    std::vector<uint8_t> interleaved = make_source(INTERLEAVED_STRIDE, rng);
+
+    BenchReport report;
+    report.name = "vertex_conversion";
+    run_baseline(report, packed);
+    ConversionIsa supported = supported_conversion_isa();
+    for (uint32_t isa = 0; isa <= (uint32_t)supported; isa++) {
+        //Same kernels as sse2
+        if (isa == CONVERSION_ISA_SSSE3) continue;
+        run_suite(report, (ConversionIsa)isa, packed, interleaved);
+    }
+    set_conversion_isa(supported);
+
+    report.print();
+    if (!report.write_json(out_path)) return -1;
+    printf("Wrote %s\n", out_path);
+    return 0;
+}
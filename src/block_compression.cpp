@@ -0,0 +1,493 @@
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "block_compression.h"
+#include "mip_generation.h"
+
+//Texels of one block as floats, RGBA
+typedef float BlockTexels[16][4];
+
+const char* block_format_name(BlockFormat format) {
+	switch (format) {
+		case BLOCK_FORMAT_BC1: return "BC1";
+		case BLOCK_FORMAT_BC3: return "BC3";
+		case BLOCK_FORMAT_BC4: return "BC4";
+		case BLOCK_FORMAT_BC5: return "BC5";
+		case BLOCK_FORMAT_BC7: return "BC7";
+	}
+	return "unknown";
+}
+
+uint32_t block_bytes(BlockFormat format) {
+	switch (format) {
+		case BLOCK_FORMAT_BC1:
+		case BLOCK_FORMAT_BC4:
+			return 8;
+		default:
+			return 16;
+	}
+}
+
+size_t block_compressed_size(BlockFormat format, uint32_t width, uint32_t height) {
+	return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * block_bytes(format);
+}
+
+size_t block_compressed_mip_chain_size(BlockFormat format, uint32_t width, uint32_t height, uint32_t mip_count) {
+	size_t size = 0;
+	for (uint32_t i = 0; i < mip_count; i++) {
+		size += block_compressed_size(format, std::max(width >> i, 1u), std::max(height >> i, 1u));
+	}
+	return size;
+}
+
+static void load_block_texels(const uint8_t pixels[64], BlockTexels& texels) {
+	for (uint32_t i = 0; i < 16; i++) {
+		for (uint32_t c = 0; c < 4; c++) {
+			texels[i][c] = pixels[4 * i + c];
+		}
+	}
+}
+
+//Mean of the first dims channels and the direction they vary along the most
+//axis is all zeros when every texel is the same
+static void principal_axis(const BlockTexels& texels, uint32_t dims, float mean[4], float axis[4]) {
+	for (uint32_t c = 0; c < 4; c++) {
+		mean[c] = 0.0f;
+		axis[c] = 0.0f;
+	}
+	for (uint32_t i = 0; i < 16; i++) {
+		for (uint32_t c = 0; c < dims; c++) mean[c] += texels[i][c];
+	}
+	for (uint32_t c = 0; c < dims; c++) mean[c] /= 16.0f;
+
+	float covariance[4][4] = {};
+	for (uint32_t i = 0; i < 16; i++) {
+		float d[4];
+		for (uint32_t c = 0; c < dims; c++) d[c] = texels[i][c] - mean[c];
+		for (uint32_t a = 0; a < dims; a++) {
+			for (uint32_t b = 0; b < dims; b++) covariance[a][b] += d[a] * d[b];
+		}
+	}
+
+	//Start from the channel with the largest spread so anticorrelated channels still converge
+	uint32_t widest = 0;
+	for (uint32_t c = 1; c < dims; c++) {
+		if (covariance[c][c] > covariance[widest][widest]) widest = c;
+	}
+	if (covariance[widest][widest] < 1e-4f) return;
+
+	float v[4] = {};
+	for (uint32_t c = 0; c < dims; c++) v[c] = covariance[widest][c];
+	for (uint32_t iteration = 0; iteration < 8; iteration++) {
+		float next[4] = {};
+		for (uint32_t a = 0; a < dims; a++) {
+			for (uint32_t b = 0; b < dims; b++) next[a] += covariance[a][b] * v[b];
+		}
+		float length = 0.0f;
+		for (uint32_t c = 0; c < dims; c++) length += next[c] * next[c];
+		if (length < 1e-12f) break;
+		length = 1.0f / sqrtf(length);
+		for (uint32_t c = 0; c < dims; c++) v[c] = next[c] * length;
+	}
+
+	float length = 0.0f;
+	for (uint32_t c = 0; c < dims; c++) length += v[c] * v[c];
+	if (length < 1e-12f) return;
+	length = 1.0f / sqrtf(length);
+	for (uint32_t c = 0; c < dims; c++) axis[c] = v[c] * length;
+}
+
+//Endpoints at the extremes of the texels' projections onto their principal axis
+static void axis_endpoints(const BlockTexels& texels, uint32_t dims, float e0[4], float e1[4]) {
+	float mean[4], axis[4];
+	principal_axis(texels, dims, mean, axis);
+
+	float min_t = 0.0f, max_t = 0.0f;
+	for (uint32_t i = 0; i < 16; i++) {
+		float t = 0.0f;
+		for (uint32_t c = 0; c < dims; c++) t += (texels[i][c] - mean[c]) * axis[c];
+		min_t = std::min(min_t, t);
+		max_t = std::max(max_t, t);
+	}
+	for (uint32_t c = 0; c < 4; c++) {
+		e0[c] = std::clamp(mean[c] + axis[c] * max_t, 0.0f, 255.0f);
+		e1[c] = std::clamp(mean[c] + axis[c] * min_t, 0.0f, 255.0f);
+	}
+}
+
+//Endpoints that minimize the squared error of the texels given which palette entry each one uses
+//weights[i] is how much of e1 is in palette entry i. Returns false when the fit is degenerate
+static bool least_squares_endpoints(const BlockTexels& texels, uint32_t dims, const uint8_t indices[16], const float* weights, float e0[4], float e1[4]) {
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[4] = {}, bx[4] = {};
+	for (uint32_t i = 0; i < 16; i++) {
+		float b = weights[indices[i]];
+		float a = 1.0f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (uint32_t c = 0; c < dims; c++) {
+			ax[c] += a * texels[i][c];
+			bx[c] += b * texels[i][c];
+		}
+	}
+
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f) return false;
+	det = 1.0f / det;
+	for (uint32_t c = 0; c < dims; c++) {
+		e0[c] = std::clamp((bb * ax[c] - ab * bx[c]) * det, 0.0f, 255.0f);
+		e1[c] = std::clamp((aa * bx[c] - ab * ax[c]) * det, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+//Picks the nearest of palette_size entries for every texel and returns the total squared error
+static float select_indices(const BlockTexels& texels, uint32_t dims, const float palette[][4], uint32_t palette_size, uint8_t indices[16]) {
+	float total = 0.0f;
+	for (uint32_t i = 0; i < 16; i++) {
+		float best = 1e30f;
+		uint8_t best_idx = 0;
+		for (uint32_t p = 0; p < palette_size; p++) {
+			float error = 0.0f;
+			for (uint32_t c = 0; c < dims; c++) {
+				float d = texels[i][c] - palette[p][c];
+				error += d * d;
+			}
+			if (error < best) {
+				best = error;
+				best_idx = (uint8_t)p;
+			}
+		}
+		indices[i] = best_idx;
+		total += best;
+	}
+	return total;
+}
+
+//BC1 color
+
+static uint16_t pack_565(const float color[4]) {
+	uint32_t r = (uint32_t)std::clamp((int)(color[0] * (31.0f / 255.0f) + 0.5f), 0, 31);
+	uint32_t g = (uint32_t)std::clamp((int)(color[1] * (63.0f / 255.0f) + 0.5f), 0, 63);
+	uint32_t b = (uint32_t)std::clamp((int)(color[2] * (31.0f / 255.0f) + 0.5f), 0, 31);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void unpack_565(uint16_t packed, float color[4]) {
+	uint32_t r = (packed >> 11) & 31;
+	uint32_t g = (packed >> 5) & 63;
+	uint32_t b = packed & 31;
+	color[0] = (float)((r << 3) | (r >> 2));
+	color[1] = (float)((g << 2) | (g >> 4));
+	color[2] = (float)((b << 3) | (b >> 2));
+	color[3] = 255.0f;
+}
+
+//Share of color1 in each four color mode palette entry
+static const float BC1_WEIGHTS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+//Quantizes the endpoints to a four color mode block and returns its squared error
+static float try_bc1_endpoints(const BlockTexels& texels, const float e0[4], const float e1[4], uint16_t* out_c0, uint16_t* out_c1, uint8_t indices[16]) {
+	uint16_t c0 = pack_565(e0);
+	uint16_t c1 = pack_565(e1);
+	if (c0 < c1) std::swap(c0, c1);
+
+	float palette[4][4];
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+	for (uint32_t c = 0; c < 3; c++) {
+		palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+		palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+	}
+
+	*out_c0 = c0;
+	*out_c1 = c1;
+
+	//Equal endpoints would make this a three color block, so only the first entry is safe to use
+	return select_indices(texels, 3, palette, c0 == c1 ? 1 : 4, indices);
+}
+
+static void compress_bc1_color(const BlockTexels& texels, uint8_t out[8]) {
+	float e0[4], e1[4];
+	axis_endpoints(texels, 3, e0, e1);
+
+	//Pull the endpoints in a little, since the extremes are usually outliers
+	for (uint32_t c = 0; c < 3; c++) {
+		float inset = (e0[c] - e1[c]) / 16.0f;
+		e0[c] -= inset;
+		e1[c] += inset;
+	}
+
+	uint16_t c0, c1;
+	uint8_t indices[16];
+	float error = try_bc1_endpoints(texels, e0, e1, &c0, &c1, indices);
+
+	//One round of refining the endpoints against the chosen indices
+	if (error > 0.0f && c0 != c1 && least_squares_endpoints(texels, 3, indices, BC1_WEIGHTS, e0, e1)) {
+		uint16_t refined_c0, refined_c1;
+		uint8_t refined_indices[16];
+		float refined_error = try_bc1_endpoints(texels, e0, e1, &refined_c0, &refined_c1, refined_indices);
+		if (refined_error < error) {
+			c0 = refined_c0;
+			c1 = refined_c1;
+			memcpy(indices, refined_indices, sizeof(indices));
+		}
+	}
+
+	uint32_t packed_indices = 0;
+	for (uint32_t i = 0; i < 16; i++) {
+		packed_indices |= (uint32_t)indices[i] << (2 * i);
+	}
+
+	out[0] = (uint8_t)(c0 & 0xFF);
+	out[1] = (uint8_t)(c0 >> 8);
+	out[2] = (uint8_t)(c1 & 0xFF);
+	out[3] = (uint8_t)(c1 >> 8);
+	for (uint32_t i = 0; i < 4; i++) {
+		out[4 + i] = (uint8_t)(packed_indices >> (8 * i));
+	}
+}
+
+void compress_block_bc1(const uint8_t pixels[64], uint8_t out[8]) {
+	BlockTexels texels;
+	load_block_texels(pixels, texels);
+	compress_bc1_color(texels, out);
+}
+
+//BC4 single channel
+
+void compress_block_bc4(const uint8_t pixels[64], uint32_t channel, uint8_t out[8]) {
+	uint8_t lo = 255, hi = 0;
+	for (uint32_t i = 0; i < 16; i++) {
+		lo = std::min(lo, pixels[4 * i + channel]);
+		hi = std::max(hi, pixels[4 * i + channel]);
+	}
+
+	memset(out, 0, 8);
+	out[0] = hi;
+	out[1] = lo;
+	if (hi == lo) return;
+
+	//hi > lo selects the eight value mode
+	float palette[8];
+	palette[0] = hi;
+	palette[1] = lo;
+	for (uint32_t p = 2; p < 8; p++) {
+		palette[p] = ((8 - p) * (float)hi + (p - 1) * (float)lo) / 7.0f;
+	}
+
+	uint64_t packed_indices = 0;
+	for (uint32_t i = 0; i < 16; i++) {
+		float value = pixels[4 * i + channel];
+		float best = 1e30f;
+		uint64_t best_idx = 0;
+		for (uint32_t p = 0; p < 8; p++) {
+			float d = fabsf(value - palette[p]);
+			if (d < best) {
+				best = d;
+				best_idx = p;
+			}
+		}
+		packed_indices |= best_idx << (3 * i);
+	}
+
+	for (uint32_t i = 0; i < 6; i++) {
+		out[2 + i] = (uint8_t)(packed_indices >> (8 * i));
+	}
+}
+
+void compress_block_bc3(const uint8_t pixels[64], uint8_t out[16]) {
+	compress_block_bc4(pixels, 3, out);
+	compress_block_bc1(pixels, out + 8);
+}
+
+void compress_block_bc5(const uint8_t pixels[64], uint8_t out[16]) {
+	compress_block_bc4(pixels, 0, out);
+	compress_block_bc4(pixels, 1, out + 8);
+}
+
+//BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a p-bit each, 4 bit indices
+
+static const uint32_t BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct Bc7Endpoint {
+	uint8_t q[4];		//7 bit channels
+	uint8_t p;
+};
+
+static Bc7Endpoint quantize_bc7_endpoint(const float e[4]) {
+	Bc7Endpoint best = {};
+	float best_error = 1e30f;
+	for (uint8_t p = 0; p < 2; p++) {
+		Bc7Endpoint candidate = {};
+		candidate.p = p;
+		float error = 0.0f;
+		for (uint32_t c = 0; c < 4; c++) {
+			int q = std::clamp((int)floorf((e[c] - p) * 0.5f + 0.5f), 0, 127);
+			candidate.q[c] = (uint8_t)q;
+			float d = (float)((q << 1) | p) - e[c];
+			error += d * d;
+		}
+		if (error < best_error) {
+			best_error = error;
+			best = candidate;
+		}
+	}
+	return best;
+}
+
+static float try_bc7_endpoints(const BlockTexels& texels, const float e0[4], const float e1[4], Bc7Endpoint* out_q0, Bc7Endpoint* out_q1, uint8_t indices[16]) {
+	Bc7Endpoint q0 = quantize_bc7_endpoint(e0);
+	Bc7Endpoint q1 = quantize_bc7_endpoint(e1);
+
+	float palette[16][4];
+	for (uint32_t p = 0; p < 16; p++) {
+		for (uint32_t c = 0; c < 4; c++) {
+			uint32_t a = (q0.q[c] << 1) | q0.p;
+			uint32_t b = (q1.q[c] << 1) | q1.p;
+			palette[p][c] = (float)(((64 - BC7_WEIGHTS4[p]) * a + BC7_WEIGHTS4[p] * b + 32) >> 6);
+		}
+	}
+
+	*out_q0 = q0;
+	*out_q1 = q1;
+
+	//The palette is a line, so project onto it and only compare the entries either side of the projection
+	float d[4];
+	float dd = 0.0f;
+	for (uint32_t c = 0; c < 4; c++) {
+		d[c] = palette[15][c] - palette[0][c];
+		dd += d[c] * d[c];
+	}
+	if (dd < 1e-6f) return select_indices(texels, 4, palette, 1, indices);
+
+	float total = 0.0f;
+	for (uint32_t i = 0; i < 16; i++) {
+		float t = 0.0f;
+		for (uint32_t c = 0; c < 4; c++) t += (texels[i][c] - palette[0][c]) * d[c];
+		t = std::clamp(t / dd * 64.0f, 0.0f, 64.0f);
+
+		uint32_t guess = 0;
+		while (guess < 15 && BC7_WEIGHTS4[guess + 1] <= t) guess += 1;
+
+		float best = 1e30f;
+		uint8_t best_idx = 0;
+		for (uint32_t p = guess > 0 ? guess - 1 : 0; p <= std::min(guess + 2, 15u); p++) {
+			float error = 0.0f;
+			for (uint32_t c = 0; c < 4; c++) {
+				float e = texels[i][c] - palette[p][c];
+				error += e * e;
+			}
+			if (error < best) {
+				best = error;
+				best_idx = (uint8_t)p;
+			}
+		}
+		indices[i] = best_idx;
+		total += best;
+	}
+	return total;
+}
+
+//Writes value LSB first at bit position *bit
+static void put_bits(uint8_t* out, uint32_t* bit, uint32_t value, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		if ((value >> i) & 1) out[*bit >> 3] |= (uint8_t)(1 << (*bit & 7));
+		*bit += 1;
+	}
+}
+
+void compress_block_bc7(const uint8_t pixels[64], uint8_t out[16]) {
+	BlockTexels texels;
+	load_block_texels(pixels, texels);
+
+	float e0[4], e1[4];
+	axis_endpoints(texels, 4, e0, e1);
+
+	Bc7Endpoint q0, q1;
+	uint8_t indices[16];
+	float error = try_bc7_endpoints(texels, e0, e1, &q0, &q1, indices);
+
+	if (error > 0.0f) {
+		float weights[16];
+		for (uint32_t p = 0; p < 16; p++) weights[p] = BC7_WEIGHTS4[p] / 64.0f;
+		if (least_squares_endpoints(texels, 4, indices, weights, e0, e1)) {
+			Bc7Endpoint refined_q0, refined_q1;
+			uint8_t refined_indices[16];
+			float refined_error = try_bc7_endpoints(texels, e0, e1, &refined_q0, &refined_q1, refined_indices);
+			if (refined_error < error) {
+				q0 = refined_q0;
+				q1 = refined_q1;
+				memcpy(indices, refined_indices, sizeof(indices));
+			}
+		}
+	}
+
+	//The first texel's index is stored without its top bit, so it has to be in the lower half
+	if (indices[0] & 8) {
+		std::swap(q0, q1);
+		for (uint32_t i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+	}
+
+	memset(out, 0, 16);
+	uint32_t bit = 0;
+	put_bits(out, &bit, 1 << 6, 7);
+	for (uint32_t c = 0; c < 4; c++) {
+		put_bits(out, &bit, q0.q[c], 7);
+		put_bits(out, &bit, q1.q[c], 7);
+	}
+	put_bits(out, &bit, q0.p, 1);
+	put_bits(out, &bit, q1.p, 1);
+	put_bits(out, &bit, indices[0], 3);
+	for (uint32_t i = 1; i < 16; i++) {
+		put_bits(out, &bit, indices[i], 4);
+	}
+}
+
+void compress_image(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* out) {
+	uint32_t blocks_x = (width + 3) / 4;
+	uint32_t blocks_y = (height + 3) / 4;
+	uint32_t out_block_bytes = block_bytes(format);
+
+	uint8_t block[64];
+	for (uint32_t by = 0; by < blocks_y; by++) {
+		for (uint32_t bx = 0; bx < blocks_x; bx++) {
+			for (uint32_t y = 0; y < 4; y++) {
+				uint32_t sy = std::min(4 * by + y, height - 1);
+				for (uint32_t x = 0; x < 4; x++) {
+					uint32_t sx = std::min(4 * bx + x, width - 1);
+					memcpy(&block[4 * (4 * y + x)], &rgba[4 * ((size_t)sy * width + sx)], 4);
+				}
+			}
+
+			switch (format) {
+				case BLOCK_FORMAT_BC1: compress_block_bc1(block, out); break;
+				case BLOCK_FORMAT_BC3: compress_block_bc3(block, out); break;
+				case BLOCK_FORMAT_BC4: compress_block_bc4(block, 0, out); break;
+				case BLOCK_FORMAT_BC5: compress_block_bc5(block, out); break;
+				case BLOCK_FORMAT_BC7: compress_block_bc7(block, out); break;
+			}
+			out += out_block_bytes;
+		}
+	}
+}
+
+void compress_mip_chain(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t mip_count, bool srgb, uint8_t* out) {
+	std::vector<uint8_t> levels[2];
+	const uint8_t* level = rgba;
+	for (uint32_t i = 0; i < mip_count; i++) {
+		compress_image(format, level, width, height, out);
+		out += block_compressed_size(format, width, height);
+
+		if (i + 1 < mip_count) {
+			std::vector<uint8_t>& next = levels[i & 1];
+			next.resize(4 * (size_t)std::max(width >> 1, 1u) * std::max(height >> 1, 1u));
+			downsample_rgba8(level, width, height, srgb, next.data());
+			level = next.data();
+			width = std::max(width >> 1, 1u);
+			height = std::max(height >> 1, 1u);
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//CPU encoders for the BCn block-compressed texture formats
+//Every encoder takes RGBA8 pixels and writes 4x4 blocks left to right, top to bottom.
+//Blocks hanging over the right or bottom edge repeat the image's last column and row.
+
+enum BlockFormat {
+	BLOCK_FORMAT_BC1,		//RGB at 4 bits per texel, always in four color mode
+	BLOCK_FORMAT_BC3,		//BC1 color plus a BC4 alpha block, 8 bits per texel
+	BLOCK_FORMAT_BC4,		//R only, 4 bits per texel
+	BLOCK_FORMAT_BC5,		//R and G as two BC4 blocks, 8 bits per texel
+	BLOCK_FORMAT_BC7		//RGBA at 8 bits per texel. Only mode 6 is emitted
+};
+
+const char* block_format_name(BlockFormat format);
+
+//Bytes per 4x4 block
+uint32_t block_bytes(BlockFormat format);
+
+size_t block_compressed_size(BlockFormat format, uint32_t width, uint32_t height);
+
+//Size of mip_count levels stored one after another, largest first
+size_t block_compressed_mip_chain_size(BlockFormat format, uint32_t width, uint32_t height, uint32_t mip_count);
+
+//One block from 16 RGBA8 texels in row-major order
+void compress_block_bc1(const uint8_t pixels[64], uint8_t out[8]);
+void compress_block_bc3(const uint8_t pixels[64], uint8_t out[16]);
+void compress_block_bc4(const uint8_t pixels[64], uint32_t channel, uint8_t out[8]);
+void compress_block_bc5(const uint8_t pixels[64], uint8_t out[16]);
+void compress_block_bc7(const uint8_t pixels[64], uint8_t out[16]);
+
+//out must hold block_compressed_size() bytes
+void compress_image(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* out);
+
+//Compresses mip_count levels, each made by downsampling the one before it with downsample_rgba8()
+//out must hold block_compressed_mip_chain_size() bytes
+void compress_mip_chain(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t mip_count, bool srgb, uint8_t* out);
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string.h>
+#include <type_traits>
+#include <stdio.h>
+#include <stdlib.h>
+#include "slotmap.h"
+
+//Slotmap variant that can be shared between threads without a lock
+//get() and iteration are wait-free: they only load a slot's generation word.
+//insert() and remove() go through a tagged lock-free free list and only contend
+//with each other on its head. Storage is allocated in fixed-size chunks the first
+//time a chunk is needed and is never moved, so element pointers stay put.
+//
+//A pointer from get() is valid until the element is removed; callers that may race
+//with remove() should copy the element out with try_read() instead, or defer removal
+//the way the device's deletion queues do.
+//
+//try_read() is a seqlock read: the slot's generation is checked, the value copied with
+//relaxed atomic loads, then the generation checked again behind an acquire fence.
+//insert() writes values with relaxed atomic stores behind a release fence, so a reader
+//that sees any byte of a newer value also sees the generation that invalidates its key.
+template<typename T, typename Tkey = Key<T>>
+struct concurrent_slotmap {
+    static_assert(std::is_trivially_copyable_v<T>, "concurrent_slotmap elements are copied word by word through atomics");
+    static constexpr uint32_t CHUNK_SLOTS = 1024;
+    static constexpr uint32_t NO_INDEX = 0xFFFFFFFF;
+
+    struct Slot {
+        std::atomic<uint32_t> generation;
+        std::atomic<uint32_t> next_free;
+        T value;
+    };
+
+    //Iterator impl for concurrent_slotmap
+    //Visits elements that were live at the moment the iterator reached them
+    struct iterator {
+        using Element = T;
+        using Pointer = Element*;
+        using Reference = Element&;
+
+        iterator(concurrent_slotmap* m, uint32_t i, uint32_t e) {
+            map = m;
+            idx = i;
+            end_idx = e;
+            skip_dead();
+        }
+        Reference operator*() const { return map->slot(idx)->value; }
+        Pointer operator->() { return &map->slot(idx)->value; }
+        iterator& operator++() {
+            idx += 1;
+            skip_dead();
+            return *this;
+        }
+        bool operator==(const iterator& other) { return idx == other.idx; }
+        bool operator!=(const iterator& other) { return idx != other.idx; }
+
+        uint32_t slot_index() {
+            return idx;
+        }
+
+        uint32_t generation_bits() {
+            return map->slot(idx)->generation.load(std::memory_order_acquire);
+        }
+
+    private:
+        void skip_dead() {
+            while (idx < end_idx) {
+                Slot* s = map->slot(idx);
+                if (s != nullptr && (s->generation.load(std::memory_order_acquire) & LIVE_BIT)) break;
+                idx += 1;
+            }
+        }
+
+        concurrent_slotmap* map;
+        uint32_t idx;
+        uint32_t end_idx;
+    };
+    iterator begin() {
+        uint32_t e = _end_idx.load(std::memory_order_acquire);
+        return iterator(this, 0, e);
+    }
+
+    iterator end() {
+        uint32_t e = _end_idx.load(std::memory_order_acquire);
+        return iterator(this, e, e);
+    }
+
+    void alloc(uint32_t size);
+    uint32_t count();
+    T* get(Tkey key);
+    bool try_read(Tkey key, T& out);
+    Tkey insert(T thing);
+    void remove(uint32_t idx);
+    uint32_t size();
+
+    concurrent_slotmap() = default;
+    concurrent_slotmap(const concurrent_slotmap&) = delete;
+    concurrent_slotmap& operator=(const concurrent_slotmap&) = delete;
+    ~concurrent_slotmap();
+
+private:
+    //Widest word the value's size and alignment allow, so copies stay atomic per word without tearing bytes apart
+    using Word = std::conditional_t<alignof(T) % 8 == 0 && sizeof(T) % 8 == 0, uint64_t,
+                 std::conditional_t<alignof(T) % 4 == 0 && sizeof(T) % 4 == 0, uint32_t, unsigned char>>;
+    static constexpr size_t WORD_COUNT = sizeof(T) / sizeof(Word);
+
+    static void atomic_load_value(const T& src, T& dst) {
+        Word* s = reinterpret_cast<Word*>(const_cast<T*>(&src));
+        Word words[WORD_COUNT];
+        for (size_t i = 0; i < WORD_COUNT; i++) {
+            words[i] = std::atomic_ref<Word>(s[i]).load(std::memory_order_relaxed);
+        }
+        memcpy(static_cast<void*>(&dst), words, sizeof(T));
+    }
+
+    static void atomic_store_value(T& dst, const T& src) {
+        Word words[WORD_COUNT];
+        memcpy(words, &src, sizeof(T));
+        Word* d = reinterpret_cast<Word*>(&dst);
+        for (size_t i = 0; i < WORD_COUNT; i++) {
+            std::atomic_ref<Word>(d[i]).store(words[i], std::memory_order_relaxed);
+        }
+    }
+
+    Slot* slot(uint32_t idx) {
+        Slot* chunk = _chunks[idx / CHUNK_SLOTS].load(std::memory_order_acquire);
+        return chunk == nullptr ? nullptr : chunk + idx % CHUNK_SLOTS;
+    }
+
+    Slot* acquire_chunk(uint32_t chunk_idx);
+
+    std::unique_ptr<std::atomic<Slot*>[]> _chunks;
+    uint32_t _chunk_count = 0;
+    uint32_t _capacity = 0;
+    std::atomic<uint64_t> _free_head = NO_INDEX;        //ABA tag in the high 32 bits, slot index in the low 32 bits
+    std::atomic<uint32_t> _high_water = 0;
+    std::atomic<uint32_t> _end_idx = 0;
+    std::atomic<uint32_t> _count = 0;
+};
+
+template<typename T, typename Tkey>
+void concurrent_slotmap<T, Tkey>::alloc(uint32_t size) {
+    assert(_capacity == 0);
+    _capacity = size;
+    _chunk_count = (size + CHUNK_SLOTS - 1) / CHUNK_SLOTS;
+    _chunks = std::make_unique<std::atomic<Slot*>[]>(_chunk_count);
+    for (uint32_t i = 0; i < _chunk_count; i++) {
+        _chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+template<typename T, typename Tkey>
+uint32_t concurrent_slotmap<T, Tkey>::count() {
+    return _count.load(std::memory_order_relaxed);
+}
+
+template<typename T, typename Tkey>
+uint32_t concurrent_slotmap<T, Tkey>::size() {
+    return _capacity;
+}
+
+template<typename T, typename Tkey>
+typename concurrent_slotmap<T, Tkey>::Slot* concurrent_slotmap<T, Tkey>::acquire_chunk(uint32_t chunk_idx) {
+    Slot* chunk = _chunks[chunk_idx].load(std::memory_order_acquire);
+    if (chunk != nullptr) return chunk;
+
+    //Several threads can race to create the same chunk. The loser frees its copy
+    Slot* fresh = new Slot[CHUNK_SLOTS];
+    for (uint32_t i = 0; i < CHUNK_SLOTS; i++) {
+        fresh[i].generation.store(0, std::memory_order_relaxed);
+        fresh[i].next_free.store(NO_INDEX, std::memory_order_relaxed);
+    }
+    if (_chunks[chunk_idx].compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel, std::memory_order_acquire)) {
+        return fresh;
+    }
+    delete[] fresh;
+    return chunk;
+}
+
+template<typename T, typename Tkey>
+T* concurrent_slotmap<T, Tkey>::get(Tkey key) {
+    uint32_t idx = EXTRACT_IDX(key.value());
+    uint32_t gen = static_cast<uint32_t>(key.value() >> 32);
+    if (idx >= _capacity) return nullptr;
+
+    Slot* s = slot(idx);
+    T* d = nullptr;
+    if (s != nullptr && s->generation.load(std::memory_order_acquire) == gen) {
+        d = &s->value;
+    }
+    return d;
+}
+
+//Copies the element out, failing if it was removed before or during the copy
+//Generations only ever move forward, so a changed generation can't come back and there's nothing to retry
+//out is unspecified when this returns false
+template<typename T, typename Tkey>
+bool concurrent_slotmap<T, Tkey>::try_read(Tkey key, T& out) {
+    uint32_t idx = EXTRACT_IDX(key.value());
+    uint32_t gen = static_cast<uint32_t>(key.value() >> 32);
+    if (idx >= _capacity || !(gen & LIVE_BIT)) return false;
+
+    Slot* s = slot(idx);
+    if (s == nullptr || s->generation.load(std::memory_order_acquire) != gen) return false;
+    atomic_load_value(s->value, out);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return s->generation.load(std::memory_order_relaxed) == gen;
+}
+
+template<typename T, typename Tkey>
+Tkey concurrent_slotmap<T, Tkey>::insert(T thing) {
+    //Pop a recycled slot off the free list
+    uint32_t free_idx = NO_INDEX;
+    uint64_t head = _free_head.load(std::memory_order_acquire);
+    while (static_cast<uint32_t>(head) != NO_INDEX) {
+        uint32_t candidate = static_cast<uint32_t>(head);
+        uint32_t next = slot(candidate)->next_free.load(std::memory_order_relaxed);
+        uint64_t new_head = ((head >> 32) + 1) << 32 | next;
+        if (_free_head.compare_exchange_weak(head, new_head, std::memory_order_acquire, std::memory_order_acquire)) {
+            free_idx = candidate;
+            break;
+        }
+    }
+
+    //Otherwise take a never-used slot
+    if (free_idx == NO_INDEX) {
+        free_idx = _high_water.fetch_add(1, std::memory_order_relaxed);
+        if (free_idx >= _capacity) {
+            printf("concurrent_slotmap capacity of %u exceeded.\n", _capacity);
+            exit(-1);
+        }
+        acquire_chunk(free_idx / CHUNK_SLOTS);
+    }
+
+    //The fence keeps the value's stores after the remove() that retired the slot's last generation,
+    //which is what lets try_read() notice it copied part of this value
+    Slot* s = slot(free_idx);
+    std::atomic_thread_fence(std::memory_order_release);
+    atomic_store_value(s->value, thing);
+    uint32_t generation = s->generation.load(std::memory_order_relaxed) | LIVE_BIT;
+    s->generation.store(generation, std::memory_order_release);    //Publishes the value to readers
+    _count.fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t end = _end_idx.load(std::memory_order_relaxed);
+    while (free_idx >= end && !_end_idx.compare_exchange_weak(end, free_idx + 1, std::memory_order_release, std::memory_order_relaxed)) {}
+
+    uint64_t data = (static_cast<uint64_t>(generation) << 32) | static_cast<uint64_t>(free_idx);
+    return Tkey(data);
+}
+
+template<typename T, typename Tkey>
+void concurrent_slotmap<T, Tkey>::remove(uint32_t idx) {
+    Slot* s = slot(idx);
+    uint32_t generation = s->generation.load(std::memory_order_relaxed);
+    assert(generation & LIVE_BIT);
+    s->generation.store((generation & ~LIVE_BIT) + 1, std::memory_order_release);
+    _count.fetch_sub(1, std::memory_order_relaxed);
+
+    //Push the slot onto the free list
+    uint64_t head = _free_head.load(std::memory_order_relaxed);
+    uint64_t new_head;
+    do {
+        s->next_free.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        new_head = ((head >> 32) + 1) << 32 | idx;
+    } while (!_free_head.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed));
+}
+
+template<typename T, typename Tkey>
+concurrent_slotmap<T, Tkey>::~concurrent_slotmap() {
+    for (uint32_t i = 0; i < _chunk_count; i++) {
+        delete[] _chunks[i].load(std::memory_order_relaxed);
+    }
+}
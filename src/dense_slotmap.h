@@ -0,0 +1,169 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+#include "slotmap.h"
+
+//Slotmap variant that keeps live elements packed at the front of one array
+//Keys index a sparse table that points into the dense array, and removal swaps the
+//last element into the hole. Iteration is a linear walk over count() elements.
+//Removing an element moves another one, so pointers from get() are only valid until the next remove().
+template<typename T, typename Tkey = Key<T>>
+struct dense_slotmap {
+    //Iterator impl for dense_slotmap
+    struct iterator {
+        using Element = T;
+        using Pointer = Element*;
+        using Reference = Element&;
+
+        iterator(dense_slotmap* m, uint32_t i) {
+            map = m;
+            dense_idx = i;
+        }
+        Reference operator*() const { return map->_data[dense_idx]; }
+        Pointer operator->() { return &map->_data[dense_idx]; }
+        iterator& operator++() {
+            dense_idx += 1;
+            return *this;
+        }
+        bool operator==(const iterator& other) { return dense_idx == other.dense_idx; }
+        bool operator!=(const iterator& other) { return dense_idx != other.dense_idx; }
+
+        //Index of the element's slot, i.e. the index stored in its key
+        uint32_t slot_index() {
+            return map->_dense_to_sparse[dense_idx];
+        }
+
+        uint32_t generation_bits() {
+            return map->_sparse[slot_index()].generation;
+        }
+
+    private:
+        dense_slotmap* map;
+        uint32_t dense_idx;
+    };
+    iterator begin() {
+        return iterator(this, 0);
+    }
+
+    iterator end() {
+        return iterator(this, _count);
+    }
+
+    void alloc(uint32_t size);
+    uint32_t count();
+    void clear();
+    T* data();
+    T* get(Tkey key);
+    Tkey insert(T thing);
+    void remove(uint32_t idx);
+    uint32_t size();
+
+private:
+    struct SparseSlot {
+        uint32_t dense_idx;
+        uint32_t generation;
+    };
+
+    std::vector<T> _data = {};
+    std::vector<uint32_t> _dense_to_sparse = {};
+    std::vector<SparseSlot> _sparse = {};
+    std::vector<uint32_t> free_indices = {};
+    uint32_t _count = 0;
+    uint32_t _capacity = 0;
+};
+
+template<typename T, typename Tkey>
+void dense_slotmap<T, Tkey>::alloc(uint32_t size) {
+    assert(_capacity == 0);
+    _capacity = size;
+    _data.reserve(size);
+    _dense_to_sparse.reserve(size);
+    _sparse.reserve(size);
+    free_indices.reserve(size);
+}
+
+template<typename T, typename Tkey>
+uint32_t dense_slotmap<T, Tkey>::count() {
+    return _count;
+}
+
+template<typename T, typename Tkey>
+uint32_t dense_slotmap<T, Tkey>::size() {
+    return _capacity;
+}
+
+template<typename T, typename Tkey>
+void dense_slotmap<T, Tkey>::clear() {
+    //Bump every live generation so outstanding keys stop resolving
+    for (uint32_t sparse_idx : _dense_to_sparse) {
+        _sparse[sparse_idx].generation &= ~LIVE_BIT;
+        _sparse[sparse_idx].generation += 1;
+        free_indices.push_back(sparse_idx);
+    }
+    _data.clear();
+    _dense_to_sparse.clear();
+    _count = 0;
+}
+
+//Pointer to the packed array of count() live elements
+template<typename T, typename Tkey>
+T* dense_slotmap<T, Tkey>::data() {
+    return _data.data();
+}
+
+template<typename T, typename Tkey>
+T* dense_slotmap<T, Tkey>::get(Tkey key) {
+    uint32_t idx = EXTRACT_IDX(key.value());
+    uint32_t gen = static_cast<uint32_t>(key.value() >> 32);
+    T* d = nullptr;
+    if (idx < _sparse.size() && gen == _sparse[idx].generation) {
+        d = &_data[_sparse[idx].dense_idx];
+    }
+    return d;
+}
+
+template<typename T, typename Tkey>
+Tkey dense_slotmap<T, Tkey>::insert(T thing) {
+    assert(_count < _capacity);
+    uint32_t sparse_idx;
+    if (free_indices.size() > 0) {
+        sparse_idx = free_indices.back();
+        free_indices.pop_back();
+    } else {
+        sparse_idx = static_cast<uint32_t>(_sparse.size());
+        _sparse.push_back({});
+    }
+
+    SparseSlot& slot = _sparse[sparse_idx];
+    slot.dense_idx = _count;
+    slot.generation |= LIVE_BIT;
+    _data.push_back(thing);
+    _dense_to_sparse.push_back(sparse_idx);
+    _count += 1;
+
+    uint64_t data = (static_cast<uint64_t>(slot.generation) << 32) | static_cast<uint64_t>(sparse_idx);
+    return Tkey(data);
+}
+
+template<typename T, typename Tkey>
+void dense_slotmap<T, Tkey>::remove(uint32_t idx) {
+    SparseSlot& slot = _sparse[idx];
+    assert(slot.generation & LIVE_BIT);
+
+    //Swap the last live element into the hole
+    uint32_t hole = slot.dense_idx;
+    uint32_t last = _count - 1;
+    if (hole != last) {
+        _data[hole] = std::move(_data[last]);
+        _dense_to_sparse[hole] = _dense_to_sparse[last];
+        _sparse[_dense_to_sparse[hole]].dense_idx = hole;
+    }
+    _data.pop_back();
+    _dense_to_sparse.pop_back();
+    _count -= 1;
+
+    slot.generation &= ~LIVE_BIT;
+    slot.generation += 1;
+    free_indices.push_back(idx);
+}
@@ -1,13 +1,578 @@
+#include <algorithm>
+#include <bit>
+#include <string.h>
 #include "gltf_loader.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "meshopt_codec.h"
 #include "utils.h"
+#include "vertex_conversion.h"
 
-GLBData load_glb(const std::filesystem::path& glb_path) {
+//Returns the accessor's data as a span straight into the source bytes when it's already
+//tightly packed, unnormalized ComponentT x component_count, or an empty span if it has to be converted
+template<typename ComponentT>
+static std::span<const ComponentT> direct_accessor_view(
+	fastgltf::Asset& asset,
+	fastgltf::Accessor& accessor,
+	fastgltf::ComponentType component_type,
+	size_t component_count
+) {
 	using namespace fastgltf;
 
-	Parser parser;
-	GltfDataBuffer data;
-	data.loadFromFile(glb_path);
-	Expected<Asset> asset = parser.loadGltfBinary(&data, glb_path.parent_path());
+	if (accessor.sparse.has_value() || accessor.normalized) return {};
+	if (accessor.componentType != component_type || getNumComponents(accessor.type) != component_count) return {};
+	if (!accessor.bufferViewIndex.has_value()) return {};
+
+	BufferView& bv = asset.bufferViews[accessor.bufferViewIndex.value()];
+	if (bv.meshoptCompression) return {};
+	if (bv.byteStride.has_value() && bv.byteStride.value() != component_count * sizeof(ComponentT)) return {};
+
+	const sources::ByteView* bytes = std::get_if<sources::ByteView>(&asset.buffers[bv.bufferIndex].data);
+	if (bytes == nullptr) return {};
+
+	const std::byte* ptr = bytes->bytes.data() + bv.byteOffset + accessor.byteOffset;
+	if (reinterpret_cast<uintptr_t>(ptr) % alignof(ComponentT) != 0) return {};
+
+	return std::span<const ComponentT>(reinterpret_cast<const ComponentT*>(ptr), accessor.count * component_count);
+}
+
+//Where an accessor's elements sit in the source bytes, for the bulk conversion kernels
+struct AccessorBytes {
+	const uint8_t* data;
+	size_t stride;
+};
+
+//Fails for sparse or compressed accessors and ones whose data isn't in the loaded bytes,
+//which have to go through fastgltf's iterators instead
+static bool accessor_bytes(fastgltf::Asset& asset, fastgltf::Accessor& accessor, AccessorBytes& out) {
+	using namespace fastgltf;
+
+	if (accessor.sparse.has_value() || !accessor.bufferViewIndex.has_value()) return false;
+
+	BufferView& bv = asset.bufferViews[accessor.bufferViewIndex.value()];
+	if (bv.meshoptCompression) return false;
+
+	const sources::ByteView* bytes = std::get_if<sources::ByteView>(&asset.buffers[bv.bufferIndex].data);
+	if (bytes == nullptr) return false;
+
+	size_t element_size = getElementByteSize(accessor.type, accessor.componentType);
+	out.stride = bv.byteStride.has_value() ? bv.byteStride.value() : element_size;
+	if (accessor.count > 0 && accessor.byteOffset + (accessor.count - 1) * out.stride + element_size > bv.byteLength) return false;
+
+	out.data = reinterpret_cast<const uint8_t*>(bytes->bytes.data()) + bv.byteOffset + accessor.byteOffset;
+	return true;
+}
+
+static bool normalized_format(fastgltf::ComponentType type, NormalizedFormat& out) {
+	switch (type) {
+		case fastgltf::ComponentType::UnsignedByte: out = NORMALIZED_UNORM8; return true;
+		case fastgltf::ComponentType::UnsignedShort: out = NORMALIZED_UNORM16; return true;
+		case fastgltf::ComponentType::Byte: out = NORMALIZED_SNORM8; return true;
+		case fastgltf::ComponentType::Short: out = NORMALIZED_SNORM16; return true;
+		default: return false;
+	}
+}
+
+//Integer component types KHR_mesh_quantization allows for positions and uvs
+static bool is_integer_component(fastgltf::ComponentType type) {
+	return type == fastgltf::ComponentType::UnsignedByte || type == fastgltf::ComponentType::Byte ||
+		type == fastgltf::ComponentType::UnsignedShort || type == fastgltf::ComponentType::Short;
+}
+
+template<typename T>
+static void widen_components(const AccessorBytes& view, size_t count, uint32_t components, uint32_t out_components, int32_t bias, uint16_t* out) {
+	for (size_t v = 0; v < count; v++) {
+		const uint8_t* element = view.data + v * view.stride;
+		for (uint32_t c = 0; c < components; c++) {
+			T value;
+			memcpy(&value, element + c * sizeof(T), sizeof(T));
+			out[v * out_components + c] = (uint16_t)((int32_t)value + bias);
+		}
+	}
+}
+
+//Widens integer components to the unorm16 the quantized streams use, with components past the source's zeroed
+//Signed values are biased to stay ordered. scale and offset are set so offset + scale * q is the accessor's value
+static void widen_to_unorm16(
+	const AccessorBytes& view,
+	size_t count,
+	fastgltf::ComponentType type,
+	bool normalized,
+	uint32_t components,
+	uint32_t out_components,
+	float* scale,
+	float* offset,
+	std::vector<uint16_t>& out
+) {
+	using namespace fastgltf;
+
+	float max = 1.0f;
+	int32_t bias = 0;
+	switch (type) {
+		case ComponentType::UnsignedByte: max = 255.0f; break;
+		case ComponentType::Byte: max = 127.0f; bias = 128; break;
+		case ComponentType::UnsignedShort: max = 65535.0f; break;
+		case ComponentType::Short: max = 32767.0f; bias = 32768; break;
+		default: break;
+	}
+	for (uint32_t c = 0; c < components; c++) {
+		scale[c] = normalized ? 1.0f / max : 1.0f;
+		offset[c] = -(float)bias * scale[c];
+	}
+
+	out.assign(count * out_components, 0);
+	switch (type) {
+		case ComponentType::UnsignedByte: widen_components<uint8_t>(view, count, components, out_components, bias, out.data()); break;
+		case ComponentType::Byte: widen_components<int8_t>(view, count, components, out_components, bias, out.data()); break;
+		case ComponentType::UnsignedShort:
+			//Already the right encoding, only the layout may differ
+			if (components == out_components) {
+				gather_strided(view.data, view.stride, count, components * sizeof(uint16_t), out.data());
+			} else {
+				widen_components<uint16_t>(view, count, components, out_components, bias, out.data());
+			}
+			break;
+		case ComponentType::Short: widen_components<int16_t>(view, count, components, out_components, bias, out.data()); break;
+		default: break;
+	}
+}
+
+//unorm8 RGB or RGBA colors packed one per uint32_t as the quantized color stream stores them, RGB getting an opaque alpha
+static void pack_unorm8_colors(const AccessorBytes& view, size_t count, uint32_t components, std::vector<uint32_t>& out) {
+	out.resize(count);
+	if (components == 4) {
+		gather_strided(view.data, view.stride, count, sizeof(uint32_t), out.data());
+		return;
+	}
+	for (size_t v = 0; v < count; v++) {
+		uint32_t packed = 0;
+		memcpy(&packed, view.data + v * view.stride, 3);
+		out[v] = packed | 0xFF000000;
+	}
+}
+
+//Replaces every meshopt compressed buffer view with its decoded bytes, held in decoded_views
+//Each decoded view gets a buffer of its own so every accessor path downstream reads it like uncompressed data
+//Returns false if any view fails to decode. Its accessors would read compressed or fallback bytes as vertices, so nothing in the file can be trusted
+static bool decode_meshopt_buffer_views(fastgltf::Asset& asset, std::vector<std::vector<uint8_t>>& decoded_views, ThreadPool* pool) {
+	using namespace fastgltf;
+
+	std::vector<size_t> view_indices;
+	for (size_t i = 0; i < asset.bufferViews.size(); i++) {
+		if (asset.bufferViews[i].meshoptCompression) view_indices.push_back(i);
+	}
+	if (view_indices.empty()) return true;
+
+	decoded_views.resize(view_indices.size());
+	std::vector<uint8_t> decoded(view_indices.size());
+	auto decode_view = [&](uint32_t i) {
+		CompressedBufferView& compressed = *asset.bufferViews[view_indices[i]].meshoptCompression;
+		const sources::ByteView* bytes = std::get_if<sources::ByteView>(&asset.buffers[compressed.bufferIndex].data);
+		if (bytes == nullptr || compressed.byteOffset + compressed.byteLength > bytes->bytes.size()) return;
+
+		const uint8_t* src = reinterpret_cast<const uint8_t*>(bytes->bytes.data()) + compressed.byteOffset;
+		std::vector<uint8_t>& dst = decoded_views[i];
+		dst.resize(compressed.count * compressed.byteStride);
+		bool ok = false;
+		switch (compressed.mode) {
+			case MeshoptCompressionMode::Attributes:
+				ok = decode_meshopt_vertices(dst.data(), compressed.count, compressed.byteStride, src, compressed.byteLength);
+				break;
+			case MeshoptCompressionMode::Triangles:
+				ok = decode_meshopt_triangles(dst.data(), compressed.count, compressed.byteStride, src, compressed.byteLength);
+				break;
+			case MeshoptCompressionMode::Indices:
+				ok = decode_meshopt_indices(dst.data(), compressed.count, compressed.byteStride, src, compressed.byteLength);
+				break;
+			default:
+				break;
+		}
+
+		MeshoptFilter filter = MESHOPT_FILTER_NONE;
+		switch (compressed.filter) {
+			case MeshoptCompressionFilter::Octahedral: filter = MESHOPT_FILTER_OCTAHEDRAL; break;
+			case MeshoptCompressionFilter::Quaternion: filter = MESHOPT_FILTER_QUATERNION; break;
+			case MeshoptCompressionFilter::Exponential: filter = MESHOPT_FILTER_EXPONENTIAL; break;
+			default: break;
+		}
+		decoded[i] = ok && apply_meshopt_filter(dst.data(), compressed.count, compressed.byteStride, filter);
+	};
+	if (pool != nullptr) {
+		pool->parallel_for((uint32_t)view_indices.size(), decode_view);
+	} else {
+		for (uint32_t i = 0; i < view_indices.size(); i++) decode_view(i);
+	}
+
+	for (size_t i = 0; i < view_indices.size(); i++) {
+		if (!decoded[i]) {
+			printf("Failed to decode meshopt compressed buffer view %i\n", (int)view_indices[i]);
+			return false;
+		}
+	}
+
+	//Appending buffers is left until every decode is done since the decodes read asset.buffers
+	for (size_t i = 0; i < view_indices.size(); i++) {
+		BufferView& bv = asset.bufferViews[view_indices[i]];
+
+		Buffer buffer;
+		buffer.byteLength = decoded_views[i].size();
+		buffer.data = sources::ByteView {
+			std::span<const std::byte>(reinterpret_cast<const std::byte*>(decoded_views[i].data()), decoded_views[i].size()),
+			MimeType::None
+		};
+		asset.buffers.push_back(std::move(buffer));
+
+		if (bv.meshoptCompression->mode == MeshoptCompressionMode::Attributes) bv.byteStride = bv.meshoptCompression->byteStride;
+		bv.bufferIndex = asset.buffers.size() - 1;
+		bv.byteOffset = 0;
+		bv.byteLength = decoded_views[i].size();
+		bv.meshoptCompression.reset();
+	}
+	return true;
+}
+
+//Copies a primitive's indices, whichever width they're stored in
+static std::vector<uint32_t> widen_indices(const GLBPrimitive& prim) {
+	if (!prim.indices32.empty()) return std::vector<uint32_t>(prim.indices32.begin(), prim.indices32.end());
+	return std::vector<uint32_t>(prim.indices.begin(), prim.indices.end());
+}
+
+//Stores indices in the narrowest width that can address vertex_count vertices
+static void store_indices(GLBPrimitive& prim, std::span<const uint32_t> indices, size_t vertex_count) {
+	prim.indices = {};
+	prim.indices32 = {};
+	if (vertex_count <= 65536) {
+		prim.index_storage.assign(indices.begin(), indices.end());
+		prim.index32_storage = {};
+		prim.indices = prim.index_storage;
+	} else {
+		prim.index32_storage.assign(indices.begin(), indices.end());
+		prim.index_storage = {};
+		prim.indices32 = prim.index32_storage;
+	}
+}
+
+//Positions are float4 or quantized with four components, whichever the primitive has
+static size_t primitive_vertex_count(const GLBPrimitive& prim) {
+	return prim.positions.empty() ? prim.quantized_positions.size() / 4 : prim.positions.size() / 4;
+}
+
+//Float positions for the passes that measure geometry, dequantized into storage when the primitive only has quantized ones
+static std::span<const float> float_positions(const GLBPrimitive& prim, std::vector<float>& storage) {
+	if (!prim.positions.empty() || prim.quantized_positions.empty()) return prim.positions;
+	dequantize_positions(prim.quantized_positions, prim.quantization, storage);
+	return storage;
+}
+
+//A quantized stream's bytes viewed as floats, for weld_vertices which only compares vertices bitwise
+template<typename T>
+static std::span<const float> float_bits(std::span<const T> data) {
+	return std::span<const float>(reinterpret_cast<const float*>(data.data()), data.size_bytes() / sizeof(float));
+}
+
+template<typename T>
+static std::vector<T> remap_quantized_stream(std::span<const T> data, uint32_t components, std::span<const uint32_t> remap, uint32_t new_vertex_count) {
+	std::vector<T> out(new_vertex_count * components);
+	for (size_t v = 0; v < remap.size(); v++) {
+		if (remap[v] == NO_VERTEX) continue;
+		for (uint32_t c = 0; c < components; c++) out[remap[v] * components + c] = data[v * components + c];
+	}
+	return out;
+}
+
+//Bit per stream a primitive has, float and quantized counted separately
+static uint32_t primitive_stream_mask(const GLBPrimitive& prim) {
+	return (uint32_t)!prim.positions.empty() |
+		(uint32_t)!prim.colors.empty() << 1 |
+		(uint32_t)!prim.uvs.empty() << 2 |
+		(uint32_t)!prim.quantized_positions.empty() << 3 |
+		(uint32_t)!prim.quantized_colors.empty() << 4 |
+		(uint32_t)!prim.quantized_uvs.empty() << 5;
+}
+
+//Concatenates primitives that share a material, the same set of streams and quantization and the same instances into one primitive each
+//Primitives drawn at different nodes are never merged since they're drawn with different transforms.
+//instances is rewritten to reference the merged primitives.
+static std::vector<GLBPrimitive> merge_primitives(std::vector<GLBPrimitive>& primitives, std::vector<GLBInstance>& instances) {
+	//Nodes each primitive is drawn at, in node order
+	std::vector<std::vector<uint32_t>> prim_nodes(primitives.size());
+	for (GLBInstance& instance : instances) prim_nodes[instance.primitive_idx].push_back(instance.node_idx);
+
+	//Quantized streams can only be concatenated when they map back to floats the same way
+	struct MergeGroup {
+		uint32_t material_idx;
+		uint32_t streams;
+		VertexQuantization quantization;
+		std::vector<uint32_t> nodes;
+		std::vector<uint32_t> members;
+	};
+	std::vector<MergeGroup> groups;
+	for (uint32_t i = 0; i < primitives.size(); i++) {
+		GLBPrimitive& prim = primitives[i];
+		uint32_t streams = primitive_stream_mask(prim);
+		MergeGroup* group = nullptr;
+		for (MergeGroup& g : groups) {
+			if (
+				g.material_idx == prim.material_idx &&
+				g.streams == streams &&
+				memcmp(&g.quantization, &prim.quantization, sizeof(VertexQuantization)) == 0 &&
+				g.nodes == prim_nodes[i]
+			) {
+				group = &g;
+				break;
+			}
+		}
+		if (group == nullptr) {
+			groups.push_back({ prim.material_idx, streams, prim.quantization, prim_nodes[i], {} });
+			group = &groups.back();
+		}
+		group->members.push_back(i);
+	}
+
+	std::vector<GLBPrimitive> merged;
+	merged.reserve(groups.size());
+	instances.clear();
+	for (MergeGroup& group : groups) {
+		for (uint32_t node : group.nodes) instances.push_back({ (uint32_t)merged.size(), node });
+		if (group.members.size() == 1) {
+			merged.push_back(std::move(primitives[group.members[0]]));
+			continue;
+		}
+
+		GLBPrimitive out;
+		out.material_idx = group.material_idx;
+		out.quantization = group.quantization;
+		std::vector<uint32_t> indices;
+		uint32_t base_vertex = 0;
+		for (uint32_t member : group.members) {
+			GLBPrimitive& prim = primitives[member];
+			out.position_storage.insert(out.position_storage.end(), prim.positions.begin(), prim.positions.end());
+			out.color_storage.insert(out.color_storage.end(), prim.colors.begin(), prim.colors.end());
+			out.uv_storage.insert(out.uv_storage.end(), prim.uvs.begin(), prim.uvs.end());
+			out.quantized_position_storage.insert(out.quantized_position_storage.end(), prim.quantized_positions.begin(), prim.quantized_positions.end());
+			out.quantized_color_storage.insert(out.quantized_color_storage.end(), prim.quantized_colors.begin(), prim.quantized_colors.end());
+			out.quantized_uv_storage.insert(out.quantized_uv_storage.end(), prim.quantized_uvs.begin(), prim.quantized_uvs.end());
+			for (uint32_t index : widen_indices(prim)) indices.push_back(base_vertex + index);
+			base_vertex += (uint32_t)primitive_vertex_count(prim);
+		}
+		out.positions = out.position_storage;
+		out.colors = out.color_storage;
+		out.uvs = out.uv_storage;
+		out.quantized_positions = out.quantized_position_storage;
+		out.quantized_colors = out.quantized_color_storage;
+		out.quantized_uvs = out.quantized_uv_storage;
+		store_indices(out, indices, base_vertex);
+		merged.push_back(std::move(out));
+	}
+	return merged;
+}
+
+//Welds duplicate vertices and reorders the primitive's triangles and vertices, replacing its streams with storage
+//Fills before and after with the post-transform cache statistics of the index buffer
+static void optimize_primitive(GLBPrimitive& prim, const GLBLoadOptions& options, VertexCacheStats& before, VertexCacheStats& after) {
+	size_t vertex_count = primitive_vertex_count(prim);
+	std::vector<uint32_t> indices = widen_indices(prim);
+	before = analyze_vertex_cache(indices, vertex_count);
+	after = before;
+
+	//Quantized streams are welded by their bits like the float ones
+	MeshVertexStream streams[6];
+	uint32_t stream_count = 0;
+	if (!prim.positions.empty()) streams[stream_count++] = { prim.positions, 4 };
+	if (!prim.colors.empty()) streams[stream_count++] = { prim.colors, 4 };
+	if (!prim.uvs.empty()) streams[stream_count++] = { prim.uvs, 2 };
+	if (!prim.quantized_positions.empty()) streams[stream_count++] = { float_bits(prim.quantized_positions), 2 };
+	if (!prim.quantized_colors.empty()) streams[stream_count++] = { float_bits(prim.quantized_colors), 1 };
+	if (!prim.quantized_uvs.empty()) streams[stream_count++] = { float_bits(prim.quantized_uvs), 1 };
+	for (uint32_t i = 0; i < stream_count; i++) {
+		if (streams[i].data.size() != vertex_count * streams[i].components) {
+			printf("Skipping optimization of a primitive with mismatched vertex streams\n");
+			return;
+		}
+	}
+
+	weld_vertices(std::span<const MeshVertexStream>(streams, stream_count), vertex_count, indices);
+	optimize_vertex_cache(indices, vertex_count);
+	if (options.optimize_overdraw) {
+		std::vector<float> dequantized;
+		optimize_overdraw(indices, float_positions(prim, dequantized), 4, vertex_count, options.overdraw_threshold);
+	}
+
+	std::vector<uint32_t> remap(vertex_count);
+	uint32_t new_vertex_count = optimize_vertex_fetch_remap(indices, vertex_count, remap);
+	after = analyze_vertex_cache(indices, new_vertex_count);
+
+	if (!prim.positions.empty()) {
+		prim.position_storage = remap_vertex_stream({ prim.positions, 4 }, remap, new_vertex_count);
+		prim.positions = prim.position_storage;
+	}
+	if (!prim.colors.empty()) {
+		prim.color_storage = remap_vertex_stream({ prim.colors, 4 }, remap, new_vertex_count);
+		prim.colors = prim.color_storage;
+	}
+	if (!prim.uvs.empty()) {
+		prim.uv_storage = remap_vertex_stream({ prim.uvs, 2 }, remap, new_vertex_count);
+		prim.uvs = prim.uv_storage;
+	}
+	if (!prim.quantized_positions.empty()) {
+		prim.quantized_position_storage = remap_quantized_stream(prim.quantized_positions, 4, remap, new_vertex_count);
+		prim.quantized_positions = prim.quantized_position_storage;
+	}
+	if (!prim.quantized_colors.empty()) {
+		prim.quantized_color_storage = remap_quantized_stream(prim.quantized_colors, 1, remap, new_vertex_count);
+		prim.quantized_colors = prim.quantized_color_storage;
+	}
+	if (!prim.quantized_uvs.empty()) {
+		prim.quantized_uv_storage = remap_quantized_stream(prim.quantized_uvs, 2, remap, new_vertex_count);
+		prim.quantized_uvs = prim.quantized_uv_storage;
+	}
+	store_indices(prim, indices, new_vertex_count);
+}
+
+//Appends coarser levels of detail to the primitive's index stream
+static void build_primitive_lods(GLBPrimitive& prim, const GLBLoadOptions& options) {
+	size_t vertex_count = primitive_vertex_count(prim);
+	if (vertex_count == 0) return;
+
+	std::vector<float> dequantized;
+	std::span<const float> positions = float_positions(prim, dequantized);
+	float mins[3] = { positions[0], positions[1], positions[2] };
+	float maxs[3] = { mins[0], mins[1], mins[2] };
+	for (size_t v = 0; v < vertex_count; v++) {
+		for (size_t c = 0; c < 3; c++) {
+			mins[c] = std::min(mins[c], positions[4 * v + c]);
+			maxs[c] = std::max(maxs[c], positions[4 * v + c]);
+		}
+	}
+	float extent[3] = { maxs[0] - mins[0], maxs[1] - mins[1], maxs[2] - mins[2] };
+	float diagonal = sqrtf(extent[0] * extent[0] + extent[1] * extent[1] + extent[2] * extent[2]);
+
+	std::vector<uint32_t> indices = widen_indices(prim);
+	std::vector<uint32_t> lod_indices;
+	prim.lod_storage = build_lod_chain(
+		indices,
+		positions,
+		4,
+		vertex_count,
+		options.lod_count,
+		options.lod_reduction,
+		options.lod_max_error * diagonal,
+		lod_indices
+	);
+	if (prim.lod_storage.size() <= 1) {
+		prim.lod_storage = {};
+		return;
+	}
+	prim.lods = prim.lod_storage;
+	store_indices(prim, lod_indices, vertex_count);
+}
+
+//Reorders the full detail level's triangles into meshlets
+//Coarser levels stay as they are, so their ranges of the index stream don't move
+static void build_primitive_meshlets(GLBPrimitive& prim, const GLBLoadOptions& options) {
+	size_t vertex_count = primitive_vertex_count(prim);
+	if (vertex_count == 0) return;
+
+	std::vector<uint32_t> indices = widen_indices(prim);
+	size_t lod0_count = prim.lods.empty() ? indices.size() : prim.lods[0].index_count;
+	std::vector<float> dequantized;
+	prim.meshlet_storage = build_meshlets(
+		std::span<uint32_t>(indices.data(), lod0_count),
+		float_positions(prim, dequantized),
+		4,
+		vertex_count,
+		options.meshlet_triangles,
+		options.meshlet_triangles
+	);
+
+	//One meshlet culls no better than the whole primitive
+	if (prim.meshlet_storage.size() <= 1) {
+		prim.meshlet_storage = {};
+		return;
+	}
+	prim.meshlets = prim.meshlet_storage;
+	store_indices(prim, indices, vertex_count);
+}
+
+//Replaces the primitive's float streams with their quantized encodings
+//Streams that were loaded already quantized are left as they are
+static void quantize_primitive(GLBPrimitive& prim) {
+	if (!prim.positions.empty()) {
+		quantize_positions(prim.positions, prim.quantized_position_storage, prim.quantization);
+		prim.quantized_positions = prim.quantized_position_storage;
+	}
+	if (!prim.colors.empty()) {
+		quantize_colors(prim.colors, prim.quantized_color_storage);
+		prim.quantized_colors = prim.quantized_color_storage;
+	}
+	if (!prim.uvs.empty()) {
+		quantize_uvs(prim.uvs, prim.quantized_uv_storage, prim.quantization);
+		prim.quantized_uvs = prim.quantized_uv_storage;
+	}
+
+	prim.positions = {};
+	prim.colors = {};
+	prim.uvs = {};
+	prim.position_storage = {};
+	prim.color_storage = {};
+	prim.uv_storage = {};
+}
+
+//Hash of every option that changes what ends up in a baked primitive
+static uint64_t bake_options_hash(const GLBLoadOptions& options) {
+	uint32_t packed[] = {
+		(uint32_t)options.optimize_meshes,
+		(uint32_t)options.optimize_overdraw,
+		std::bit_cast<uint32_t>(options.overdraw_threshold),
+		(uint32_t)options.quantize_vertices,
+		(uint32_t)options.merge_primitives,
+		options.lod_count,
+		std::bit_cast<uint32_t>(options.lod_reduction),
+		std::bit_cast<uint32_t>(options.lod_max_error),
+		options.meshlet_triangles
+	};
+	return hash_file_contents(reinterpret_cast<const uint8_t*>(packed), sizeof(packed));
+}
+
+GLBData load_glb(const std::filesystem::path& glb_path, ThreadPool* pool, const GLBLoadOptions& options) {
+	using namespace fastgltf;
+
+	std::shared_ptr<GLBSource> source = std::make_shared<GLBSource>();
+	bool use_cache = !options.cache_dir.empty();
+	if (options.memory_map || use_cache) source->file.open(glb_path);
+
+	//Warm path: the baked cache for this exact file content
+	MeshCacheKey cache_key = {};
+	std::filesystem::path cache_path;
+	if (use_cache && source->file.data != nullptr) {
+		cache_key.source_hash = hash_file_contents(source->file.data, source->file.size);
+		cache_key.source_size = source->file.size;
+		cache_key.bake_options = bake_options_hash(options);
+		cache_path = mesh_cache_path(options.cache_dir, glb_path);
+
+		GLBData cached;
+		if (load_mesh_cache(cache_path, cache_key, cached)) return cached;
+	}
+
+	//Parse straight out of a mapping of the file when the last page has room for the parser's padding
+	bool mapped = false;
+	if (options.memory_map && source->file.data != nullptr) {
+		MappedFile& file = source->file;
+		if (file.mapped_size - file.size >= getGltfBufferPadding()) {
+			mapped = source->buffer.fromByteView(file.data, file.size, file.mapped_size);
+		}
+	}
+	if (!mapped) {
+		source->file.close();
+		source->buffer.loadFromFile(glb_path);
+	}
+
+	Parser parser(Extensions::EXT_meshopt_compression | Extensions::KHR_mesh_quantization | Extensions::MSFT_texture_dds | Extensions::KHR_texture_basisu);
+	Expected<Asset> asset = parser.loadGltfBinary(&source->buffer, glb_path.parent_path());
+	if (!decode_meshopt_buffer_views(asset.get(), source->decoded_views, pool)) {
+		printf("Skipping \"%s\" because its meshopt compressed data is corrupt\n", glb_path.filename().string().c_str());
+		return {};
+	}
 
 	//Pull out all materials in the asset before walking the primitives of the mesh
 	std::vector<GLBMaterial> materials;
@@ -26,11 +591,18 @@ GLBData load_glb(const std::filesystem::path& glb_path) {
 		if (pbr.baseColorTexture.has_value()) {
 			TextureInfo& info = pbr.baseColorTexture.value();
 			Texture& tex = asset->textures[info.textureIndex];
-			Image& im = asset->images[tex.imageIndex.value()];
+
+			//DDS and KTX2 images carry their own mips and block compression, so they're preferred over the fallback
+			//DDS comes first because its levels are copied as they are, while KTX2 ones still need transcoding
+			size_t image_idx;
+			if (tex.ddsImageIndex.has_value()) image_idx = tex.ddsImageIndex.value();
+			else if (tex.basisuImageIndex.has_value()) image_idx = tex.basisuImageIndex.value();
+			else image_idx = tex.imageIndex.value();
+			Image& im = asset->images[image_idx];
 
 			const sources::BufferView* data_ptr = std::get_if<sources::BufferView>(&im.data);
 			PRORENDER_ASSERT(data_ptr != nullptr, true);
-			PRORENDER_ASSERT(data_ptr->mimeType == MimeType::JPEG || data_ptr->mimeType == MimeType::PNG, true);
+			PRORENDER_ASSERT(data_ptr->mimeType == MimeType::JPEG || data_ptr->mimeType == MimeType::PNG || data_ptr->mimeType == MimeType::DDS || data_ptr->mimeType == MimeType::KTX2, true);
 
 			fastgltf::BufferView& bv = asset->bufferViews[data_ptr->bufferViewIndex];
 			fastgltf::Buffer& buffer = asset->buffers[bv.bufferIndex];
@@ -38,55 +610,163 @@ GLBData load_glb(const std::filesystem::path& glb_path) {
 			const sources::ByteView* arr = std::get_if<sources::ByteView>(&buffer.data);
 			PRORENDER_ASSERT(arr != nullptr, true);
 
-			material.color_image_bytes.resize(bv.byteLength);
-			memcpy(material.color_image_bytes.data(), arr->bytes.data() + bv.byteOffset, bv.byteLength);
+			material.color_image_bytes = std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(arr->bytes.data()) + bv.byteOffset, bv.byteLength);
 
 			//printf("Loading image \"%s\"\n", im.name.c_str());
 		}
 		materials.push_back(material);
 	}
 
-	std::vector<GLBPrimitive> primitives;
-	std::vector<uint16_t> prim_parents;
-	for (Node& node : asset->nodes) {
-		std::vector<float> positions;
-		std::vector<float> colors;
-		std::vector<float> uvs;
-		std::vector<uint16_t> indices;
-
-		if (node.meshIndex.has_value()) {
-			size_t mesh_idx = node.meshIndex.value();
-			Mesh& mesh = asset->meshes[mesh_idx];
-
-			//Just loading the first primitive for now
-			for (Primitive& prim : mesh.primitives) {
-				bool has_color = false;
-				for (auto& a : prim.attributes) {
-					if (a.first == "COLOR_0") {
-						has_color = true;
-					}
+	//Walk the default scene breadth-first so every node lands after its parent and each depth is contiguous
+	//A mesh's primitives are flattened the first time a node references it so they can be converted independently,
+	//and every node using the mesh gets an instance of them instead of its own copy
+	struct PrimitiveRef {
+		size_t mesh_idx;
+		size_t prim_idx;
+	};
+	std::vector<PrimitiveRef> prim_refs;
+	std::vector<GLBInstance> instances;
+	std::vector<uint32_t> mesh_first_prim(asset->meshes.size(), std::numeric_limits<uint32_t>::max());
+	NodeHierarchy nodes;
+	{
+		std::vector<size_t> level;
+		if (!asset->scenes.empty()) {
+			size_t scene_idx = asset->defaultScene.has_value() ? asset->defaultScene.value() : 0;
+			Scene& scene = asset->scenes[scene_idx];
+			level.assign(scene.nodeIndices.begin(), scene.nodeIndices.end());
+		} else {
+			//Without a scene, every node that isn't some node's child is a root
+			std::vector<bool> is_child(asset->nodes.size());
+			for (Node& node : asset->nodes) {
+				for (size_t child : node.children) is_child[child] = true;
+			}
+			for (size_t i = 0; i < asset->nodes.size(); i++) {
+				if (!is_child[i]) level.push_back(i);
+			}
+		}
+		std::vector<uint32_t> level_parents(level.size(), NodeHierarchy::NO_PARENT);
+
+		while (!level.empty()) {
+			std::vector<size_t> next_level;
+			std::vector<uint32_t> next_parents;
+			for (size_t i = 0; i < level.size(); i++) {
+				Node& node = asset->nodes[level[i]];
+				float t[3] = { 0.0f, 0.0f, 0.0f };
+				float r[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+				float s[3] = { 1.0f, 1.0f, 1.0f };
+				if (const Node::TRS* trs = std::get_if<Node::TRS>(&node.transform)) {
+					for (int c = 0; c < 3; c++) t[c] = trs->translation[c];
+					for (int c = 0; c < 4; c++) r[c] = trs->rotation[c];
+					for (int c = 0; c < 3; c++) s[c] = trs->scale[c];
+				} else if (const Node::TransformMatrix* m = std::get_if<Node::TransformMatrix>(&node.transform)) {
+					decompose_transform(m->data(), t, r, s);
 				}
+				uint32_t node_idx = nodes.add_node(level_parents[i], t, r, s);
 
-				//Loading vertex position data
-				{
-					uint64_t accessor_index = prim.findAttribute("POSITION")->second;
-					Accessor& accessor = asset->accessors[accessor_index];
-					positions.reserve(4 * accessor.count);
-					auto iterator = fastgltf::iterateAccessor<hlslpp::float3>(asset.get(), accessor);
-					for (auto it = iterator.begin(); it != iterator.end(); ++it) {
-						hlslpp::float3 p = *it;
-						positions.emplace_back(p[0]);
-						positions.emplace_back(p[1]);
-						positions.emplace_back(p[2]);
-						positions.emplace_back(1.0f);
+				if (node.meshIndex.has_value()) {
+					size_t mesh_idx = node.meshIndex.value();
+					Mesh& mesh = asset->meshes[mesh_idx];
+					if (mesh_first_prim[mesh_idx] == std::numeric_limits<uint32_t>::max()) {
+						mesh_first_prim[mesh_idx] = (uint32_t)prim_refs.size();
+						for (size_t p = 0; p < mesh.primitives.size(); p++) {
+							prim_refs.push_back({ mesh_idx, p });
+						}
 					}
+					for (size_t p = 0; p < mesh.primitives.size(); p++) {
+						instances.push_back({ mesh_first_prim[mesh_idx] + (uint32_t)p, node_idx });
+					}
+				}
+				for (size_t child : node.children) {
+					next_level.push_back(child);
+					next_parents.push_back(node_idx);
 				}
+			}
+			level.swap(next_level);
+			level_parents.swap(next_parents);
+		}
+	}
+
+	//Each primitive writes only its own output slot, so the result doesn't depend on scheduling
+	std::vector<GLBPrimitive> primitives(prim_refs.size());
+	auto convert_primitive = [&](uint32_t i) {
+		Primitive& prim = asset->meshes[prim_refs[i].mesh_idx].primitives[prim_refs[i].prim_idx];
+		GLBPrimitive& out = primitives[i];
+		std::vector<float>& positions = out.position_storage;
+		std::vector<float>& colors = out.color_storage;
+		std::vector<float>& uvs = out.uv_storage;
+		std::vector<uint16_t>& indices = out.index_storage;
+
+		bool has_color = false;
+		for (auto& a : prim.attributes) {
+			if (a.first == "COLOR_0") {
+				has_color = true;
+			}
+		}
+
+		//Loading vertex position data
+		//Float positions are always converted since the renderer wants a w component the file doesn't have
+		//Integer positions from KHR_mesh_quantization go straight to the quantized stream when quantizing
+		{
+			uint64_t accessor_index = prim.findAttribute("POSITION")->second;
+			Accessor& accessor = asset->accessors[accessor_index];
+			AccessorBytes view;
+			NormalizedFormat format;
+			bool in_place = accessor_bytes(asset.get(), accessor, view) && accessor.type == AccessorType::Vec3;
+			if (in_place && options.quantize_vertices && is_integer_component(accessor.componentType)) {
+				widen_to_unorm16(
+					view, accessor.count, accessor.componentType, accessor.normalized, 3, 4,
+					out.quantization.position_scale, out.quantization.position_offset, out.quantized_position_storage
+				);
+				out.quantized_positions = out.quantized_position_storage;
+			} else if (in_place && accessor.componentType == ComponentType::Float) {
+				positions.resize(4 * accessor.count);
+				convert_float3_to_float4(view.data, view.stride, accessor.count, 1.0f, positions.data());
+				out.positions = positions;
+			} else if (in_place && accessor.normalized && normalized_format(accessor.componentType, format)) {
+				positions.resize(4 * accessor.count);
+				convert_normalized_to_float(view.data, view.stride, accessor.count, format, 3, 4, 1.0f, positions.data());
+				out.positions = positions;
+			} else {
+				positions.reserve(4 * accessor.count);
+				auto iterator = fastgltf::iterateAccessor<hlslpp::float3>(asset.get(), accessor);
+				for (auto it = iterator.begin(); it != iterator.end(); ++it) {
+					hlslpp::float3 p = *it;
+					positions.emplace_back(p[0]);
+					positions.emplace_back(p[1]);
+					positions.emplace_back(p[2]);
+					positions.emplace_back(1.0f);
+				}
+				out.positions = positions;
+			}
+		}
 
-				//Loading vertex color data
-				if (has_color) {
-					uint64_t accessor_index = prim.findAttribute("COLOR_0")->second;
-					Accessor& accessor = asset->accessors[accessor_index];
-					printf("GLB primitive has %i colors\n", (int)accessor.count);
+		//Loading vertex color data
+		//RGB colors get an alpha of 1
+		if (has_color) {
+			uint64_t accessor_index = prim.findAttribute("COLOR_0")->second;
+			Accessor& accessor = asset->accessors[accessor_index];
+			printf("GLB primitive has %i colors\n", (int)accessor.count);
+			AccessorBytes view;
+			NormalizedFormat format;
+			bool in_place = accessor_bytes(asset.get(), accessor, view);
+			uint32_t components = (uint32_t)getNumComponents(accessor.type);
+			if (
+				in_place && options.quantize_vertices && accessor.normalized &&
+				accessor.componentType == ComponentType::UnsignedByte && (components == 3 || components == 4)
+			) {
+				pack_unorm8_colors(view, accessor.count, components, out.quantized_color_storage);
+				out.quantized_colors = out.quantized_color_storage;
+			} else {
+				if (in_place && accessor.componentType == ComponentType::Float && accessor.type == AccessorType::Vec3) {
+					colors.resize(4 * accessor.count);
+					convert_float3_to_float4(view.data, view.stride, accessor.count, 1.0f, colors.data());
+				} else if (in_place && accessor.componentType == ComponentType::Float && accessor.type == AccessorType::Vec4) {
+					colors.resize(4 * accessor.count);
+					gather_strided(view.data, view.stride, accessor.count, 4 * sizeof(float), colors.data());
+				} else if (in_place && accessor.normalized && normalized_format(accessor.componentType, format) && (components == 3 || components == 4)) {
+					colors.resize(4 * accessor.count);
+					convert_normalized_to_float(view.data, view.stride, accessor.count, format, components, 4, 1.0f, colors.data());
+				} else {
 					colors.reserve(4 * accessor.count);
 					auto iterator = fastgltf::iterateAccessor<hlslpp::float3>(asset.get(), accessor);
 					for (auto it = iterator.begin(); it != iterator.end(); ++it) {
@@ -97,11 +777,34 @@ GLBData load_glb(const std::filesystem::path& glb_path) {
 						colors.emplace_back(1.0f);
 					}
 				}
+				out.colors = colors;
+			}
+		}
 
-				//Load vertex uv data
-				{
-					uint64_t accessor_index = prim.findAttribute("TEXCOORD_0")->second;
-					Accessor& accessor = asset->accessors[accessor_index];
+		//Load vertex uv data
+		{
+			uint64_t accessor_index = prim.findAttribute("TEXCOORD_0")->second;
+			Accessor& accessor = asset->accessors[accessor_index];
+			AccessorBytes view;
+			bool in_place = accessor_bytes(asset.get(), accessor, view) && accessor.type == AccessorType::Vec2;
+			if (in_place && options.quantize_vertices && is_integer_component(accessor.componentType)) {
+				widen_to_unorm16(
+					view, accessor.count, accessor.componentType, accessor.normalized, 2, 2,
+					out.quantization.uv_scale, out.quantization.uv_offset, out.quantized_uv_storage
+				);
+				out.quantized_uvs = out.quantized_uv_storage;
+			} else {
+				out.uvs = direct_accessor_view<float>(asset.get(), accessor, ComponentType::Float, 2);
+			}
+			if (out.uvs.empty() && out.quantized_uvs.empty() && accessor.count > 0) {
+				NormalizedFormat format;
+				if (in_place && accessor.componentType == ComponentType::Float && !accessor.normalized) {
+					uvs.resize(2 * accessor.count);
+					gather_strided(view.data, view.stride, accessor.count, 2 * sizeof(float), uvs.data());
+				} else if (in_place && accessor.normalized && normalized_format(accessor.componentType, format)) {
+					uvs.resize(2 * accessor.count);
+					convert_normalized_to_float(view.data, view.stride, accessor.count, format, 2, 2, 0.0f, uvs.data());
+				} else {
 					uvs.reserve(2 * accessor.count);
 					auto iterator = fastgltf::iterateAccessor<hlslpp::float2>(asset.get(), accessor);
 					for (auto it = iterator.begin(); it != iterator.end(); ++it) {
@@ -110,41 +813,126 @@ GLBData load_glb(const std::filesystem::path& glb_path) {
 						uvs.emplace_back(p[1]);
 					}
 				}
-				
-				//Loading index data
-				{
-					uint64_t idx = prim.indicesAccessor.value();
-					Accessor& accessor = asset->accessors[idx];
-					PRORENDER_ASSERT(accessor.componentType == ComponentType::UnsignedShort, true);
+				out.uvs = uvs;
+			}
+		}
+		
+		//Loading index data
+		//32-bit indices stay 32-bit, 8 and 16-bit ones become 16-bit
+		{
+			uint64_t idx = prim.indicesAccessor.value();
+			Accessor& accessor = asset->accessors[idx];
+			if (accessor.componentType == ComponentType::UnsignedInt) {
+				out.indices32 = direct_accessor_view<uint32_t>(asset.get(), accessor, ComponentType::UnsignedInt, 1);
+				if (out.indices32.empty() && accessor.count > 0) {
+					out.index32_storage.reserve(accessor.count);
+					auto iterator = fastgltf::iterateAccessor<uint32_t>(asset.get(), accessor);
+					for (auto it = iterator.begin(); it != iterator.end(); ++it) {
+						uint32_t p = *it;
+						out.index32_storage.emplace_back(p);
+					}
+					out.indices32 = out.index32_storage;
+				}
+			} else {
+				out.indices = direct_accessor_view<uint16_t>(asset.get(), accessor, ComponentType::UnsignedShort, 1);
+				if (out.indices.empty() && accessor.count > 0) {
 					indices.reserve(accessor.count);
 					auto iterator = fastgltf::iterateAccessor<uint16_t>(asset.get(), accessor);
 					for (auto it = iterator.begin(); it != iterator.end(); ++it) {
 						uint16_t p = *it;
 						indices.emplace_back(p);
 					}
+					out.indices = indices;
 				}
+			}
+		}
 
-				uint32_t mat_idx = std::numeric_limits<uint32_t>::max();
-				if (prim.materialIndex.has_value()) {
-					mat_idx = (uint32_t)prim.materialIndex.value();
-				}
+		uint32_t mat_idx = std::numeric_limits<uint32_t>::max();
+		if (prim.materialIndex.has_value()) {
+			mat_idx = (uint32_t)prim.materialIndex.value();
+		}
+		out.material_idx = mat_idx;
+	};
 
-				GLBPrimitive p = {
-					.positions = positions,
-					.colors = colors,
-					.uvs = uvs,
-					.indices = indices,
-					.material_idx = mat_idx
-				};
-				primitives.push_back(p);
-			}
+	auto for_each_primitive = [&](const std::function<void(uint32_t)>& fn) {
+		if (pool != nullptr) {
+			pool->parallel_for((uint32_t)primitives.size(), fn);
+		} else {
+			for (uint32_t i = 0; i < primitives.size(); i++) fn(i);
+		}
+	};
+	for_each_primitive(convert_primitive);
+	if (instances.size() > primitives.size()) {
+		printf("Instanced \"%s\": %i node primitives share %i converted ones\n", glb_path.filename().string().c_str(), (int)instances.size(), (int)primitives.size());
+	}
+
+	if (options.merge_primitives) {
+		size_t before_count = primitives.size();
+		primitives = merge_primitives(primitives, instances);
+		printf("Merged \"%s\": %i primitives -> %i\n", glb_path.filename().string().c_str(), (int)before_count, (int)primitives.size());
+	}
+
+	std::vector<VertexCacheStats> cache_before(primitives.size());
+	std::vector<VertexCacheStats> cache_after(primitives.size());
+	for_each_primitive([&](uint32_t i) {
+		if (options.optimize_meshes) {
+			optimize_primitive(primitives[i], options, cache_before[i], cache_after[i]);
+		}
+		if (options.lod_count > 1) {
+			build_primitive_lods(primitives[i], options);
+		}
+		if (options.quantize_vertices) {
+			quantize_primitive(primitives[i]);
+		}
+		//After quantizing, so meshlet bounds hold the positions the GPU reconstructs
+		if (options.meshlet_triangles > 0) {
+			build_primitive_meshlets(primitives[i], options);
+		}
+	});
+
+	if (options.optimize_meshes) {
+		VertexCacheStats total_before = {};
+		VertexCacheStats total_after = {};
+		for (size_t i = 0; i < primitives.size(); i++) {
+			total_before.misses += cache_before[i].misses;
+			total_before.triangle_count += cache_before[i].triangle_count;
+			total_before.vertex_count += cache_before[i].vertex_count;
+			total_after.misses += cache_after[i].misses;
+			total_after.triangle_count += cache_after[i].triangle_count;
+			total_after.vertex_count += cache_after[i].vertex_count;
 		}
+		printf(
+			"Optimized \"%s\": ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+			glb_path.filename().string().c_str(),
+			total_before.acmr(), total_after.acmr(),
+			total_before.atvr(), total_after.atvr()
+		);
 	}
 
 	GLBData g = {
-		.primitives = primitives,
-		.materials = materials
+		.primitives = std::move(primitives),
+		.instances = std::move(instances),
+		.nodes = std::move(nodes),
+		.materials = std::move(materials),
+		.source = std::move(source)
 	};
 
+	if (!cache_path.empty()) {
+		std::error_code ec;
+		std::filesystem::create_directories(options.cache_dir, ec);
+		if (!write_mesh_cache(cache_path, cache_key, g)) {
+			printf("Couldn't write mesh cache \"%s\"\n", cache_path.string().c_str());
+		}
+	}
+
 	return g;
+}
+
+std::vector<GLBData> load_glbs(std::span<const std::filesystem::path> glb_paths, ThreadPool& pool, const GLBLoadOptions& options) {
+	//One slot per file keeps the output in the same order as glb_paths
+	std::vector<GLBData> glbs(glb_paths.size());
+	pool.parallel_for((uint32_t)glb_paths.size(), [&](uint32_t i) {
+		glbs[i] = load_glb(glb_paths[i], &pool, options);
+	});
+	return glbs;
 }
\ No newline at end of file
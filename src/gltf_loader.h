@@ -1,9 +1,16 @@
 #include "volk.h"
 #include <hlsl++.h>
 #include <filesystem>
+#include <memory>
+#include <span>
 #include <vector>
 #include <fastgltf/core.hpp>
 #include <fastgltf/tools.hpp>
+#include "mapped_file.h"
+#include "mesh_optimizer.h"
+#include "node_hierarchy.h"
+#include "thread_pool.h"
+#include "vertex_quantization.h"
 
 
 template <>
@@ -13,23 +20,89 @@ struct fastgltf::ElementTraits<hlslpp::float3> : fastgltf::ElementTraitsBase<hls
 
 struct GLBMaterial {
 	hlslpp::float4 base_color;
-	std::vector<uint8_t> color_image_bytes;
+	std::span<const uint8_t> color_image_bytes;		//Encoded image, viewed in place in the GLB's source bytes
 	VkFormat color_image_format;
 };
 
+//Vertex streams of one primitive
+//Each span points straight into the owning GLBData's source bytes when the file's layout
+//already matches what the renderer consumes. Otherwise it points at the matching storage vector.
+//A quantized primitive has its streams in the quantized_* spans and empty float spans.
+//While loading, streams that came from KHR_mesh_quantization integers can be quantized before the rest are.
 struct GLBPrimitive {
-	std::vector<float> positions;
-	std::vector<float> colors;
-	std::vector<float> uvs;
-	std::vector<uint16_t> indices;
+	std::span<const float> positions;
+	std::span<const float> colors;
+	std::span<const float> uvs;
+	std::span<const uint16_t> indices;
+	std::span<const uint32_t> indices32;		//Used instead of indices when the primitive has too many vertices for 16 bits
+	std::span<const MeshLod> lods;				//Ranges of the index stream for each level of detail. Empty if there's only one
+	std::span<const MeshMeshlet> meshlets;		//Clusters of the full detail level's triangles, culled on the GPU. Empty if not built
 	uint32_t material_idx;
+
+	std::span<const uint16_t> quantized_positions;
+	std::span<const uint32_t> quantized_colors;
+	std::span<const uint16_t> quantized_uvs;
+	VertexQuantization quantization = {};
+
+	std::vector<float> position_storage;
+	std::vector<float> color_storage;
+	std::vector<float> uv_storage;
+	std::vector<uint16_t> index_storage;
+	std::vector<uint32_t> index32_storage;
+	std::vector<MeshLod> lod_storage;
+	std::vector<MeshMeshlet> meshlet_storage;
+	std::vector<uint16_t> quantized_position_storage;
+	std::vector<uint32_t> quantized_color_storage;
+	std::vector<uint16_t> quantized_uv_storage;
+
+	//Copying would leave the spans pointing at the original's storage
+	GLBPrimitive() = default;
+	GLBPrimitive(const GLBPrimitive&) = delete;
+	GLBPrimitive& operator=(const GLBPrimitive&) = delete;
+	GLBPrimitive(GLBPrimitive&&) = default;
+	GLBPrimitive& operator=(GLBPrimitive&&) = default;
+};
+
+//One placement of a primitive in the node tree
+struct GLBInstance {
+	uint32_t primitive_idx;
+	uint32_t node_idx;
+};
+
+//Owner of a GLB's bytes, either a memory mapping or a buffer the file was read into
+//Buffer views compressed with EXT_meshopt_compression are decoded into decoded_views
+struct GLBSource {
+	MappedFile file;
+	fastgltf::GltfDataBuffer buffer;
+	std::vector<std::vector<uint8_t>> decoded_views;
 };
 
 //Data extracted from a .glb file, ready to be ingested by a renderer
+//Spans in primitives and materials stay valid for as long as this lives
 struct GLBData {
 	std::vector<GLBPrimitive> primitives;
-	std::vector<uint16_t> prim_parents;
+	std::vector<GLBInstance> instances;		//A primitive of a mesh used by several nodes has one instance per node
+	NodeHierarchy nodes;					//The default scene's node tree
 	std::vector<GLBMaterial> materials;
+	std::shared_ptr<GLBSource> source;		//Shared with image uploads still reading material images out of it
 };
 
-GLBData load_glb(const std::filesystem::path& glb_path);
\ No newline at end of file
+struct GLBLoadOptions {
+	bool memory_map = true;				//Map the file instead of reading it into a heap buffer
+	std::filesystem::path cache_dir;	//Directory for baked mesh caches. Caching is off when empty
+	bool optimize_meshes = true;		//Weld vertices and reorder for the post-transform cache and vertex fetch
+	bool optimize_overdraw = false;		//Also reorder triangle clusters front to back, trading some cache efficiency
+	float overdraw_threshold = 1.05f;	//ACMR a cluster may reach relative to the cache optimized order
+	bool quantize_vertices = false;		//Store positions and uvs as unorm16 and colors as unorm8. Integer attributes pass through without a float round trip
+	bool merge_primitives = false;		//Combine primitives sharing a material and a node into one draw
+	uint32_t lod_count = 1;				//Levels of detail to build per primitive, including the full detail one
+	float lod_reduction = 0.5f;			//Triangle count of each level relative to the previous one
+	float lod_max_error = 0.02f;		//Largest error a level may have, relative to the primitive's bounding box diagonal
+	uint32_t meshlet_triangles = 0;		//Split the full detail level into meshlets of at most this many triangles. Zero draws primitives whole
+};
+
+//Primitive conversion is spread across pool's threads when one is given
+GLBData load_glb(const std::filesystem::path& glb_path, ThreadPool* pool = nullptr, const GLBLoadOptions& options = {});
+
+//Loads several files concurrently. The result is in the same order as glb_paths
+std::vector<GLBData> load_glbs(std::span<const std::filesystem::path> glb_paths, ThreadPool& pool, const GLBLoadOptions& options = {});
\ No newline at end of file
@@ -27,6 +27,8 @@
 #include "VulkanRenderer.h"
 #include "ImguiRenderer.h"
 #include "gltf_loader.h"
+#include "node_hierarchy.h"
+#include "thread_pool.h"
 #include "vma.h"
 #include "timer.h"
 #include "utils.h"
@@ -42,11 +44,12 @@ struct Configuration {
 struct DrawPrimitive {
 	Key<BufferView> mesh;
 	Key<Material> material;
+	std::vector<uint32_t> nodes;		//Nodes this primitive is drawn at, one instance each
 };
 
 struct Ps1Object {
 	std::vector<DrawPrimitive> primitives;
-	std::vector<uint16_t> primitive_parents;
+	NodeHierarchy nodes;
 };
 
 int main(int argc, char* argv[]) {
@@ -163,49 +166,94 @@ int main(int argc, char* argv[]) {
 		"models/samus.glb",
 		"models/CesiumMan.glb"
 	};
+	ThreadPool thread_pool;
+	GLBLoadOptions glb_options = {
+		.memory_map = true,
+		.cache_dir = "models/.meshcache",
+		.quantize_vertices = true,
+		.merge_primitives = true,
+		.lod_count = 4,
+		.meshlet_triangles = 256
+	};
+	std::vector<GLBData> glbs = load_glbs(std::span<const std::filesystem::path>(glb_paths), thread_pool, glb_options);
+	app_timer.print("Parsed glbs");
+	app_timer.start();
+
 	std::vector<Ps1Object> ps1_objects;
-	for (auto& path : glb_paths) {
+	for (GLBData& ps1_glb : glbs) {
 		Key<BufferView> mesh;
 		Key<Material> material;
 
-		GLBData ps1_glb = load_glb(path);
 		Ps1Object obj = {};
-		obj.primitive_parents = ps1_glb.prim_parents;
+		obj.nodes = std::move(ps1_glb.nodes);
 		printf("GLB has %i primitives\n", (int)ps1_glb.primitives.size());
 
-		std::unordered_map<uint32_t, Key<Material>> seen_materials;
-		seen_materials.reserve(ps1_glb.materials.size());
+		//Only materials some primitive uses get created, so unused textures are never decoded
+		//Primitives without a material share a default one, which takes the last slot
+		constexpr uint32_t UNUSED_MATERIAL = std::numeric_limits<uint32_t>::max();
+		std::vector<uint32_t> material_slots(ps1_glb.materials.size() + 1, UNUSED_MATERIAL);
+		std::vector<uint32_t> used_materials;
+		for (GLBPrimitive& prim : ps1_glb.primitives) {
+			uint32_t idx = prim.material_idx != std::numeric_limits<uint32_t>::max() ? prim.material_idx : (uint32_t)ps1_glb.materials.size();
+			if (material_slots[idx] != UNUSED_MATERIAL) continue;
+			material_slots[idx] = (uint32_t)used_materials.size();
+			used_materials.push_back(idx);
+		}
+
+		//Create the used materials in one go
+		std::vector<Material> materials;
+		materials.reserve(used_materials.size());
+		for (uint32_t material_idx : used_materials) {
+			if (material_idx == ps1_glb.materials.size()) {
+				materials.push_back({
+					.base_color = hlslpp::float4(1.0, 1.0, 1.0, 1.0),
+					.batch_id = 0,
+					.sampler_idx = ImmutableSamplers::STANDARD
+				});
+				continue;
+			}
+
+			GLBMaterial& mat = ps1_glb.materials[material_idx];
+			uint64_t batch_id = 0;
+			if (mat.color_image_bytes.size() > 0) {
+				CompressedImage image = { .bytes = mat.color_image_bytes, .owner = ps1_glb.source };
+				batch_id = vgd.load_compressed_images({image}, {VK_FORMAT_R8G8B8A8_SRGB});
+			}
+			materials.push_back({
+				.base_color = mat.base_color,
+				.batch_id = batch_id,
+				.sampler_idx = ImmutableSamplers::STANDARD
+			});
+		}
+
+		std::vector<Key<Material>> material_keys(materials.size());
+		renderer.push_materials(std::span<const Material>(materials), material_keys.data());
 
 		for (GLBPrimitive& prim : ps1_glb.primitives) {
 			//Handle material for this primitive
 			if (prim.material_idx != std::numeric_limits<uint32_t>::max()) {
-				//If prim has material
-				if (seen_materials.contains(prim.material_idx)) {
-					material = seen_materials[prim.material_idx];
-				} else {
-					//If material hasn't been seen before, handle it
-					GLBMaterial& mat = ps1_glb.materials[prim.material_idx];
-					if (mat.color_image_bytes.size() > 0) {
-
-						CompressedImage image = { .bytes = mat.color_image_bytes};
-						uint64_t batch_id = vgd.load_compressed_images({image}, {VK_FORMAT_R8G8B8A8_SRGB});
-
-						material = renderer.push_material(batch_id, ImmutableSamplers::STANDARD, mat.base_color);
-					} else {
-						material = renderer.push_material(ImmutableSamplers::STANDARD, mat.base_color);
-					}
-					seen_materials[prim.material_idx] = material;
-				}
+				material = material_keys[material_slots[prim.material_idx]];
 			} else {
-				//If prim has no material, give default one
-				material = renderer.push_material(ImmutableSamplers::STANDARD, hlslpp::float4(1.0, 1.0, 1.0, 1.0));
+				material = material_keys[material_slots.back()];
 			}
 
 			//Push vertex data into renderer
-			mesh = renderer.push_vertex_positions(std::span(prim.positions));
-			if (prim.uvs.size() > 0) renderer.push_vertex_uvs(mesh, std::span(prim.uvs));
-			if (prim.colors.size() > 0) renderer.push_vertex_colors(mesh, std::span(prim.colors));
-			renderer.push_indices16(mesh, std::span(prim.indices));
+			if (prim.quantized_positions.size() > 0) {
+				mesh = renderer.push_quantized_vertex_positions(prim.quantized_positions, prim.quantization);
+				if (prim.quantized_uvs.size() > 0) renderer.push_quantized_vertex_uvs(mesh, prim.quantized_uvs, prim.quantization);
+				if (prim.quantized_colors.size() > 0) renderer.push_quantized_vertex_colors(mesh, prim.quantized_colors);
+			} else {
+				mesh = renderer.push_vertex_positions(std::span(prim.positions));
+				if (prim.uvs.size() > 0) renderer.push_vertex_uvs(mesh, std::span(prim.uvs));
+				if (prim.colors.size() > 0) renderer.push_vertex_colors(mesh, std::span(prim.colors));
+			}
+			if (prim.indices32.size() > 0) {
+				renderer.push_indices32(mesh, prim.indices32);
+			} else {
+				renderer.push_indices16(mesh, std::span(prim.indices));
+			}
+			if (prim.lods.size() > 0) renderer.push_mesh_lods(mesh, prim.lods);
+			if (prim.meshlets.size() > 0) renderer.push_mesh_meshlets(mesh, prim.meshlets);
 			
 			DrawPrimitive p = {
 				.mesh = mesh,
@@ -213,8 +261,12 @@ int main(int argc, char* argv[]) {
 			};
 			obj.primitives.push_back(p);
 		}
-		ps1_objects.push_back(obj);
+		for (GLBInstance& instance : ps1_glb.instances) {
+			obj.primitives[instance.primitive_idx].nodes.push_back(instance.node_idx);
+		}
+		ps1_objects.push_back(std::move(obj));
 	}
+	glbs.clear();		//Everything has been copied into renderer buffers. Files with images still being decoded stay mapped until the upload thread lets go
 	app_timer.print("Loaded glbs");
 	app_timer.start();
 
@@ -444,6 +496,11 @@ int main(int argc, char* argv[]) {
 					ImGui::Text("Camera yaw: %f", camera->yaw);
 					ImGui::Text("Camera roll: %f", camera->roll);
 					ImGui::SliderFloat("Timescale", &timescale, 0.0, 2.0);
+					ImGui::SliderFloat("LOD pixel error", &renderer.lod_pixel_error, 0.0, 16.0);
+					ImGui::SliderFloat("LOD hysteresis", &renderer.lod_hysteresis, 0.0, 0.9);
+					ImGui::Checkbox("Meshlet culling", &renderer.meshlet_culling);
+					ImGui::Text("CPU mips: %.2fms for %.2fM texels", vgd.cpu_mip_generation_ms(), vgd.cpu_mip_generation_texels() / 1000000.0);
+					ImGui::Text("GPU mips: %.2fms for %.2fM texels, %u images untimed", vgd.gpu_mip_generation_ms(), vgd.gpu_mip_generation_texels() / 1000000.0, vgd.gpu_mip_untimed_images());
 				}
 
 				ImGuiWindowFlags window_flags = 0;
@@ -454,11 +511,11 @@ int main(int argc, char* argv[]) {
 				ImGui::Separator();
 
 				for (auto it = vgd.bindless_images.begin(); it != vgd.bindless_images.end(); ++it) {
-					VulkanBindlessImage& image = *it;
+					VulkanImage& image = it.get<BINDLESS_VK_IMAGE>();
 
-					ImGui::Text("From batch #%i", image.batch_id);
+					ImGui::Text("From batch #%i", (int)it.get<BINDLESS_BATCH_ID>());
 
-					ImVec2 dims = ImVec2((float)image.vk_image.width, (float)image.vk_image.height);
+					ImVec2 dims = ImVec2((float)image.width, (float)image.height);
 					ImGui::BulletText("Width = %i", (uint32_t)dims.x);
 					ImGui::BulletText("Height = %i", (uint32_t)dims.y);
 
@@ -538,8 +595,24 @@ int main(int argc, char* argv[]) {
 					0.0, 0.0, 1.0, 0.0,
 					0.0, 0.0, 0.0, 1.0
 				);
-				InstanceData mats[] = {hlslpp::mul(yaw_matrix, hlslpp::mul(mat, scale_mat))};
+				//The object's matrix places the roots of its node tree
+				alignas(16) float root_world[16];
+				hlslpp::store(hlslpp::mul(yaw_matrix, hlslpp::mul(mat, scale_mat)), root_world);
+				propagate_world_transforms(p.nodes, root_world, &thread_pool);
+				//A primitive shared by several nodes is one instanced draw
+				std::vector<InstanceData> mats;
 				for (DrawPrimitive& prim : p.primitives) {
+					mats.clear();
+					for (uint32_t node : prim.nodes) {
+						float w[16];
+						p.nodes.world_matrix(node, w);
+						mats.push_back({hlslpp::float4x4(
+							w[0], w[1], w[2], w[3],
+							w[4], w[5], w[6], w[7],
+							w[8], w[9], w[10], w[11],
+							w[12], w[13], w[14], w[15]
+						)});
+					}
 					renderer.ps1_draw(prim.mesh, prim.material, std::span(mats));
 				}
 				rotation += timescale * delta_time;
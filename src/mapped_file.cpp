@@ -0,0 +1,78 @@
+#include "mapped_file.h"
+#include "virtual_memory.h"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+bool MappedFile::open(const std::filesystem::path& path) {
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	//The view and the mapping object keep the file alive, so both handles can go right away
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (mapping == nullptr) return false;
+	void* ptr = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	if (ptr == nullptr) return false;
+
+	size = static_cast<size_t>(file_size.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	size = static_cast<size_t>(st.st_size);
+	void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (ptr == MAP_FAILED) {
+		size = 0;
+		return false;
+	}
+	madvise(ptr, size, MADV_WILLNEED);
+#endif
+
+	size_t page_size = virtual_page_size();
+	data = static_cast<uint8_t*>(ptr);
+	mapped_size = ((size + page_size - 1) / page_size) * page_size;
+	return true;
+}
+
+void MappedFile::close() {
+	if (data == nullptr) return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(data, size);
+#endif
+	data = nullptr;
+	size = 0;
+	mapped_size = 0;
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <filesystem>
+#include <stddef.h>
+#include <stdint.h>
+
+//A whole file mapped copy-on-write into the address space
+//The mapping is rounded up to whole pages. Bytes between size and mapped_size read as zero,
+//which lets parsers that want trailing padding use the mapping in place.
+struct MappedFile {
+	uint8_t* data = nullptr;
+	size_t size = 0;
+	size_t mapped_size = 0;
+
+	bool open(const std::filesystem::path& path);
+	void close();
+
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+};
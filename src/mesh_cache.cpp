@@ -0,0 +1,358 @@
+#include <bit>
+#include <functional>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include "mesh_cache.h"
+
+#ifdef _WIN32
+	#include <process.h>
+	#define getpid _getpid
+#else
+	#include <unistd.h>
+#endif
+
+static constexpr char MESH_CACHE_MAGIC[8] = { 'P', 'R', 'M', 'E', 'S', 'H', 'C', '\0' };
+static constexpr uint64_t MESH_CACHE_ALIGNMENT = 16;
+
+struct MeshCacheHeader {
+	char magic[8];
+	uint32_t layout_version;
+	uint32_t header_size;
+	uint64_t source_hash;
+	uint64_t source_size;
+	uint64_t bake_options;
+	uint32_t primitive_count;
+	uint32_t material_count;
+	uint64_t instances_offset;
+	uint64_t instances_count;
+	uint32_t node_count;
+	uint32_t _pad0;
+	uint64_t node_parents_offset;
+	uint64_t node_transforms_offset;		//Translations, rotations then scales, each component a node_count array
+};
+
+//Offsets are from the start of the file, counts are in elements
+struct MeshCachePrimitive {
+	uint64_t positions_offset;
+	uint64_t positions_count;
+	uint64_t colors_offset;
+	uint64_t colors_count;
+	uint64_t uvs_offset;
+	uint64_t uvs_count;
+	uint64_t indices_offset;
+	uint64_t indices_count;
+	uint64_t indices32_offset;
+	uint64_t indices32_count;
+	uint64_t lods_offset;
+	uint64_t lods_count;
+	uint64_t meshlets_offset;
+	uint64_t meshlets_count;
+	uint64_t quantized_positions_offset;
+	uint64_t quantized_positions_count;
+	uint64_t quantized_colors_offset;
+	uint64_t quantized_colors_count;
+	uint64_t quantized_uvs_offset;
+	uint64_t quantized_uvs_count;
+	VertexQuantization quantization;
+	uint32_t material_idx;
+	uint32_t _pad0;
+};
+
+struct MeshCacheMaterial {
+	float base_color[4];
+	uint32_t color_image_format;
+	uint32_t _pad0;
+	uint64_t color_image_offset;
+	uint64_t color_image_size;
+};
+
+//XXH64
+uint64_t hash_file_contents(const uint8_t* data, size_t size) {
+	constexpr uint64_t P1 = 0x9E3779B185EBCA87ull;
+	constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+	constexpr uint64_t P3 = 0x165667B19E3779F9ull;
+	constexpr uint64_t P4 = 0x85EBCA77C2B2AE63ull;
+	constexpr uint64_t P5 = 0x27D4EB2F165667C5ull;
+
+	auto read64 = [](const uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return v; };
+	auto read32 = [](const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; };
+	auto xxh_round = [](uint64_t acc, uint64_t input) {
+		acc += input * P2;
+		acc = std::rotl(acc, 31);
+		return acc * P1;
+	};
+	auto merge_round = [&](uint64_t acc, uint64_t val) {
+		acc ^= xxh_round(0, val);
+		return acc * P1 + P4;
+	};
+
+	const uint8_t* p = data;
+	const uint8_t* end = data + size;
+	uint64_t h;
+	if (size >= 32) {
+		uint64_t v1 = P1 + P2;
+		uint64_t v2 = P2;
+		uint64_t v3 = 0;
+		uint64_t v4 = 0 - P1;
+		do {
+			v1 = xxh_round(v1, read64(p));
+			v2 = xxh_round(v2, read64(p + 8));
+			v3 = xxh_round(v3, read64(p + 16));
+			v4 = xxh_round(v4, read64(p + 24));
+			p += 32;
+		} while (p + 32 <= end);
+
+		h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+		h = merge_round(h, v1);
+		h = merge_round(h, v2);
+		h = merge_round(h, v3);
+		h = merge_round(h, v4);
+	} else {
+		h = P5;
+	}
+	h += size;
+
+	while (p + 8 <= end) {
+		h ^= xxh_round(0, read64(p));
+		h = std::rotl(h, 27) * P1 + P4;
+		p += 8;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)read32(p) * P1;
+		h = std::rotl(h, 23) * P2 + P3;
+		p += 4;
+	}
+	while (p < end) {
+		h ^= (*p) * P5;
+		h = std::rotl(h, 11) * P1;
+		p += 1;
+	}
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
+
+//Span of count Ts at offset in the mapping, or false if it doesn't fit
+template<typename T>
+static bool cache_view(MappedFile& file, uint64_t offset, uint64_t count, std::span<const T>& out) {
+	if (count == 0) {
+		out = {};
+		return true;
+	}
+	if (offset % alignof(T) != 0 || offset > file.size || count > (file.size - offset) / sizeof(T)) return false;
+	out = std::span<const T>(reinterpret_cast<const T*>(file.data + offset), count);
+	return true;
+}
+
+bool load_mesh_cache(const std::filesystem::path& cache_path, const MeshCacheKey& key, GLBData& out) {
+	std::shared_ptr<GLBSource> source = std::make_shared<GLBSource>();
+	MappedFile& file = source->file;
+	if (!file.open(cache_path)) return false;
+	if (file.size < sizeof(MeshCacheHeader)) return false;
+
+	MeshCacheHeader header;
+	memcpy(&header, file.data, sizeof(header));
+	if (memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) != 0) return false;
+	if (header.layout_version != MESH_CACHE_LAYOUT_VERSION || header.header_size != sizeof(MeshCacheHeader)) return false;
+	if (header.source_hash != key.source_hash || header.source_size != key.source_size || header.bake_options != key.bake_options) return false;
+
+	uint64_t table_bytes = (uint64_t)header.primitive_count * sizeof(MeshCachePrimitive) + (uint64_t)header.material_count * sizeof(MeshCacheMaterial);
+	if (table_bytes > file.size - sizeof(MeshCacheHeader)) return false;
+	const uint8_t* table = file.data + sizeof(MeshCacheHeader);
+
+	GLBData glb;
+	glb.primitives.resize(header.primitive_count);
+	for (uint32_t i = 0; i < header.primitive_count; i++) {
+		MeshCachePrimitive entry;
+		memcpy(&entry, table + i * sizeof(MeshCachePrimitive), sizeof(entry));
+
+		GLBPrimitive& prim = glb.primitives[i];
+		prim.material_idx = entry.material_idx;
+		prim.quantization = entry.quantization;
+		if (
+			!cache_view(file, entry.positions_offset, entry.positions_count, prim.positions) ||
+			!cache_view(file, entry.colors_offset, entry.colors_count, prim.colors) ||
+			!cache_view(file, entry.uvs_offset, entry.uvs_count, prim.uvs) ||
+			!cache_view(file, entry.indices_offset, entry.indices_count, prim.indices) ||
+			!cache_view(file, entry.indices32_offset, entry.indices32_count, prim.indices32) ||
+			!cache_view(file, entry.lods_offset, entry.lods_count, prim.lods) ||
+			!cache_view(file, entry.meshlets_offset, entry.meshlets_count, prim.meshlets) ||
+			!cache_view(file, entry.quantized_positions_offset, entry.quantized_positions_count, prim.quantized_positions) ||
+			!cache_view(file, entry.quantized_colors_offset, entry.quantized_colors_count, prim.quantized_colors) ||
+			!cache_view(file, entry.quantized_uvs_offset, entry.quantized_uvs_count, prim.quantized_uvs)
+		) return false;
+	}
+
+	table += header.primitive_count * sizeof(MeshCachePrimitive);
+	glb.materials.resize(header.material_count);
+	for (uint32_t i = 0; i < header.material_count; i++) {
+		MeshCacheMaterial entry;
+		memcpy(&entry, table + i * sizeof(MeshCacheMaterial), sizeof(entry));
+
+		GLBMaterial& mat = glb.materials[i];
+		mat.base_color = hlslpp::float4(entry.base_color[0], entry.base_color[1], entry.base_color[2], entry.base_color[3]);
+		mat.color_image_format = (VkFormat)entry.color_image_format;
+		if (!cache_view(file, entry.color_image_offset, entry.color_image_size, mat.color_image_bytes)) return false;
+	}
+
+	std::span<const GLBInstance> instances;
+	if (!cache_view(file, header.instances_offset, header.instances_count, instances)) return false;
+	glb.instances.assign(instances.begin(), instances.end());
+
+	std::span<const uint32_t> node_parents;
+	std::span<const float> node_transforms;
+	if (
+		!cache_view(file, header.node_parents_offset, header.node_count, node_parents) ||
+		!cache_view(file, header.node_transforms_offset, 10 * (uint64_t)header.node_count, node_transforms)
+	) return false;
+	for (uint32_t i = 0; i < header.node_count; i++) {
+		if (node_parents[i] != NodeHierarchy::NO_PARENT && node_parents[i] >= i) return false;
+		float t[3], r[4], s[3];
+		for (int c = 0; c < 3; c++) t[c] = node_transforms[c * header.node_count + i];
+		for (int c = 0; c < 4; c++) r[c] = node_transforms[(3 + c) * header.node_count + i];
+		for (int c = 0; c < 3; c++) s[c] = node_transforms[(7 + c) * header.node_count + i];
+		glb.nodes.add_node(node_parents[i], t, r, s);
+	}
+	for (GLBInstance& instance : glb.instances) {
+		if (instance.primitive_idx >= header.primitive_count || instance.node_idx >= header.node_count) return false;
+	}
+
+	glb.source = std::move(source);
+	out = std::move(glb);
+	return true;
+}
+
+//Accumulates the blob section of a cache file, remembering where each array landed
+struct MeshCacheWriter {
+	std::vector<uint8_t> blobs;
+	uint64_t base_offset;
+
+	template<typename T>
+	uint64_t append(std::span<const T> data) {
+		if (data.empty()) return 0;
+		size_t aligned = (blobs.size() + MESH_CACHE_ALIGNMENT - 1) & ~(MESH_CACHE_ALIGNMENT - 1);
+		blobs.resize(aligned + data.size_bytes());
+		memcpy(blobs.data() + aligned, data.data(), data.size_bytes());
+		return base_offset + aligned;
+	}
+};
+
+std::filesystem::path mesh_cache_path(const std::filesystem::path& cache_dir, const std::filesystem::path& source_path) {
+	//weakly_canonical() leaves relative paths relative when their first component doesn't exist, so it's made absolute first
+	std::error_code ec;
+	std::filesystem::path canonical = std::filesystem::weakly_canonical(std::filesystem::absolute(source_path, ec), ec);
+	if (ec) canonical = source_path;
+	std::u8string canonical_name = canonical.generic_u8string();
+	uint64_t path_hash = hash_file_contents(reinterpret_cast<const uint8_t*>(canonical_name.data()), canonical_name.size());
+
+	//The file's own name stays in front to keep the directory readable
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), "-%016llx.meshcache", (unsigned long long)path_hash);
+	std::filesystem::path cache_path = cache_dir / source_path.stem();
+	cache_path += suffix;
+	return cache_path;
+}
+
+bool write_mesh_cache(const std::filesystem::path& cache_path, const MeshCacheKey& key, GLBData& glb) {
+	MeshCacheHeader header = {};
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+	header.layout_version = MESH_CACHE_LAYOUT_VERSION;
+	header.header_size = sizeof(MeshCacheHeader);
+	header.source_hash = key.source_hash;
+	header.source_size = key.source_size;
+	header.bake_options = key.bake_options;
+	header.primitive_count = (uint32_t)glb.primitives.size();
+	header.material_count = (uint32_t)glb.materials.size();
+
+	uint64_t table_end = sizeof(MeshCacheHeader) + glb.primitives.size() * sizeof(MeshCachePrimitive) + glb.materials.size() * sizeof(MeshCacheMaterial);
+	MeshCacheWriter writer = {
+		.blobs = {},
+		.base_offset = (table_end + MESH_CACHE_ALIGNMENT - 1) & ~(MESH_CACHE_ALIGNMENT - 1)
+	};
+
+	std::vector<MeshCachePrimitive> prim_entries;
+	prim_entries.reserve(glb.primitives.size());
+	for (GLBPrimitive& prim : glb.primitives) {
+		MeshCachePrimitive entry = {};
+		entry.positions_offset = writer.append(prim.positions);
+		entry.positions_count = prim.positions.size();
+		entry.colors_offset = writer.append(prim.colors);
+		entry.colors_count = prim.colors.size();
+		entry.uvs_offset = writer.append(prim.uvs);
+		entry.uvs_count = prim.uvs.size();
+		entry.indices_offset = writer.append(prim.indices);
+		entry.indices_count = prim.indices.size();
+		entry.indices32_offset = writer.append(prim.indices32);
+		entry.indices32_count = prim.indices32.size();
+		entry.lods_offset = writer.append(prim.lods);
+		entry.lods_count = prim.lods.size();
+		entry.meshlets_offset = writer.append(prim.meshlets);
+		entry.meshlets_count = prim.meshlets.size();
+		entry.quantized_positions_offset = writer.append(prim.quantized_positions);
+		entry.quantized_positions_count = prim.quantized_positions.size();
+		entry.quantized_colors_offset = writer.append(prim.quantized_colors);
+		entry.quantized_colors_count = prim.quantized_colors.size();
+		entry.quantized_uvs_offset = writer.append(prim.quantized_uvs);
+		entry.quantized_uvs_count = prim.quantized_uvs.size();
+		entry.quantization = prim.quantization;
+		entry.material_idx = prim.material_idx;
+		prim_entries.push_back(entry);
+	}
+
+	std::vector<MeshCacheMaterial> mat_entries;
+	mat_entries.reserve(glb.materials.size());
+	for (GLBMaterial& mat : glb.materials) {
+		MeshCacheMaterial entry = {};
+		entry.base_color[0] = mat.base_color[0];
+		entry.base_color[1] = mat.base_color[1];
+		entry.base_color[2] = mat.base_color[2];
+		entry.base_color[3] = mat.base_color[3];
+		entry.color_image_format = (uint32_t)mat.color_image_format;
+		entry.color_image_offset = writer.append(mat.color_image_bytes);
+		entry.color_image_size = mat.color_image_bytes.size();
+		mat_entries.push_back(entry);
+	}
+
+	header.instances_offset = writer.append(std::span<const GLBInstance>(glb.instances));
+	header.instances_count = glb.instances.size();
+
+	const NodeHierarchy& nodes = glb.nodes;
+	std::vector<float> node_transforms;
+	node_transforms.reserve(10 * nodes.node_count());
+	for (int c = 0; c < 3; c++) node_transforms.insert(node_transforms.end(), nodes.translation[c].begin(), nodes.translation[c].end());
+	for (int c = 0; c < 4; c++) node_transforms.insert(node_transforms.end(), nodes.rotation[c].begin(), nodes.rotation[c].end());
+	for (int c = 0; c < 3; c++) node_transforms.insert(node_transforms.end(), nodes.scale[c].begin(), nodes.scale[c].end());
+	header.node_count = nodes.node_count();
+	header.node_parents_offset = writer.append(std::span<const uint32_t>(nodes.parents));
+	header.node_transforms_offset = writer.append(std::span<const float>(node_transforms));
+
+	//Write to a temporary and rename so a crash never leaves a truncated cache behind
+	//Its name is unique to this process and thread, so writers baking the same cache at once never share a file
+	char temp_suffix[64];
+	snprintf(temp_suffix, sizeof(temp_suffix), ".%llu-%016llx.tmp", (unsigned long long)getpid(), (unsigned long long)std::hash<std::thread::id>()(std::this_thread::get_id()));
+	std::filesystem::path temp_path = cache_path;
+	temp_path += temp_suffix;
+	FILE* f = fopen(temp_path.string().c_str(), "wb");
+	if (f == nullptr) return false;
+
+	static const uint8_t zeros[MESH_CACHE_ALIGNMENT] = {};
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	ok = ok && (prim_entries.empty() || fwrite(prim_entries.data(), sizeof(MeshCachePrimitive), prim_entries.size(), f) == prim_entries.size());
+	ok = ok && (mat_entries.empty() || fwrite(mat_entries.data(), sizeof(MeshCacheMaterial), mat_entries.size(), f) == mat_entries.size());
+	ok = ok && (writer.base_offset == table_end || fwrite(zeros, 1, writer.base_offset - table_end, f) == writer.base_offset - table_end);
+	ok = ok && (writer.blobs.empty() || fwrite(writer.blobs.data(), 1, writer.blobs.size(), f) == writer.blobs.size());
+	ok = (fclose(f) == 0) && ok;
+
+	std::error_code ec;
+	if (ok) std::filesystem::rename(temp_path, cache_path, ec);
+	if (!ok || ec) {
+		std::filesystem::remove(temp_path, ec);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <filesystem>
+#include "gltf_loader.h"
+
+//On-disk cache of GLBData baked in the exact stream layout the renderer's vertex buffers use
+//A warm load is a mapping of the cache file with GLBPrimitive spans pointing into it.
+//Cache files are keyed by a hash of the source file's contents, the options it was baked with
+//and MESH_CACHE_LAYOUT_VERSION, and get rebuilt when any of them changes.
+
+//Bump whenever the baked stream layout or the cache file format changes
+static constexpr uint32_t MESH_CACHE_LAYOUT_VERSION = 9;
+
+//Identifies the source a cache file was baked from and how
+struct MeshCacheKey {
+	uint64_t source_hash;
+	uint64_t source_size;
+	uint64_t bake_options;		//Hash of the load options that change the baked output
+};
+
+uint64_t hash_file_contents(const uint8_t* data, size_t size);
+
+//Where the cache for source_path lives in cache_dir
+//The name carries a hash of the source's canonical path so files with the same name in different directories don't share one
+std::filesystem::path mesh_cache_path(const std::filesystem::path& cache_dir, const std::filesystem::path& source_path);
+
+//Fills out from the cache entry baked with the given key. Returns false on a miss
+bool load_mesh_cache(const std::filesystem::path& cache_path, const MeshCacheKey& key, GLBData& out);
+
+//Writes glb to cache_path so a later load_mesh_cache() with the same key succeeds
+bool write_mesh_cache(const std::filesystem::path& cache_path, const MeshCacheKey& key, GLBData& glb);
@@ -0,0 +1,797 @@
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include "mesh_optimizer.h"
+
+//Returns which triangles miss how many times in a FIFO cache of cache_size entries
+//A vertex is resident if it was last loaded fewer than cache_size misses ago
+static uint64_t simulate_fifo_cache(std::span<const uint32_t> indices, size_t vertex_count, uint32_t cache_size, uint8_t* triangle_misses) {
+	std::vector<uint64_t> load_time(vertex_count, 0);
+	uint64_t timestamp = cache_size + 1;
+	uint64_t misses = 0;
+	for (size_t t = 0; t < indices.size() / 3; t++) {
+		uint8_t tri_misses = 0;
+		for (size_t c = 0; c < 3; c++) {
+			uint32_t v = indices[3 * t + c];
+			if (timestamp - load_time[v] > cache_size) {
+				load_time[v] = timestamp++;
+				tri_misses++;
+			}
+		}
+		if (triangle_misses != nullptr) triangle_misses[t] = tri_misses;
+		misses += tri_misses;
+	}
+	return misses;
+}
+
+VertexCacheStats analyze_vertex_cache(std::span<const uint32_t> indices, size_t vertex_count, uint32_t cache_size) {
+	//ATVR is relative to the vertices actually drawn, not to the size of the vertex buffer
+	std::vector<uint8_t> referenced(vertex_count, 0);
+	uint64_t unique_vertices = 0;
+	for (uint32_t v : indices) {
+		unique_vertices += referenced[v] == 0;
+		referenced[v] = 1;
+	}
+
+	VertexCacheStats stats = {};
+	stats.misses = simulate_fifo_cache(indices, vertex_count, cache_size, nullptr);
+	stats.triangle_count = indices.size() / 3;
+	stats.vertex_count = unique_vertices;
+	return stats;
+}
+
+static uint64_t hash_vertex(std::span<const MeshVertexStream> streams, uint32_t v) {
+	//FNV-1a over the bits of every attribute
+	uint64_t h = 0xCBF29CE484222325ull;
+	for (const MeshVertexStream& stream : streams) {
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(stream.data.data() + (size_t)v * stream.components);
+		for (size_t i = 0; i < stream.components * sizeof(float); i++) {
+			h ^= bytes[i];
+			h *= 0x100000001B3ull;
+		}
+	}
+	return h;
+}
+
+static bool vertices_equal(std::span<const MeshVertexStream> streams, uint32_t a, uint32_t b) {
+	for (const MeshVertexStream& stream : streams) {
+		const float* pa = stream.data.data() + (size_t)a * stream.components;
+		const float* pb = stream.data.data() + (size_t)b * stream.components;
+		if (memcmp(pa, pb, stream.components * sizeof(float)) != 0) return false;
+	}
+	return true;
+}
+
+uint32_t weld_vertices(std::span<const MeshVertexStream> streams, size_t vertex_count, std::span<uint32_t> indices) {
+	//Open addressing table of canonical vertices, kept at most half full
+	size_t capacity = 16;
+	while (capacity < vertex_count * 2) capacity *= 2;
+	std::vector<uint32_t> table(capacity, NO_VERTEX);
+
+	std::vector<uint32_t> canonical(vertex_count, NO_VERTEX);
+	uint32_t unique = 0;
+	for (uint32_t& index : indices) {
+		uint32_t v = index;
+		if (canonical[v] == NO_VERTEX) {
+			size_t slot = hash_vertex(streams, v) & (capacity - 1);
+			while (table[slot] != NO_VERTEX && !vertices_equal(streams, table[slot], v)) {
+				slot = (slot + 1) & (capacity - 1);
+			}
+			if (table[slot] == NO_VERTEX) {
+				table[slot] = v;
+				unique++;
+			}
+			canonical[v] = table[slot];
+		}
+		index = canonical[v];
+	}
+	return unique;
+}
+
+//Forsyth's scoring function, see "Linear-Speed Vertex Cache Optimisation" (Tom Forsyth, 2006)
+static constexpr uint32_t FORSYTH_CACHE_SIZE = 32;
+static constexpr uint32_t FORSYTH_MAX_VALENCE = 32;
+static constexpr float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+static constexpr float FORSYTH_LAST_TRI_SCORE = 0.75f;
+static constexpr float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+static constexpr float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+struct ForsythScoreTable {
+	float cache[FORSYTH_CACHE_SIZE];
+	float valence[FORSYTH_MAX_VALENCE];
+
+	ForsythScoreTable() {
+		for (uint32_t i = 0; i < FORSYTH_CACHE_SIZE; i++) {
+			//The three most recent vertices get a fixed score so the next triangle doesn't strictly follow the strip
+			if (i < 3) {
+				cache[i] = FORSYTH_LAST_TRI_SCORE;
+			} else {
+				float scaler = 1.0f / (float)(FORSYTH_CACHE_SIZE - 3);
+				cache[i] = powf(1.0f - (float)(i - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+			}
+		}
+		for (uint32_t i = 0; i < FORSYTH_MAX_VALENCE; i++) {
+			valence[i] = valence_score(i);
+		}
+	}
+
+	//Vertices with few triangles left get a boost so they're finished off and leave the cache
+	static float valence_score(uint32_t live_triangles) {
+		if (live_triangles == 0) return 0.0f;
+		return FORSYTH_VALENCE_BOOST_SCALE * powf((float)live_triangles, -FORSYTH_VALENCE_BOOST_POWER);
+	}
+
+	float score(int32_t cache_position, uint32_t live_triangles) const {
+		if (live_triangles == 0) return -1.0f;
+		float s = cache_position >= 0 ? cache[cache_position] : 0.0f;
+		s += live_triangles < FORSYTH_MAX_VALENCE ? valence[live_triangles] : valence_score(live_triangles);
+		return s;
+	}
+};
+
+void optimize_vertex_cache(std::span<uint32_t> indices, size_t vertex_count) {
+	static const ForsythScoreTable scores;
+
+	size_t triangle_count = indices.size() / 3;
+	if (triangle_count == 0) return;
+
+	//Triangle adjacency per vertex. The first live_triangles[v] entries of each list are the not yet emitted ones
+	std::vector<uint32_t> live_triangles(vertex_count, 0);
+	for (size_t i = 0; i < triangle_count * 3; i++) live_triangles[indices[i]]++;
+	std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+	for (size_t v = 0; v < vertex_count; v++) adjacency_offsets[v + 1] = adjacency_offsets[v] + live_triangles[v];
+	std::vector<uint32_t> adjacency(triangle_count * 3);
+	{
+		std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+		for (size_t i = 0; i < triangle_count * 3; i++) adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+	}
+
+	std::vector<int32_t> cache_position(vertex_count, -1);
+	std::vector<float> vertex_score(vertex_count);
+	for (size_t v = 0; v < vertex_count; v++) vertex_score[v] = scores.score(-1, live_triangles[v]);
+
+	std::vector<float> triangle_score(triangle_count);
+	std::vector<uint8_t> emitted(triangle_count, 0);
+	uint32_t best_triangle = 0;
+	for (size_t t = 0; t < triangle_count; t++) {
+		triangle_score[t] = vertex_score[indices[3 * t]] + vertex_score[indices[3 * t + 1]] + vertex_score[indices[3 * t + 2]];
+		if (triangle_score[t] > triangle_score[best_triangle]) best_triangle = (uint32_t)t;
+	}
+
+	std::vector<uint32_t> output;
+	output.reserve(triangle_count * 3);
+
+	uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+	uint32_t cache_count = 0;
+	size_t scan_cursor = 0;
+	while (best_triangle != NO_VERTEX) {
+		uint32_t tri[3] = { indices[3 * best_triangle], indices[3 * best_triangle + 1], indices[3 * best_triangle + 2] };
+		output.insert(output.end(), tri, tri + 3);
+		emitted[best_triangle] = 1;
+
+		for (uint32_t v : tri) {
+			uint32_t* list = adjacency.data() + adjacency_offsets[v];
+			for (uint32_t i = 0; i < live_triangles[v]; i++) {
+				if (list[i] == best_triangle) {
+					std::swap(list[i], list[live_triangles[v] - 1]);
+					live_triangles[v]--;
+					break;
+				}
+			}
+		}
+
+		//Emitted vertices move to the front and everything else shifts back, possibly out of the cache
+		uint32_t new_cache[FORSYTH_CACHE_SIZE + 3];
+		uint32_t new_count = 0;
+		for (uint32_t v : tri) {
+			if (std::find(new_cache, new_cache + new_count, v) == new_cache + new_count) new_cache[new_count++] = v;
+		}
+		for (uint32_t i = 0; i < cache_count; i++) {
+			uint32_t v = cache[i];
+			if (v != tri[0] && v != tri[1] && v != tri[2]) new_cache[new_count++] = v;
+		}
+
+		for (uint32_t i = 0; i < new_count; i++) {
+			uint32_t v = new_cache[i];
+			cache_position[v] = i < FORSYTH_CACHE_SIZE ? (int32_t)i : -1;
+			float score = scores.score(cache_position[v], live_triangles[v]);
+			float delta = score - vertex_score[v];
+			vertex_score[v] = score;
+
+			const uint32_t* list = adjacency.data() + adjacency_offsets[v];
+			for (uint32_t j = 0; j < live_triangles[v]; j++) triangle_score[list[j]] += delta;
+		}
+		cache_count = std::min(new_count, FORSYTH_CACHE_SIZE);
+		memcpy(cache, new_cache, cache_count * sizeof(uint32_t));
+
+		//Only triangles touching the cache can have changed score, so the best one is usually among them
+		best_triangle = NO_VERTEX;
+		float best_score = -1.0f;
+		for (uint32_t i = 0; i < cache_count; i++) {
+			uint32_t v = cache[i];
+			const uint32_t* list = adjacency.data() + adjacency_offsets[v];
+			for (uint32_t j = 0; j < live_triangles[v]; j++) {
+				if (triangle_score[list[j]] > best_score) {
+					best_score = triangle_score[list[j]];
+					best_triangle = list[j];
+				}
+			}
+		}
+
+		//Nothing adjacent left, so restart from the next triangle in input order
+		if (best_triangle == NO_VERTEX) {
+			while (scan_cursor < triangle_count && emitted[scan_cursor]) scan_cursor++;
+			if (scan_cursor < triangle_count) best_triangle = (uint32_t)scan_cursor;
+		}
+	}
+
+	memcpy(indices.data(), output.data(), output.size() * sizeof(uint32_t));
+}
+
+void optimize_overdraw(std::span<uint32_t> indices, std::span<const float> positions, uint32_t position_stride, size_t vertex_count, float threshold) {
+	size_t triangle_count = indices.size() / 3;
+	if (triangle_count < 2) return;
+
+	std::vector<uint8_t> triangle_misses(triangle_count);
+	uint64_t total_misses = simulate_fifo_cache(indices, vertex_count, VERTEX_CACHE_ANALYSIS_SIZE, triangle_misses.data());
+
+	//Hard boundaries are where the cache got flushed, so reordering there costs nothing
+	std::vector<uint32_t> cluster_starts;
+	for (size_t t = 0; t < triangle_count; t++) {
+		if (t == 0 || triangle_misses[t] == 3) cluster_starts.push_back((uint32_t)t);
+	}
+
+	//Soft boundaries split a hard cluster wherever the piece so far is already about as efficient as the whole input
+	float split_acmr = threshold * (float)total_misses / (float)triangle_count;
+	std::vector<uint32_t> clusters;
+	for (size_t c = 0; c < cluster_starts.size(); c++) {
+		uint32_t start = cluster_starts[c];
+		uint32_t end = c + 1 < cluster_starts.size() ? cluster_starts[c + 1] : (uint32_t)triangle_count;
+
+		clusters.push_back(start);
+		uint32_t piece_start = start;
+		uint32_t piece_misses = 0;
+		for (uint32_t t = start; t < end; t++) {
+			piece_misses += triangle_misses[t];
+			float piece_acmr = (float)piece_misses / (float)(t - piece_start + 1);
+			if (t + 1 < end && piece_acmr <= split_acmr) {
+				clusters.push_back(t + 1);
+				piece_start = t + 1;
+				piece_misses = 0;
+			}
+		}
+	}
+
+	struct ClusterSort {
+		float key;
+		uint32_t start;
+		uint32_t end;
+	};
+	std::vector<ClusterSort> sorted(clusters.size());
+
+	//Area weighted centroid and normal of every cluster
+	float mesh_centroid[3] = {};
+	float mesh_area = 0.0f;
+	std::vector<float> cluster_data(clusters.size() * 7, 0.0f);
+	for (size_t c = 0; c < clusters.size(); c++) {
+		uint32_t start = clusters[c];
+		uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : (uint32_t)triangle_count;
+		float* data = &cluster_data[c * 7];
+		for (uint32_t t = start; t < end; t++) {
+			const float* p0 = positions.data() + (size_t)indices[3 * t] * position_stride;
+			const float* p1 = positions.data() + (size_t)indices[3 * t + 1] * position_stride;
+			const float* p2 = positions.data() + (size_t)indices[3 * t + 2] * position_stride;
+
+			float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			float n[3] = {
+				e1[1] * e2[2] - e1[2] * e2[1],
+				e1[2] * e2[0] - e1[0] * e2[2],
+				e1[0] * e2[1] - e1[1] * e2[0]
+			};
+			float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			for (int i = 0; i < 3; i++) {
+				data[i] += (p0[i] + p1[i] + p2[i]) * (area / 3.0f);
+				data[3 + i] += n[i];
+			}
+			data[6] += area;
+		}
+
+		for (int i = 0; i < 3; i++) mesh_centroid[i] += data[i];
+		mesh_area += data[6];
+		sorted[c].start = start;
+		sorted[c].end = end;
+	}
+	if (mesh_area > 0.0f) {
+		for (int i = 0; i < 3; i++) mesh_centroid[i] /= mesh_area;
+	}
+
+	//Clusters facing away from the middle of the mesh are likely to occlude the rest of it
+	for (size_t c = 0; c < clusters.size(); c++) {
+		float* data = &cluster_data[c * 7];
+		float inv_area = data[6] > 0.0f ? 1.0f / data[6] : 0.0f;
+		float normal_length = sqrtf(data[3] * data[3] + data[4] * data[4] + data[5] * data[5]);
+		float inv_normal = normal_length > 0.0f ? 1.0f / normal_length : 0.0f;
+
+		float key = 0.0f;
+		for (int i = 0; i < 3; i++) key += (data[i] * inv_area - mesh_centroid[i]) * data[3 + i] * inv_normal;
+		sorted[c].key = key;
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), [](const ClusterSort& a, const ClusterSort& b) {
+		return a.key > b.key;
+	});
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	for (ClusterSort& cluster : sorted) {
+		output.insert(output.end(), indices.begin() + 3 * cluster.start, indices.begin() + 3 * cluster.end);
+	}
+	memcpy(indices.data(), output.data(), output.size() * sizeof(uint32_t));
+}
+
+uint32_t optimize_vertex_fetch_remap(std::span<uint32_t> indices, size_t vertex_count, std::span<uint32_t> remap) {
+	std::fill(remap.begin(), remap.begin() + vertex_count, NO_VERTEX);
+	uint32_t next = 0;
+	for (uint32_t& index : indices) {
+		if (remap[index] == NO_VERTEX) remap[index] = next++;
+		index = remap[index];
+	}
+	return next;
+}
+
+std::vector<float> remap_vertex_stream(const MeshVertexStream& stream, std::span<const uint32_t> remap, uint32_t new_vertex_count) {
+	std::vector<float> out((size_t)new_vertex_count * stream.components);
+	size_t vertex_size = stream.components * sizeof(float);
+	for (size_t v = 0; v < remap.size(); v++) {
+		if (remap[v] == NO_VERTEX) continue;
+		memcpy(out.data() + (size_t)remap[v] * stream.components, stream.data.data() + v * stream.components, vertex_size);
+	}
+	return out;
+}
+
+//Symmetric 4x4 matrix summing squared distances to a set of planes
+struct Quadric {
+	float a2, ab, ac, ad;
+	float b2, bc, bd;
+	float c2, cd;
+	float d2;
+
+	void add_plane(float a, float b, float c, float d) {
+		a2 += a * a; ab += a * b; ac += a * c; ad += a * d;
+		b2 += b * b; bc += b * c; bd += b * d;
+		c2 += c * c; cd += c * d;
+		d2 += d * d;
+	}
+
+	void add(const Quadric& q) {
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+	}
+
+	float error(const float* p) const {
+		float x = p[0], y = p[1], z = p[2];
+		float e =
+			a2 * x * x + 2.0f * ab * x * y + 2.0f * ac * x * z + 2.0f * ad * x +
+			b2 * y * y + 2.0f * bc * y * z + 2.0f * bd * y +
+			c2 * z * z + 2.0f * cd * z +
+			d2;
+		return std::max(e, 0.0f);
+	}
+};
+
+static void triangle_normal(const float* p0, const float* p1, const float* p2, float* n) {
+	float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+	float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+//Marks vertices that can't move without opening a crack: ones sharing a position with another vertex
+//(uv or color seams) and ones on an edge only a single triangle uses
+static std::vector<uint8_t> find_locked_vertices(std::span<const uint32_t> indices, std::span<const float> positions, uint32_t position_stride, size_t vertex_count) {
+	//Group vertices by position so topology is judged without attribute splits
+	size_t capacity = 16;
+	while (capacity < vertex_count * 2) capacity *= 2;
+	std::vector<uint32_t> table(capacity, NO_VERTEX);
+	std::vector<uint32_t> position_id(vertex_count);
+	std::vector<uint32_t> twins(vertex_count, 0);
+	MeshVertexStream stream = { positions, position_stride };
+	for (uint32_t v = 0; v < vertex_count; v++) {
+		size_t slot = hash_vertex(std::span<const MeshVertexStream>(&stream, 1), v) & (capacity - 1);
+		while (table[slot] != NO_VERTEX && memcmp(&positions[(size_t)table[slot] * position_stride], &positions[(size_t)v * position_stride], 3 * sizeof(float)) != 0) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+		if (table[slot] == NO_VERTEX) table[slot] = v;
+		position_id[v] = table[slot];
+		twins[table[slot]]++;
+	}
+
+	std::vector<uint8_t> locked(vertex_count, 0);
+	for (uint32_t v = 0; v < vertex_count; v++) {
+		if (twins[position_id[v]] > 1) locked[v] = 1;
+	}
+
+	//Count how many triangles use each undirected edge
+	std::vector<uint64_t> edges;
+	edges.reserve(indices.size());
+	for (size_t t = 0; t < indices.size() / 3; t++) {
+		for (size_t c = 0; c < 3; c++) {
+			uint32_t a = position_id[indices[3 * t + c]];
+			uint32_t b = position_id[indices[3 * t + (c + 1) % 3]];
+			if (a == b) continue;
+			edges.push_back((uint64_t)std::min(a, b) << 32 | std::max(a, b));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	std::vector<uint8_t> border_position(vertex_count, 0);
+	for (size_t i = 0; i < edges.size();) {
+		size_t j = i;
+		while (j < edges.size() && edges[j] == edges[i]) j++;
+		if (j - i == 1) {
+			border_position[edges[i] >> 32] = 1;
+			border_position[edges[i] & 0xFFFFFFFF] = 1;
+		}
+		i = j;
+	}
+	for (uint32_t v = 0; v < vertex_count; v++) {
+		if (border_position[position_id[v]]) locked[v] = 1;
+	}
+	return locked;
+}
+
+float simplify_mesh(
+	std::span<const uint32_t> indices,
+	std::span<const float> positions,
+	uint32_t position_stride,
+	size_t vertex_count,
+	size_t target_index_count,
+	float target_error,
+	std::vector<uint32_t>& out
+) {
+	out.assign(indices.begin(), indices.end());
+	if (indices.size() <= target_index_count) return 0.0f;
+
+	auto position = [&](uint32_t v) { return &positions[(size_t)v * position_stride]; };
+
+	std::vector<uint8_t> locked = find_locked_vertices(indices, positions, position_stride, vertex_count);
+
+	//Unweighted plane quadrics, so errors come out as squared distances
+	std::vector<Quadric> quadrics(vertex_count, Quadric{});
+	for (size_t t = 0; t < indices.size() / 3; t++) {
+		const float* p0 = position(indices[3 * t]);
+		float n[3];
+		triangle_normal(p0, position(indices[3 * t + 1]), position(indices[3 * t + 2]), n);
+		float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length == 0.0f) continue;
+		n[0] /= length; n[1] /= length; n[2] /= length;
+		float d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+		for (size_t c = 0; c < 3; c++) quadrics[indices[3 * t + c]].add_plane(n[0], n[1], n[2], d);
+	}
+
+	struct Collapse {
+		float cost;
+		uint32_t from;
+		uint32_t to;
+	};
+	std::vector<Collapse> candidates;
+	std::vector<uint32_t> adjacency_offsets(vertex_count + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<uint8_t> touched(vertex_count);
+	std::vector<uint32_t> remap(vertex_count);
+	float max_cost = target_error * target_error;
+	float reached_cost = 0.0f;
+
+	//Each pass collapses a set of edges whose neighborhoods don't overlap, then rebuilds
+	while (out.size() > target_index_count) {
+		size_t triangle_count = out.size() / 3;
+
+		std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+		for (uint32_t v : out) adjacency_offsets[v + 1]++;
+		for (size_t v = 0; v < vertex_count; v++) adjacency_offsets[v + 1] += adjacency_offsets[v];
+		adjacency.resize(out.size());
+		{
+			std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+			for (size_t i = 0; i < out.size(); i++) adjacency[fill[out[i]]++] = (uint32_t)(i / 3);
+		}
+
+		candidates.clear();
+		for (size_t t = 0; t < triangle_count; t++) {
+			for (size_t c = 0; c < 3; c++) {
+				uint32_t a = out[3 * t + c];
+				uint32_t b = out[3 * t + (c + 1) % 3];
+				Quadric q = quadrics[a];
+				q.add(quadrics[b]);
+				if (!locked[a]) candidates.push_back({ q.error(position(b)), a, b });
+				if (!locked[b]) candidates.push_back({ q.error(position(a)), b, a });
+			}
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Collapse& x, const Collapse& y) {
+			return x.cost < y.cost;
+		});
+
+		std::fill(touched.begin(), touched.end(), 0);
+		for (uint32_t v = 0; v < vertex_count; v++) remap[v] = v;
+		size_t collapses = 0;
+		size_t removed_indices = 0;
+		for (const Collapse& collapse : candidates) {
+			if (collapse.cost > max_cost) break;
+			if (out.size() - removed_indices <= target_index_count) break;
+			if (touched[collapse.from] || touched[collapse.to]) continue;
+
+			//Moving from onto to mustn't turn any remaining triangle around
+			bool flips = false;
+			uint32_t removed_triangles = 0;
+			for (uint32_t i = adjacency_offsets[collapse.from]; i < adjacency_offsets[collapse.from + 1]; i++) {
+				const uint32_t* tri = &out[3 * adjacency[i]];
+				if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) {
+					removed_triangles++;
+					continue;
+				}
+				const float* p[3];
+				const float* moved[3];
+				for (int c = 0; c < 3; c++) {
+					p[c] = position(tri[c]);
+					moved[c] = tri[c] == collapse.from ? position(collapse.to) : p[c];
+				}
+				float n0[3], n1[3];
+				triangle_normal(p[0], p[1], p[2], n0);
+				triangle_normal(moved[0], moved[1], moved[2], n1);
+				if (n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.0f) {
+					flips = true;
+					break;
+				}
+			}
+			if (flips) continue;
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			for (uint32_t i = adjacency_offsets[collapse.from]; i < adjacency_offsets[collapse.from + 1]; i++) {
+				const uint32_t* tri = &out[3 * adjacency[i]];
+				touched[tri[0]] = 1;
+				touched[tri[1]] = 1;
+				touched[tri[2]] = 1;
+			}
+			reached_cost = std::max(reached_cost, collapse.cost);
+			removed_indices += 3 * removed_triangles;
+			collapses++;
+		}
+		if (collapses == 0) break;
+
+		size_t write = 0;
+		for (size_t t = 0; t < triangle_count; t++) {
+			uint32_t a = remap[out[3 * t]];
+			uint32_t b = remap[out[3 * t + 1]];
+			uint32_t c = remap[out[3 * t + 2]];
+			if (a == b || b == c || a == c) continue;
+			out[write++] = a;
+			out[write++] = b;
+			out[write++] = c;
+		}
+		out.resize(write);
+	}
+
+	return sqrtf(reached_cost);
+}
+
+std::vector<MeshLod> build_lod_chain(
+	std::span<const uint32_t> indices,
+	std::span<const float> positions,
+	uint32_t position_stride,
+	size_t vertex_count,
+	uint32_t lod_count,
+	float reduction,
+	float max_error,
+	std::vector<uint32_t>& out_indices
+) {
+	std::vector<MeshLod> lods;
+	size_t base = out_indices.size();
+	out_indices.insert(out_indices.end(), indices.begin(), indices.end());
+	lods.push_back({ 0, (uint32_t)indices.size(), 0.0f, 0 });
+
+	std::vector<uint32_t> previous(indices.begin(), indices.end());
+	std::vector<uint32_t> simplified;
+	float error = 0.0f;
+	for (uint32_t level = 1; level < std::min(lod_count, (uint32_t)MAX_MESH_LODS); level++) {
+		size_t target = (size_t)((float)(previous.size() / 3) * reduction) * 3;
+		float level_error = simplify_mesh(previous, positions, position_stride, vertex_count, target, max_error, simplified);
+
+		//Not worth a level if it barely shrank
+		if (simplified.empty() || simplified.size() > previous.size() * 9 / 10) break;
+
+		//Each level is simplified from the one before, so errors add up
+		error += level_error;
+		if (error > max_error) break;
+
+		optimize_vertex_cache(simplified, vertex_count);
+		lods.push_back({ (uint32_t)(out_indices.size() - base), (uint32_t)simplified.size(), error, 0 });
+		out_indices.insert(out_indices.end(), simplified.begin(), simplified.end());
+		previous.swap(simplified);
+	}
+	return lods;
+}
+
+//Bounding sphere and normal cone of the triangles of indices
+static void compute_meshlet_bounds(std::span<const uint32_t> indices, std::span<const float> positions, uint32_t position_stride, MeshMeshlet& meshlet) {
+	auto position = [&](uint32_t v) { return &positions[(size_t)v * position_stride]; };
+
+	//Sphere around the center of the bounding box
+	float mins[3], maxs[3];
+	for (size_t c = 0; c < 3; c++) mins[c] = maxs[c] = position(indices[0])[c];
+	for (uint32_t v : indices) {
+		const float* p = position(v);
+		for (size_t c = 0; c < 3; c++) {
+			mins[c] = std::min(mins[c], p[c]);
+			maxs[c] = std::max(maxs[c], p[c]);
+		}
+	}
+	float radius_squared = 0.0f;
+	for (size_t c = 0; c < 3; c++) meshlet.center[c] = 0.5f * (mins[c] + maxs[c]);
+	for (uint32_t v : indices) {
+		const float* p = position(v);
+		float d[3] = { p[0] - meshlet.center[0], p[1] - meshlet.center[1], p[2] - meshlet.center[2] };
+		radius_squared = std::max(radius_squared, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	}
+	meshlet.radius = sqrtf(radius_squared);
+
+	//Cone around the average facing direction, as wide as the triangle that deviates from it most
+	std::vector<float> normals;
+	normals.reserve(indices.size());
+	float axis[3] = { 0.0f, 0.0f, 0.0f };
+	for (size_t t = 0; t < indices.size() / 3; t++) {
+		float n[3];
+		triangle_normal(position(indices[3 * t]), position(indices[3 * t + 1]), position(indices[3 * t + 2]), n);
+		float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length == 0.0f) continue;
+		for (size_t c = 0; c < 3; c++) {
+			normals.push_back(n[c] / length);
+			axis[c] += n[c] / length;
+		}
+	}
+	meshlet.cone_axis[0] = meshlet.cone_axis[1] = meshlet.cone_axis[2] = 0.0f;
+	meshlet.cone_cutoff = 1.0f;
+	float axis_length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	if (axis_length == 0.0f) return;
+	for (size_t c = 0; c < 3; c++) axis[c] /= axis_length;
+
+	float min_dot = 1.0f;
+	for (size_t i = 0; i < normals.size(); i += 3) {
+		min_dot = std::min(min_dot, normals[i] * axis[0] + normals[i + 1] * axis[1] + normals[i + 2] * axis[2]);
+	}
+	//Past 90 degrees some triangle faces every viewpoint
+	if (min_dot <= 0.0f) return;
+
+	for (size_t c = 0; c < 3; c++) meshlet.cone_axis[c] = axis[c];
+	meshlet.cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+}
+
+std::vector<MeshMeshlet> build_meshlets(
+	std::span<uint32_t> indices,
+	std::span<const float> positions,
+	uint32_t position_stride,
+	size_t vertex_count,
+	uint32_t max_triangles,
+	uint32_t max_vertices
+) {
+	std::vector<MeshMeshlet> meshlets;
+	size_t triangle_count = indices.size() / 3;
+	if (triangle_count == 0 || max_triangles == 0 || max_vertices < 3) return meshlets;
+
+	auto position = [&](uint32_t v) { return &positions[(size_t)v * position_stride]; };
+
+	//Triangles using each vertex
+	std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+	for (size_t i = 0; i < 3 * triangle_count; i++) adjacency_offsets[indices[i] + 1]++;
+	for (size_t v = 0; v < vertex_count; v++) adjacency_offsets[v + 1] += adjacency_offsets[v];
+	std::vector<uint32_t> adjacency(3 * triangle_count);
+	{
+		std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+		for (size_t i = 0; i < 3 * triangle_count; i++) adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+	}
+
+	std::vector<uint8_t> emitted(triangle_count, 0);
+	std::vector<uint32_t> vertex_meshlet(vertex_count, NO_VERTEX);		//Last meshlet to use each vertex
+	std::vector<uint32_t> candidate_meshlet(triangle_count, NO_VERTEX);	//Last meshlet each triangle was a candidate for
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> meshlet_triangles;
+	std::vector<uint32_t> reordered;
+	reordered.reserve(3 * triangle_count);
+	size_t scan = 0;
+	while (true) {
+		while (scan < triangle_count && emitted[scan]) scan++;
+		if (scan == triangle_count) break;
+
+		uint32_t meshlet_idx = (uint32_t)meshlets.size();
+		uint32_t meshlet_vertices = 0;
+		float centroid_sum[3] = { 0.0f, 0.0f, 0.0f };
+		meshlet_triangles.clear();
+		candidates.clear();
+
+		uint32_t next = (uint32_t)scan;
+		while (next != NO_VERTEX) {
+			emitted[next] = 1;
+			meshlet_triangles.push_back(next);
+			for (size_t c = 0; c < 3; c++) {
+				uint32_t v = indices[3 * next + c];
+				const float* p = position(v);
+				centroid_sum[0] += p[0];
+				centroid_sum[1] += p[1];
+				centroid_sum[2] += p[2];
+				if (vertex_meshlet[v] == meshlet_idx) continue;
+
+				//The new vertex's other triangles can now join cheaply
+				vertex_meshlet[v] = meshlet_idx;
+				meshlet_vertices++;
+				for (uint32_t i = adjacency_offsets[v]; i < adjacency_offsets[v + 1]; i++) {
+					uint32_t t = adjacency[i];
+					if (emitted[t] || candidate_meshlet[t] == meshlet_idx) continue;
+					candidate_meshlet[t] = meshlet_idx;
+					candidates.push_back(t);
+				}
+			}
+			if (meshlet_triangles.size() == max_triangles) break;
+
+			//Fewest new vertices first, then closest to the meshlet's centroid
+			float scale = 1.0f / (float)(3 * meshlet_triangles.size());
+			float centroid[3] = { centroid_sum[0] * scale, centroid_sum[1] * scale, centroid_sum[2] * scale };
+			next = NO_VERTEX;
+			uint32_t best_new_vertices = 4;
+			float best_distance = 0.0f;
+			size_t write = 0;
+			for (uint32_t t : candidates) {
+				if (emitted[t]) continue;
+				candidates[write++] = t;
+
+				uint32_t new_vertices = 0;
+				float tri_centroid[3] = { 0.0f, 0.0f, 0.0f };
+				for (size_t c = 0; c < 3; c++) {
+					uint32_t v = indices[3 * t + c];
+					new_vertices += vertex_meshlet[v] != meshlet_idx;
+					const float* p = position(v);
+					tri_centroid[0] += p[0];
+					tri_centroid[1] += p[1];
+					tri_centroid[2] += p[2];
+				}
+				if (meshlet_vertices + new_vertices > max_vertices) continue;
+
+				float d[3] = {
+					tri_centroid[0] / 3.0f - centroid[0],
+					tri_centroid[1] / 3.0f - centroid[1],
+					tri_centroid[2] / 3.0f - centroid[2]
+				};
+				float distance = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+				if (new_vertices < best_new_vertices || (new_vertices == best_new_vertices && distance < best_distance)) {
+					next = t;
+					best_new_vertices = new_vertices;
+					best_distance = distance;
+				}
+			}
+			candidates.resize(write);
+
+			//Nothing connected left to add, so carry on with the next piece in input order
+			if (next == NO_VERTEX && meshlet_vertices + 3 <= max_vertices) {
+				while (scan < triangle_count && emitted[scan]) scan++;
+				if (scan < triangle_count) next = (uint32_t)scan;
+			}
+		}
+
+		std::sort(meshlet_triangles.begin(), meshlet_triangles.end());
+		MeshMeshlet meshlet = {};
+		meshlet.index_offset = (uint32_t)reordered.size();
+		meshlet.index_count = (uint32_t)(3 * meshlet_triangles.size());
+		for (uint32_t t : meshlet_triangles) {
+			reordered.push_back(indices[3 * t]);
+			reordered.push_back(indices[3 * t + 1]);
+			reordered.push_back(indices[3 * t + 2]);
+		}
+		compute_meshlet_bounds(std::span<const uint32_t>(reordered).subspan(meshlet.index_offset), positions, position_stride, meshlet);
+		meshlets.push_back(meshlet);
+	}
+
+	std::copy(reordered.begin(), reordered.end(), indices.begin());
+	return meshlets;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+//Index and vertex reordering for indexed triangle lists
+//All functions work on 32-bit indices in place. Vertex streams aren't touched until
+//remap_vertex_stream() is called with the remap from optimize_vertex_fetch_remap().
+
+static constexpr uint32_t NO_VERTEX = 0xFFFFFFFF;
+
+//Cache size assumed when reporting ACMR/ATVR
+//Roughly what post-transform caches on current desktop GPUs behave like
+static constexpr uint32_t VERTEX_CACHE_ANALYSIS_SIZE = 16;
+
+//One float attribute stream of a mesh, components floats per vertex
+struct MeshVertexStream {
+	std::span<const float> data;
+	uint32_t components;
+};
+
+//FIFO post-transform cache simulation of an index buffer
+struct VertexCacheStats {
+	uint64_t misses;
+	uint64_t triangle_count;
+	uint64_t vertex_count;
+
+	//Average cache miss ratio, transformed vertices per triangle. 0.5 is the best a regular grid can do, 3.0 the worst
+	float acmr() const { return triangle_count == 0 ? 0.0f : (float)misses / (float)triangle_count; }
+
+	//Average transform to vertex ratio, transformed vertices per unique vertex. 1.0 is optimal
+	float atvr() const { return vertex_count == 0 ? 0.0f : (float)misses / (float)vertex_count; }
+};
+
+VertexCacheStats analyze_vertex_cache(std::span<const uint32_t> indices, size_t vertex_count, uint32_t cache_size = VERTEX_CACHE_ANALYSIS_SIZE);
+
+//Points every index at the first vertex whose attributes are bitwise equal to its own in all streams
+//Returns the number of distinct vertices referenced afterwards
+uint32_t weld_vertices(std::span<const MeshVertexStream> streams, size_t vertex_count, std::span<uint32_t> indices);
+
+//Reorders triangles for post-transform cache hits using Forsyth's linear-speed vertex cache optimisation
+void optimize_vertex_cache(std::span<uint32_t> indices, size_t vertex_count);
+
+//Reorders clusters of triangles so that outward facing ones are drawn first, at a small cost in cache efficiency
+//Cluster boundaries are placed where the cache simulation allows; threshold is how much worse than the
+//input's ACMR a cluster may get before it stops being split. Run after optimize_vertex_cache().
+void optimize_overdraw(std::span<uint32_t> indices, std::span<const float> positions, uint32_t position_stride, size_t vertex_count, float threshold = 1.05f);
+
+//Builds a remap that numbers vertices in the order indices first use them and rewrites indices to match
+//Unreferenced vertices map to NO_VERTEX. Returns the number of vertices that remain.
+uint32_t optimize_vertex_fetch_remap(std::span<uint32_t> indices, size_t vertex_count, std::span<uint32_t> remap);
+
+//Gathers the vertices of stream into their remapped positions
+std::vector<float> remap_vertex_stream(const MeshVertexStream& stream, std::span<const uint32_t> remap, uint32_t new_vertex_count);
+
+//Collapses edges in order of quadric error until at most target_index_count indices remain, or until the next
+//collapse would move the surface by more than target_error. Vertices on open borders and on attribute seams never move.
+//The simplified triangles go to out and reference the same vertices. Returns the error reached, in position units
+float simplify_mesh(
+	std::span<const uint32_t> indices,
+	std::span<const float> positions,
+	uint32_t position_stride,
+	size_t vertex_count,
+	size_t target_index_count,
+	float target_error,
+	std::vector<uint32_t>& out
+);
+
+#define MAX_MESH_LODS 8
+
+//One level of detail of a mesh, as a range of its index stream
+struct MeshLod {
+	uint32_t index_offset;		//Relative to the first index of the mesh
+	uint32_t index_count;
+	float error;				//Distance in position units this level's surface may be from the full detail one
+	uint32_t _pad0;
+};
+
+//Appends LOD 0 (indices as given) and up to lod_count - 1 coarser levels to out_indices
+//Each level aims for reduction times the previous level's triangle count, and the chain ends early once a
+//level would exceed max_error or stops shrinking. Coarser levels are vertex cache optimized.
+std::vector<MeshLod> build_lod_chain(
+	std::span<const uint32_t> indices,
+	std::span<const float> positions,
+	uint32_t position_stride,
+	size_t vertex_count,
+	uint32_t lod_count,
+	float reduction,
+	float max_error,
+	std::vector<uint32_t>& out_indices
+);
+
+//A cluster of a mesh's triangles with the bounds the GPU culls it by
+struct MeshMeshlet {
+	uint32_t index_offset;		//Relative to the first index of the mesh
+	uint32_t index_count;
+	uint32_t _pad0, _pad1;
+	float center[3];			//Bounding sphere
+	float radius;
+	float cone_axis[3];			//Normal cone. Every triangle faces away from a viewpoint for which
+	float cone_cutoff;			//dot(center - viewpoint, cone_axis) >= cone_cutoff * length(center - viewpoint) + radius
+};
+
+//Reorders triangles into meshlets of at most max_triangles triangles using at most max_vertices distinct vertices
+//Meshlets grow through triangles that share vertices with them so they stay compact, and keep their triangles in
+//the input's relative order so a vertex cache optimized input stays mostly that way. Disconnected pieces are packed
+//together in input order. Meshlets too wide for a useful normal cone get a cutoff of 1, which never culls.
+std::vector<MeshMeshlet> build_meshlets(
+	std::span<uint32_t> indices,
+	std::span<const float> positions,
+	uint32_t position_stride,
+	size_t vertex_count,
+	uint32_t max_triangles,
+	uint32_t max_vertices
+);
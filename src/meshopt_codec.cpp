@@ -0,0 +1,530 @@
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <immintrin.h>
+#include "meshopt_codec.h"
+#include "vertex_conversion.h"
+
+//MSVC accepts SSSE3 intrinsics anywhere, GCC and Clang need the function marked
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_SSSE3
+#else
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+
+//Vertex codec
+
+constexpr uint8_t VERTEX_HEADER = 0xA0;
+constexpr size_t VERTEX_BLOCK_SIZE_BYTES = 8192;
+constexpr size_t VERTEX_BLOCK_MAX_SIZE = 256;
+constexpr size_t BYTE_GROUP_SIZE = 16;
+constexpr size_t BYTE_GROUP_DECODE_LIMIT = 24;		//Most bytes one group can read, header bytes included
+constexpr size_t VERTEX_TAIL_MIN_SIZE = 32;
+
+//For each mask of escaped bytes in half a group, the pshufb indices that pull the escapes
+//out of the data that follows the group's selectors, and how many escapes there are
+struct ByteGroupTables {
+	uint8_t shuffle[256][8];
+	uint8_t count[256];
+};
+
+static constexpr ByteGroupTables make_byte_group_tables() {
+	ByteGroupTables tables{};
+	for (uint32_t mask = 0; mask < 256; mask++) {
+		uint8_t next = 0;
+		for (uint32_t lane = 0; lane < 8; lane++) {
+			tables.shuffle[mask][lane] = (mask & (1u << lane)) ? next++ : 0x80;
+		}
+		tables.count[mask] = next;
+	}
+	return tables;
+}
+
+alignas(16) static constexpr ByteGroupTables BYTE_GROUP_TABLES = make_byte_group_tables();
+
+static size_t vertex_block_size(size_t stride) {
+	size_t result = (VERTEX_BLOCK_SIZE_BYTES / stride) & ~(BYTE_GROUP_SIZE - 1);
+	return std::min(result, VERTEX_BLOCK_MAX_SIZE);
+}
+
+static uint8_t unzigzag8(uint8_t v) {
+	return (uint8_t)(-(v & 1) ^ (v >> 1));
+}
+
+//Bits per value in the group, from the two bit selector packed four to a header byte
+static int byte_group_bits_log2(const uint8_t* header, size_t group) {
+	return (header[group / 4] >> ((group % 4) * 2)) & 3;
+}
+
+//Values are packed most significant first, an all ones value means the byte follows the packed data
+template<int Bits>
+static const uint8_t* unpack_byte_group(const uint8_t* data, uint8_t* buffer) {
+	constexpr uint32_t escape = (1u << Bits) - 1;
+	const uint8_t* data_var = data + (BYTE_GROUP_SIZE * Bits) / 8;
+	for (size_t i = 0; i < BYTE_GROUP_SIZE; i++) {
+		size_t bit = i * Bits;
+		uint32_t enc = (data[bit / 8] >> (8 - Bits - bit % 8)) & escape;
+		if (enc == escape) {
+			buffer[i] = *data_var++;
+		} else {
+			buffer[i] = (uint8_t)enc;
+		}
+	}
+	return data_var;
+}
+
+static const uint8_t* decode_byte_group_scalar(const uint8_t* data, uint8_t* buffer, int bits_log2) {
+	switch (bits_log2) {
+		case 0:
+			memset(buffer, 0, BYTE_GROUP_SIZE);
+			return data;
+		case 1:
+			return unpack_byte_group<2>(data, buffer);
+		case 2:
+			return unpack_byte_group<4>(data, buffer);
+		default:
+			memcpy(buffer, data, BYTE_GROUP_SIZE);
+			return data + BYTE_GROUP_SIZE;
+	}
+}
+
+//Widens the packed selectors to one per byte, then shuffles the escaped bytes into the lanes that asked for them
+TARGET_SSSE3 static const uint8_t* expand_byte_group_ssse3(__m128i sel, __m128i escaped, const uint8_t* rest, uint8_t* buffer) {
+	__m128i mask = _mm_cmpeq_epi8(sel, escaped);
+	int mask16 = _mm_movemask_epi8(mask);
+	int mask0 = mask16 & 255;
+	int mask1 = mask16 >> 8;
+
+	__m128i shuffle0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(BYTE_GROUP_TABLES.shuffle[mask0]));
+	__m128i shuffle1 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(BYTE_GROUP_TABLES.shuffle[mask1]));
+	shuffle1 = _mm_add_epi8(shuffle1, _mm_set1_epi8((char)BYTE_GROUP_TABLES.count[mask0]));
+	__m128i shuffle = _mm_unpacklo_epi64(shuffle0, shuffle1);
+
+	__m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rest));
+	__m128i result = _mm_or_si128(_mm_shuffle_epi8(values, shuffle), _mm_andnot_si128(mask, sel));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(buffer), result);
+	return rest + BYTE_GROUP_TABLES.count[mask0] + BYTE_GROUP_TABLES.count[mask1];
+}
+
+TARGET_SSSE3 static const uint8_t* decode_byte_group_ssse3(const uint8_t* data, uint8_t* buffer, int bits_log2) {
+	switch (bits_log2) {
+		case 0:
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(buffer), _mm_setzero_si128());
+			return data;
+		case 1: {
+			int packed;
+			memcpy(&packed, data, sizeof(packed));
+			__m128i sel2 = _mm_cvtsi32_si128(packed);
+			__m128i sel22 = _mm_unpacklo_epi8(_mm_srli_epi16(sel2, 4), sel2);
+			__m128i sel2222 = _mm_unpacklo_epi8(_mm_srli_epi16(sel22, 2), sel22);
+			__m128i sel = _mm_and_si128(sel2222, _mm_set1_epi8(3));
+			return expand_byte_group_ssse3(sel, _mm_set1_epi8(3), data + 4, buffer);
+		}
+		case 2: {
+			__m128i sel4 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(data));
+			__m128i sel44 = _mm_unpacklo_epi8(_mm_srli_epi16(sel4, 4), sel4);
+			__m128i sel = _mm_and_si128(sel44, _mm_set1_epi8(15));
+			return expand_byte_group_ssse3(sel, _mm_set1_epi8(15), data + 8, buffer);
+		}
+		default:
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(buffer), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+			return data + BYTE_GROUP_SIZE;
+	}
+}
+
+//One byte channel of a block, buffer_size rounded up to whole groups
+//Every group needs BYTE_GROUP_DECODE_LIMIT readable bytes, which the stream's tail guarantees up to its last group
+static const uint8_t* decode_bytes_scalar(const uint8_t* data, const uint8_t* data_end, uint8_t* buffer, size_t buffer_size) {
+	size_t header_size = (buffer_size / BYTE_GROUP_SIZE + 3) / 4;
+	if ((size_t)(data_end - data) < header_size) return nullptr;
+	const uint8_t* header = data;
+	data += header_size;
+
+	for (size_t i = 0; i < buffer_size; i += BYTE_GROUP_SIZE) {
+		if ((size_t)(data_end - data) < BYTE_GROUP_DECODE_LIMIT) return nullptr;
+		data = decode_byte_group_scalar(data, buffer + i, byte_group_bits_log2(header, i / BYTE_GROUP_SIZE));
+	}
+	return data;
+}
+
+TARGET_SSSE3 static const uint8_t* decode_bytes_ssse3(const uint8_t* data, const uint8_t* data_end, uint8_t* buffer, size_t buffer_size) {
+	size_t header_size = (buffer_size / BYTE_GROUP_SIZE + 3) / 4;
+	if ((size_t)(data_end - data) < header_size) return nullptr;
+	const uint8_t* header = data;
+	data += header_size;
+
+	for (size_t i = 0; i < buffer_size; i += BYTE_GROUP_SIZE) {
+		if ((size_t)(data_end - data) < BYTE_GROUP_DECODE_LIMIT) return nullptr;
+		data = decode_byte_group_ssse3(data, buffer + i, byte_group_bits_log2(header, i / BYTE_GROUP_SIZE));
+	}
+	return data;
+}
+
+//Each byte channel is delta coded against the same byte of the previous vertex
+static const uint8_t* decode_vertex_block_scalar(
+	const uint8_t* data, const uint8_t* data_end, uint8_t* vertex_data, size_t vertex_count, size_t stride, uint8_t last_vertex[256]
+) {
+	uint8_t buffer[VERTEX_BLOCK_MAX_SIZE];
+	size_t aligned_count = (vertex_count + BYTE_GROUP_SIZE - 1) & ~(BYTE_GROUP_SIZE - 1);
+
+	for (size_t k = 0; k < stride; k++) {
+		data = decode_bytes_scalar(data, data_end, buffer, aligned_count);
+		if (data == nullptr) return nullptr;
+
+		uint8_t p = last_vertex[k];
+		for (size_t i = 0; i < vertex_count; i++) {
+			p = (uint8_t)(unzigzag8(buffer[i]) + p);
+			vertex_data[i * stride + k] = p;
+		}
+	}
+
+	memcpy(last_vertex, vertex_data + (vertex_count - 1) * stride, stride);
+	return data;
+}
+
+//Same as the scalar block, with the zigzag decode and running sum done sixteen vertices at a time
+TARGET_SSSE3 static const uint8_t* decode_vertex_block_ssse3(
+	const uint8_t* data, const uint8_t* data_end, uint8_t* vertex_data, size_t vertex_count, size_t stride, uint8_t last_vertex[256]
+) {
+	alignas(16) uint8_t buffer[VERTEX_BLOCK_MAX_SIZE];
+	alignas(16) uint8_t sums[BYTE_GROUP_SIZE];
+	size_t aligned_count = (vertex_count + BYTE_GROUP_SIZE - 1) & ~(BYTE_GROUP_SIZE - 1);
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i low_seven = _mm_set1_epi8(0x7F);
+	const __m128i last_lane = _mm_set1_epi8(15);
+
+	for (size_t k = 0; k < stride; k++) {
+		data = decode_bytes_ssse3(data, data_end, buffer, aligned_count);
+		if (data == nullptr) return nullptr;
+
+		__m128i p = _mm_set1_epi8((char)last_vertex[k]);
+		for (size_t i = 0; i < vertex_count; i += BYTE_GROUP_SIZE) {
+			__m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(buffer + i));
+			__m128i sign = _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(v, one));
+			v = _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(v, 1), low_seven), sign);
+
+			v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
+			v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+			v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+			v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+			v = _mm_add_epi8(v, p);
+			p = _mm_shuffle_epi8(v, last_lane);
+
+			_mm_store_si128(reinterpret_cast<__m128i*>(sums), v);
+			size_t n = std::min(BYTE_GROUP_SIZE, vertex_count - i);
+			uint8_t* out = vertex_data + i * stride + k;
+			for (size_t j = 0; j < n; j++) out[j * stride] = sums[j];
+		}
+	}
+
+	memcpy(last_vertex, vertex_data + (vertex_count - 1) * stride, stride);
+	return data;
+}
+
+bool decode_meshopt_vertices(uint8_t* dst, size_t count, size_t stride, const uint8_t* src, size_t src_size) {
+	if (stride == 0 || stride > 256 || stride % 4 != 0) return false;
+	if (src_size < 1 + stride) return false;
+	if (src[0] != VERTEX_HEADER) return false;
+
+	const uint8_t* data = src + 1;
+	const uint8_t* data_end = src + src_size;
+	size_t tail_size = std::max(stride, VERTEX_TAIL_MIN_SIZE);
+	if ((size_t)(data_end - data) < tail_size) return false;
+
+	//The first vertex is delta coded against the one stored at the very end of the stream
+	uint8_t last_vertex[256];
+	memcpy(last_vertex, data_end - stride, stride);
+
+	bool simd = conversion_isa() >= CONVERSION_ISA_SSSE3;
+	size_t block_size = vertex_block_size(stride);
+	for (size_t offset = 0; offset < count; offset += block_size) {
+		size_t n = std::min(block_size, count - offset);
+		if (simd) {
+			data = decode_vertex_block_ssse3(data, data_end, dst + offset * stride, n, stride, last_vertex);
+		} else {
+			data = decode_vertex_block_scalar(data, data_end, dst + offset * stride, n, stride, last_vertex);
+		}
+		if (data == nullptr) return false;
+	}
+
+	return (size_t)(data_end - data) == tail_size;
+}
+
+//Index codecs
+
+constexpr uint8_t TRIANGLE_HEADER = 0xE0;
+constexpr uint8_t SEQUENCE_HEADER = 0xD0;
+constexpr size_t TRIANGLE_CODEAUX_SIZE = 16;
+constexpr size_t SEQUENCE_TAIL_SIZE = 4;
+
+static void write_index(uint8_t* dst, size_t i, size_t index_size, uint32_t index) {
+	if (index_size == 2) {
+		uint16_t v = (uint16_t)index;
+		memcpy(dst + 2 * i, &v, sizeof(v));
+	} else {
+		memcpy(dst + 4 * i, &index, sizeof(index));
+	}
+}
+
+//Little endian groups of seven bits, the high bit set on every byte but the last
+static uint32_t decode_vbyte(const uint8_t*& data) {
+	uint8_t lead = *data++;
+	if (lead < 128) return lead;
+
+	uint32_t result = lead & 127;
+	uint32_t shift = 7;
+	for (int i = 0; i < 4; i++) {
+		uint8_t group = *data++;
+		result |= (uint32_t)(group & 127) << shift;
+		shift += 7;
+		if (group < 128) break;
+	}
+	return result;
+}
+
+static uint32_t decode_index(const uint8_t*& data, uint32_t last) {
+	uint32_t v = decode_vbyte(data);
+	uint32_t d = (v >> 1) ^ -(v & 1);
+	return last + d;
+}
+
+//Triangles are coded against a fifo of recently seen edges and one of recently seen vertices,
+//with indices that haven't appeared yet expected to come in order
+struct TriangleDecoder {
+	uint32_t edges[16][2];
+	uint32_t vertices[16];
+	size_t edge_offset = 0;
+	size_t vertex_offset = 0;
+
+	TriangleDecoder() {
+		memset(edges, -1, sizeof(edges));
+		memset(vertices, -1, sizeof(vertices));
+	}
+
+	void push_edge(uint32_t a, uint32_t b) {
+		edges[edge_offset][0] = a;
+		edges[edge_offset][1] = b;
+		edge_offset = (edge_offset + 1) & 15;
+	}
+
+	void push_vertex(uint32_t v, bool advance = true) {
+		vertices[vertex_offset] = v;
+		vertex_offset = (vertex_offset + advance) & 15;
+	}
+
+	uint32_t vertex(size_t back) const {
+		return vertices[(vertex_offset - back) & 15];
+	}
+};
+
+bool decode_meshopt_triangles(uint8_t* dst, size_t count, size_t index_size, const uint8_t* src, size_t src_size) {
+	if (count % 3 != 0) return false;
+	if (index_size != 2 && index_size != 4) return false;
+	if (src_size < 1 + count / 3 + TRIANGLE_CODEAUX_SIZE) return false;
+	if ((src[0] & 0xF0) != TRIANGLE_HEADER) return false;
+	uint32_t version = src[0] & 0x0F;
+	if (version > 1) return false;
+
+	TriangleDecoder fifo;
+	uint32_t next = 0;
+	uint32_t last = 0;
+
+	//Version 1 spends codes 13 and 14 on free indices one away from the last
+	uint32_t fec_max = version >= 1 ? 13 : 15;
+
+	const uint8_t* code = src + 1;
+	const uint8_t* data = code + count / 3;
+	const uint8_t* data_safe_end = src + src_size - TRIANGLE_CODEAUX_SIZE;
+	const uint8_t* codeaux_table = data_safe_end;
+
+	for (size_t i = 0; i < count; i += 3) {
+		//A triangle reads at most 16 bytes, which the codeaux table at the end covers
+		if (data > data_safe_end) return false;
+		uint8_t codetri = *code++;
+
+		if (codetri < 0xF0) {
+			//Shares an edge from the fifo, third vertex is new, from the vertex fifo or free
+			uint32_t fe = codetri >> 4;
+			uint32_t a = fifo.edges[(fifo.edge_offset - 1 - fe) & 15][0];
+			uint32_t b = fifo.edges[(fifo.edge_offset - 1 - fe) & 15][1];
+			uint32_t fec = codetri & 15;
+
+			uint32_t c;
+			if (fec < fec_max) {
+				bool fec0 = fec == 0;
+				c = fec0 ? next : fifo.vertex(1 + fec);
+				next += fec0;
+				fifo.push_vertex(c, fec0);
+			} else {
+				//13 and 14 map to -1 and +1
+				c = fec != 15 ? last + (fec - (fec ^ 3)) : decode_index(data, last);
+				last = c;
+				fifo.push_vertex(c);
+			}
+			write_index(dst, i + 0, index_size, a);
+			write_index(dst, i + 1, index_size, b);
+			write_index(dst, i + 2, index_size, c);
+			fifo.push_edge(c, b);
+			fifo.push_edge(a, c);
+		} else {
+			//No shared edge, the first vertex is new or free
+			uint8_t codeaux;
+			uint32_t fea;
+			if (codetri < 0xFE) {
+				codeaux = codeaux_table[codetri & 15];
+				fea = 0;
+			} else {
+				codeaux = *data++;
+				fea = codetri == 0xFE ? 0 : 15;
+				if (codeaux == 0) next = 0;
+			}
+			uint32_t feb = codeaux >> 4;
+			uint32_t fec = codeaux & 15;
+
+			uint32_t a = fea == 0 ? next++ : 0;
+			uint32_t b = feb == 0 ? next++ : fifo.vertex(feb);
+			uint32_t c = fec == 0 ? next++ : fifo.vertex(fec);
+
+			//Only the explicitly coded form can hold free indices
+			if (codetri >= 0xFE) {
+				if (fea == 15) last = a = decode_index(data, last);
+				if (feb == 15) last = b = decode_index(data, last);
+				if (fec == 15) last = c = decode_index(data, last);
+			}
+
+			write_index(dst, i + 0, index_size, a);
+			write_index(dst, i + 1, index_size, b);
+			write_index(dst, i + 2, index_size, c);
+			fifo.push_vertex(a);
+			fifo.push_vertex(b, feb == 0 || (codetri >= 0xFE && feb == 15));
+			fifo.push_vertex(c, fec == 0 || (codetri >= 0xFE && fec == 15));
+			fifo.push_edge(b, a);
+			fifo.push_edge(c, b);
+			fifo.push_edge(a, c);
+		}
+	}
+
+	return data == data_safe_end;
+}
+
+bool decode_meshopt_indices(uint8_t* dst, size_t count, size_t index_size, const uint8_t* src, size_t src_size) {
+	if (index_size != 2 && index_size != 4) return false;
+	if (src_size < 1 + count + SEQUENCE_TAIL_SIZE) return false;
+	if ((src[0] & 0xF0) != SEQUENCE_HEADER) return false;
+	uint32_t version = src[0] & 0x0F;
+	if (version > 1) return false;
+
+	const uint8_t* data = src + 1;
+	const uint8_t* data_safe_end = src + src_size - SEQUENCE_TAIL_SIZE;
+
+	//The low bit of each delta picks which of two baselines it applies to
+	uint32_t last[2] = { 0, 0 };
+	for (size_t i = 0; i < count; i++) {
+		if (data >= data_safe_end) return false;
+		uint32_t v = decode_vbyte(data);
+		uint32_t current = v & 1;
+		v >>= 1;
+
+		uint32_t d = (v >> 1) ^ -(v & 1);
+		uint32_t index = last[current] + d;
+		last[current] = index;
+		write_index(dst, i, index_size, index);
+	}
+
+	return data == data_safe_end;
+}
+
+//Filters
+
+static int round_to_int(float v) {
+	return (int)(v + (v >= 0.0f ? 0.5f : -0.5f));
+}
+
+//Reconstructs z from the octahedral x and y, then renormalizes to the component's full range
+//The fourth component is left as it is
+template<typename T>
+static void decode_octahedral(T* data, size_t count) {
+	const float max = (float)((1 << (sizeof(T) * 8 - 1)) - 1);
+
+	for (size_t i = 0; i < count; i++) {
+		float x = (float)data[i * 4 + 0];
+		float y = (float)data[i * 4 + 1];
+		float z = (float)data[i * 4 + 2] - fabsf(x) - fabsf(y);
+
+		//Unfold the lower hemisphere
+		float t = z >= 0.0f ? 0.0f : z;
+		x += x >= 0.0f ? t : -t;
+		y += y >= 0.0f ? t : -t;
+
+		float s = max / sqrtf(x * x + y * y + z * z);
+		data[i * 4 + 0] = (T)round_to_int(x * s);
+		data[i * 4 + 1] = (T)round_to_int(y * s);
+		data[i * 4 + 2] = (T)round_to_int(z * s);
+	}
+}
+
+//The three smallest components are stored with the scale in the fourth, whose low two bits give the dropped component
+static void decode_quaternion(int16_t* data, size_t count) {
+	const float scale = 1.0f / sqrtf(2.0f);
+
+	for (size_t i = 0; i < count; i++) {
+		int sf = data[i * 4 + 3] | 3;
+		float ss = scale / (float)sf;
+
+		float x = (float)data[i * 4 + 0] * ss;
+		float y = (float)data[i * 4 + 1] * ss;
+		float z = (float)data[i * 4 + 2] * ss;
+
+		//Clamped since rounding can push the sum just past 1
+		float ww = 1.0f - x * x - y * y - z * z;
+		float w = sqrtf(ww >= 0.0f ? ww : 0.0f);
+
+		int qc = data[i * 4 + 3] & 3;
+		data[i * 4 + ((qc + 1) & 3)] = (int16_t)round_to_int(x * 32767.0f);
+		data[i * 4 + ((qc + 2) & 3)] = (int16_t)round_to_int(y * 32767.0f);
+		data[i * 4 + ((qc + 3) & 3)] = (int16_t)round_to_int(z * 32767.0f);
+		data[i * 4 + ((qc + 0) & 3)] = (int16_t)round_to_int(w * 32767.0f);
+	}
+}
+
+//Signed 24 bit mantissa in the low bits, signed exponent in the high byte
+static void decode_exponential(uint32_t* data, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		uint32_t v = data[i];
+		int32_t m = (int32_t)(v << 8) >> 8;
+		int32_t e = (int32_t)v >> 24;
+
+		//ldexp(m, e) without the call, exact while e stays in the normal range
+		uint32_t bits = (uint32_t)(e + 127) << 23;
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		f *= (float)m;
+		memcpy(&data[i], &f, sizeof(f));
+	}
+}
+
+bool apply_meshopt_filter(uint8_t* data, size_t count, size_t stride, MeshoptFilter filter) {
+	switch (filter) {
+		case MESHOPT_FILTER_NONE:
+			return true;
+		case MESHOPT_FILTER_OCTAHEDRAL:
+			if (stride == 4) {
+				decode_octahedral(reinterpret_cast<int8_t*>(data), count);
+				return true;
+			}
+			if (stride == 8) {
+				decode_octahedral(reinterpret_cast<int16_t*>(data), count);
+				return true;
+			}
+			return false;
+		case MESHOPT_FILTER_QUATERNION:
+			if (stride != 8) return false;
+			decode_quaternion(reinterpret_cast<int16_t*>(data), count);
+			return true;
+		case MESHOPT_FILTER_EXPONENTIAL:
+			if (stride % 4 != 0) return false;
+			decode_exponential(reinterpret_cast<uint32_t*>(data), count * stride / 4);
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Decoders for buffer views compressed with EXT_meshopt_compression
+//These follow the bitstream described by the extension, so any conforming encoder's output decodes.
+//Every function returns false when the stream is malformed or doesn't hold exactly count elements,
+//in which case the contents of dst are unspecified.
+
+enum MeshoptFilter {
+	MESHOPT_FILTER_NONE,
+	MESHOPT_FILTER_OCTAHEDRAL,		//Unit vectors as 8 or 16-bit octahedral coordinates
+	MESHOPT_FILTER_QUATERNION,		//Unit quaternions as three 16-bit components plus the index of the largest one
+	MESHOPT_FILTER_EXPONENTIAL		//32-bit floats as a shared exponent and 24-bit mantissa
+};
+
+//ATTRIBUTES mode: count elements of stride bytes each, stride a multiple of 4 no larger than 256
+bool decode_meshopt_vertices(uint8_t* dst, size_t count, size_t stride, const uint8_t* src, size_t src_size);
+
+//TRIANGLES mode: count indices forming a triangle list, index_size 2 or 4
+bool decode_meshopt_triangles(uint8_t* dst, size_t count, size_t index_size, const uint8_t* src, size_t src_size);
+
+//INDICES mode: count indices in any order, index_size 2 or 4
+bool decode_meshopt_indices(uint8_t* dst, size_t count, size_t index_size, const uint8_t* src, size_t src_size);
+
+//Undoes filter on count decoded elements of stride bytes in place
+bool apply_meshopt_filter(uint8_t* data, size_t count, size_t stride, MeshoptFilter filter);
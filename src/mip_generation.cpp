@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <immintrin.h>
+#include "mip_generation.h"
+#include "vertex_conversion.h"
+
+//MSVC accepts AVX2 intrinsics anywhere, GCC and Clang need the function marked
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+//Linear values are 14-bit fixed point, so four of them add up without leaving 16 bits
+//The whole sRGB path is integer, which keeps every instruction set on the same bytes for free
+static constexpr uint32_t LINEAR_MAX = 16383;
+
+struct SrgbTables {
+	uint16_t to_linear[256 + 1];			//One entry of padding so AVX2 can gather the last one with a 32-bit load
+	uint8_t to_srgb[LINEAR_MAX + 1];		//Indexed by the rounded average of four to_linear values
+
+	SrgbTables() {
+		for (uint32_t i = 0; i < 256; i++) {
+			float c = i / 255.0f;
+			float l = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			to_linear[i] = (uint16_t)(l * LINEAR_MAX + 0.5f);
+		}
+		to_linear[256] = 0;
+		for (uint32_t i = 0; i <= LINEAR_MAX; i++) {
+			float c = i / (float)LINEAR_MAX;
+			float s = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+			to_srgb[i] = (uint8_t)std::clamp((int32_t)(s * 255.0f + 0.5f), 0, 255);
+		}
+	}
+};
+
+static const SrgbTables& srgb_tables() {
+	static SrgbTables tables;
+	return tables;
+}
+
+//Output pixels [x_begin, x_end) of one row. Columns past the edge repeat the last one
+static void downsample_row_scalar(const uint8_t* row0, const uint8_t* row1, uint32_t width, bool srgb, uint32_t x_begin, uint32_t x_end, uint8_t* dst_row) {
+	const SrgbTables& tables = srgb_tables();
+	for (uint32_t x = x_begin; x < x_end; x++) {
+		uint32_t x0 = 4 * std::min(2 * x, width - 1);
+		uint32_t x1 = 4 * std::min(2 * x + 1, width - 1);
+		uint8_t* out = &dst_row[4 * x];
+
+		for (uint32_t c = 0; c < 3; c++) {
+			if (srgb) {
+				uint32_t sum = tables.to_linear[row0[x0 + c]] + tables.to_linear[row0[x1 + c]] + tables.to_linear[row1[x0 + c]] + tables.to_linear[row1[x1 + c]];
+				out[c] = tables.to_srgb[(sum + 2) / 4];
+			} else {
+				out[c] = (uint8_t)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+			}
+		}
+		out[3] = (uint8_t)((row0[x0 + 3] + row0[x1 + 3] + row1[x0 + 3] + row1[x1 + 3] + 2) / 4);
+	}
+}
+
+//The SIMD kernels only take output pixels whose two source columns are both inside the row, and return how many they did
+//The scalar loop finishes the row from there
+
+static uint32_t downsample_row_sse2(const uint8_t* row0, const uint8_t* row1, uint32_t width, uint8_t* dst_row) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+	uint32_t x = 0;
+	for (; x + 4 <= width / 2; x += 4) {
+		__m128 a0 = _mm_loadu_ps(reinterpret_cast<const float*>(row0 + 8 * x));
+		__m128 b0 = _mm_loadu_ps(reinterpret_cast<const float*>(row0 + 8 * x + 16));
+		__m128 a1 = _mm_loadu_ps(reinterpret_cast<const float*>(row1 + 8 * x));
+		__m128 b1 = _mm_loadu_ps(reinterpret_cast<const float*>(row1 + 8 * x + 16));
+
+		//Split each row into its even and odd pixels
+		__m128i even0 = _mm_castps_si128(_mm_shuffle_ps(a0, b0, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i odd0 = _mm_castps_si128(_mm_shuffle_ps(a0, b0, _MM_SHUFFLE(3, 1, 3, 1)));
+		__m128i even1 = _mm_castps_si128(_mm_shuffle_ps(a1, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i odd1 = _mm_castps_si128(_mm_shuffle_ps(a1, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+		__m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(even0, zero), _mm_unpacklo_epi8(odd0, zero)), _mm_add_epi16(_mm_unpacklo_epi8(even1, zero), _mm_unpacklo_epi8(odd1, zero)));
+		__m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(even0, zero), _mm_unpackhi_epi8(odd0, zero)), _mm_add_epi16(_mm_unpackhi_epi8(even1, zero), _mm_unpackhi_epi8(odd1, zero)));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst_row + 4 * x), _mm_packus_epi16(lo, hi));
+	}
+	return x;
+}
+
+TARGET_AVX2 static uint32_t downsample_row_avx2(const uint8_t* row0, const uint8_t* row1, uint32_t width, uint8_t* dst_row) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i two = _mm256_set1_epi16(2);
+	uint32_t x = 0;
+	for (; x + 8 <= width / 2; x += 8) {
+		__m256 a0 = _mm256_loadu_ps(reinterpret_cast<const float*>(row0 + 8 * x));
+		__m256 b0 = _mm256_loadu_ps(reinterpret_cast<const float*>(row0 + 8 * x + 32));
+		__m256 a1 = _mm256_loadu_ps(reinterpret_cast<const float*>(row1 + 8 * x));
+		__m256 b1 = _mm256_loadu_ps(reinterpret_cast<const float*>(row1 + 8 * x + 32));
+
+		//Shuffles stay within 128-bit lanes, so these hold output pixels 0, 1, 4, 5 | 2, 3, 6, 7
+		__m256i even0 = _mm256_castps_si256(_mm256_shuffle_ps(a0, b0, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m256i odd0 = _mm256_castps_si256(_mm256_shuffle_ps(a0, b0, _MM_SHUFFLE(3, 1, 3, 1)));
+		__m256i even1 = _mm256_castps_si256(_mm256_shuffle_ps(a1, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m256i odd1 = _mm256_castps_si256(_mm256_shuffle_ps(a1, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+		__m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(even0, zero), _mm256_unpacklo_epi8(odd0, zero)), _mm256_add_epi16(_mm256_unpacklo_epi8(even1, zero), _mm256_unpacklo_epi8(odd1, zero)));
+		__m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(even0, zero), _mm256_unpackhi_epi8(odd0, zero)), _mm256_add_epi16(_mm256_unpackhi_epi8(even1, zero), _mm256_unpackhi_epi8(odd1, zero)));
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+		__m256i packed = _mm256_packus_epi16(lo, hi);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst_row + 4 * x), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	return x;
+}
+
+//Going to linear space and back is a table lookup per channel, and SSE2 has no gathers
+//Without them the lookups go one at a time anyway, so below AVX2 sRGB rows get this loop. It's the scalar one without the edge clamping
+static uint32_t downsample_row_srgb_lookup(const uint8_t* row0, const uint8_t* row1, uint32_t width, uint8_t* dst_row) {
+	const SrgbTables& tables = srgb_tables();
+	uint32_t x = 0;
+	for (; x < width / 2; x++) {
+		const uint8_t* p0 = row0 + 8 * x;
+		const uint8_t* p1 = row1 + 8 * x;
+		uint8_t* out = &dst_row[4 * x];
+		for (uint32_t c = 0; c < 3; c++) {
+			uint32_t sum = tables.to_linear[p0[c]] + tables.to_linear[p0[c + 4]] + tables.to_linear[p1[c]] + tables.to_linear[p1[c + 4]];
+			out[c] = tables.to_srgb[(sum + 2) / 4];
+		}
+		out[3] = (uint8_t)((p0[3] + p0[7] + p1[3] + p1[7] + 2) / 4);
+	}
+	return x;
+}
+
+//Gathers the linear values and does the sums with vector math. The 8-bit result table still gets read one channel at a time,
+//which measured faster than gathering it from a 32-bit copy
+TARGET_AVX2 static uint32_t downsample_row_srgb_avx2(const uint8_t* row0, const uint8_t* row1, uint32_t width, uint8_t* dst_row) {
+	const SrgbTables& tables = srgb_tables();
+	const int* to_linear = reinterpret_cast<const int*>(tables.to_linear);
+	const __m256i low_half = _mm256_set1_epi32(0xFFFF);
+	const __m256i two = _mm256_set1_epi32(2);
+	alignas(32) uint32_t averages[8];
+	uint32_t x = 0;
+	for (; x + 2 <= width / 2; x += 2) {
+		//Each 32-bit lane is one channel of one output pixel
+		__m128i r0 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x)), _MM_SHUFFLE(3, 1, 2, 0));
+		__m128i r1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x)), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i even0 = _mm256_cvtepu8_epi32(r0);
+		__m256i odd0 = _mm256_cvtepu8_epi32(_mm_srli_si128(r0, 8));
+		__m256i even1 = _mm256_cvtepu8_epi32(r1);
+		__m256i odd1 = _mm256_cvtepu8_epi32(_mm_srli_si128(r1, 8));
+
+		//Each gather reads 32 bits, so the entry after the one asked for comes along in the high half
+		__m256i sum = _mm256_and_si256(_mm256_i32gather_epi32(to_linear, even0, 2), low_half);
+		sum = _mm256_add_epi32(sum, _mm256_and_si256(_mm256_i32gather_epi32(to_linear, odd0, 2), low_half));
+		sum = _mm256_add_epi32(sum, _mm256_and_si256(_mm256_i32gather_epi32(to_linear, even1, 2), low_half));
+		sum = _mm256_add_epi32(sum, _mm256_and_si256(_mm256_i32gather_epi32(to_linear, odd1, 2), low_half));
+
+		//Alpha lanes take the sum of the stored values instead, so after rounding they're already the output
+		__m256i alpha = _mm256_add_epi32(_mm256_add_epi32(even0, odd0), _mm256_add_epi32(even1, odd1));
+		sum = _mm256_blend_epi32(sum, alpha, 0x88);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(averages), _mm256_srli_epi32(_mm256_add_epi32(sum, two), 2));
+
+		uint8_t* out = &dst_row[4 * x];
+		for (uint32_t i = 0; i < 8; i += 4) {
+			out[i + 0] = tables.to_srgb[averages[i + 0]];
+			out[i + 1] = tables.to_srgb[averages[i + 1]];
+			out[i + 2] = tables.to_srgb[averages[i + 2]];
+			out[i + 3] = (uint8_t)averages[i + 3];
+		}
+	}
+	return x;
+}
+
+void downsample_rgba8(const uint8_t* src, uint32_t width, uint32_t height, bool srgb, uint8_t* dst) {
+	ConversionIsa isa = conversion_isa();
+	uint32_t dst_width = std::max(width >> 1, 1u);
+	uint32_t dst_height = std::max(height >> 1, 1u);
+
+	for (uint32_t y = 0; y < dst_height; y++) {
+		const uint8_t* row0 = &src[4 * (size_t)std::min(2 * y, height - 1) * width];
+		const uint8_t* row1 = &src[4 * (size_t)std::min(2 * y + 1, height - 1) * width];
+		uint8_t* dst_row = &dst[4 * (size_t)y * dst_width];
+
+		uint32_t x = 0;
+		if (isa >= CONVERSION_ISA_AVX2) {
+			x = srgb ? downsample_row_srgb_avx2(row0, row1, width, dst_row) : downsample_row_avx2(row0, row1, width, dst_row);
+		} else if (isa >= CONVERSION_ISA_SSE2) {
+			x = srgb ? downsample_row_srgb_lookup(row0, row1, width, dst_row) : downsample_row_sse2(row0, row1, width, dst_row);
+		}
+		downsample_row_scalar(row0, row1, width, srgb, x, dst_width, dst_row);
+	}
+}
+
+size_t rgba8_mip_chain_size(uint32_t width, uint32_t height, uint32_t mip_count) {
+	size_t size = 0;
+	for (uint32_t i = 0; i < mip_count; i++) {
+		size += 4 * (size_t)std::max(width >> i, 1u) * std::max(height >> i, 1u);
+	}
+	return size;
+}
+
+void generate_mip_chain_rgba8(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t mip_count, bool srgb, uint8_t* out) {
+	//Levels are built in scratch memory and copied out, so out is never read back
+	std::vector<uint8_t> levels[2];
+	const uint8_t* level = rgba;
+	for (uint32_t i = 0; i < mip_count; i++) {
+		size_t level_size = 4 * (size_t)width * height;
+		memcpy(out, level, level_size);
+		out += level_size;
+
+		if (i + 1 < mip_count) {
+			std::vector<uint8_t>& next = levels[i & 1];
+			next.resize(4 * (size_t)std::max(width >> 1, 1u) * std::max(height >> 1, 1u));
+			downsample_rgba8(level, width, height, srgb, next.data());
+			level = next.data();
+			width = std::max(width >> 1, 1u);
+			height = std::max(height >> 1, 1u);
+		}
+	}
+}
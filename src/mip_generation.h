@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//CPU mip generation for RGBA8 images with a 2x2 box filter
+//The kernels follow the instruction set picked in vertex_conversion.h, so set_conversion_isa() applies here too.
+//Every instruction set produces the same bytes.
+
+//Halves rgba with a 2x2 box filter. Odd sizes round down but never go below 1
+//RGB is averaged in linear space when srgb is set. Alpha is always averaged as stored
+void downsample_rgba8(const uint8_t* src, uint32_t width, uint32_t height, bool srgb, uint8_t* dst);
+
+//Size of mip_count RGBA8 levels stored one after another, largest first
+size_t rgba8_mip_chain_size(uint32_t width, uint32_t height, uint32_t mip_count);
+
+//Writes rgba as level 0 followed by mip_count - 1 levels, each made by downsampling the one before it
+//out must hold rgba8_mip_chain_size() bytes. It's only ever written to, in order, so it can be write-combined memory
+void generate_mip_chain_rgba8(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t mip_count, bool srgb, uint8_t* out);
@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <math.h>
+#include <xmmintrin.h>
+#include "node_hierarchy.h"
+#include "utils.h"
+
+//Nodes per parallel_for index when a level is split across threads
+static constexpr uint32_t PROPAGATION_CHUNK_SIZE = 512;
+
+uint32_t NodeHierarchy::add_node(uint32_t parent, const float t[3], const float r[4], const float s[3]) {
+	uint32_t node = node_count();
+	uint32_t depth = 0;
+	if (parent != NO_PARENT) {
+		PRORENDER_ASSERT(parent < node, true);
+		depth = (uint32_t)(std::upper_bound(level_starts.begin(), level_starts.end(), parent) - level_starts.begin());
+	}
+
+	//level_starts has one entry per level plus the end of the last one
+	if (level_starts.empty()) level_starts.push_back(0);
+	uint32_t level_count = (uint32_t)level_starts.size() - 1;
+	PRORENDER_ASSERT(depth + 1 >= level_count && depth <= level_count, true);
+	if (depth == level_count) {
+		level_starts.push_back(node + 1);
+	} else {
+		level_starts.back() = node + 1;
+	}
+
+	parents.push_back(parent);
+	for (int i = 0; i < 3; i++) translation[i].push_back(t[i]);
+	for (int i = 0; i < 4; i++) rotation[i].push_back(r[i]);
+	for (int i = 0; i < 3; i++) scale[i].push_back(s[i]);
+	for (int i = 0; i < 12; i++) world[i].push_back((i % 5) == 0 ? 1.0f : 0.0f);
+	return node;
+}
+
+void NodeHierarchy::world_matrix(uint32_t node, float out[16]) const {
+	for (int i = 0; i < 12; i++) out[i] = world[i][node];
+	out[12] = 0.0f;
+	out[13] = 0.0f;
+	out[14] = 0.0f;
+	out[15] = 1.0f;
+}
+
+void decompose_transform(const float column_major[16], float t[3], float r[4], float s[3]) {
+	const float* m = column_major;
+	t[0] = m[12];
+	t[1] = m[13];
+	t[2] = m[14];
+	for (int c = 0; c < 3; c++) {
+		s[c] = sqrtf(m[4 * c] * m[4 * c] + m[4 * c + 1] * m[4 * c + 1] + m[4 * c + 2] * m[4 * c + 2]);
+	}
+
+	//A mirrored matrix has a negative determinant, which no rotation does
+	//Flipping the x scale takes the mirror out, and dividing by it below negates the matching column
+	float det =
+		m[0] * (m[5] * m[10] - m[9] * m[6]) -
+		m[4] * (m[1] * m[10] - m[9] * m[2]) +
+		m[8] * (m[1] * m[6] - m[5] * m[2]);
+	if (det < 0.0f) s[0] = -s[0];
+
+	//Rotation matrix element at row i, column j once the scale is divided out
+	auto R = [&](int i, int j) { return s[j] != 0.0f ? m[4 * j + i] / s[j] : 0.0f; };
+
+	float trace = R(0, 0) + R(1, 1) + R(2, 2);
+	if (trace > 0.0f) {
+		float k = 0.5f / sqrtf(trace + 1.0f);
+		r[3] = 0.25f / k;
+		r[0] = (R(2, 1) - R(1, 2)) * k;
+		r[1] = (R(0, 2) - R(2, 0)) * k;
+		r[2] = (R(1, 0) - R(0, 1)) * k;
+	} else if (R(0, 0) > R(1, 1) && R(0, 0) > R(2, 2)) {
+		float k = 2.0f * sqrtf(1.0f + R(0, 0) - R(1, 1) - R(2, 2));
+		r[3] = (R(2, 1) - R(1, 2)) / k;
+		r[0] = 0.25f * k;
+		r[1] = (R(0, 1) + R(1, 0)) / k;
+		r[2] = (R(0, 2) + R(2, 0)) / k;
+	} else if (R(1, 1) > R(2, 2)) {
+		float k = 2.0f * sqrtf(1.0f + R(1, 1) - R(0, 0) - R(2, 2));
+		r[3] = (R(0, 2) - R(2, 0)) / k;
+		r[0] = (R(0, 1) + R(1, 0)) / k;
+		r[1] = 0.25f * k;
+		r[2] = (R(1, 2) + R(2, 1)) / k;
+	} else {
+		float k = 2.0f * sqrtf(1.0f + R(2, 2) - R(0, 0) - R(1, 1));
+		r[3] = (R(1, 0) - R(0, 1)) / k;
+		r[0] = (R(0, 2) + R(2, 0)) / k;
+		r[1] = (R(1, 2) + R(2, 1)) / k;
+		r[2] = 0.25f * k;
+	}
+}
+
+//Top three rows of T * R * S for one node
+static void local_matrix(const NodeHierarchy& h, uint32_t i, float m[12]) {
+	float x = h.rotation[0][i], y = h.rotation[1][i], z = h.rotation[2][i], w = h.rotation[3][i];
+	float sx = h.scale[0][i], sy = h.scale[1][i], sz = h.scale[2][i];
+	m[0] = (1.0f - 2.0f * (y * y + z * z)) * sx;
+	m[1] = 2.0f * (x * y - z * w) * sy;
+	m[2] = 2.0f * (x * z + y * w) * sz;
+	m[3] = h.translation[0][i];
+	m[4] = 2.0f * (x * y + z * w) * sx;
+	m[5] = (1.0f - 2.0f * (x * x + z * z)) * sy;
+	m[6] = 2.0f * (y * z - x * w) * sz;
+	m[7] = h.translation[1][i];
+	m[8] = 2.0f * (x * z - y * w) * sx;
+	m[9] = 2.0f * (y * z + x * w) * sy;
+	m[10] = (1.0f - 2.0f * (x * x + y * y)) * sz;
+	m[11] = h.translation[2][i];
+}
+
+//World matrices of nodes [begin, end), four nodes per SSE register with a scalar tail
+//Parent rows come from root_world for the first level and are gathered from the world arrays otherwise.
+//Parents always sit in an earlier level, so the gathers never read a matrix this call writes.
+static void propagate_range(NodeHierarchy& h, uint32_t begin, uint32_t end, const float* root_world) {
+	const uint32_t* parents = h.parents.data();
+	float* world[12];
+	for (int e = 0; e < 12; e++) world[e] = h.world[e].data();
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	uint32_t i = begin;
+	for (; i + 4 <= end; i += 4) {
+		__m128 x = _mm_loadu_ps(&h.rotation[0][i]);
+		__m128 y = _mm_loadu_ps(&h.rotation[1][i]);
+		__m128 z = _mm_loadu_ps(&h.rotation[2][i]);
+		__m128 w = _mm_loadu_ps(&h.rotation[3][i]);
+		__m128 sx = _mm_loadu_ps(&h.scale[0][i]);
+		__m128 sy = _mm_loadu_ps(&h.scale[1][i]);
+		__m128 sz = _mm_loadu_ps(&h.scale[2][i]);
+
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 xw = _mm_mul_ps(x, w), yw = _mm_mul_ps(y, w), zw = _mm_mul_ps(z, w);
+
+		__m128 l[12];
+		l[0] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+		l[1] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, zw)), sy);
+		l[2] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, yw)), sz);
+		l[3] = _mm_loadu_ps(&h.translation[0][i]);
+		l[4] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, zw)), sx);
+		l[5] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+		l[6] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, xw)), sz);
+		l[7] = _mm_loadu_ps(&h.translation[1][i]);
+		l[8] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, yw)), sx);
+		l[9] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, xw)), sy);
+		l[10] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+		l[11] = _mm_loadu_ps(&h.translation[2][i]);
+
+		//World = ParentWorld * Local, one row at a time
+		for (int r = 0; r < 3; r++) {
+			__m128 p[4];
+			if (root_world != nullptr) {
+				for (int k = 0; k < 4; k++) p[k] = _mm_set1_ps(root_world[4 * r + k]);
+			} else {
+				uint32_t a = parents[i], b = parents[i + 1], c = parents[i + 2], d = parents[i + 3];
+				for (int k = 0; k < 4; k++) {
+					const float* src = world[4 * r + k];
+					p[k] = _mm_setr_ps(src[a], src[b], src[c], src[d]);
+				}
+			}
+
+			for (int c = 0; c < 4; c++) {
+				__m128 v = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(p[0], l[c]), _mm_mul_ps(p[1], l[4 + c])),
+					_mm_mul_ps(p[2], l[8 + c])
+				);
+				if (c == 3) v = _mm_add_ps(v, p[3]);
+				_mm_storeu_ps(world[4 * r + c] + i, v);
+			}
+		}
+	}
+
+	for (; i < end; i++) {
+		float l[12];
+		local_matrix(h, i, l);
+		float p[12];
+		if (root_world != nullptr) {
+			for (int e = 0; e < 12; e++) p[e] = root_world[e];
+		} else {
+			for (int e = 0; e < 12; e++) p[e] = world[e][parents[i]];
+		}
+
+		for (int r = 0; r < 3; r++) {
+			for (int c = 0; c < 4; c++) {
+				float v = p[4 * r] * l[c] + p[4 * r + 1] * l[4 + c] + p[4 * r + 2] * l[8 + c];
+				if (c == 3) v += p[4 * r + 3];
+				world[4 * r + c][i] = v;
+			}
+		}
+	}
+}
+
+void propagate_world_transforms(NodeHierarchy& hierarchy, const float root_world[16], ThreadPool* pool) {
+	for (size_t level = 0; level + 1 < hierarchy.level_starts.size(); level++) {
+		uint32_t begin = hierarchy.level_starts[level];
+		uint32_t end = hierarchy.level_starts[level + 1];
+		const float* parent_world = level == 0 ? root_world : nullptr;
+
+		uint32_t chunk_count = (end - begin + PROPAGATION_CHUNK_SIZE - 1) / PROPAGATION_CHUNK_SIZE;
+		if (pool != nullptr && chunk_count > 1) {
+			pool->parallel_for(chunk_count, [&](uint32_t chunk) {
+				uint32_t chunk_begin = begin + chunk * PROPAGATION_CHUNK_SIZE;
+				uint32_t chunk_end = std::min(chunk_begin + PROPAGATION_CHUNK_SIZE, end);
+				propagate_range(hierarchy, chunk_begin, chunk_end, parent_world);
+			});
+		} else {
+			propagate_range(hierarchy, begin, end, parent_world);
+		}
+	}
+}
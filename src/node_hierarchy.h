@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "thread_pool.h"
+
+//Transform tree flattened into arrays, ordered by depth
+//Every node comes after its parent, and all nodes of one depth are contiguous, so a level can be
+//updated in parallel once the level above it is done. Local transforms are stored one array per
+//component so the local matrix pass runs over contiguous floats and vectorizes.
+struct NodeHierarchy {
+	static constexpr uint32_t NO_PARENT = 0xFFFFFFFF;
+
+	std::vector<uint32_t> parents;
+	std::vector<uint32_t> level_starts;		//Nodes at depth d are [level_starts[d], level_starts[d + 1])
+
+	std::vector<float> translation[3];
+	std::vector<float> rotation[4];			//Quaternion x, y, z, w
+	std::vector<float> scale[3];
+
+	//Top three rows of each node's row-major world matrix, one array per element
+	//The bottom row is always (0, 0, 0, 1)
+	std::vector<float> world[12];
+
+	uint32_t node_count() const { return (uint32_t)parents.size(); }
+
+	//Nodes must be added in order of depth, parents first. Returns the new node's index
+	uint32_t add_node(uint32_t parent, const float t[3], const float r[4], const float s[3]);
+
+	//Row-major 4x4 world matrix of node as of the last propagate_world_transforms()
+	void world_matrix(uint32_t node, float out[16]) const;
+};
+
+//Splits a column-major affine matrix without shear into translation, rotation and scale
+void decompose_transform(const float column_major[16], float t[3], float r[4], float s[3]);
+
+//Recomputes every node's world matrix with roots placed by root_world, a row-major 4x4
+//Levels are processed in order and large ones are split across pool's threads when one is given
+void propagate_world_transforms(NodeHierarchy& hierarchy, const float root_world[16], ThreadPool* pool = nullptr);
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <new>
+#include <queue>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include "slotmap.h"
+#include "virtual_memory.h"
+
+//Slotmap variant for very large, sparsely populated tables
+//alloc() only reserves address space for the requested capacity. Fixed-size pages of
+//element storage are committed the first time one of their slots is used and handed
+//back to the OS once every slot in them has been removed, except for the most recently
+//emptied page, which stays committed as a spare so churn across a page boundary doesn't
+//commit and decommit it on every insert/remove pair.
+//Keys have the same layout as slotmap keys and stay valid until removed.
+template<typename T, typename Tkey = Key<T>>
+struct paged_slotmap {
+    static constexpr size_t PAGE_BYTES = 64 * 1024;
+    static constexpr uint32_t SLOTS_PER_PAGE = sizeof(T) >= PAGE_BYTES ? 1 : static_cast<uint32_t>(PAGE_BYTES / sizeof(T));
+    static constexpr size_t PAGE_STRIDE = ((SLOTS_PER_PAGE * sizeof(T) + PAGE_BYTES - 1) / PAGE_BYTES) * PAGE_BYTES;
+    static constexpr uint32_t GENERATIONS_PER_PAGE = static_cast<uint32_t>(PAGE_BYTES / sizeof(uint32_t));
+    static constexpr uint32_t NO_PAGE = 0xFFFFFFFF;
+
+    //Iterator impl for paged_slotmap
+    struct iterator {
+        using Element = T;
+        using Pointer = Element*;
+        using Reference = Element&;
+
+        iterator(paged_slotmap* m, uint32_t i) {
+            map = m;
+            idx = i;
+        }
+        Reference operator*() const { return *map->slot_ptr(idx); }
+        Pointer operator->() { return map->slot_ptr(idx); }
+        iterator& operator++() {
+            idx += 1;
+            while (idx != map->_end_idx && (map->_generation_bits[idx] & LIVE_BIT) == 0) {
+                idx += 1;
+            }
+            return *this;
+        }
+        bool operator==(const iterator& other) { return idx == other.idx; }
+        bool operator!=(const iterator& other) { return idx != other.idx; }
+
+        uint32_t slot_index() {
+            return idx;
+        }
+
+        uint32_t generation_bits() {
+            return map->_generation_bits[idx];
+        }
+
+    private:
+        paged_slotmap* map;
+        uint32_t idx;
+    };
+    iterator begin() {
+        uint32_t idx = 0;
+        while (idx != _end_idx && (_generation_bits[idx] & LIVE_BIT) == 0) {
+            idx += 1;
+        }
+        return iterator(this, idx);
+    }
+
+    iterator end() {
+        return iterator(this, _end_idx);
+    }
+
+    void alloc(uint32_t size);
+    uint32_t count();
+    void clear();
+    T* get(Tkey key);
+    Tkey insert(T thing);
+    void remove(uint32_t idx);
+    uint32_t size();
+    uint32_t committed_pages();
+
+    paged_slotmap() = default;
+    paged_slotmap(const paged_slotmap&) = delete;
+    paged_slotmap& operator=(const paged_slotmap&) = delete;
+    ~paged_slotmap();
+
+private:
+    T* slot_ptr(uint32_t idx) {
+        uint8_t* page = _data + static_cast<size_t>(idx / SLOTS_PER_PAGE) * PAGE_STRIDE;
+        return reinterpret_cast<T*>(page) + idx % SLOTS_PER_PAGE;
+    }
+
+    uint8_t* _data = nullptr;
+    uint32_t* _generation_bits = nullptr;
+    std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> free_indices;     //Lowest index first so live slots stay packed toward the front
+    std::vector<uint32_t> _page_live_counts;
+    std::vector<uint8_t> _page_committed;
+    uint32_t _capacity = 0;
+    uint32_t _count = 0;
+    uint32_t _end_idx = 0;
+    uint32_t _high_water = 0;           //Every slot at or above this index has never been used
+    uint32_t _generations_committed = 0;
+    uint32_t _committed_pages = 0;
+    uint32_t _spare_page = NO_PAGE;     //Committed page with nothing live in it
+};
+
+template<typename T, typename Tkey>
+void paged_slotmap<T, Tkey>::alloc(uint32_t size) {
+    assert(_data == nullptr);
+    _capacity = size;
+
+    uint32_t page_count = (size + SLOTS_PER_PAGE - 1) / SLOTS_PER_PAGE;
+    _page_live_counts.resize(page_count);
+    _page_committed.resize(page_count);
+
+    size_t generation_bytes = ((static_cast<size_t>(size) * sizeof(uint32_t) + PAGE_BYTES - 1) / PAGE_BYTES) * PAGE_BYTES;
+    _data = static_cast<uint8_t*>(virtual_reserve(page_count * PAGE_STRIDE));
+    _generation_bits = static_cast<uint32_t*>(virtual_reserve(generation_bytes));
+    if (_data == nullptr || _generation_bits == nullptr) {
+        printf("Reserving address space for paged_slotmap failed.\n");
+        exit(-1);
+    }
+}
+
+template<typename T, typename Tkey>
+uint32_t paged_slotmap<T, Tkey>::count() {
+    return _count;
+}
+
+template<typename T, typename Tkey>
+uint32_t paged_slotmap<T, Tkey>::size() {
+    return _capacity;
+}
+
+template<typename T, typename Tkey>
+uint32_t paged_slotmap<T, Tkey>::committed_pages() {
+    return _committed_pages;
+}
+
+template<typename T, typename Tkey>
+void paged_slotmap<T, Tkey>::clear() {
+    for (uint32_t i = 0; i < _end_idx; i++) {
+        if (_generation_bits[i] & LIVE_BIT) remove(i);
+    }
+    free_indices = {};
+    _high_water = 0;
+}
+
+template<typename T, typename Tkey>
+T* paged_slotmap<T, Tkey>::get(Tkey key) {
+    uint32_t idx = EXTRACT_IDX(key.value());
+    uint32_t gen = static_cast<uint32_t>(key.value() >> 32);
+    T* d = nullptr;
+    if (idx < _high_water && gen == _generation_bits[idx]) {
+        d = slot_ptr(idx);
+    }
+    return d;
+}
+
+template<typename T, typename Tkey>
+Tkey paged_slotmap<T, Tkey>::insert(T thing) {
+    uint32_t free_idx;
+    if (free_indices.size() > 0) {
+        free_idx = free_indices.top();
+        free_indices.pop();
+    } else {
+        assert(_high_water < _capacity);
+        free_idx = _high_water;
+        _high_water += 1;
+
+        //Generation bits are never decommitted so that stale keys keep failing lookups
+        if (free_idx >= _generations_committed) {
+            if (!virtual_commit(_generation_bits + _generations_committed, PAGE_BYTES)) {
+                printf("Committing paged_slotmap generation page failed.\n");
+                exit(-1);
+            }
+            _generations_committed += GENERATIONS_PER_PAGE;
+        }
+    }
+
+    uint32_t page = free_idx / SLOTS_PER_PAGE;
+    if (!_page_committed[page]) {
+        if (!virtual_commit(_data + static_cast<size_t>(page) * PAGE_STRIDE, PAGE_STRIDE)) {
+            printf("Committing paged_slotmap page failed.\n");
+            exit(-1);
+        }
+        _page_committed[page] = 1;
+        _committed_pages += 1;
+    }
+    if (page == _spare_page) _spare_page = NO_PAGE;
+    _page_live_counts[page] += 1;
+
+    if (free_idx >= _end_idx) _end_idx = free_idx + 1;
+    new (slot_ptr(free_idx)) T(thing);
+    _generation_bits[free_idx] |= LIVE_BIT;
+    uint32_t generation = _generation_bits[free_idx];
+    _count += 1;
+    uint64_t data = (static_cast<uint64_t>(generation) << 32) | static_cast<uint64_t>(free_idx);
+    return Tkey(data);
+}
+
+template<typename T, typename Tkey>
+void paged_slotmap<T, Tkey>::remove(uint32_t idx) {
+    assert(_generation_bits[idx] & LIVE_BIT);
+    slot_ptr(idx)->~T();
+    free_indices.push(idx);
+    _generation_bits[idx] &= ~LIVE_BIT;
+    _generation_bits[idx] += 1;
+    _count -= 1;
+
+    //Once nothing lives in the page it becomes the spare, and the previous spare goes back to the OS
+    uint32_t page = idx / SLOTS_PER_PAGE;
+    _page_live_counts[page] -= 1;
+    if (_page_live_counts[page] == 0) {
+        if (_spare_page != NO_PAGE) {
+            virtual_decommit(_data + static_cast<size_t>(_spare_page) * PAGE_STRIDE, PAGE_STRIDE);
+            _page_committed[_spare_page] = 0;
+            _committed_pages -= 1;
+        }
+        _spare_page = page;
+    }
+
+    //Recalculate end index
+    if (_end_idx == idx + 1) {
+        uint32_t n = idx;
+        while ((_generation_bits[n] & LIVE_BIT) == 0) {
+            _end_idx = n;
+            if (n == 0) break;
+            n -= 1;
+        }
+    }
+}
+
+template<typename T, typename Tkey>
+paged_slotmap<T, Tkey>::~paged_slotmap() {
+    if (_data == nullptr) return;
+
+    for (uint32_t i = 0; i < _end_idx; i++) {
+        if (_generation_bits[i] & LIVE_BIT) slot_ptr(i)->~T();
+    }
+
+    uint32_t page_count = static_cast<uint32_t>(_page_committed.size());
+    size_t generation_bytes = ((static_cast<size_t>(_capacity) * sizeof(uint32_t) + PAGE_BYTES - 1) / PAGE_BYTES) * PAGE_BYTES;
+    virtual_release(_data, page_count * PAGE_STRIDE);
+    virtual_release(_generation_bits, generation_bytes);
+}
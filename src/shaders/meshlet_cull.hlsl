@@ -0,0 +1,40 @@
+#define MESHLET_CULL_GROUP_SIZE 64
+
+//Mirrors MeshMeshlet in mesh_optimizer.h
+struct GPUMeshlet {
+    uint index_offset;
+    uint index_count;
+    uint _pad0;
+    uint _pad1;
+    float4 sphere;      //Center in xyz, radius in w
+    float4 cone;        //Axis in xyz, cutoff in w
+};
+
+//One instance of a mesh whose meshlets get culled. Mirrors GPUMeshletCullJob
+struct MeshletCullJob {
+    uint instance_idx;
+    uint meshlet_start;
+    uint meshlet_count;
+    uint first_index;
+    uint index_width;
+    uint _pad0;
+    uint _pad1;
+    uint _pad2;
+};
+
+//Draw buffer layout per frame: a count for each index width padded to 16 bytes,
+//then max_draws VkDrawIndexedIndirectCommands for each index width
+#define DRAW_COMMAND_SIZE 20
+#define DRAW_COUNTS_SIZE 16
+
+[[vk::push_constant]]
+struct {
+    uint64_t uniforms_addr;
+    uint camera_idx;
+    uint job_count;
+    uint64_t jobs_addr;
+    uint64_t meshlets_addr;
+    uint draws_buffer_idx;
+    uint draws_offset;
+    uint max_draws;
+} pc;
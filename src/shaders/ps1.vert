@@ -16,19 +16,39 @@ Ps1VertexOutput main(uint vtx_id : SV_VertexID, uint inst_idx : SV_INSTANCEID) {
     float4x4 world_matrix = vk::RawBufferLoad<float4x4>(instance_data_baseaddr + sizeof(GPUInstanceData) * inst_idx);
     uint mesh_idx = vk::RawBufferLoad<uint>(instance_data_baseaddr + sizeof(GPUInstanceData) * inst_idx + sizeof(float4x4));
 
-    uint position_offset = vk::RawBufferLoad<uint>(mesh_baseaddr + sizeof(GPUMesh) * mesh_idx);
-    uint uv_offset = vk::RawBufferLoad<uint>(mesh_baseaddr + sizeof(GPUMesh) * mesh_idx + sizeof(uint));
-    uint color_offset = vk::RawBufferLoad<uint>(mesh_baseaddr + sizeof(GPUMesh) * mesh_idx + 2 * sizeof(uint));
-    
-    uint position_float4_offset = (vtx_id + (position_offset / 4));
-    uint color_float4_offset = (vtx_id + (color_offset / 4));
-    uint uv_float2_offset = (vtx_id + (uv_offset / 2));
-    float4 pos = raw_block_load<float4>(pos_baseaddr, sizeof(VertexPositionBlock), position_float4_offset);
-    float2 uv = raw_block_load<float2>(uv_baseaddr, sizeof(VertexUvBlock), uv_float2_offset);
+    uint64_t mesh_addr = mesh_baseaddr + sizeof(GPUMesh) * mesh_idx;
+    uint position_offset = vk::RawBufferLoad<uint>(mesh_addr);
+    uint uv_offset = vk::RawBufferLoad<uint>(mesh_addr + sizeof(uint));
+    uint color_offset = vk::RawBufferLoad<uint>(mesh_addr + 2 * sizeof(uint));
+    uint mesh_flags = vk::RawBufferLoad<uint>(mesh_addr + 3 * sizeof(uint));
+
+    //Quantized streams are stored relative to the mesh's bounds and get mapped back with one multiply-add
+    float4 pos;
+    if (mesh_flags & MESH_QUANTIZED_POSITIONS) {
+        float4 position_scale = vk::RawBufferLoad<float4>(mesh_addr + 4 * sizeof(uint));
+        float4 position_offset_f = vk::RawBufferLoad<float4>(mesh_addr + 4 * sizeof(uint) + sizeof(float4));
+        uint2 packed = raw_block_load<uint2>(pos_baseaddr, sizeof(VertexPositionBlock), vtx_id + (position_offset / 2));
+        pos = float4(position_offset_f.xyz + position_scale.xyz * unpack_unorm16x3(packed), 1.0);
+    } else {
+        pos = raw_block_load<float4>(pos_baseaddr, sizeof(VertexPositionBlock), vtx_id + (position_offset / 4));
+    }
+
+    float2 uv;
+    if (mesh_flags & MESH_QUANTIZED_UVS) {
+        float4 uv_scale_offset = vk::RawBufferLoad<float4>(mesh_addr + 4 * sizeof(uint) + 2 * sizeof(float4));
+        uint packed = raw_block_load<uint>(uv_baseaddr, sizeof(VertexUvBlock), vtx_id + uv_offset);
+        uv = uv_scale_offset.zw + uv_scale_offset.xy * unpack_unorm16x2(packed);
+    } else {
+        uv = raw_block_load<float2>(uv_baseaddr, sizeof(VertexUvBlock), vtx_id + (uv_offset / 2));
+    }
     
     float4 color = float4(1.0, 1.0, 1.0, 1.0);
     if (color_offset != 0xFFFFFFFF) {
-        color = raw_block_load<float4>(color_baseaddr, sizeof(VertexColorBlock), color_float4_offset);
+        if (mesh_flags & MESH_QUANTIZED_COLORS) {
+            color = unpack_unorm8x4(raw_block_load<uint>(color_baseaddr, sizeof(VertexColorBlock), vtx_id + color_offset));
+        } else {
+            color = raw_block_load<float4>(color_baseaddr, sizeof(VertexColorBlock), vtx_id + (color_offset / 4));
+        }
     }
 
     //For some reason float4x4's memory ordering is different than when using descriptors
@@ -0,0 +1,2 @@
+[[vk::binding(2, 0)]]
+RWByteAddressBuffer storage_buffers[];
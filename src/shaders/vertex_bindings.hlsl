@@ -14,8 +14,30 @@ struct VertexUvBlock {
     float2 uvs[UV_BLOCK_SIZE];
 };
 
+#define MESH_QUANTIZED_POSITIONS 0x1
+#define MESH_QUANTIZED_UVS 0x2
+#define MESH_QUANTIZED_COLORS 0x4
+
+//Stream starts are in 32-bit words
 struct GPUMesh {
     uint position_start;
     uint uv_start;
     uint color_start;
+    uint flags;
+    float4 position_scale;
+    float4 position_offset;
+    float4 uv_scale_offset;
 };
+
+//Quantized encodings written by vertex_quantization.cpp
+float3 unpack_unorm16x3(uint2 packed) {
+    return float3(packed.x & 0xFFFF, packed.x >> 16, packed.y & 0xFFFF);
+}
+
+float2 unpack_unorm16x2(uint packed) {
+    return float2(packed & 0xFFFF, packed >> 16);
+}
+
+float4 unpack_unorm8x4(uint packed) {
+    return float4(packed & 0xFF, (packed >> 8) & 0xFF, (packed >> 16) & 0xFF, packed >> 24) / 255.0;
+}
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
+#include <span>
 #include <vector>
-#include <stack>
 #include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #define LIVE_BIT 0x80000000
 #define EXTRACT_IDX(key) (key & 0xFFFFFFFF)
@@ -10,6 +14,30 @@
 
 #define SLOTMAP_IMPLEMENTATION  //TODO: Figure out how to remove this
 
+//Index of the first set bit in [from, end) of a bitset, or end if there isn't one
+//Skips 64 empty slots per word instead of probing them one at a time
+inline uint32_t bitset_next_set(const uint64_t* words, uint32_t from, uint32_t end) {
+    while (from < end) {
+        uint64_t word = words[from / 64] >> (from % 64);
+        if (word != 0) return std::min(from + static_cast<uint32_t>(std::countr_zero(word)), end);
+        from = (from / 64 + 1) * 64;
+    }
+    return end;
+}
+
+//One past the last set bit in [0, end) of a bitset, or zero if there isn't one
+inline uint32_t bitset_last_set_end(const uint64_t* words, uint32_t end) {
+    while (end > 0) {
+        uint32_t w = (end - 1) / 64;
+        uint32_t bits = end - w * 64;
+        uint64_t word = words[w];
+        if (bits < 64) word &= (1ull << bits) - 1;
+        if (word != 0) return w * 64 + 64 - static_cast<uint32_t>(std::countl_zero(word));
+        end = w * 64;
+    }
+    return 0;
+}
+
 
 //Slotmap key type
 template<typename PHANTOM>
@@ -30,18 +58,17 @@ struct slotmap {
         using Pointer = Element*;
         using Reference = Element&;
 
-        iterator(Pointer c, Pointer s, uint32_t e, uint32_t* gen_bits) {
+        iterator(Pointer c, Pointer s, uint32_t e, uint32_t* gen_bits, const uint64_t* live) {
             current = c;
             start = s;
             end_idx = e;
             _generation_bits = gen_bits;
+            live_bits = live;
         }
         Reference operator*() const { return *current; }
         iterator& operator++() {
-            current += 1;
-            while ((current != start + end_idx) && (_generation_bits[current - start] & LIVE_BIT) == 0) {
-                current += 1;
-            }
+            uint32_t idx = static_cast<uint32_t>(current - start);
+            current = start + bitset_next_set(live_bits, idx + 1, end_idx);
             return *this;
         }
         iterator operator++(int) {
@@ -67,18 +94,15 @@ struct slotmap {
         Pointer current, start;
         uint32_t end_idx;
         uint32_t* _generation_bits;
+        const uint64_t* live_bits;
     };
     iterator begin() {
-        if (_count == 0) return iterator(_data.data(), _data.data(), _end_idx, generation_bits.data());
-        T* current = _data.data();
-        while ((generation_bits[current - _data.data()] & LIVE_BIT) == 0) {
-            current += 1;
-        }
-        return iterator(current, _data.data(), _end_idx, generation_bits.data());
+        uint32_t idx = bitset_next_set(live_bits.data(), 0, _end_idx);
+        return iterator(_data.data() + idx, _data.data(), _end_idx, generation_bits.data(), live_bits.data());
     }
 
     iterator end() {
-        return iterator(_data.data() + _end_idx, _data.data(), _end_idx, generation_bits.data());
+        return iterator(_data.data() + _end_idx, _data.data(), _end_idx, generation_bits.data(), live_bits.data());
     }
 
     void alloc(uint32_t size);
@@ -87,13 +111,16 @@ struct slotmap {
     T* data();
     T* get(Tkey key);
     Tkey insert(T thing);
+    std::span<Tkey> insert_range(std::span<const T> things, Tkey* out_keys);
     void remove(uint32_t idx);
+    void remove_range(std::span<Tkey> keys);
     uint32_t size();
 
 private:
     std::vector<T> _data = {};
     std::vector<uint32_t> generation_bits = {};
-    std::stack<uint32_t, std::vector<uint32_t>> free_indices;
+    std::vector<uint64_t> live_bits = {};                   //One bit per slot, mirrors LIVE_BIT in generation_bits
+    std::vector<uint32_t> free_indices = {};                //Used as a stack, lowest index on top
     uint32_t _count = 0;
     uint32_t _end_idx = 0;
 };
@@ -104,14 +131,12 @@ void slotmap<T, Tkey>::alloc(uint32_t size) {
     assert(_data.size() == 0);
     _data.resize(size);
     generation_bits.resize(size);
-    std::vector<uint32_t> free_inds;
-    free_inds.resize(size);
+    live_bits.resize((size + 63) / 64);
+    free_indices.resize(size);
     //TODO: There has to be a better way!
     for (uint32_t i = 0; i < size; i++) {
-        free_inds[i] = size - i - 1;
+        free_indices[i] = size - i - 1;
     }
-    
-    free_indices = std::stack(free_inds);
 }
 
 template<typename T, typename Tkey>
@@ -133,15 +158,13 @@ void slotmap<T, Tkey>::clear() {
     _data.resize(size);
     generation_bits.clear();
     generation_bits.resize(size);
+    live_bits.assign(live_bits.size(), 0);
     
-    std::vector<uint32_t> free_inds;
-    free_inds.resize(size);
+    free_indices.resize(size);
     //TODO: There has to be a better way!
     for (uint32_t i = 0; i < size; i++) {
-        free_inds[i] = (uint32_t)size - i - 1;
+        free_indices[i] = (uint32_t)size - i - 1;
     }
-    
-    free_indices = std::stack(free_inds);
 }
 
 template<typename T, typename Tkey>
@@ -162,33 +185,71 @@ T* slotmap<T, Tkey>::get(Tkey key) {
 
 template<typename T, typename Tkey>
 Tkey slotmap<T, Tkey>::insert(T thing) {
-    uint32_t free_idx = free_indices.top();
-    free_indices.pop();
+    uint32_t free_idx = free_indices.back();
+    free_indices.pop_back();
     if (free_idx >= _end_idx) _end_idx = free_idx + 1;
     _data[free_idx] = thing;
     generation_bits[free_idx] |= LIVE_BIT;
+    live_bits[free_idx / 64] |= 1ull << (free_idx % 64);
     uint32_t generation = generation_bits[free_idx];
     _count += 1;
     uint64_t data = (static_cast<uint64_t>(generation) << 32) | static_cast<uint64_t>(free_idx);
     return Tkey(data);
 }
 
+//Inserts every element of things, writing their keys to out_keys
+//Returns the keys as a span over out_keys, which must have room for things.size() keys
+template<typename T, typename Tkey>
+std::span<Tkey> slotmap<T, Tkey>::insert_range(std::span<const T> things, Tkey* out_keys) {
+    uint32_t n = static_cast<uint32_t>(things.size());
+    assert(n <= free_indices.size());
+
+    //Take the top n free slots in one go
+    uint32_t* free_top = free_indices.data() + free_indices.size();
+    uint32_t end_idx = _end_idx;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t free_idx = *(free_top - 1 - i);
+        end_idx = std::max(end_idx, free_idx + 1);
+        _data[free_idx] = things[i];
+        generation_bits[free_idx] |= LIVE_BIT;
+        live_bits[free_idx / 64] |= 1ull << (free_idx % 64);
+        uint64_t data = (static_cast<uint64_t>(generation_bits[free_idx]) << 32) | static_cast<uint64_t>(free_idx);
+        out_keys[i] = Tkey(data);
+    }
+    free_indices.resize(free_indices.size() - n);
+    _end_idx = end_idx;
+    _count += n;
+
+    return std::span<Tkey>(out_keys, n);
+}
+
 template<typename T, typename Tkey>
 void slotmap<T, Tkey>::remove(uint32_t idx) {
-    free_indices.push(idx);
+    free_indices.push_back(idx);
     generation_bits[idx] &= ~LIVE_BIT;
     generation_bits[idx] += 1;
+    live_bits[idx / 64] &= ~(1ull << (idx % 64));
     _count -= 1;
 
     //Recalculate end index
     if (_end_idx == idx + 1) {
-        uint32_t n = idx;
-        while ((generation_bits[n] & LIVE_BIT) == 0) {
-            _end_idx = n;
-            if (n == 0) break;
-            n -= 1;
-        }
+        _end_idx = bitset_last_set_end(live_bits.data(), idx);
+    }
+}
+
+//Removes every element in keys, recalculating the end index once at the end
+template<typename T, typename Tkey>
+void slotmap<T, Tkey>::remove_range(std::span<Tkey> keys) {
+    for (Tkey& key : keys) {
+        uint32_t idx = EXTRACT_IDX(key.value());
+        assert(generation_bits[idx] & LIVE_BIT);
+        free_indices.push_back(idx);
+        generation_bits[idx] &= ~LIVE_BIT;
+        generation_bits[idx] += 1;
+        live_bits[idx / 64] &= ~(1ull << (idx % 64));
     }
+    _count -= static_cast<uint32_t>(keys.size());
+    _end_idx = bitset_last_set_end(live_bits.data(), _end_idx);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <algorithm>
+#include <queue>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include "slotmap.h"
+#include "virtual_memory.h"
+
+//Struct-of-arrays slotmap: each of Fields... lives in its own column, and all columns
+//share one slot index and generation scheme. Code that only needs one field walks that
+//column and the generation bits instead of pulling whole elements through the cache.
+//
+//Like paged_slotmap, alloc() only reserves address space for each column. Memory is
+//committed in granules as the live range grows. Freed slots are reused lowest first, so
+//live elements stay packed toward the front and the tail of each column can be decommitted.
+//Fields must be trivially copyable since elements are never constructed or destroyed.
+template<typename Tkey, typename... Fields>
+struct soa_slotmap {
+    static_assert(sizeof...(Fields) > 0, "soa_slotmap needs at least one field");
+    static_assert((std::is_trivially_copyable_v<Fields> && ...), "soa_slotmap fields must be trivially copyable");
+
+    static constexpr size_t PAGE_BYTES = 64 * 1024;
+    static constexpr uint32_t COMMIT_GRANULE = 4096;        //Slots committed at a time
+    static constexpr uint32_t NO_INDEX = 0xFFFFFFFF;
+
+    template<size_t I>
+    using field_t = std::tuple_element_t<I, std::tuple<Fields...>>;
+
+    //Iterator impl for soa_slotmap
+    //Dereferencing yields the slot index since there's no single element to point at
+    struct iterator {
+        iterator(soa_slotmap* m, uint32_t i) {
+            map = m;
+            idx = i;
+        }
+        uint32_t operator*() const { return idx; }
+        iterator& operator++() {
+            idx += 1;
+            while (idx != map->_end_idx && (map->_generation_bits[idx] & LIVE_BIT) == 0) {
+                idx += 1;
+            }
+            return *this;
+        }
+        bool operator==(const iterator& other) { return idx == other.idx; }
+        bool operator!=(const iterator& other) { return idx != other.idx; }
+
+        uint32_t slot_index() {
+            return idx;
+        }
+
+        uint32_t generation_bits() {
+            return map->_generation_bits[idx];
+        }
+
+        template<size_t I>
+        field_t<I>& get() {
+            return map->template column<I>()[idx];
+        }
+
+    private:
+        soa_slotmap* map;
+        uint32_t idx;
+    };
+    iterator begin() {
+        uint32_t idx = 0;
+        while (idx != _end_idx && (_generation_bits[idx] & LIVE_BIT) == 0) {
+            idx += 1;
+        }
+        return iterator(this, idx);
+    }
+
+    iterator end() {
+        return iterator(this, _end_idx);
+    }
+
+    void alloc(uint32_t size);
+    uint32_t count();
+    void clear();
+    bool contains(Tkey key);
+    Tkey insert(const Fields&... values);
+    void remove(uint32_t idx);
+    uint32_t size();
+
+    //Pointer to field I of the element, or nullptr if the key is stale
+    template<size_t I>
+    field_t<I>* get(Tkey key) {
+        if (!contains(key)) return nullptr;
+        return column<I>() + EXTRACT_IDX(key.value());
+    }
+
+    //Raw column access. Only slots below end_index() whose generation has LIVE_BIT set hold elements
+    template<size_t I>
+    field_t<I>* column() {
+        return std::get<I>(_columns);
+    }
+
+    uint32_t end_index() {
+        return _end_idx;
+    }
+
+    bool is_live(uint32_t idx) {
+        return idx < _end_idx && (_generation_bits[idx] & LIVE_BIT);
+    }
+
+    //Index of the first live slot whose field I equals value, or NO_INDEX
+    //Counts matches over fixed-size blocks first so the hot loop has no early exit and vectorizes
+    template<size_t I>
+    uint32_t find(const field_t<I>& value) {
+        static constexpr uint32_t BLOCK = 32;
+        const field_t<I>* col = column<I>();
+        const uint32_t* generations = _generation_bits;
+        const field_t<I> v = value;
+        uint32_t base = 0;
+        for (; base + BLOCK <= _end_idx; base += BLOCK) {
+            uint32_t hits = 0;
+            for (uint32_t j = 0; j < BLOCK; j++) {
+                hits += (col[base + j] == v) & (generations[base + j] >> 31);
+            }
+            if (hits != 0) break;
+        }
+        for (; base < _end_idx; base++) {
+            if ((_generation_bits[base] & LIVE_BIT) && col[base] == value) return base;
+        }
+        return NO_INDEX;
+    }
+
+    soa_slotmap() = default;
+    soa_slotmap(const soa_slotmap&) = delete;
+    soa_slotmap& operator=(const soa_slotmap&) = delete;
+    ~soa_slotmap();
+
+private:
+    template<typename F>
+    static size_t column_bytes(uint32_t slots) {
+        return ((static_cast<size_t>(slots) * sizeof(F) + PAGE_BYTES - 1) / PAGE_BYTES) * PAGE_BYTES;
+    }
+
+    template<typename F>
+    static void commit_column(F* col, uint32_t from, uint32_t to) {
+        //The first page may already be partly in use, which is fine since committing is idempotent
+        size_t start = ((static_cast<size_t>(from) * sizeof(F)) / PAGE_BYTES) * PAGE_BYTES;
+        size_t end = column_bytes<F>(to);
+        if (end > start && !virtual_commit(reinterpret_cast<uint8_t*>(col) + start, end - start)) {
+            printf("Committing soa_slotmap column failed.\n");
+            exit(-1);
+        }
+    }
+
+    template<typename F>
+    static void decommit_column(F* col, uint32_t from, uint32_t to) {
+        //Only whole pages past the last slot still in use
+        size_t start = column_bytes<F>(from);
+        size_t end = column_bytes<F>(to);
+        if (end > start) virtual_decommit(reinterpret_cast<uint8_t*>(col) + start, end - start);
+    }
+
+    template<size_t... Is>
+    void store(uint32_t idx, std::index_sequence<Is...>, const Fields&... values) {
+        ((std::get<Is>(_columns)[idx] = values), ...);
+    }
+
+    void ensure_committed(uint32_t idx);
+    void shrink_committed();
+
+    std::tuple<Fields*...> _columns = {};
+    uint32_t* _generation_bits = nullptr;
+    std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> free_indices;
+    uint32_t _capacity = 0;
+    uint32_t _count = 0;
+    uint32_t _end_idx = 0;
+    uint32_t _high_water = 0;           //Every slot at or above this index has never been used
+    uint32_t _committed_slots = 0;      //Column storage below this index is committed
+    uint32_t _generations_committed = 0;
+};
+
+template<typename Tkey, typename... Fields>
+void soa_slotmap<Tkey, Fields...>::alloc(uint32_t size) {
+    assert(_generation_bits == nullptr);
+    _capacity = size;
+
+    bool ok = true;
+    _columns = std::tuple<Fields*...>(static_cast<Fields*>(virtual_reserve(column_bytes<Fields>(size)))...);
+    std::apply([&](auto*... cols) { ok = ((cols != nullptr) && ...); }, _columns);
+    _generation_bits = static_cast<uint32_t*>(virtual_reserve(column_bytes<uint32_t>(size)));
+    if (!ok || _generation_bits == nullptr) {
+        printf("Reserving address space for soa_slotmap failed.\n");
+        exit(-1);
+    }
+}
+
+template<typename Tkey, typename... Fields>
+uint32_t soa_slotmap<Tkey, Fields...>::count() {
+    return _count;
+}
+
+template<typename Tkey, typename... Fields>
+uint32_t soa_slotmap<Tkey, Fields...>::size() {
+    return _capacity;
+}
+
+template<typename Tkey, typename... Fields>
+void soa_slotmap<Tkey, Fields...>::clear() {
+    for (uint32_t i = 0; i < _end_idx; i++) {
+        if (_generation_bits[i] & LIVE_BIT) remove(i);
+    }
+    free_indices = {};
+    _high_water = 0;
+}
+
+template<typename Tkey, typename... Fields>
+bool soa_slotmap<Tkey, Fields...>::contains(Tkey key) {
+    uint32_t idx = EXTRACT_IDX(key.value());
+    uint32_t gen = static_cast<uint32_t>(key.value() >> 32);
+    return idx < _high_water && gen == _generation_bits[idx];
+}
+
+template<typename Tkey, typename... Fields>
+void soa_slotmap<Tkey, Fields...>::ensure_committed(uint32_t idx) {
+    if (idx < _committed_slots) return;
+
+    uint32_t target = std::min(((idx / COMMIT_GRANULE) + 1) * COMMIT_GRANULE, _capacity);
+    std::apply([&](auto*... cols) { (commit_column(cols, _committed_slots, target), ...); }, _columns);
+    _committed_slots = target;
+
+    //Generation bits are never decommitted so that stale keys keep failing lookups
+    if (target > _generations_committed) {
+        commit_column(_generation_bits, _generations_committed, target);
+        _generations_committed = target;
+    }
+}
+
+template<typename Tkey, typename... Fields>
+void soa_slotmap<Tkey, Fields...>::shrink_committed() {
+    //Keep one spare granule past the live range so a remove/insert pair at the boundary doesn't thrash
+    uint32_t target = ((_end_idx + COMMIT_GRANULE - 1) / COMMIT_GRANULE) * COMMIT_GRANULE;
+    if (_committed_slots <= target + COMMIT_GRANULE) return;
+
+    std::apply([&](auto*... cols) { (decommit_column(cols, target, _committed_slots), ...); }, _columns);
+    _committed_slots = target;
+}
+
+template<typename Tkey, typename... Fields>
+Tkey soa_slotmap<Tkey, Fields...>::insert(const Fields&... values) {
+    uint32_t free_idx;
+    if (free_indices.size() > 0) {
+        free_idx = free_indices.top();
+        free_indices.pop();
+    } else {
+        assert(_high_water < _capacity);
+        free_idx = _high_water;
+        _high_water += 1;
+    }
+    ensure_committed(free_idx);
+
+    if (free_idx >= _end_idx) _end_idx = free_idx + 1;
+    store(free_idx, std::index_sequence_for<Fields...>{}, values...);
+    _generation_bits[free_idx] |= LIVE_BIT;
+    uint32_t generation = _generation_bits[free_idx];
+    _count += 1;
+    uint64_t data = (static_cast<uint64_t>(generation) << 32) | static_cast<uint64_t>(free_idx);
+    return Tkey(data);
+}
+
+template<typename Tkey, typename... Fields>
+void soa_slotmap<Tkey, Fields...>::remove(uint32_t idx) {
+    assert(_generation_bits[idx] & LIVE_BIT);
+    free_indices.push(idx);
+    _generation_bits[idx] &= ~LIVE_BIT;
+    _generation_bits[idx] += 1;
+    _count -= 1;
+
+    //Recalculate end index
+    if (_end_idx == idx + 1) {
+        uint32_t n = idx;
+        while ((_generation_bits[n] & LIVE_BIT) == 0) {
+            _end_idx = n;
+            if (n == 0) break;
+            n -= 1;
+        }
+        shrink_committed();
+    }
+}
+
+template<typename Tkey, typename... Fields>
+soa_slotmap<Tkey, Fields...>::~soa_slotmap() {
+    if (_generation_bits == nullptr) return;
+
+    std::apply([&](auto*... cols) { (virtual_release(cols, column_bytes<std::remove_pointer_t<decltype(cols)>>(_capacity)), ...); }, _columns);
+    virtual_release(_generation_bits, column_bytes<uint32_t>(_capacity));
+}
@@ -0,0 +1,499 @@
+#include <algorithm>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include "texture_container.h"
+#include "basisu_transcoder.h"
+
+//Both containers are little-endian, like every platform this runs on
+template<typename T>
+static T read_le(const uint8_t* bytes, size_t offset) {
+	T value;
+	memcpy(&value, bytes + offset, sizeof(T));
+	return value;
+}
+
+static constexpr uint32_t fourcc(char a, char b, char c, char d) {
+	return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24);
+}
+
+TexelBlock texel_block(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_R8_UNORM:
+		return { 1, 1, 1 };
+	case VK_FORMAT_R8G8_UNORM:
+		return { 1, 1, 2 };
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+		return { 1, 1, 4 };
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		return { 1, 1, 8 };
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		return { 1, 1, 16 };
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		return { 4, 4, 8 };
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return { 4, 4, 16 };
+	default:
+		return { 0, 0, 0 };
+	}
+}
+
+VkFormat srgb_format(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_R8G8B8A8_UNORM: return VK_FORMAT_R8G8B8A8_SRGB;
+	case VK_FORMAT_B8G8R8A8_UNORM: return VK_FORMAT_B8G8R8A8_SRGB;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK: return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	case VK_FORMAT_BC2_UNORM_BLOCK: return VK_FORMAT_BC2_SRGB_BLOCK;
+	case VK_FORMAT_BC3_UNORM_BLOCK: return VK_FORMAT_BC3_SRGB_BLOCK;
+	case VK_FORMAT_BC7_UNORM_BLOCK: return VK_FORMAT_BC7_SRGB_BLOCK;
+	default: return format;
+	}
+}
+
+size_t texture_level_size(VkFormat format, uint32_t width, uint32_t height) {
+	TexelBlock block = texel_block(format);
+	size_t blocks_x = (width + block.width - 1) / block.width;
+	size_t blocks_y = (height + block.height - 1) / block.height;
+	return blocks_x * blocks_y * block.bytes;
+}
+
+//Checks the parts of the header both containers share and fills in the levels of a tightly packed chain
+static bool validate_levels(const char* container, size_t size, TextureContainer* out) {
+	if (texel_block(out->format).bytes == 0) {
+		printf("%s texture has unsupported format %i.\n", container, (int)out->format);
+		return false;
+	}
+	if (out->width == 0 || out->height == 0) {
+		printf("%s texture has no texels.\n", container);
+		return false;
+	}
+
+	uint32_t full_chain = 1;
+	for (uint32_t dimension = std::max(out->width, out->height); dimension >>= 1;) full_chain += 1;
+	if (out->level_count > full_chain || out->level_count > MAX_CONTAINER_LEVELS) {
+		printf("%s texture has %i levels, more than its size allows.\n", container, (int)out->level_count);
+		return false;
+	}
+
+	for (uint32_t i = 0; i < out->level_count; i++) {
+		const TextureLevel& level = out->levels[i];
+		size_t expected_size = texture_level_size(out->format, std::max(out->width >> i, 1u), std::max(out->height >> i, 1u));
+
+		//Basis levels are stored at whatever size they compressed to
+		if (!out->basis && level.size != expected_size) {
+			printf("%s texture level %i is %i bytes instead of %i.\n", container, (int)i, (int)level.size, (int)expected_size);
+			return false;
+		}
+		if (level.offset > size || level.size > size - level.offset) {
+			printf("%s texture is truncated.\n", container);
+			return false;
+		}
+	}
+	return true;
+}
+
+//KTX2
+
+static const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+constexpr size_t KTX2_HEADER_SIZE = 80;		//Identifier, header and index
+constexpr size_t KTX2_LEVEL_INDEX_ENTRY_SIZE = 24;
+
+enum KTX2Supercompression : uint32_t {
+	KTX2_SUPERCOMPRESSION_NONE,
+	KTX2_SUPERCOMPRESSION_BASISLZ,
+	KTX2_SUPERCOMPRESSION_ZSTD,
+	KTX2_SUPERCOMPRESSION_ZLIB
+};
+
+//Values from the Khronos data format descriptor's basic block
+constexpr size_t KTX2_DFD_SAMPLE_OFFSET = 24;		//From the start of the basic block
+constexpr size_t KTX2_DFD_SAMPLE_SIZE = 16;
+
+enum KTX2ColorModel : uint8_t {
+	KHR_DF_MODEL_ETC1S = 163,
+	KHR_DF_MODEL_UASTC = 166
+};
+
+enum KTX2TransferFunction : uint8_t {
+	KHR_DF_TRANSFER_SRGB = 2
+};
+
+//ETC1S stores one slice per sample, UASTC a single sample naming its whole layout
+enum KTX2ChannelId : uint8_t {
+	KHR_DF_CHANNEL_ETC1S_RGB = 0,
+	KHR_DF_CHANNEL_ETC1S_RRR = 3,
+	KHR_DF_CHANNEL_ETC1S_GGG = 4,
+	KHR_DF_CHANNEL_ETC1S_AAA = 15,
+	KHR_DF_CHANNEL_UASTC_RGB = 0,
+	KHR_DF_CHANNEL_UASTC_RGBA = 3,
+	KHR_DF_CHANNEL_UASTC_RRR = 4,
+	KHR_DF_CHANNEL_UASTC_RRRG = 5,
+	KHR_DF_CHANNEL_UASTC_RG = 6
+};
+
+//Works out what a Basis Universal texture's channels hold and which BCn format keeps them
+//BC4 and BC5 have no sRGB variants, so grey sRGB textures go to BC7 instead. Two unrelated channels are never colors
+static bool parse_basis_dfd(const uint8_t* bytes, size_t size, uint32_t supercompression, TextureContainer* out) {
+	uint32_t dfd_offset = read_le<uint32_t>(bytes, 48);
+	uint32_t dfd_length = read_le<uint32_t>(bytes, 52);
+	if (dfd_offset > size || dfd_length > size - dfd_offset || dfd_length < 4 + KTX2_DFD_SAMPLE_OFFSET) {
+		printf("KTX2 texture is truncated.\n");
+		return false;
+	}
+
+	const uint8_t* block = bytes + dfd_offset + 4;
+	uint8_t color_model = block[8];
+	bool srgb = block[10] == KHR_DF_TRANSFER_SRGB;
+	uint32_t block_size = read_le<uint16_t>(block, 6);
+	if (block_size < KTX2_DFD_SAMPLE_OFFSET || block_size > dfd_length - 4) {
+		printf("KTX2 texture has a malformed data format descriptor.\n");
+		return false;
+	}
+	uint32_t sample_count = (block_size - KTX2_DFD_SAMPLE_OFFSET) / KTX2_DFD_SAMPLE_SIZE;
+	uint8_t channel0 = sample_count > 0 ? block[KTX2_DFD_SAMPLE_OFFSET + 3] & 0xF : 0;
+	uint8_t channel1 = sample_count > 1 ? block[KTX2_DFD_SAMPLE_OFFSET + KTX2_DFD_SAMPLE_SIZE + 3] & 0xF : 0;
+
+	if (color_model == KHR_DF_MODEL_ETC1S && supercompression == KTX2_SUPERCOMPRESSION_BASISLZ && (sample_count == 1 || sample_count == 2)) {
+		if (channel0 == KHR_DF_CHANNEL_ETC1S_RRR && sample_count == 1) out->basis_channels = BASIS_CHANNELS_R;
+		else if (channel0 == KHR_DF_CHANNEL_ETC1S_RRR && channel1 == KHR_DF_CHANNEL_ETC1S_GGG) out->basis_channels = BASIS_CHANNELS_RG;
+		else if (channel0 == KHR_DF_CHANNEL_ETC1S_RRR && channel1 == KHR_DF_CHANNEL_ETC1S_AAA) out->basis_channels = BASIS_CHANNELS_GREY_ALPHA;
+		else if (channel0 == KHR_DF_CHANNEL_ETC1S_RGB && sample_count == 1) out->basis_channels = BASIS_CHANNELS_RGB;
+		else if (channel0 == KHR_DF_CHANNEL_ETC1S_RGB && channel1 == KHR_DF_CHANNEL_ETC1S_AAA) out->basis_channels = BASIS_CHANNELS_RGBA;
+		else {
+			printf("KTX2 ETC1S texture has unsupported channels %i and %i.\n", (int)channel0, (int)channel1);
+			return false;
+		}
+	} else if (color_model == KHR_DF_MODEL_UASTC && supercompression != KTX2_SUPERCOMPRESSION_BASISLZ && sample_count >= 1) {
+		switch (channel0) {
+		case KHR_DF_CHANNEL_UASTC_RGB: out->basis_channels = BASIS_CHANNELS_RGB; break;
+		case KHR_DF_CHANNEL_UASTC_RGBA: out->basis_channels = BASIS_CHANNELS_RGBA; break;
+		case KHR_DF_CHANNEL_UASTC_RRR: out->basis_channels = BASIS_CHANNELS_R; break;
+		case KHR_DF_CHANNEL_UASTC_RRRG:
+		case KHR_DF_CHANNEL_UASTC_RG: out->basis_channels = BASIS_CHANNELS_RG; break;
+		default:
+			printf("KTX2 UASTC texture has unsupported channels %i.\n", (int)channel0);
+			return false;
+		}
+	} else {
+		printf("KTX2 texture with color model %i and supercompression %i isn't Basis Universal.\n", (int)color_model, (int)supercompression);
+		return false;
+	}
+
+	out->basis = true;
+	switch (out->basis_channels) {
+	case BASIS_CHANNELS_R:
+		out->format = srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC4_UNORM_BLOCK;
+		break;
+	case BASIS_CHANNELS_RG:
+		out->format = VK_FORMAT_BC5_UNORM_BLOCK;
+		break;
+	case BASIS_CHANNELS_GREY_ALPHA:
+		out->format = srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC5_UNORM_BLOCK;
+		break;
+	default:
+		out->format = srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+		break;
+	}
+	return true;
+}
+
+static bool parse_ktx2(const uint8_t* bytes, size_t size, TextureContainer* out) {
+	if (size < KTX2_HEADER_SIZE) {
+		printf("KTX2 texture is truncated.\n");
+		return false;
+	}
+
+	uint32_t vk_format = read_le<uint32_t>(bytes, 12);
+	uint32_t pixel_width = read_le<uint32_t>(bytes, 20);
+	uint32_t pixel_height = read_le<uint32_t>(bytes, 24);
+	uint32_t pixel_depth = read_le<uint32_t>(bytes, 28);
+	uint32_t layer_count = read_le<uint32_t>(bytes, 32);
+	uint32_t face_count = read_le<uint32_t>(bytes, 36);
+	uint32_t level_count = read_le<uint32_t>(bytes, 40);
+	uint32_t supercompression = read_le<uint32_t>(bytes, 44);
+
+	//Basis Universal ETC1S and UASTC files are stored with VK_FORMAT_UNDEFINED and get transcoded on load
+	//Their supercompression is undone by the transcoder. Anything else has to be stored ready to copy
+	if (vk_format == VK_FORMAT_UNDEFINED) {
+		if (!parse_basis_dfd(bytes, size, supercompression, out)) return false;
+	} else if (supercompression != KTX2_SUPERCOMPRESSION_NONE) {
+		printf("KTX2 texture is supercompressed, which is only supported for Basis Universal textures.\n");
+		return false;
+	} else {
+		out->format = static_cast<VkFormat>(vk_format);
+	}
+	if (pixel_depth > 1 || layer_count > 1 || face_count != 1) {
+		printf("KTX2 texture isn't a single 2D image.\n");
+		return false;
+	}
+
+	//A level count of zero means only the base level is stored
+	uint32_t stored_levels = std::max(level_count, 1u);
+	if (stored_levels > MAX_CONTAINER_LEVELS || size < KTX2_HEADER_SIZE + stored_levels * KTX2_LEVEL_INDEX_ENTRY_SIZE) {
+		printf("KTX2 texture is truncated.\n");
+		return false;
+	}
+
+	out->width = pixel_width;
+	out->height = pixel_height;
+	out->level_count = stored_levels;
+	out->generate_mips = level_count == 0;
+	out->color_space_known = true;
+	for (uint32_t i = 0; i < stored_levels; i++) {
+		size_t entry = KTX2_HEADER_SIZE + i * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+		out->levels[i].offset = static_cast<size_t>(read_le<uint64_t>(bytes, entry));
+		out->levels[i].size = static_cast<size_t>(read_le<uint64_t>(bytes, entry + 8));
+	}
+	return validate_levels("KTX2", size, out);
+}
+
+//DDS
+
+constexpr size_t DDS_HEADER_OFFSET = 4;
+constexpr size_t DDS_HEADER_SIZE = 124;
+constexpr size_t DDS_DX10_HEADER_SIZE = 20;
+
+enum DDSFlags : uint32_t {
+	DDSD_MIPMAPCOUNT = 0x20000
+};
+
+enum DDSPixelFormatFlags : uint32_t {
+	DDPF_ALPHAPIXELS = 0x1,
+	DDPF_FOURCC = 0x4,
+	DDPF_RGB = 0x40
+};
+
+enum DDSCaps2 : uint32_t {
+	DDSCAPS2_CUBEMAP = 0x200,
+	DDSCAPS2_VOLUME = 0x200000
+};
+
+enum DXGIFormat : uint32_t {
+	DXGI_FORMAT_R32G32B32A32_FLOAT = 2,
+	DXGI_FORMAT_R16G16B16A16_FLOAT = 10,
+	DXGI_FORMAT_R8G8B8A8_UNORM = 28,
+	DXGI_FORMAT_R8G8B8A8_UNORM_SRGB = 29,
+	DXGI_FORMAT_R8G8_UNORM = 49,
+	DXGI_FORMAT_R8_UNORM = 61,
+	DXGI_FORMAT_BC1_UNORM = 71,
+	DXGI_FORMAT_BC1_UNORM_SRGB = 72,
+	DXGI_FORMAT_BC2_UNORM = 74,
+	DXGI_FORMAT_BC2_UNORM_SRGB = 75,
+	DXGI_FORMAT_BC3_UNORM = 77,
+	DXGI_FORMAT_BC3_UNORM_SRGB = 78,
+	DXGI_FORMAT_BC4_UNORM = 80,
+	DXGI_FORMAT_BC4_SNORM = 81,
+	DXGI_FORMAT_BC5_UNORM = 83,
+	DXGI_FORMAT_BC5_SNORM = 84,
+	DXGI_FORMAT_B8G8R8A8_UNORM = 87,
+	DXGI_FORMAT_B8G8R8A8_UNORM_SRGB = 91,
+	DXGI_FORMAT_BC6H_UF16 = 95,
+	DXGI_FORMAT_BC6H_SF16 = 96,
+	DXGI_FORMAT_BC7_UNORM = 98,
+	DXGI_FORMAT_BC7_UNORM_SRGB = 99
+};
+
+enum DX10ResourceDimension : uint32_t {
+	D3D10_RESOURCE_DIMENSION_TEXTURE2D = 3
+};
+
+enum DX10MiscFlags : uint32_t {
+	D3D10_RESOURCE_MISC_TEXTURECUBE = 0x4
+};
+
+static VkFormat dxgi_to_vk_format(uint32_t dxgi_format) {
+	switch (dxgi_format) {
+	case DXGI_FORMAT_R32G32B32A32_FLOAT: return VK_FORMAT_R32G32B32A32_SFLOAT;
+	case DXGI_FORMAT_R16G16B16A16_FLOAT: return VK_FORMAT_R16G16B16A16_SFLOAT;
+	case DXGI_FORMAT_R8G8B8A8_UNORM: return VK_FORMAT_R8G8B8A8_UNORM;
+	case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB: return VK_FORMAT_R8G8B8A8_SRGB;
+	case DXGI_FORMAT_R8G8_UNORM: return VK_FORMAT_R8G8_UNORM;
+	case DXGI_FORMAT_R8_UNORM: return VK_FORMAT_R8_UNORM;
+	case DXGI_FORMAT_BC1_UNORM: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case DXGI_FORMAT_BC1_UNORM_SRGB: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	case DXGI_FORMAT_BC2_UNORM: return VK_FORMAT_BC2_UNORM_BLOCK;
+	case DXGI_FORMAT_BC2_UNORM_SRGB: return VK_FORMAT_BC2_SRGB_BLOCK;
+	case DXGI_FORMAT_BC3_UNORM: return VK_FORMAT_BC3_UNORM_BLOCK;
+	case DXGI_FORMAT_BC3_UNORM_SRGB: return VK_FORMAT_BC3_SRGB_BLOCK;
+	case DXGI_FORMAT_BC4_UNORM: return VK_FORMAT_BC4_UNORM_BLOCK;
+	case DXGI_FORMAT_BC4_SNORM: return VK_FORMAT_BC4_SNORM_BLOCK;
+	case DXGI_FORMAT_BC5_UNORM: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case DXGI_FORMAT_BC5_SNORM: return VK_FORMAT_BC5_SNORM_BLOCK;
+	case DXGI_FORMAT_B8G8R8A8_UNORM: return VK_FORMAT_B8G8R8A8_UNORM;
+	case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB: return VK_FORMAT_B8G8R8A8_SRGB;
+	case DXGI_FORMAT_BC6H_UF16: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+	case DXGI_FORMAT_BC6H_SF16: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+	case DXGI_FORMAT_BC7_UNORM: return VK_FORMAT_BC7_UNORM_BLOCK;
+	case DXGI_FORMAT_BC7_UNORM_SRGB: return VK_FORMAT_BC7_SRGB_BLOCK;
+	default: return VK_FORMAT_UNDEFINED;
+	}
+}
+
+//Formats from before the DX10 header, identified by FourCC code or channel masks
+static VkFormat legacy_dds_format(const uint8_t* pixel_format) {
+	uint32_t flags = read_le<uint32_t>(pixel_format, 4);
+	uint32_t code = read_le<uint32_t>(pixel_format, 8);
+	if (flags & DDPF_FOURCC) {
+		switch (code) {
+		case fourcc('D', 'X', 'T', '1'): return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+		case fourcc('D', 'X', 'T', '2'):
+		case fourcc('D', 'X', 'T', '3'): return VK_FORMAT_BC2_UNORM_BLOCK;
+		case fourcc('D', 'X', 'T', '4'):
+		case fourcc('D', 'X', 'T', '5'): return VK_FORMAT_BC3_UNORM_BLOCK;
+		case fourcc('A', 'T', 'I', '1'):
+		case fourcc('B', 'C', '4', 'U'): return VK_FORMAT_BC4_UNORM_BLOCK;
+		case fourcc('B', 'C', '4', 'S'): return VK_FORMAT_BC4_SNORM_BLOCK;
+		case fourcc('A', 'T', 'I', '2'):
+		case fourcc('B', 'C', '5', 'U'): return VK_FORMAT_BC5_UNORM_BLOCK;
+		case fourcc('B', 'C', '5', 'S'): return VK_FORMAT_BC5_SNORM_BLOCK;
+		case 113: return VK_FORMAT_R16G16B16A16_SFLOAT;		//D3DFMT_A16B16G16R16F
+		case 116: return VK_FORMAT_R32G32B32A32_SFLOAT;		//D3DFMT_A32B32G32R32F
+		default: return VK_FORMAT_UNDEFINED;
+		}
+	}
+
+	uint32_t bit_count = read_le<uint32_t>(pixel_format, 12);
+	uint32_t r_mask = read_le<uint32_t>(pixel_format, 16);
+	uint32_t a_mask = read_le<uint32_t>(pixel_format, 28);
+	if ((flags & DDPF_RGB) && bit_count == 32) {
+		bool has_alpha = (flags & DDPF_ALPHAPIXELS) && a_mask == 0xFF000000;
+		if (r_mask == 0x000000FF && has_alpha) return VK_FORMAT_R8G8B8A8_UNORM;
+		if (r_mask == 0x00FF0000 && has_alpha) return VK_FORMAT_B8G8R8A8_UNORM;
+	}
+	return VK_FORMAT_UNDEFINED;
+}
+
+static bool parse_dds(const uint8_t* bytes, size_t size, TextureContainer* out) {
+	if (size < DDS_HEADER_OFFSET + DDS_HEADER_SIZE || read_le<uint32_t>(bytes, DDS_HEADER_OFFSET) != DDS_HEADER_SIZE) {
+		printf("DDS texture is truncated.\n");
+		return false;
+	}
+
+	const uint8_t* header = bytes + DDS_HEADER_OFFSET;
+	uint32_t flags = read_le<uint32_t>(header, 4);
+	uint32_t height = read_le<uint32_t>(header, 8);
+	uint32_t width = read_le<uint32_t>(header, 12);
+	uint32_t mip_map_count = read_le<uint32_t>(header, 24);
+	const uint8_t* pixel_format = header + 72;
+	uint32_t caps2 = read_le<uint32_t>(header, 108);
+	if (caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME)) {
+		printf("DDS texture isn't a single 2D image.\n");
+		return false;
+	}
+
+	size_t data_offset = DDS_HEADER_OFFSET + DDS_HEADER_SIZE;
+	uint32_t pixel_format_flags = read_le<uint32_t>(pixel_format, 4);
+	if ((pixel_format_flags & DDPF_FOURCC) && read_le<uint32_t>(pixel_format, 8) == fourcc('D', 'X', '1', '0')) {
+		if (size < data_offset + DDS_DX10_HEADER_SIZE) {
+			printf("DDS texture is truncated.\n");
+			return false;
+		}
+		const uint8_t* dx10_header = bytes + data_offset;
+		uint32_t dimension = read_le<uint32_t>(dx10_header, 4);
+		uint32_t misc_flags = read_le<uint32_t>(dx10_header, 8);
+		uint32_t array_size = read_le<uint32_t>(dx10_header, 12);
+		if (dimension != D3D10_RESOURCE_DIMENSION_TEXTURE2D || (misc_flags & D3D10_RESOURCE_MISC_TEXTURECUBE) || array_size > 1) {
+			printf("DDS texture isn't a single 2D image.\n");
+			return false;
+		}
+		out->format = dxgi_to_vk_format(read_le<uint32_t>(dx10_header, 0));
+		out->color_space_known = true;
+		data_offset += DDS_DX10_HEADER_SIZE;
+	} else {
+		out->format = legacy_dds_format(pixel_format);
+		out->color_space_known = false;
+	}
+
+	out->width = width;
+	out->height = height;
+	out->level_count = (flags & DDSD_MIPMAPCOUNT) ? std::max(mip_map_count, 1u) : 1;
+	out->generate_mips = false;
+	if (texel_block(out->format).bytes == 0 || out->level_count > MAX_CONTAINER_LEVELS) return validate_levels("DDS", size, out);
+
+	//Levels are stored back to back with no padding
+	for (uint32_t i = 0; i < out->level_count; i++) {
+		out->levels[i].offset = data_offset;
+		out->levels[i].size = texture_level_size(out->format, std::max(width >> i, 1u), std::max(height >> i, 1u));
+		data_offset += out->levels[i].size;
+	}
+	return validate_levels("DDS", size, out);
+}
+
+bool is_texture_container(const uint8_t* bytes, size_t size) {
+	if (size >= sizeof(KTX2_IDENTIFIER) && memcmp(bytes, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0) return true;
+	return size >= 4 && read_le<uint32_t>(bytes, 0) == fourcc('D', 'D', 'S', ' ');
+}
+
+bool parse_texture_container(const uint8_t* bytes, size_t size, TextureContainer* out) {
+	*out = {};
+	if (size >= sizeof(KTX2_IDENTIFIER) && memcmp(bytes, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0) return parse_ktx2(bytes, size, out);
+	if (size >= 4 && read_le<uint32_t>(bytes, 0) == fourcc('D', 'D', 'S', ' ')) return parse_dds(bytes, size, out);
+	printf("Not a KTX2 or DDS texture.\n");
+	return false;
+}
+
+//Transcoding
+
+static std::once_flag basis_transcoder_initialized;
+
+bool transcode_basis_levels(const uint8_t* bytes, size_t size, const TextureContainer& container, uint8_t* out) {
+	std::call_once(basis_transcoder_initialized, []() { basist::basisu_transcoder_init(); });
+
+	//The transcoder keeps per-file decoding state, so each call gets its own
+	basist::ktx2_transcoder transcoder;
+	if (!transcoder.init(bytes, static_cast<uint32_t>(size)) || !transcoder.start_transcoding()) {
+		printf("KTX2 texture couldn't be read by the Basis Universal transcoder.\n");
+		return false;
+	}
+
+	//BC5 takes its second channel from alpha unless told otherwise. UASTC RG textures keep it in green
+	basist::transcoder_texture_format target;
+	int channel0 = -1;
+	int channel1 = -1;
+	switch (container.format) {
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		target = basist::transcoder_texture_format::cTFBC4_R;
+		break;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		target = basist::transcoder_texture_format::cTFBC5_RG;
+		if (transcoder.is_uastc() && container.basis_channels == BASIS_CHANNELS_RG) {
+			channel0 = 0;
+			channel1 = 1;
+		}
+		break;
+	default:
+		target = basist::transcoder_texture_format::cTFBC7_RGBA;
+		break;
+	}
+
+	TexelBlock block = texel_block(container.format);
+	for (uint32_t k = 0; k < container.level_count; k++) {
+		uint32_t level_width = std::max(container.width >> k, 1u);
+		uint32_t level_height = std::max(container.height >> k, 1u);
+		uint32_t block_count = ((level_width + block.width - 1) / block.width) * ((level_height + block.height - 1) / block.height);
+		if (!transcoder.transcode_image_level(k, 0, 0, out, block_count, target, 0, 0, 0, channel0, channel1)) {
+			printf("Transcoding level %i of a KTX2 texture failed.\n", (int)k);
+			return false;
+		}
+		out += static_cast<size_t>(block_count) * block.bytes;
+	}
+	return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "volk.h"
+
+//Readers for KTX2 and DDS texture containers
+//Only the container is parsed. Level data is left where it is in the file's bytes so it can be copied to the GPU as is,
+//except for Basis Universal KTX2 files, which get transcoded to a BCn format by transcode_basis_levels().
+
+#define MAX_CONTAINER_LEVELS 16
+
+//What a Basis Universal texture's channels hold, from its data format descriptor
+enum BasisChannels : uint8_t {
+	BASIS_CHANNELS_RGB,
+	BASIS_CHANNELS_RGBA,
+	BASIS_CHANNELS_R,
+	BASIS_CHANNELS_RG,				//Two unrelated channels, like a normal map's X and Y
+	BASIS_CHANNELS_GREY_ALPHA
+};
+
+struct TextureLevel {
+	size_t offset;		//From the start of the container
+	size_t size;
+};
+
+struct TextureContainer {
+	VkFormat format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t level_count;					//Stored levels, largest first
+	bool generate_mips;						//The file only has level 0 and asks for the rest to be made on load
+	bool color_space_known;					//False for legacy DDS, which can't say whether its colors are sRGB
+	bool basis;								//Levels are ETC1S or UASTC, and format is what they get transcoded to
+	BasisChannels basis_channels;
+	TextureLevel levels[MAX_CONTAINER_LEVELS];
+};
+
+//Size of the format's texel blocks. One texel for uncompressed formats
+struct TexelBlock {
+	uint32_t width;
+	uint32_t height;
+	uint32_t bytes;
+};
+
+//Checks the magic bytes only. Needs at least 12 bytes to recognize KTX2
+bool is_texture_container(const uint8_t* bytes, size_t size);
+
+//Fails with a message on stdout if the file isn't a single 2D texture in a format from texel_block()
+//or a Basis Universal format, is truncated, or is supercompressed with anything but BasisLZ or Zstandard on a Basis texture
+bool parse_texture_container(const uint8_t* bytes, size_t size, TextureContainer* out);
+
+//Transcodes every level of a Basis Universal container to its format, stored one after another, largest first
+//out must hold texture_level_size() bytes for each level. Any number of threads can transcode at once
+bool transcode_basis_levels(const uint8_t* bytes, size_t size, const TextureContainer& container, uint8_t* out);
+
+//bytes is zero for formats containers can't be loaded in
+TexelBlock texel_block(VkFormat format);
+
+//The sRGB variant of a UNORM color format, or format itself if there isn't one
+VkFormat srgb_format(VkFormat format);
+
+size_t texture_level_size(VkFormat format, uint32_t width, uint32_t height);
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(uint32_t thread_count) {
+	if (thread_count == 0) {
+		uint32_t hw = std::thread::hardware_concurrency();
+		thread_count = hw > 1 ? hw - 1 : 1;
+	}
+
+	_threads.reserve(thread_count);
+	for (uint32_t i = 0; i < thread_count; i++) {
+		_threads.emplace_back([this]() { worker_loop(); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_running = false;
+	}
+	_work_available.notify_all();
+	for (std::thread& t : _threads) {
+		t.join();
+	}
+}
+
+uint32_t ThreadPool::thread_count() {
+	return (uint32_t)_threads.size();
+}
+
+//Claims and runs indices of job until there are none left
+void ThreadPool::run_indices(Job* job) {
+	while (true) {
+		uint32_t i = job->next_index.fetch_add(1, std::memory_order_relaxed);
+		if (i >= job->count) break;
+		(*job->fn)(i);
+	}
+}
+
+void ThreadPool::worker_loop() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true) {
+		_work_available.wait(lock, [this]() { return !_jobs.empty() || !_running; });
+		if (!_running) return;
+
+		Job* job = _jobs.front();
+		job->active_workers += 1;
+		lock.unlock();
+
+		run_indices(job);
+
+		lock.lock();
+		//Every index has been claimed, so nobody else needs to find this job
+		auto it = std::find(_jobs.begin(), _jobs.end(), job);
+		if (it != _jobs.end()) _jobs.erase(it);
+		job->active_workers -= 1;
+		if (job->active_workers == 0) _job_released.notify_all();
+	}
+}
+
+void ThreadPool::parallel_for(uint32_t count, const std::function<void(uint32_t)>& fn) {
+	if (count == 0) return;
+	if (count == 1 || _threads.empty()) {
+		for (uint32_t i = 0; i < count; i++) fn(i);
+		return;
+	}
+
+	Job job;
+	job.fn = &fn;
+	job.count = count;
+	job.next_index.store(0, std::memory_order_relaxed);
+	job.active_workers = 0;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_jobs.push_back(&job);
+	}
+	_work_available.notify_all();
+
+	run_indices(&job);
+
+	//All indices are claimed at this point. Wait for the workers still running theirs
+	std::unique_lock<std::mutex> lock(_mutex);
+	auto it = std::find(_jobs.begin(), _jobs.end(), &job);
+	if (it != _jobs.end()) _jobs.erase(it);
+	_job_released.wait(lock, [&job]() { return job.active_workers == 0; });
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Fixed set of worker threads for fork-join style CPU work
+//parallel_for() may be called from inside a parallel_for() body. The calling thread always
+//works on its own loop while it waits, so nested calls can't deadlock the pool.
+struct ThreadPool {
+	//thread_count == 0 picks one worker per hardware thread minus the caller
+	explicit ThreadPool(uint32_t thread_count = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	uint32_t thread_count();
+
+	//Calls fn(i) for every i in [0, count) and returns once all calls have finished
+	//Indices are handed out in increasing order but may complete in any order
+	void parallel_for(uint32_t count, const std::function<void(uint32_t)>& fn);
+
+private:
+	struct Job {
+		const std::function<void(uint32_t)>* fn;
+		uint32_t count;
+		std::atomic<uint32_t> next_index;
+		uint32_t active_workers;			//Workers currently running indices of this job. Guarded by _mutex
+	};
+
+	void worker_loop();
+	static void run_indices(Job* job);
+
+	std::vector<std::thread> _threads;
+	std::deque<Job*> _jobs;					//Jobs that may still have unclaimed indices
+	std::mutex _mutex;
+	std::condition_variable _work_available;
+	std::condition_variable _job_released;
+	bool _running = true;
+};
@@ -0,0 +1,443 @@
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+#include <immintrin.h>
+#include "vertex_conversion.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+//MSVC accepts AVX2 intrinsics anywhere, GCC and Clang need the function marked
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuidex(r, (int)leaf, (int)subleaf);
+	for (int i = 0; i < 4; i++) regs[i] = (uint32_t)r[i];
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t xgetbv0() {
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	uint32_t lo, hi;
+	__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+ConversionIsa supported_conversion_isa() {
+	static const ConversionIsa supported = [] {
+		uint32_t regs[4];
+		cpuid(0, 0, regs);
+		uint32_t max_leaf = regs[0];
+
+		cpuid(1, 0, regs);
+		bool sse2 = (regs[3] & (1u << 26)) != 0;
+		bool ssse3 = (regs[2] & (1u << 9)) != 0;
+		bool osxsave = (regs[2] & (1u << 27)) != 0;
+		bool avx = (regs[2] & (1u << 28)) != 0;
+		if (!sse2) return CONVERSION_ISA_SCALAR;
+
+		//AVX2 also needs the OS to save ymm registers across context switches
+		if (osxsave && avx && (xgetbv0() & 0x6) == 0x6 && max_leaf >= 7) {
+			cpuid(7, 0, regs);
+			if ((regs[1] & (1u << 5)) != 0) return CONVERSION_ISA_AVX2;
+		}
+		return ssse3 ? CONVERSION_ISA_SSSE3 : CONVERSION_ISA_SSE2;
+	}();
+	return supported;
+}
+
+static std::atomic<ConversionIsa>& active_isa() {
+	static std::atomic<ConversionIsa> isa = supported_conversion_isa();
+	return isa;
+}
+
+ConversionIsa conversion_isa() {
+	return active_isa().load(std::memory_order_relaxed);
+}
+
+void set_conversion_isa(ConversionIsa isa) {
+	active_isa().store(std::min(isa, supported_conversion_isa()), std::memory_order_relaxed);
+}
+
+const char* conversion_isa_name(ConversionIsa isa) {
+	switch (isa) {
+		case CONVERSION_ISA_SCALAR: return "scalar";
+		case CONVERSION_ISA_SSE2: return "sse2";
+		case CONVERSION_ISA_SSSE3: return "ssse3";
+		case CONVERSION_ISA_AVX2: return "avx2";
+		default: return "unknown";
+	}
+}
+
+//Number of leading elements that can be read with a load_bytes wide load without reading past the last element
+//The extra bytes land in lanes the kernels mask off
+static size_t wide_load_count(size_t stride, size_t count, size_t element_bytes, size_t load_bytes) {
+	if (count == 0) return 0;
+	size_t end = (count - 1) * stride + element_bytes;
+	if (end < load_bytes) return 0;
+	return std::min(count, (end - load_bytes) / stride + 1);
+}
+
+//float3 -> float4
+
+static void float3_to_float4_range(const uint8_t* src, size_t stride, size_t begin, size_t count, float w, float* dst) {
+	for (size_t i = begin; i < count; i++) {
+		memcpy(dst + 4 * i, src + i * stride, 3 * sizeof(float));
+		dst[4 * i + 3] = w;
+	}
+}
+
+static void float3_to_float4_scalar(const uint8_t* src, size_t stride, size_t count, float w, float* dst) {
+	float3_to_float4_range(src, stride, 0, count, w, dst);
+}
+
+static void float3_to_float4_sse2(const uint8_t* src, size_t stride, size_t count, float w, float* dst) {
+	const __m128 xyz_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	const __m128 w_lane = _mm_setr_ps(0.0f, 0.0f, 0.0f, w);
+	size_t wide_count = wide_load_count(stride, count, 3 * sizeof(float), 4 * sizeof(float));
+	size_t i = 0;
+	for (; i < wide_count; i++) {
+		__m128 v = _mm_loadu_ps(reinterpret_cast<const float*>(src + i * stride));
+		_mm_storeu_ps(dst + 4 * i, _mm_or_ps(_mm_and_ps(v, xyz_mask), w_lane));
+	}
+	float3_to_float4_range(src, stride, i, count, w, dst);
+}
+
+TARGET_AVX2 static void float3_to_float4_avx2(const uint8_t* src, size_t stride, size_t count, float w, float* dst) {
+	const __m256 w_lanes = _mm256_set1_ps(w);
+	size_t wide_count = wide_load_count(stride, count, 3 * sizeof(float), 4 * sizeof(float));
+	size_t i = 0;
+	for (; i + 2 <= wide_count; i += 2) {
+		__m128 a = _mm_loadu_ps(reinterpret_cast<const float*>(src + i * stride));
+		__m128 b = _mm_loadu_ps(reinterpret_cast<const float*>(src + (i + 1) * stride));
+		__m256 v = _mm256_insertf128_ps(_mm256_castps128_ps256(a), b, 1);
+		_mm256_storeu_ps(dst + 4 * i, _mm256_blend_ps(v, w_lanes, 0x88));
+	}
+	float3_to_float4_range(src, stride, i, count, w, dst);
+}
+
+//Normalized integers -> float
+
+static size_t component_size(NormalizedFormat format) {
+	return (format == NORMALIZED_UNORM16 || format == NORMALIZED_SNORM16) ? 2 : 1;
+}
+
+static float normalized_scale(NormalizedFormat format) {
+	switch (format) {
+		case NORMALIZED_UNORM8: return 1.0f / 255.0f;
+		case NORMALIZED_UNORM16: return 1.0f / 65535.0f;
+		case NORMALIZED_SNORM8: return 1.0f / 127.0f;
+		case NORMALIZED_SNORM16: return 1.0f / 32767.0f;
+	}
+	return 1.0f;
+}
+
+//Multiplies by the reciprocal like the vector kernels so every isa gives bit identical results
+static float decode_normalized(const uint8_t* p, NormalizedFormat format) {
+	float scale = normalized_scale(format);
+	switch (format) {
+		case NORMALIZED_UNORM8: return (float)p[0] * scale;
+		case NORMALIZED_SNORM8: return std::max((float)(int8_t)p[0] * scale, -1.0f);
+		case NORMALIZED_UNORM16: {
+			uint16_t v;
+			memcpy(&v, p, sizeof(v));
+			return (float)v * scale;
+		}
+		case NORMALIZED_SNORM16: {
+			int16_t v;
+			memcpy(&v, p, sizeof(v));
+			return std::max((float)v * scale, -1.0f);
+		}
+	}
+	return 0.0f;
+}
+
+static void normalized_to_float_range(
+	const uint8_t* src, size_t stride, size_t begin, size_t count, NormalizedFormat format,
+	uint32_t components, uint32_t out_components, float pad, float* dst
+) {
+	size_t size = component_size(format);
+	for (size_t i = begin; i < count; i++) {
+		for (uint32_t c = 0; c < out_components; c++) {
+			dst[i * out_components + c] = c < components ? decode_normalized(src + i * stride + c * size, format) : pad;
+		}
+	}
+}
+
+static void normalized_to_float_scalar(
+	const uint8_t* src, size_t stride, size_t count, NormalizedFormat format,
+	uint32_t components, uint32_t out_components, float pad, float* dst
+) {
+	normalized_to_float_range(src, stride, 0, count, format, components, out_components, pad, dst);
+}
+
+//Each element is read with one 8 byte load and widened to four int32 lanes
+template<NormalizedFormat Format>
+static void normalized_to_float_sse2(
+	const uint8_t* src, size_t stride, size_t count,
+	uint32_t components, uint32_t out_components, float pad, float* dst
+) {
+	const size_t element_bytes = components * component_size(Format);
+	const __m128 scale = _mm_set1_ps(normalized_scale(Format));
+	const __m128 minus_one = _mm_set1_ps(-1.0f);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 keep = _mm_castsi128_ps(_mm_setr_epi32(
+		components > 0 ? -1 : 0, components > 1 ? -1 : 0, components > 2 ? -1 : 0, components > 3 ? -1 : 0
+	));
+	const __m128 pad_lanes = _mm_andnot_ps(keep, _mm_set1_ps(pad));
+
+	size_t wide_count = wide_load_count(stride, count, element_bytes, 8);
+	size_t i = 0;
+	for (; i < wide_count; i++) {
+		__m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i * stride));
+
+		__m128i lanes;
+		if constexpr (Format == NORMALIZED_UNORM8) {
+			lanes = _mm_unpacklo_epi16(_mm_unpacklo_epi8(x, zero), zero);
+		} else if constexpr (Format == NORMALIZED_UNORM16) {
+			lanes = _mm_unpacklo_epi16(x, zero);
+		} else if constexpr (Format == NORMALIZED_SNORM8) {
+			__m128i x16 = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+			lanes = _mm_srai_epi32(_mm_unpacklo_epi16(x16, x16), 16);
+		} else {
+			lanes = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		}
+
+		__m128 f = _mm_mul_ps(_mm_cvtepi32_ps(lanes), scale);
+		if constexpr (Format == NORMALIZED_SNORM8 || Format == NORMALIZED_SNORM16) f = _mm_max_ps(f, minus_one);
+		f = _mm_or_ps(_mm_and_ps(f, keep), pad_lanes);
+
+		if (out_components == 4) {
+			_mm_storeu_ps(dst + 4 * i, f);
+		} else if (out_components == 2) {
+			_mm_storel_pi(reinterpret_cast<__m64*>(dst + 2 * i), f);
+		} else {
+			alignas(16) float lane_values[4];
+			_mm_store_ps(lane_values, f);
+			memcpy(dst + out_components * i, lane_values, out_components * sizeof(float));
+		}
+	}
+	normalized_to_float_range(src, stride, i, count, Format, components, out_components, pad, dst);
+}
+
+//Two elements per iteration, each read with an 8 byte load and widened straight to eight int32 lanes
+template<NormalizedFormat Format>
+TARGET_AVX2 static void normalized_to_float_avx2(
+	const uint8_t* src, size_t stride, size_t count,
+	uint32_t components, uint32_t out_components, float pad, float* dst
+) {
+	const size_t element_bytes = components * component_size(Format);
+	const __m256 scale = _mm256_set1_ps(normalized_scale(Format));
+	const __m256 minus_one = _mm256_set1_ps(-1.0f);
+	const __m128i keep4 = _mm_setr_epi32(
+		components > 0 ? -1 : 0, components > 1 ? -1 : 0, components > 2 ? -1 : 0, components > 3 ? -1 : 0
+	);
+	const __m256 keep = _mm256_castsi256_ps(_mm256_broadcastsi128_si256(keep4));
+	const __m256 pad_lanes = _mm256_andnot_ps(keep, _mm256_set1_ps(pad));
+
+	size_t wide_count = wide_load_count(stride, count, element_bytes, 8);
+	size_t i = 0;
+	for (; i + 2 <= wide_count; i += 2) {
+		__m128i x = _mm_unpacklo_epi64(
+			_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i * stride)),
+			_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + (i + 1) * stride))
+		);
+
+		__m256i lanes;
+		if constexpr (Format == NORMALIZED_UNORM8) {
+			lanes = _mm256_cvtepu8_epi32(_mm_unpacklo_epi32(x, _mm_srli_si128(x, 8)));
+		} else if constexpr (Format == NORMALIZED_UNORM16) {
+			lanes = _mm256_cvtepu16_epi32(x);
+		} else if constexpr (Format == NORMALIZED_SNORM8) {
+			lanes = _mm256_cvtepi8_epi32(_mm_unpacklo_epi32(x, _mm_srli_si128(x, 8)));
+		} else {
+			lanes = _mm256_cvtepi16_epi32(x);
+		}
+
+		__m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(lanes), scale);
+		if constexpr (Format == NORMALIZED_SNORM8 || Format == NORMALIZED_SNORM16) f = _mm256_max_ps(f, minus_one);
+		f = _mm256_or_ps(_mm256_and_ps(f, keep), pad_lanes);
+
+		if (out_components == 4) {
+			_mm256_storeu_ps(dst + 4 * i, f);
+		} else if (out_components == 2) {
+			__m128 lo = _mm256_castps256_ps128(f);
+			__m128 hi = _mm256_extractf128_ps(f, 1);
+			_mm_storeu_ps(dst + 2 * i, _mm_movelh_ps(lo, hi));
+		} else {
+			alignas(32) float lane_values[8];
+			_mm256_store_ps(lane_values, f);
+			memcpy(dst + out_components * i, lane_values, out_components * sizeof(float));
+			memcpy(dst + out_components * (i + 1), lane_values + 4, out_components * sizeof(float));
+		}
+	}
+	normalized_to_float_range(src, stride, i, count, Format, components, out_components, pad, dst);
+}
+
+static void normalized_to_float_sse2_dispatch(
+	const uint8_t* src, size_t stride, size_t count, NormalizedFormat format,
+	uint32_t components, uint32_t out_components, float pad, float* dst
+) {
+	switch (format) {
+		case NORMALIZED_UNORM8: normalized_to_float_sse2<NORMALIZED_UNORM8>(src, stride, count, components, out_components, pad, dst); break;
+		case NORMALIZED_UNORM16: normalized_to_float_sse2<NORMALIZED_UNORM16>(src, stride, count, components, out_components, pad, dst); break;
+		case NORMALIZED_SNORM8: normalized_to_float_sse2<NORMALIZED_SNORM8>(src, stride, count, components, out_components, pad, dst); break;
+		case NORMALIZED_SNORM16: normalized_to_float_sse2<NORMALIZED_SNORM16>(src, stride, count, components, out_components, pad, dst); break;
+	}
+}
+
+static void normalized_to_float_avx2_dispatch(
+	const uint8_t* src, size_t stride, size_t count, NormalizedFormat format,
+	uint32_t components, uint32_t out_components, float pad, float* dst
+) {
+	switch (format) {
+		case NORMALIZED_UNORM8: normalized_to_float_avx2<NORMALIZED_UNORM8>(src, stride, count, components, out_components, pad, dst); break;
+		case NORMALIZED_UNORM16: normalized_to_float_avx2<NORMALIZED_UNORM16>(src, stride, count, components, out_components, pad, dst); break;
+		case NORMALIZED_SNORM8: normalized_to_float_avx2<NORMALIZED_SNORM8>(src, stride, count, components, out_components, pad, dst); break;
+		case NORMALIZED_SNORM16: normalized_to_float_avx2<NORMALIZED_SNORM16>(src, stride, count, components, out_components, pad, dst); break;
+	}
+}
+
+//Strided gathers
+
+template<size_t Size>
+static void gather_fixed_scalar(const uint8_t* src, size_t stride, size_t begin, size_t count, uint8_t* dst) {
+	for (size_t i = begin; i < count; i++) memcpy(dst + i * Size, src + i * stride, Size);
+}
+
+static void gather_strided_scalar(const uint8_t* src, size_t stride, size_t count, size_t element_size, void* dst) {
+	uint8_t* out = static_cast<uint8_t*>(dst);
+	switch (element_size) {
+		case 4: gather_fixed_scalar<4>(src, stride, 0, count, out); break;
+		case 8: gather_fixed_scalar<8>(src, stride, 0, count, out); break;
+		case 12: gather_fixed_scalar<12>(src, stride, 0, count, out); break;
+		case 16: gather_fixed_scalar<16>(src, stride, 0, count, out); break;
+		default:
+			for (size_t i = 0; i < count; i++) memcpy(out + i * element_size, src + i * stride, element_size);
+			break;
+	}
+}
+
+static void gather_strided_sse2(const uint8_t* src, size_t stride, size_t count, size_t element_size, void* dst) {
+	uint8_t* out = static_cast<uint8_t*>(dst);
+	size_t i = 0;
+	switch (element_size) {
+		case 8:
+			for (; i + 2 <= count; i += 2) {
+				__m128i a = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i * stride));
+				__m128i b = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + (i + 1) * stride));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8 * i), _mm_unpacklo_epi64(a, b));
+			}
+			gather_fixed_scalar<8>(src, stride, i, count, out);
+			break;
+		case 16:
+			for (; i < count; i++) {
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * stride));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * i), v);
+			}
+			break;
+		default:
+			gather_strided_scalar(src, stride, count, element_size, dst);
+			break;
+	}
+}
+
+//4 and 8 byte elements use hardware gathers with lane offsets that are multiples of stride
+//Offsets are relative to each iteration's first element so they stay small
+TARGET_AVX2 static void gather_strided_avx2(const uint8_t* src, size_t stride, size_t count, size_t element_size, void* dst) {
+	uint8_t* out = static_cast<uint8_t*>(dst);
+	size_t i = 0;
+	if (stride > 0x7FFFFFFF / 8) {
+		gather_strided_sse2(src, stride, count, element_size, dst);
+		return;
+	}
+
+	int s = (int)stride;
+	switch (element_size) {
+		case 4: {
+			const __m256i offsets = _mm256_setr_epi32(0, s, 2 * s, 3 * s, 4 * s, 5 * s, 6 * s, 7 * s);
+			for (; i + 8 <= count; i += 8) {
+				__m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(src + i * stride), offsets, 1);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 4 * i), v);
+			}
+			gather_fixed_scalar<4>(src, stride, i, count, out);
+			break;
+		}
+		case 8: {
+			const __m128i offsets = _mm_setr_epi32(0, s, 2 * s, 3 * s);
+			for (; i + 4 <= count; i += 4) {
+				__m256i v = _mm256_i32gather_epi64(reinterpret_cast<const long long*>(src + i * stride), offsets, 1);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8 * i), v);
+			}
+			gather_fixed_scalar<8>(src, stride, i, count, out);
+			break;
+		}
+		case 16:
+			for (; i + 2 <= count; i += 2) {
+				__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * stride));
+				__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (i + 1) * stride));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 16 * i), _mm256_set_m128i(b, a));
+			}
+			gather_fixed_scalar<16>(src, stride, i, count, out);
+			break;
+		default:
+			gather_strided_scalar(src, stride, count, element_size, dst);
+			break;
+	}
+}
+
+//Dispatch
+
+struct ConversionKernels {
+	void (*float3_to_float4)(const uint8_t*, size_t, size_t, float, float*);
+	void (*normalized_to_float)(const uint8_t*, size_t, size_t, NormalizedFormat, uint32_t, uint32_t, float, float*);
+	void (*gather_strided)(const uint8_t*, size_t, size_t, size_t, void*);
+};
+
+//The conversions gain nothing from SSSE3, it's there for the meshopt decoder
+static const ConversionKernels CONVERSION_KERNELS[CONVERSION_ISA_COUNT] = {
+	{ float3_to_float4_scalar, normalized_to_float_scalar, gather_strided_scalar },
+	{ float3_to_float4_sse2, normalized_to_float_sse2_dispatch, gather_strided_sse2 },
+	{ float3_to_float4_sse2, normalized_to_float_sse2_dispatch, gather_strided_sse2 },
+	{ float3_to_float4_avx2, normalized_to_float_avx2_dispatch, gather_strided_avx2 }
+};
+
+void convert_float3_to_float4(const uint8_t* src, size_t stride, size_t count, float w, float* dst) {
+	CONVERSION_KERNELS[conversion_isa()].float3_to_float4(src, stride, count, w, dst);
+}
+
+void convert_normalized_to_float(
+	const uint8_t* src,
+	size_t stride,
+	size_t count,
+	NormalizedFormat format,
+	uint32_t components,
+	uint32_t out_components,
+	float pad,
+	float* dst
+) {
+	//The vector kernels hold one element in four lanes
+	if (components > 4 || out_components > 4 || components > out_components) {
+		normalized_to_float_scalar(src, stride, count, format, components, out_components, pad, dst);
+		return;
+	}
+	CONVERSION_KERNELS[conversion_isa()].normalized_to_float(src, stride, count, format, components, out_components, pad, dst);
+}
+
+void gather_strided(const uint8_t* src, size_t stride, size_t count, size_t element_size, void* dst) {
+	CONVERSION_KERNELS[conversion_isa()].gather_strided(src, stride, count, element_size, dst);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Bulk conversion of glTF accessor data into the float streams the renderer consumes
+//Every kernel reads count elements spaced stride bytes apart straight out of a buffer view and
+//writes them tightly packed to dst. The implementation is picked at runtime from what the CPU supports.
+
+enum ConversionIsa {
+	CONVERSION_ISA_SCALAR,
+	CONVERSION_ISA_SSE2,
+	CONVERSION_ISA_SSSE3,
+	CONVERSION_ISA_AVX2,
+	CONVERSION_ISA_COUNT
+};
+
+//Integer component encodings that map to [0, 1] or [-1, 1]
+enum NormalizedFormat {
+	NORMALIZED_UNORM8,
+	NORMALIZED_UNORM16,
+	NORMALIZED_SNORM8,
+	NORMALIZED_SNORM16
+};
+
+//Best instruction set this CPU and OS support
+ConversionIsa supported_conversion_isa();
+
+//Instruction set the kernels currently use. Defaults to supported_conversion_isa()
+ConversionIsa conversion_isa();
+
+//Forces the kernels down to isa, for comparing implementations. Clamped to what's supported
+void set_conversion_isa(ConversionIsa isa);
+
+const char* conversion_isa_name(ConversionIsa isa);
+
+//Three floats per element, written as float4s with w in the fourth component
+void convert_float3_to_float4(const uint8_t* src, size_t stride, size_t count, float w, float* dst);
+
+//components normalized integers per element, written as out_components floats
+//Components past the source's are set to pad, e.g. alpha 1 for an RGB color
+void convert_normalized_to_float(
+	const uint8_t* src,
+	size_t stride,
+	size_t count,
+	NormalizedFormat format,
+	uint32_t components,
+	uint32_t out_components,
+	float pad,
+	float* dst
+);
+
+//element_size bytes per element copied as they are
+void gather_strided(const uint8_t* src, size_t stride, size_t count, size_t element_size, void* dst);
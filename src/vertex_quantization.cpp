@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <math.h>
+#include "vertex_quantization.h"
+
+//Fills scale and offset so [min, max] of each component maps onto [0, 65535]
+//Degenerate ranges get a zero scale and quantize to 0
+static void quantize_range(
+	std::span<const float> data,
+	uint32_t stride,
+	uint32_t components,
+	float* scale,
+	float* offset,
+	std::vector<uint16_t>& out,
+	uint32_t out_stride
+) {
+	size_t vertex_count = data.size() / stride;
+	float mins[4];
+	float maxs[4];
+	for (uint32_t c = 0; c < components; c++) {
+		mins[c] = vertex_count > 0 ? data[c] : 0.0f;
+		maxs[c] = mins[c];
+	}
+	for (size_t v = 0; v < vertex_count; v++) {
+		for (uint32_t c = 0; c < components; c++) {
+			mins[c] = std::min(mins[c], data[v * stride + c]);
+			maxs[c] = std::max(maxs[c], data[v * stride + c]);
+		}
+	}
+
+	float inv_extent[4];
+	for (uint32_t c = 0; c < components; c++) {
+		float extent = maxs[c] - mins[c];
+		offset[c] = mins[c];
+		scale[c] = extent / 65535.0f;
+		inv_extent[c] = extent > 0.0f ? 65535.0f / extent : 0.0f;
+	}
+
+	out.assign(vertex_count * out_stride, 0);
+	for (size_t v = 0; v < vertex_count; v++) {
+		for (uint32_t c = 0; c < components; c++) {
+			float q = (data[v * stride + c] - mins[c]) * inv_extent[c];
+			out[v * out_stride + c] = (uint16_t)std::clamp(lrintf(q), 0l, 65535l);
+		}
+	}
+}
+
+void quantize_positions(std::span<const float> positions, std::vector<uint16_t>& out, VertexQuantization& quantization) {
+	quantize_range(positions, 4, 3, quantization.position_scale, quantization.position_offset, out, 4);
+}
+
+void quantize_uvs(std::span<const float> uvs, std::vector<uint16_t>& out, VertexQuantization& quantization) {
+	quantize_range(uvs, 2, 2, quantization.uv_scale, quantization.uv_offset, out, 2);
+}
+
+void quantize_colors(std::span<const float> colors, std::vector<uint32_t>& out) {
+	size_t vertex_count = colors.size() / 4;
+	out.resize(vertex_count);
+	for (size_t v = 0; v < vertex_count; v++) {
+		uint32_t packed = 0;
+		for (uint32_t c = 0; c < 4; c++) {
+			long q = lrintf(std::clamp(colors[4 * v + c], 0.0f, 1.0f) * 255.0f);
+			packed |= (uint32_t)q << (8 * c);
+		}
+		out[v] = packed;
+	}
+}
+
+void dequantize_positions(std::span<const uint16_t> positions, const VertexQuantization& quantization, std::vector<float>& out) {
+	size_t vertex_count = positions.size() / 4;
+	out.resize(4 * vertex_count);
+	for (size_t v = 0; v < vertex_count; v++) {
+		for (uint32_t c = 0; c < 3; c++) {
+			out[4 * v + c] = quantization.position_offset[c] + quantization.position_scale[c] * (float)positions[4 * v + c];
+		}
+		out[4 * v + 3] = 1.0f;
+	}
+}
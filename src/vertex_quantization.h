@@ -0,0 +1,31 @@
+#pragma once
+
+#include <span>
+#include <stdint.h>
+#include <vector>
+
+//Compact vertex stream encodings the ps1 vertex shader can dequantize
+//positions: unorm16 x, y, z plus a padding unorm16, relative to the mesh's bounding box
+//uvs:       unorm16 u, v relative to the mesh's uv bounding rect
+//colors:    unorm8 r, g, b, a packed into one uint32_t
+
+//Maps a quantized value q back with offset + scale * q
+//Scales already include the 1/65535 so the shader only needs one multiply-add
+struct VertexQuantization {
+	float position_scale[3];
+	float position_offset[3];
+	float uv_scale[2];
+	float uv_offset[2];
+};
+
+//positions are float4 per vertex. Writes four unorm16s per vertex to out
+void quantize_positions(std::span<const float> positions, std::vector<uint16_t>& out, VertexQuantization& quantization);
+
+//uvs are float2 per vertex. Writes two unorm16s per vertex to out
+void quantize_uvs(std::span<const float> uvs, std::vector<uint16_t>& out, VertexQuantization& quantization);
+
+//colors are float4 per vertex in [0, 1]. Writes one packed RGBA8 per vertex to out
+void quantize_colors(std::span<const float> colors, std::vector<uint32_t>& out);
+
+//Inverse of quantize_positions. Writes float4 positions with w = 1 to out
+void dequantize_positions(std::span<const uint16_t> positions, const VertexQuantization& quantization, std::vector<float>& out);
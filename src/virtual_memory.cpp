@@ -0,0 +1,55 @@
+#include "virtual_memory.h"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+size_t virtual_page_size() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return static_cast<size_t>(info.dwPageSize);
+#else
+	return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+void* virtual_reserve(size_t size) {
+#ifdef _WIN32
+	return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+	void* ptr = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return ptr == MAP_FAILED ? nullptr : ptr;
+#endif
+}
+
+bool virtual_commit(void* ptr, size_t size) {
+#ifdef _WIN32
+	return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+	return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+void virtual_decommit(void* ptr, size_t size) {
+#ifdef _WIN32
+	VirtualFree(ptr, size, MEM_DECOMMIT);
+#else
+	madvise(ptr, size, MADV_DONTNEED);
+	mprotect(ptr, size, PROT_NONE);
+#endif
+}
+
+void virtual_release(void* ptr, size_t size) {
+#ifdef _WIN32
+	(void)size;
+	VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+	munmap(ptr, size);
+#endif
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+//Thin wrapper over the OS virtual memory API
+//Address space is reserved up front and physical pages are committed/released on demand
+
+size_t virtual_page_size();
+
+//Reserves size bytes of address space without backing it with memory
+void* virtual_reserve(size_t size);
+
+//Makes [ptr, ptr + size) readable and writable. Newly committed memory reads as zero
+bool virtual_commit(void* ptr, size_t size);
+
+//Returns the physical pages backing [ptr, ptr + size) to the OS while keeping the address range reserved
+void virtual_decommit(void* ptr, size_t size);
+
+void virtual_release(void* ptr, size_t size);